@@ -0,0 +1,87 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "maths.h"
+
+namespace bkk
+{
+  namespace mesh
+  {
+    struct bone_transform_t;
+    struct skeletal_animation_t;
+
+    //Maximum error introduced by key reduction
+    struct animation_compression_settings_t
+    {
+      f32 positionTolerance_ = 0.001f;      //In model units
+      f32 scaleTolerance_ = 0.001f;
+      f32 orientationTolerance_ = 0.001f;   //In radians
+    };
+
+    //Keys of one component (position, scale or orientation) of an animated node
+    struct compressed_track_t
+    {
+      u32 firstKey_;      //Index of the first key in keyFrame_
+      u32 keyCount_;      //1 if the track is constant
+      u32 firstValue_;    //Index of the first quantized value in keyValue_
+
+      //Range of the quantized values. Only used by position and scale tracks
+      f32 min_[3];
+      f32 extent_[3];
+    };
+
+    //Skeletal animation with redundant keys removed and key values quantized to 16 bits.
+    //Each node has three tracks (position, scale and orientation) stored consecutively in tracks_
+    struct compressed_animation_t
+    {
+      u32 frameCount_;
+      u32 nodeCount_;
+      f32 duration_;  //In ms
+
+      u32* nodes_;                    //Skeleton node index of each animated node
+      compressed_track_t* tracks_;
+      u16* keyFrame_;                 //Frame of each key
+      u16* keyValue_;                 //3 values per position and scale key, 4 per orientation key
+
+      u32 keyCount_;
+      u32 keyValueCount_;
+    };
+
+    void animationCompress(const skeletal_animation_t& animation, const animation_compression_settings_t& settings, compressed_animation_t* compressedAnimation);
+    void animationDestroy(compressed_animation_t* animation);
+
+    //Samples the animation at 'cursor' (0 is the first frame and 1 the last one) and writes the local transform of every animated node.
+    //If nodeDepth (the depth of each skeleton node) is not null, nodes deeper than maxNodeDepth are not decoded and their transforms are left untouched
+    void animationSample(const compressed_animation_t& animation, f32 cursor, bone_transform_t* transforms, const u32* nodeDepth = nullptr, u32 maxNodeDepth = 0xFFFFFFFF);
+
+    //Memory used by the animation data, in bytes
+    size_t animationGetSize(const skeletal_animation_t& animation);
+    size_t animationGetSize(const compressed_animation_t& animation);
+
+  } //mesh namespace
+}//namespace bkk
+#endif  /*  ANIMATION_H   */
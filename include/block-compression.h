@@ -0,0 +1,58 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include "image.h"
+
+namespace bkk
+{
+  namespace thread { struct thread_pool_t; }
+
+  namespace image
+  {
+    //Trade-off between encoding time and quality
+    enum compression_quality_e
+    {
+      COMPRESSION_QUALITY_FAST = 0,     //Endpoints from the bounding box of the block
+      COMPRESSION_QUALITY_NORMAL = 1,   //Endpoints along the principal axis of the block
+      COMPRESSION_QUALITY_HIGH = 2      //As normal, refining the endpoints with least squares
+    };
+
+    //Selects a format from the contents of the image: BC6H for HDR images, BC5 for normal maps and 2 component images,
+    //BC4 for 1 component images, BC7 for images with alpha and BC1 otherwise
+    compression_e compressionSelect(const image2D_t& image, bool normalMap);
+
+    //Size in bytes of a 4x4 block
+    uint32_t compressionGetBlockSize(compression_e compression);
+
+    //Encodes the image in the workers of the pool (or in the calling thread if threadPool is null). BC6H encodes
+    //negative values as zero and BC7 only uses mode 6 (single subset, RGBA endpoints). The compressed image has to be unloaded
+    bool compress(const image2D_t& image, compression_e compression, compression_quality_e quality, thread::thread_pool_t* threadPool, image2D_t* compressed);
+
+  } //namespace image
+}//namespace bkk
+
+#endif  /*  BLOCK_COMPRESSION_H   */
@@ -0,0 +1,114 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef BVH_H
+#define BVH_H
+
+#include "maths.h"
+#include "mesh.h"
+#include "thread-pool.h"
+
+namespace bkk
+{
+  namespace mesh
+  {
+    //Binary node. Children of an interior node are stored next to each other (leftFirst_ and leftFirst_+1)
+    struct bvh_node_t
+    {
+      maths::vec3 min_;
+      u32 leftFirst_;       //Index of the left child for interior nodes, index of the first triangle for leaves
+      maths::vec3 max_;
+      u32 triangleCount_;   //0 for interior nodes
+    };
+
+    //4-wide node with the bounds of the children stored as structure of arrays so they can be tested at once
+    struct bvh_wide_node_t
+    {
+      f32 minX_[4];
+      f32 minY_[4];
+      f32 minZ_[4];
+      f32 maxX_[4];
+      f32 maxY_[4];
+      f32 maxZ_[4];
+
+      u32 child_[4];          //Index of the child node for interior children, index of the first triangle for leaves. ~0u if the slot is empty
+      u32 triangleCount_[4];  //0 for interior and empty children
+    };
+
+    struct bvh_t
+    {
+      bvh_node_t* nodes_ = nullptr;
+      u32 nodeCount_ = 0u;
+
+      //Only if the wide layout was requested when building the bvh
+      bvh_wide_node_t* wideNodes_ = nullptr;
+      u32 wideNodeCount_ = 0u;
+
+      maths::vec3* vertices_ = nullptr;
+      u32 vertexCount_ = 0u;
+
+      u32* triangles_ = nullptr;      //Three vertex indices per triangle, sorted so leaves reference contiguous ranges
+      u32* triangleId_ = nullptr;     //Index of each sorted triangle in the source index buffer
+      u32 triangleCount_ = 0u;
+    };
+
+    struct bvh_ray_hit_t
+    {
+      f32 t_;
+      f32 u_;         //Barycentric coordinates of the hit point in the triangle
+      f32 v_;
+      u32 triangle_;  //Index of the triangle in the source index buffer
+    };
+
+    struct bvh_closest_point_t
+    {
+      maths::vec3 point_;
+      f32 distance_;
+      u32 triangle_;  //Index of the triangle in the source index buffer
+    };
+
+    ///BVH API
+
+    //Builds a bvh from the given triangles using binned SAH. Build is parallelized using 'pool' if not null.
+    //If 'wideLayout' is true it also generates a 4-wide version of the tree which will be used by the queries
+    void bvhCreate(const maths::vec3* vertices, u32 vertexCount, const u32* index, u32 indexCount, bool wideLayout, thread::thread_pool_t* pool, bvh_t* bvh);
+
+    //Builds a bvh from the geometry of a mesh. Vertex and index buffers have to be host visible. Positions must be the first attribute in the vertex format
+    void bvhCreate(const render::context_t& context, const mesh_t& mesh, bool wideLayout, thread::thread_pool_t* pool, bvh_t* bvh);
+
+    void bvhDestroy(bvh_t* bvh);
+
+    //Updates the bounds of the tree after the vertices have moved (e.g deformed by skinning), keeping its topology.
+    //'vertices' must have the same number of vertices used to build the bvh
+    void bvhRefit(const maths::vec3* vertices, bvh_t* bvh);
+
+    //Returns true if the ray hits a triangle closer than tMax. 'direction' doesn't need to be normalized
+    bool bvhIntersectRay(const bvh_t& bvh, const maths::vec3& origin, const maths::vec3& direction, f32 tMax, bvh_ray_hit_t* hit);
+
+    //Returns true if there is a triangle closer than maxDistance to 'point'
+    bool bvhClosestPoint(const bvh_t& bvh, const maths::vec3& point, f32 maxDistance, bvh_closest_point_t* result);
+
+  } //mesh namespace
+}//namespace bkk
+#endif  /*  BVH_H   */
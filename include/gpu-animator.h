@@ -0,0 +1,112 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef GPU_ANIMATOR_H
+#define GPU_ANIMATOR_H
+
+#include "mesh.h"
+
+namespace bkk
+{
+  namespace mesh
+  {
+    //Per-instance data written by the CPU every frame
+    struct gpu_animator_instance_t
+    {
+      u32 animation_;   //Index of the animation in the mesh
+      f32 cursor_;      //0 is the first frame of the animation and 1 the last one
+    };
+
+    //Animates many instances of a skinned mesh in the GPU. The skeleton and the compressed animations of the mesh are uploaded
+    //once, and a compute shader samples the animation of each instance, evaluates the hierarchy and writes its palette.
+    //The palette of instance i starts at bone i * boneCount_ of paletteBuffer_
+    struct gpu_animator_t
+    {
+      u32 instanceCount_;
+      u32 nodeCount_;
+      u32 boneCount_;
+      u32 animationCount_;
+      f32* duration_ = nullptr;                     //Duration of each animation, in ms
+
+      gpu_animator_instance_t* instance_ = nullptr; //Persistently mapped memory of instanceBuffer_
+
+      render::gpu_buffer_t dataBuffer_;             //Skeleton and compressed animations
+      render::gpu_buffer_t instanceBuffer_;
+      render::gpu_buffer_t poseBuffer_;             //Global transform of every node of every instance
+      render::gpu_buffer_t paletteBuffer_;          //Final transform of every bone of every instance
+
+      render::descriptor_pool_t descriptorPool_;
+      render::descriptor_set_layout_t descriptorSetLayout_;
+      render::descriptor_set_t descriptorSet_;
+      render::pipeline_layout_t pipelineLayout_;
+      render::shader_t shader_;
+      render::compute_pipeline_t pipeline_;
+    };
+
+    //The mesh must have been loaded with EXPORT_COMPRESS_ANIMATIONS. Instances start at the beginning of the first animation
+    void gpuAnimatorCreate(const render::context_t& context, const mesh_t& mesh, u32 instanceCount, gpu_animator_t* animator);
+    void gpuAnimatorDestroy(const render::context_t& context, gpu_animator_t* animator);
+
+    //Advances the cursor of every instance, with speed[i] the playback speed of instance i (or 1 for all if speed is null).
+    //Cursors and animations can also be written directly in animator->instance_
+    void gpuAnimatorUpdate(f32 deltaTimeInMs, const f32* speed, gpu_animator_t* animator);
+
+    //Records the dispatch that computes the palettes, and a barrier so they can be read by vertex or compute shaders afterwards.
+    //Must be recorded outside of a render pass
+    void gpuAnimatorDispatch(VkCommandBuffer commandBuffer, const gpu_animator_t& animator);
+
+    //Deforms the vertices of a skinned mesh in a compute shader, once per frame, for every instance. The deformed vertices have the
+    //vertex format of the mesh without bone weights and indices, so all the passes drawing the mesh can use them without skinning
+    struct gpu_skinning_t
+    {
+      u32 vertexCount_;
+      u32 instanceCount_;
+
+      render::gpu_buffer_t vertexBuffer_;     //Deformed vertices of every instance, in device local memory
+      render::vertex_format_t vertexFormat_;
+      u32 constants_[8];
+
+      render::descriptor_pool_t descriptorPool_;
+      render::descriptor_set_layout_t descriptorSetLayout_;
+      render::descriptor_set_t descriptorSet_;
+      render::pipeline_layout_t pipelineLayout_;
+      render::shader_t shader_;
+      render::compute_pipeline_t pipeline_;
+    };
+
+    //'palette' contains the bone transforms of each instance, one after the other (e.g skeletal_animator_t::buffer_ for
+    //a single instance or gpu_animator_t::paletteBuffer_). The mesh must have been loaded with EXPORT_BONE_WEIGHTS
+    void gpuSkinningCreate(const render::context_t& context, const mesh_t& mesh, const render::gpu_buffer_t& palette, u32 instanceCount, gpu_skinning_t* skinning);
+    void gpuSkinningDestroy(const render::context_t& context, gpu_skinning_t* skinning);
+
+    //Records the dispatch that deforms the vertices, and a barrier so they can be used as vertex attributes afterwards.
+    //Must be recorded outside of a render pass, after the commands that write the palettes
+    void gpuSkinningDispatch(VkCommandBuffer commandBuffer, const gpu_skinning_t& skinning);
+
+    //Draws an instance using the deformed vertices and the index buffer of the mesh. The instance index is passed as first instance
+    void drawSkinned(VkCommandBuffer commandBuffer, const mesh_t& mesh, const gpu_skinning_t& skinning, u32 instance);
+
+  } //mesh namespace
+}//namespace bkk
+#endif  /*  GPU_ANIMATOR_H   */
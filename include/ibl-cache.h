@@ -0,0 +1,63 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef IBL_CACHE_H
+#define IBL_CACHE_H
+
+#include "render-types.h"
+#include "image.h"
+
+namespace bkk
+{
+  namespace render
+  {
+    struct context_t;
+
+    //Maps used for image based lighting
+    struct ibl_maps_t
+    {
+      texture_cubemap_t environment_;   //32 bit float RGBA, or half float RGBA when loaded from the cache
+      image::irradiance_sh9_t irradiance_;   //Diffuse convolution of the environment, as spherical harmonics
+      texture_cubemap_t specular_;     //Specular convolution of the environment, one roughness per level
+      texture_t brdfLut_;
+    };
+
+    struct ibl_description_t
+    {
+      uint32_t environmentSize_ = 2046u;
+      bool environmentMipmaps_ = true;
+      uint32_t specularSize_ = 256u;
+      uint32_t specularMipLevels_ = 4u;
+      uint32_t brdfLutSize_ = 512u;
+    };
+
+    //Creates the image based lighting maps of an equirectangular image, flipped vertically when it is loaded. If cacheDirectory is not nullptr the maps are stored there, keyed by the hash of the
+    //image file and the description, and subsequent calls load them from the cache instead of computing them (which also avoids compiling the shaders).
+    //The directory is created if it doesn't exist. Returns false if the image can't be loaded
+    bool iblCreate(const context_t& context, const char* imagePath, const ibl_description_t& description, const char* cacheDirectory, ibl_maps_t* maps);
+    void iblDestroy(const context_t& context, ibl_maps_t* maps);
+
+  } //render namespace
+}//namespace bkk
+#endif  /*  IBL_CACHE_H   */
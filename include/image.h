@@ -27,11 +27,29 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include "mapped-file.h"
 
 namespace bkk
 {
+  namespace thread{ struct thread_pool_t; }
+
   namespace image
   {
+    //Block compression formats. Compressed images store 4x4 blocks of 8 (BC1, BC4) or 16 bytes
+    enum compression_e
+    {
+      COMPRESSION_NONE = 0,
+      COMPRESSION_BC1 = 1,    //RGB
+      COMPRESSION_BC3 = 2,    //RGBA
+      COMPRESSION_BC4 = 3,    //R
+      COMPRESSION_BC5 = 4,    //RG
+      COMPRESSION_BC6H = 5,   //RGB unsigned half float
+      COMPRESSION_BC7 = 6     //RGBA
+    };
+
     struct image2D_t
     {
       uint32_t width_;
@@ -40,10 +58,95 @@ namespace bkk
       uint32_t componentSize_;
       uint32_t dataSize_;
       uint8_t* data_ = nullptr;
+      compression_e compression_ = COMPRESSION_NONE;   //If not COMPRESSION_NONE, componentCount_ and componentSize_ are the ones of the source image
     };
 
+    //Decodes the image in the calling thread. It is safe to call it from several threads at the same time
+    //1 and 2 component images keep their number of components, 3 component images are expanded to 4.
+    //HDR images are stored as floats, or half floats (componentSize_ 2) if they have 1 or 2 components
     bool load(const char* path, bool flipVertical, image2D_t* image);
     void unload(image2D_t* image);
+
+    //Reads the size and format the image will have once decoded without decoding it. data_ is set to null
+    bool loadInfo(const char* path, image2D_t* image);
+
+    //Decodes the image into caller-provided memory (for example a mapped staging buffer) instead of allocating it.
+    //Fails if the decoded image is bigger than destinationSize. data_ is set to null
+    bool loadInto(const char* path, bool flipVertical, void* destination, size_t destinationSize, image2D_t* image);
+
+    //Size in bytes of a mip level of an image with the format and base level size of 'image'. 64 bit so sizes read from file headers don't overflow
+    uint64_t mipLevelSize(const image2D_t& image, uint32_t level);
+
+    //Image with all its mip levels stored in a KTX2 or DDS file. The file stays mapped in memory and the levels
+    //point into the mapping, so they can be copied to staging memory without decoding or generating mipmaps
+    static const uint32_t MAX_MIP_LEVELS = 16u;
+    struct mip_chain_t
+    {
+      image2D_t image_ = {};      //Format and size of the base level. data_ is null
+      uint32_t levelCount_ = 0u;
+      const uint8_t* levelData_[MAX_MIP_LEVELS];
+      uint32_t levelSize_[MAX_MIP_LEVELS];
+      file::mapped_file_t file_;
+      uint8_t* levelStorage_ = nullptr;   //Memory of the levels if the chain was built from an image instead of loaded from a file
+    };
+
+    //Only 2D images are supported, without supercompression in KTX2 files. Formats are the uncompressed ones load() produces plus BC1 and BC3 to BC7.
+    //sRGB formats are read as their UNORM equivalents and BC1 alpha is ignored. Levels beyond MAX_MIP_LEVELS are dropped
+    bool loadMipChain(const char* path, mip_chain_t* mipChain);
+    void unloadMipChain(mip_chain_t* mipChain);
+
+    //Builds the full mip chain of an uncompressed image with a box filter. The chain has its own copy of the base level
+    bool buildMipChain(const image2D_t& image, mip_chain_t* mipChain);
+
+    //Irradiance of an environment projected onto the first 9 real spherical harmonics (3 bands). Coefficients are already convolved with the
+    //clamped cosine lobe and divided by PI, so evaluating them with the normal gives the diffuse lighting for an albedo of 1. w is not used,
+    //so the coefficients can be copied to a uniform buffer as an array of vec4
+    struct irradiance_sh9_t
+    {
+      float coefficients_[9][4];
+    };
+
+    //Projects an uncompressed equirectangular image with 3 or 4 components (only RGB is used). Rows are split between the workers of the pool,
+    //if it isn't null. Directions follow the mapping textureCubemapCreateFromEquirectangularImage uses, with Y up. Evaluate the result with:
+    //  c[0] * 0.282095 + (c[1] * y + c[2] * z + c[3] * x) * 0.488603 + (c[4] * xy + c[5] * yz + c[7] * xz) * 1.092548 +
+    //  c[6] * 0.315392 * (3z^2 - 1) + c[8] * 0.546274 * (x^2 - y^2)
+    void projectIrradianceSH9(const image2D_t& image, thread::thread_pool_t* threadPool, irradiance_sh9_t* sh);
+
+    //Half precision float conversion. Values out of range become infinity and denormals are flushed to zero
+    uint16_t floatToHalf(float value);
+    float halfToFloat(uint16_t value);
+
+    //An image decoded by a decode queue. The caller owns the image and has to unload it
+    struct decode_result_t
+    {
+      uint32_t id_;
+      bool success_;
+      image2D_t image_;
+    };
+
+    //Decodes images in the workers of a thread pool. Decoded images are queued in the order they finish
+    struct decode_queue_t
+    {
+      thread::thread_pool_t* threadPool_ = nullptr;
+
+      std::mutex mutex_;
+      std::condition_variable imageDecoded_;
+      std::deque<decode_result_t> decoded_;
+      uint32_t nextId_ = 0u;
+      uint32_t pending_ = 0u;     //Images added but not yet popped
+    };
+
+    void decodeQueueCreate(thread::thread_pool_t* threadPool, decode_queue_t* queue);
+
+    //Waits for the images in flight and unloads the ones not popped
+    void decodeQueueDestroy(decode_queue_t* queue);
+
+    //Adds an image to decode and returns its id. Ids are consecutive, starting at 0
+    uint32_t decodeQueueAdd(const char* path, bool flipVertical, decode_queue_t* queue);
+
+    //Gets the next decoded image. If wait is true it blocks until an image has been decoded.
+    //Returns false if there are no decoded images (or no images pending if wait is true)
+    bool decodeQueuePop(bool wait, decode_queue_t* queue, decode_result_t* result);
   } //namespace image
 }//namespace bkk
 
@@ -27,7 +27,8 @@
 
 #include "maths.h"
 #include "render.h"
-#include "transform-manager.h"
+#include "thread-pool.h"
+#include "animation.h"
 
 namespace bkk
 {
@@ -39,12 +40,16 @@ namespace bkk
       maths::vec3 max_;
     };
 
+    //Skeleton data is immutable after loading and can be shared by any number of animators.
+    //Only bones and their ancestors are kept, in evaluation order: node 0 is the root and parents come before their children
     struct skeleton_t
     {
-      transform_manager_t txManager_;
-      
-      handle_t* bones_;
       maths::mat4* offsets_;
+
+      u32* nodeParent_;           //Parent index of each node (0 for the root)
+      maths::mat4* bindPose_;     //Local transform of each node in the bind pose
+      u32* boneNode_;             //Node index of each bone
+      u32* nodeDepth_;            //Depth of each node in the hierarchy (0 for the root)
       
       maths::mat4 globalInverseTransform_;
       
@@ -65,21 +70,107 @@ namespace bkk
       u32 nodeCount_;
       f32 duration_;  //In ms
 
-      handle_t* nodes_;    //Handles of animated nodes
+      u32* nodes_;         //Skeleton node index of each animated node
       bone_transform_t* data_;    
     };
 
 
+    //Format of the bone transforms uploaded by an animator
+    enum palette_format_e
+    {
+      PALETTE_MATRIX = 0,           //mat4 per bone
+      PALETTE_DUAL_QUATERNION = 1   //Rotation and translation dual quaternion (real part followed by dual part) per bone. Scale is ignored
+    };
+
+    struct dual_quaternion_t
+    {
+      maths::quat real_;
+      maths::quat dual_;
+    };
+
+    //Level of detail of an animator. Lower levels of detail are cheaper to update
+    enum animator_lod_e
+    {
+      ANIMATOR_LOD_FULL = 0,            //Pose evaluated every update
+      ANIMATOR_LOD_REDUCED_RATE = 1,    //Pose evaluated once every updateInterval_ updates
+      ANIMATOR_LOD_REDUCED_BONES = 2,   //As ANIMATOR_LOD_REDUCED_RATE, and nodes deeper than maxNodeDepth_ are neither sampled nor evaluated. They follow
+                                        //their ancestor at maxNodeDepth_ with the bind pose between them
+      ANIMATOR_LOD_FROZEN = 3           //Pose not evaluated. The last palette is kept
+    };
+
+    //Thresholds used to select the level of detail of an animator from its screen size (fraction of the viewport height covered by the character)
+    struct animator_lod_policy_t
+    {
+      f32 reducedRateSize_ = 0.3f;
+      f32 reducedBonesSize_ = 0.1f;
+      f32 frozenSize_ = 0.02f;
+      u32 updateInterval_ = 4u;
+      u32 maxNodeDepth_ = 4u;
+    };
+
     struct skeletal_animator_t
     {
       f32 cursor_;
       float speed_;
 
-      skeleton_t* skeleton_;
+      const skeleton_t* skeleton_;
       const skeletal_animation_t* animation_;
+      const compressed_animation_t* compressedAnimation_ = nullptr;   //If not null the animation is decoded from the compressed clip
+      bone_transform_t* localPose_ = nullptr;                         //Decoded local transforms of the animated nodes
+      maths::mat4* localTransform_ = nullptr;                         //Per-instance local transform of each node
+      maths::mat4* globalTransform_ = nullptr;                        //Per-instance global transform of each node
 
       maths::mat4* boneTransform_;      //Final bones transforms for current time in the animation
       render::gpu_buffer_t buffer_;    //Uniform buffer with the final transformation of each bone
+
+      palette_format_e paletteFormat_ = PALETTE_MATRIX;
+      dual_quaternion_t* dualQuaternion_ = nullptr;   //Bone transforms uploaded if paletteFormat_ is PALETTE_DUAL_QUATERNION
+
+      animator_lod_e lod_ = ANIMATOR_LOD_FULL;
+      u32 updateInterval_ = 1u;           //Number of updates between evaluations of the pose
+      u32 maxNodeDepth_ = 0xFFFFFFFF;     //Nodes deeper than this are not evaluated. Bones below it follow their ancestor at this depth
+      u32 lodDepth_ = 0xFFFFFFFF;         //maxNodeDepth_ used to compute lodAncestor_ and lodOffset_
+      u32* lodAncestor_ = nullptr;        //Node at lodDepth_ that each bone follows (or the bone node itself if it is not deeper)
+      maths::mat4* lodOffset_ = nullptr;  //Offset of each bone combined with the bind pose from the bone node to lodAncestor_
+      u32 updateCount_ = 0u;              //Number of updates, offset to stagger the evaluations of different animators
+      bool evaluated_ = false;            //False until the pose has been evaluated for the first time
+    };
+
+    //Group of animators updated together. The palettes of all the animators are written to a single storage buffer,
+    //the palette of animator i starting at bone paletteOffset_[i]
+    struct animator_batch_t
+    {
+      skeletal_animator_t** animator_ = nullptr;
+      u32* paletteOffset_ = nullptr;
+      u32 animatorCount_ = 0u;
+      u32 boneCount_ = 0u;                //Total number of bones in the buffer
+
+      render::gpu_buffer_t buffer_;       //Storage buffer with the palettes of all the animators
+      maths::mat4* palette_ = nullptr;    //Persistently mapped memory of buffer_
+    };
+
+    //Big vertex and index buffers shared by many meshes. Each mesh created in the pool references a range of them,
+    //so all the meshes in the pool can be drawn binding the buffers only once
+    struct geometry_pool_t
+    {
+      render::gpu_buffer_t vertexBuffer_;
+      render::gpu_buffer_t indexBuffer_;
+      render::gpu_buffer_t positionBuffer_;   //Position stream of the meshes in the pool. Only if positionBufferSize_ > 0
+
+      size_t vertexBufferSize_;
+      size_t indexBufferSize_;
+      size_t positionBufferSize_ = 0u;
+      size_t vertexBufferUsed_ = 0u;  //In bytes
+      size_t indexBufferUsed_ = 0u;   //In bytes
+      size_t positionBufferUsed_ = 0u;  //In bytes
+    };
+
+    //Range of the index buffer of a mesh corresponding to one of the submeshes merged into it
+    struct submesh_t
+    {
+      u32 firstIndex_;  //Relative to the first index of the mesh
+      u32 indexCount_;
+      aabb_t aabb_;
     };
 
     struct mesh_t
@@ -91,10 +182,27 @@ namespace bkk
       u32 indexCount_;
       aabb_t aabb_;
 
+      //Optional tightly packed copy of the positions, for passes which only need the position (e.g depth only passes)
+      render::gpu_buffer_t positionBuffer_;
+      bool hasPositionStream_ = false;
+
+      //Range of the buffers used by the mesh. Only meshes created in a geometry pool have non-zero offsets
+      u32 firstIndex_ = 0u;
+      s32 vertexOffset_ = 0;
+      geometry_pool_t* pool_ = nullptr;
+
+      //Index of the material in the file (as returned by loadMaterials)
+      u32 materialIndex_ = 0u;
+
+      //Only used for meshes created by merging submeshes
+      submesh_t* submeshes_ = nullptr;
+      u32 submeshCount_ = 0u;
+
       //Only used for skinned meshes
       skeleton_t* skeleton_ = nullptr;
       skeletal_animation_t* animations_ = nullptr;
-      u32 animationCount_ = 0u;
+      compressed_animation_t* compressedAnimations_ = nullptr;  //Only if loaded with EXPORT_COMPRESS_ANIMATIONS (animations_ is null in that case)
+      u32 animationCount_ = 0u;                                 //Clips that don't animate any node of the skeleton are not loaded
 
       render::vertex_format_t vertexFormat_;
     };
@@ -114,8 +222,15 @@ namespace bkk
       EXPORT_NORMALS = 1,
       EXPORT_UV = 2,
       EXPORT_BONE_WEIGHTS = 4,
-      EXPORT_ALL = EXPORT_NORMALS | EXPORT_UV | EXPORT_BONE_WEIGHTS
+      EXPORT_ALL = EXPORT_NORMALS | EXPORT_UV | EXPORT_BONE_WEIGHTS,
+
+      //Import options when loading all the submeshes in a file
+      EXPORT_MERGE_BY_MATERIAL = 8,   //Static submeshes sharing material are merged into a single mesh
+      EXPORT_PRETRANSFORM = 16,       //Bakes node transforms into the vertices of merged meshes. A submesh referenced by several nodes is replicated
 
+      EXPORT_DISABLE_NATIVE_PARSER = 32,  //Always use Assimp, even for OBJ and PLY files the native parser can handle
+      EXPORT_POSITION_STREAM = 64,        //Creates a position stream for the meshes (see createPositionStream). Meshes in a pool get one if the pool has a position buffer
+      EXPORT_COMPRESS_ANIMATIONS = 128    //Skeletal animations are compressed (see animationCompress) and the uncompressed data is released
     };
 
     ///Mesh API
@@ -129,22 +244,69 @@ namespace bkk
 
     //Load all submeshes from a file
     //Warning: Allocates an array of meshes (returned by reference in 'meshes') and passes ownership of that memory to the caller
+    //If EXPORT_MERGE_BY_MATERIAL is set the number of meshes can be smaller than the number of submeshes in the file
     uint32_t createFromFile(const render::context_t& context, const char* file, export_flags_e exportFlags, render::gpu_memory_allocator_t* allocator, mesh_t** meshes);
 
     //Load a single submesh from a file
-    void createFromFile(const render::context_t& context, const char* file, export_flags_e exportFlags, render::gpu_memory_allocator_t* allocator, uint32_t subMesh, mesh_t* mesh);
+    //OBJ and PLY files with a single mesh are memory mapped and parsed natively, splitting the work between the threads in 'threadPool' if not null
+    void createFromFile(const render::context_t& context, const char* file, export_flags_e exportFlags, render::gpu_memory_allocator_t* allocator, uint32_t subMesh, mesh_t* mesh, thread::thread_pool_t* threadPool = nullptr);
 
     uint32_t loadMaterials(const char* file, uint32_t** materialIndices, material_t** materials);
 
+    //Create meshes in a geometry pool. Meshes in a pool don't own their buffers, the memory is released when the pool is destroyed
+    bool createInPool(const render::context_t& context,
+      const uint32_t* indexData, uint32_t indexDataSize,
+      const void* vertexData, size_t vertexDataSize,
+      render::vertex_attribute_t* attribute, uint32_t attributeCount,
+      geometry_pool_t* pool, mesh_t* mesh);
+
+    //Creates a buffer with the positions of the vertices tightly packed, to be drawn with drawPositionStream using a vertex format with a single vec3 attribute
+    void createPositionStream(const render::context_t& context, const void* vertexData, size_t vertexDataSize, render::gpu_memory_allocator_t* allocator, mesh_t* mesh);
+
+    //Meshes that don't fit in the pool are created with their own buffers (pool_ is null), and have to be drawn with draw or drawPositionStream
+    uint32_t createFromFileInPool(const render::context_t& context, const char* file, export_flags_e exportFlags, geometry_pool_t* pool, mesh_t** meshes);
+
     void draw(VkCommandBuffer commandBuffer, const mesh_t& mesh);
+    void drawPositionStream(VkCommandBuffer commandBuffer, const mesh_t& mesh);
     void drawInstanced(VkCommandBuffer commandBuffer, u32 instanceCount, render::gpu_buffer_t* instanceBuffer, u32 instancedAttributesCount, const mesh_t& mesh);
     void destroy(const render::context_t& context, mesh_t* mesh, render::gpu_memory_allocator_t* allocator = nullptr);
 
+    //Geometry pool
+    //If positionBufferSize is not zero the pool keeps a position stream for all its meshes. A mesh whose vertices are placed at byte offset 'o'
+    //of the vertex buffer with stride 's' needs (o/s + vertexCount) * 12 bytes of the position buffer. When a mesh has a bigger stride than the previous one
+    //its vertices are moved forward in the vertex buffer so its positions don't overlap the ones already in the pool
+    void geometryPoolCreate(const render::context_t& context, size_t vertexBufferSize, size_t indexBufferSize, geometry_pool_t* pool, size_t positionBufferSize = 0u);
+    void geometryPoolDestroy(const render::context_t& context, geometry_pool_t* pool);
+
+    //Binds the buffers of the pool to the first 'bindingCount' vertex bindings. Meshes of the pool can then be drawn with drawFromPool
+    void geometryPoolBind(VkCommandBuffer commandBuffer, const geometry_pool_t& pool, u32 bindingCount);
+    void drawFromPool(VkCommandBuffer commandBuffer, const mesh_t& mesh);
+
+    //Binds the position stream of the pool to binding 0, for pipelines with a position only vertex format. Meshes are drawn with drawFromPool
+    void geometryPoolBindPositionStream(VkCommandBuffer commandBuffer, const geometry_pool_t& pool);
+
+    //Indirect draw command for a mesh in a pool, to fill buffers for vkCmdDrawIndexedIndirect
+    VkDrawIndexedIndirectCommand getDrawIndirectCommand(const mesh_t& mesh, u32 instanceCount, u32 firstInstance);
+
     //Animator
-    void animatorCreate(const render::context_t& context, const mesh_t& mesh, u32 animationIndex, float speedFactor, skeletal_animator_t* animator);
+    void animatorCreate(const render::context_t& context, const mesh_t& mesh, u32 animationIndex, float speedFactor, skeletal_animator_t* animator, palette_format_e paletteFormat = PALETTE_MATRIX);
     void animatorUpdate(const render::context_t& context, f32 deltaTimeInMs, skeletal_animator_t* animator);
     void animatorDestroy(const render::context_t& context, skeletal_animator_t* animator);
 
+    //Animator level of detail. animatorScreenSize returns the fraction of the viewport height covered by a bounding sphere
+    //and animatorSetLod selects the level of detail for that size. The cursor keeps advancing in every update whatever the level of detail,
+    //so only the evaluation of the pose is skipped. Animators in a batch are staggered so the ones with a reduced rate
+    //don't all evaluate in the same frame
+    f32 animatorScreenSize(const maths::vec3& center, f32 radius, const maths::mat4& view, const maths::mat4& projection);
+    void animatorSetLod(const animator_lod_policy_t& policy, f32 screenSize, skeletal_animator_t* animator);
+
+    //Animator batch. The animators must outlive the batch. animatorBatchUpdate advances and evaluates all the animators,
+    //splitting them across the workers of the pool (or in the calling thread if threadPool is null), and writes their palettes
+    //directly in the mapped buffer as mat4 regardless of the palette format of the animators. The per-animator buffers (skeletal_animator_t::buffer_) are not updated
+    void animatorBatchCreate(const render::context_t& context, skeletal_animator_t** animators, u32 animatorCount, animator_batch_t* batch);
+    void animatorBatchUpdate(f32 deltaTimeInMs, thread::thread_pool_t* threadPool, animator_batch_t* batch);
+    void animatorBatchDestroy(const render::context_t& context, animator_batch_t* batch);
+
     mesh_t fullScreenQuad(const bkk::render::context_t& context);
     mesh_t unitQuad(const bkk::render::context_t& context);
     mesh_t unitCube(const bkk::render::context_t& context);
@@ -108,6 +108,7 @@ namespace bkk
       VkPhysicalDevice physicalDevice_;
       VkDevice device_;
       VkPhysicalDeviceMemoryProperties memoryProperties_;
+      VkPhysicalDeviceFeatures enabledFeatures_;    //Optional features enabled when the device was created
       VkCommandPool commandPool_;
       queue_t graphicsQueue_;
       queue_t computeQueue_;
@@ -348,6 +349,7 @@ namespace bkk
 
       vertex_attribute_t* attributes_;
       uint32_t attributeCount_;
+      uint32_t bindingCount_;   //Number of vertex buffers to bind when drawing
 
       uint32_t vertexSize_;
     };
@@ -371,6 +373,22 @@ namespace bkk
       VkFence fence_;
     };
 
+    //Records uploads and layout transitions of many resources in one command buffer, submitted with a single fence.
+    //Staging memory is sub-allocated from a ring that is reused once the uploads using it have finished
+    struct upload_batch_t
+    {
+      VkCommandBuffer commandBuffer_ = VK_NULL_HANDLE;
+      VkFence fence_ = VK_NULL_HANDLE;
+      bool recording_ = false;
+      bool submitted_ = false;
+
+      gpu_buffer_t staging_ = {};
+      uint8_t* stagingMapping_ = nullptr;
+      VkDeviceSize stagingSize_ = 0u;
+      VkDeviceSize stagingHead_ = 0u;
+      std::vector<gpu_buffer_t> overflow_;    //Staging buffers of allocations bigger than the ring, destroyed when the batch finishes
+    };
+
     struct render_pass_t
     {
       struct attachment_t
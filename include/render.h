@@ -36,7 +36,7 @@
 namespace bkk
 {
 
-  namespace image{struct image2D_t;}
+  namespace image{struct image2D_t; struct mip_chain_t;}
   namespace window{struct window_t;}
 
   namespace render
@@ -67,9 +67,32 @@ namespace bkk
     void gpuAllocatorDestroy(const context_t& context, gpu_memory_allocator_t* allocator);
 
     //Textures
+
+    //Format that matches the layout of the image data, without expanding it to a sampleable format
+    VkFormat getImageFormat(const image::image2D_t& image);
     void texture2DCreate(const context_t& context, const image::image2D_t* images, uint32_t mipLevels, texture_sampler_t sampler, texture_t* texture);
     void texture2DCreateAndGenerateMipmaps(const context_t& context, const image::image2D_t& image, texture_sampler_t sampler, texture_t* texture);
+
+    //Versions that record the upload in a batch. The texture can't be used until the batch has finished, but the source data can be freed on return.
+    //If batch is null the upload is submitted and waited for before returning. Block compressed images need the textureCompressionBC feature,
+    //without it the texture is not created (image_ is VK_NULL_HANDLE and the versions returning bool return false)
+    void texture2DCreate(const context_t& context, const image::image2D_t* images, uint32_t mipLevels, texture_sampler_t sampler, upload_batch_t* batch, texture_t* texture);
+    void texture2DCreateAndGenerateMipmaps(const context_t& context, const image::image2D_t& image, texture_sampler_t sampler, upload_batch_t* batch, texture_t* texture);
+    bool texture2DCreate(const context_t& context, const char* file, bool flipVertical, texture_sampler_t sampler, upload_batch_t* batch, texture_t* texture);
+    bool texture2DCreate(const context_t& context, const image::mip_chain_t& mipChain, texture_sampler_t sampler, upload_batch_t* batch, texture_t* texture);
+
+    //Records the generation of the mip chain of the texture from its base level using blits. The texture needs transfer source and destination usage
+    //and its format has to support blits (and linear filtering if filter is VK_FILTER_LINEAR). The base level is expected in texture->layout_ and
+    //the contents of the other levels are discarded. All levels end in shader read-only layout. Several textures can be recorded in the same command buffer
+    void textureGenerateMipmaps(VkCommandBuffer commandBuffer, texture_t* texture, VkFilter filter = VK_FILTER_LINEAR);
     void texture2DCreate(const context_t& context, uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageUsageFlags usageFlags, texture_sampler_t sampler, texture_t* texture);
+
+    //Creates a texture from an image file, decoding the image directly in the staging buffer. Returns false if the file can't be decoded.
+    //KTX2 and DDS files are copied to the staging buffer with all their mip levels, and flipVertical is ignored
+    bool texture2DCreate(const context_t& context, const char* file, bool flipVertical, texture_sampler_t sampler, texture_t* texture);
+
+    //Creates a texture with all the mip levels of a KTX2 or DDS file. Returns false if a level doesn't fit in the staging buffer
+    bool texture2DCreate(const context_t& context, const image::mip_chain_t& mipChain, texture_sampler_t sampler, texture_t* texture);
     
     void textureDestroy(const context_t& context, texture_t* texture);
     
@@ -84,13 +107,21 @@ namespace bkk
     void textureChangeLayoutNow(const context_t& context, VkImageLayout layout, texture_t* texture);
 
     void textureCubemapCreate(const context_t& context, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, texture_sampler_t sampler, texture_cubemap_t* texture);
+    void textureCubemapCreate(const context_t& context, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, VkImageUsageFlags usage, texture_sampler_t sampler, texture_cubemap_t* texture);
+
+    //'images' are the base levels of the 6 faces. The rest of the mipLevels are generated with blits, or the texture gets only
+    //the base level if the format can't be blitted with linear filtering
     void textureCubemapCreate( const context_t& context, const image::image2D_t* images, uint32_t mipLevels, texture_sampler_t sampler, texture_cubemap_t* texture);
+    void textureCubemapCreate(const context_t& context, const image::image2D_t* images, uint32_t mipLevels, texture_sampler_t sampler, upload_batch_t* batch, texture_cubemap_t* texture);
     void textureCubemapCreateFromEquirectangularImage(const context_t& context, const image::image2D_t& image, uint32_t size, bool generateMipmaps, texture_cubemap_t* cubemap);
     
 
     //Buffers
     void gpuBufferCreate(const context_t& context, uint32_t usage, uint32_t memoryType, void* data, size_t size, gpu_memory_allocator_t* allocator, gpu_buffer_t* buffer);
     void gpuBufferCreate(const context_t& context, uint32_t usage, void* data, size_t size, gpu_memory_allocator_t* allocator, gpu_buffer_t* buffer);
+
+    //Creates a device local buffer and records the upload of its data in a batch. If batch is null the upload is submitted and waited for before returning
+    void gpuBufferCreate(const context_t& context, uint32_t usage, const void* data, size_t size, gpu_memory_allocator_t* allocator, upload_batch_t* batch, gpu_buffer_t* buffer);
     void gpuBufferDestroy(const context_t& context, gpu_memory_allocator_t* allocator, gpu_buffer_t* buffer);
     void gpuBufferUpdate(const context_t& context, void* data, size_t offset, size_t size, gpu_buffer_t* buffer);
     void* gpuBufferMap(const context_t& context, const gpu_buffer_t& buffer);
@@ -140,6 +171,9 @@ namespace bkk
 
     //Vertex formats
     void vertexFormatCreate(vertex_attribute_t* attribute, uint32_t attributeCount, vertex_format_t* format);
+
+    //Attribute i is read from binding attributeBinding[i]. Attributes sharing a binding are fetched from the same buffer and must have the same stride
+    void vertexFormatCreate(vertex_attribute_t* attribute, uint32_t attributeCount, const uint32_t* attributeBinding, vertex_format_t* format);
     void vertexFormatCopy(const vertex_format_t* formatSrc, vertex_format_t* formatDst);
     void vertexFormatAddAttributes(vertex_attribute_t* attribute, uint32_t attributeCount, vertex_format_t* format);
     void vertexFormatDestroy(vertex_format_t* format);
@@ -163,6 +197,26 @@ namespace bkk
     void commandBufferEnd(const command_buffer_t& commandBuffer);
     void commandBufferSubmit(const context_t& context, const command_buffer_t& commandBuffer );
     
+    //Upload batches. Batches start recording on creation and after they finish. Resources created in a batch can be used once it has finished.
+    //stagingSize is the size of the staging ring. When it is full the batch is submitted and waited for, so it should fit a typical load
+    void uploadBatchCreate(const context_t& context, VkDeviceSize stagingSize, upload_batch_t* batch);
+
+    //Submits the pending uploads and waits for them before destroying the batch
+    void uploadBatchDestroy(const context_t& context, upload_batch_t* batch);
+
+    //Submits the recorded uploads. If wait is false uploadBatchWait has to be called before using the resources
+    void uploadBatchSubmit(const context_t& context, bool wait, upload_batch_t* batch);
+    void uploadBatchWait(const context_t& context, upload_batch_t* batch);
+
+    //Returns true if the submitted uploads have finished, or if there are none, without waiting for them
+    bool uploadBatchFinished(const context_t& context, const upload_batch_t& batch);
+
+    //Command buffer of the batch, to record other transfers or layout transitions (for example with textureChangeLayout instead of textureChangeLayoutNow)
+    VkCommandBuffer uploadBatchGetCommandBuffer(const context_t& context, upload_batch_t* batch);
+
+    //Allocates staging memory for an upload. Returns the mapped memory and the buffer and offset to copy from
+    uint8_t* uploadBatchAllocate(const context_t& context, VkDeviceSize size, VkDeviceSize alignment, upload_batch_t* batch, VkBuffer* buffer, VkDeviceSize* offset);
+
     VkSemaphore semaphoreCreate(const context_t& context );
     void semaphoreDestroy(const context_t& context, VkSemaphore semaphore);
 
@@ -184,6 +238,7 @@ namespace bkk
 
     //Utility functions    
     void diffuseConvolution(const context_t& context,texture_cubemap_t environmentMap, uint32_t size, texture_cubemap_t* irradiance);
+    //Prefilters the environment with a compute shader, one level per roughness. The environment map should have mipmaps, since they are used to filter the samples
     void specularConvolution(const context_t& context, texture_cubemap_t environmentMap, uint32_t size, uint32_t maxMipmapLevels, texture_cubemap_t* specularMap);
     void brdfConvolution(const context_t& context, uint32_t size, texture_t* brdfConvolution);
     
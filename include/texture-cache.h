@@ -0,0 +1,106 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "render-types.h"
+#include "packed-freelist.h"
+#include <string>
+#include <list>
+#include <unordered_map>
+
+namespace bkk
+{
+  namespace image { struct image2D_t; }
+
+  namespace render
+  {
+    struct context_t;
+
+    struct texture_cache_stats_t
+    {
+      uint32_t hits_ = 0u;
+      uint32_t misses_ = 0u;
+      uint32_t evictions_ = 0u;
+      uint32_t residentTextures_ = 0u;
+      uint64_t residentBytes_ = 0u;
+    };
+
+    //Shares textures loaded from the same file (or created from the same image) between all the users that acquire them.
+    //Textures are reference counted. When the last reference is released the texture stays resident, and unreferenced textures
+    //are evicted in least recently released order while the resident bytes are over the budget. Referenced textures are never evicted
+    struct texture_cache_t
+    {
+      struct entry_t
+      {
+        std::string key_;
+        texture_t texture_;
+        uint32_t refCount_;
+        std::list<handle_t>::iterator lruPosition_;   //Only valid if refCount_ is 0
+      };
+
+      packed_freelist_t<entry_t> entry_;
+      std::unordered_map<std::string, handle_t> keyToEntry_;
+      std::list<handle_t> lru_;                         //Unreferenced entries, least recently released first
+      uint64_t budget_ = 0u;
+      texture_cache_stats_t stats_;
+    };
+
+    void textureCacheCreate(uint64_t budget, texture_cache_t* cache);
+
+    //Destroys all the textures, including the ones still referenced
+    void textureCacheDestroy(const context_t& context, texture_cache_t* cache);
+
+    //Gets a reference to the texture of a file, loading it if it isn't resident. KTX2 and DDS files keep their mip chains, and
+    //other formats get a generated mip chain if generateMipmaps is true. The file is only loaded the first time, so the rest of
+    //the arguments are ignored if the texture is resident. Returns INVALID_ID if the file can't be loaded.
+    //If batch is not nullptr the upload is recorded in it, and the texture can't be used until the batch has been submitted
+    handle_t textureCacheAcquire(const context_t& context, const char* path, bool flipVertical, bool generateMipmaps, texture_sampler_t sampler, upload_batch_t* batch, texture_cache_t* cache);
+
+    //Gets a reference to a texture with the contents of an image. Images with the same size, format and data share the texture.
+    //Returns INVALID_ID if the texture can't be created
+    handle_t textureCacheAcquire(const context_t& context, const image::image2D_t& image, bool generateMipmaps, texture_sampler_t sampler, upload_batch_t* batch, texture_cache_t* cache);
+
+    //Gets a reference to the texture with the given key if it is resident. Returns INVALID_ID otherwise
+    handle_t textureCacheFind(const char* key, texture_cache_t* cache);
+
+    //Creates a texture from an already decoded image and returns a reference to it. Useful to decode images out of the cache
+    //(for example with a decode queue). If the key is resident the image is ignored and the resident texture is returned.
+    //Returns INVALID_ID if the texture can't be created
+    handle_t textureCacheAdd(const context_t& context, const char* key, const image::image2D_t& image, bool generateMipmaps, texture_sampler_t sampler, upload_batch_t* batch, texture_cache_t* cache);
+
+    //Releases a reference. The GPU must not be using the texture anymore, since it may be destroyed at any time after this call
+    void textureCacheRelease(const context_t& context, handle_t texture, texture_cache_t* cache);
+
+    //Returns the texture of a handle, or nullptr if the handle is not valid
+    texture_t* textureCacheGet(handle_t texture, texture_cache_t* cache);
+
+    //Changes the budget and evicts unreferenced textures until the cache fits in it
+    void textureCacheSetBudget(const context_t& context, uint64_t budget, texture_cache_t* cache);
+
+  } //namespace render
+}//namespace bkk
+
+#endif  /*  TEXTURE_CACHE_H   */
@@ -0,0 +1,100 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include "render-types.h"
+#include "packed-freelist.h"
+#include "image.h"
+#include <vector>
+
+namespace bkk
+{
+  namespace render
+  {
+    struct context_t;
+
+    //Texture whose most detailed levels are loaded only when they are visible
+    struct streamed_texture_t
+    {
+      image::mip_chain_t source_;       //All the levels of the texture, in CPU memory
+      texture_t texture_;               //Has memory for the levels from imageLevel_ to the last level of the source. Its view only includes the resident levels
+      texture_sampler_t sampler_;
+      uint32_t imageLevel_;             //Most detailed level the image has memory for
+      uint32_t residentLevel_;          //Most detailed resident level
+      uint32_t initialLevel_;           //Least detailed level that is kept resident, created when the texture is added
+      uint32_t targetLevel_;            //Most detailed level needed for the current screen size
+      float screenSize_;                //Size in pixels the texture covers on screen
+      bool changed_;                    //The view or the image of texture_ were replaced in the last update
+    };
+
+    //Creates textures with memory for all their levels but uploads only the smallest ones, and streams more detailed levels into the same image as they
+    //are needed, most visible textures first. The view of the texture only includes the resident levels, so sampling is clamped to them. Dropped levels
+    //are freed by recreating the texture without them. In both cases descriptors using the texture have to be updated.
+    //Uploads are recorded in an upload batch that is submitted without waiting, and no more levels are streamed until it has finished
+    struct texture_streamer_t
+    {
+      struct retired_texture_t
+      {
+        texture_t texture_;
+        uint32_t frame_;
+      };
+
+      packed_freelist_t<streamed_texture_t> texture_;
+      std::vector<retired_texture_t> retired_;      //Replaced textures and views, destroyed when frames in flight can't be using them
+      uint32_t frame_ = 0u;
+      upload_batch_t batch_;
+
+      uint32_t initialSize_ = 64u;                  //Textures are created with the levels of this size and smaller
+      uint64_t uploadBudget_ = 4u * 1024u * 1024u;  //Bytes uploaded in each update, and size of the staging ring
+      uint32_t retireDelay_ = 3u;                   //Updates a replaced texture or view is kept alive
+    };
+
+    void textureStreamerCreate(const context_t& context, uint32_t initialSize, uint64_t uploadBudget, uint32_t retireDelay, texture_streamer_t* streamer);
+    void textureStreamerDestroy(const context_t& context, texture_streamer_t* streamer);
+
+    //Adds a texture from a file. KTX2 and DDS files are streamed from their mip chains, other images are decoded and get a generated mip chain.
+    //Returns INVALID_ID if the file can't be loaded or its format can't be sampled without expanding it.
+    //The upload of the initial levels is submitted by the next textureStreamerUpdate, which has to be called before the texture is used
+    handle_t textureStreamerAdd(const context_t& context, const char* path, bool flipVertical, texture_sampler_t sampler, texture_streamer_t* streamer);
+    //The texture is destroyed by a later update, once the frames that could be using it have finished
+    void textureStreamerRemove(handle_t texture, texture_streamer_t* streamer);
+
+    //Sets the size in pixels the texture covers on screen (for example the projected size of the objects using it). Levels more detailed than
+    //what that size needs are not streamed in, and are dropped if they are resident
+    void textureStreamerSetScreenSize(handle_t texture, float screenSize, texture_streamer_t* streamer);
+
+    //Streams one more level of the textures that need it, in order of screen size, until the upload budget is spent, and drops the levels
+    //textures don't need anymore. Returns the number of textures whose view or image changed. Call it once per frame
+    uint32_t textureStreamerUpdate(const context_t& context, texture_streamer_t* streamer);
+
+    //Returns the texture of a handle, or nullptr if the handle is not valid. 'changed' is set to true if the view or the image of the texture were replaced
+    //in the last update
+    texture_t* textureStreamerGet(handle_t texture, texture_streamer_t* streamer, bool* changed = nullptr);
+
+  } //namespace render
+}//namespace bkk
+
+#endif  /*  TEXTURE_STREAMER_H   */
@@ -0,0 +1,76 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "maths.h"
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace bkk
+{
+  namespace thread
+  {
+    typedef std::function<void()> job_t;
+
+    //Body of a parallel for loop. Called with ranges [begin,end) of the iteration space
+    typedef std::function<void(u32 begin, u32 end)> parallel_for_body_t;
+
+    struct thread_pool_t
+    {
+      std::vector<std::thread> threads_;
+      std::deque<job_t> jobs_;
+
+      std::mutex mutex_;
+      std::condition_variable jobAdded_;
+      std::condition_variable jobFinished_;
+
+      u32 pendingJobs_ = 0u;  //Jobs queued or in flight
+      bool exit_ = false;
+    };
+
+    //Creates a pool with 'threadCount' workers. If threadCount is 0 it will create one worker per hardware thread minus one (the calling thread)
+    void poolCreate(u32 threadCount, thread_pool_t* pool);
+    void poolDestroy(thread_pool_t* pool);
+
+    u32 poolGetThreadCount(const thread_pool_t* pool);
+
+    void poolAddJob(thread_pool_t* pool, const job_t& job);
+
+    //Blocks until all the jobs added to the pool have finished
+    void poolWait(thread_pool_t* pool);
+
+    //Splits the range [0,count) in chunks of 'grainSize' elements and executes them in the workers. The calling thread also
+    //executes chunks and the function returns when all of them have been processed. If pool is null everything runs in the calling thread.
+    //It is safe to call it from inside a job
+    void parallelFor(thread_pool_t* pool, u32 count, u32 grainSize, const parallel_for_body_t& body);
+
+  } //thread namespace
+}//namespace bkk
+#endif  /*  THREAD_POOL_H   */
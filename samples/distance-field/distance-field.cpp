@@ -29,7 +29,12 @@
 #include "window.h"
 #include "image.h"
 #include "mesh.h"
+#include "bvh.h"
 #include "camera.h"
+#include "thread-pool.h"
+#include "timer.h"
+
+#include <float.h> //FLT_MAX
 
 using namespace bkk;
 using namespace bkk::maths;
@@ -101,6 +106,7 @@ static render::gpu_buffer_t gUbo;
 static render::gpu_buffer_t gDistanceField;
 
 static render::command_buffer_t gComputeCommandBuffer;
+static thread::thread_pool_t gThreadPool;
 static render::shader_t gVertexShader;
 static render::shader_t gFragmentShader;
 static render::shader_t gComputeShader;
@@ -218,6 +224,22 @@ static float signedDistancePointMesh(const maths::vec3& point, uint32_t* index,
   return minDistance;
 }
 
+static float signedDistancePointBVH(const maths::vec3& point, const mesh::bvh_t& bvh, const uint32_t* index, const vec3* vertex)
+{
+  mesh::bvh_closest_point_t closest;
+  if (!mesh::bvhClosestPoint(bvh, point, FLT_MAX, &closest))
+  {
+    return 10000.0f;
+  }
+
+  //Compute sign of the distance using the normal of the closest triangle (positive if in front, negative if behind)
+  const uint32_t* triangle = index + closest.triangle_ * 3;
+  maths::vec3 normal = cross(vertex[triangle[1]] - vertex[triangle[0]], vertex[triangle[2]] - vertex[triangle[0]]);
+  float sign = dot(normal, closest.point_ - point) < 0.0f ? 1.0f : -1.0f;
+
+  return sign * closest.distance_;
+}
+
 static maths::vec3 gridToLocal(u32 x, u32 y, u32 z, u32 gridWidth, u32 gridHeight, u32 gridDepth, const maths::vec3& aabbMin, const maths::vec3& aabbMax)
 {
   maths::vec3 normalized( (f32)(x / (gridWidth - 1.0f)), (f32)(y / (gridHeight - 1.0f)), (f32)(z / (gridDepth - 1.0)) );
@@ -226,42 +248,58 @@ static maths::vec3 gridToLocal(u32 x, u32 y, u32 z, u32 gridWidth, u32 gridHeigh
                 normalized.z * (aabbMax.z - aabbMin.z) + aabbMin.z );
 }
 
-static void distanceFieldFromMesh(const render::context_t& context, u32 width, u32 height, u32 depth, const bkk::mesh::mesh_t& mesh, render::gpu_buffer_t* buffer)
+//Reads indices and vertex positions of a mesh. Caller must free the returned arrays
+static void readMeshGeometry(const render::context_t& context, const bkk::mesh::mesh_t& mesh, uint32_t** index, vec3** vertexPosition)
 {
-  //Compute distances for an area twice as big as the bounding box of the mesh
-  maths::vec3 aabbMinScaled = mesh.aabb_.min_ * 4.0f;
-  maths::vec3 aabbMaxScaled = mesh.aabb_.max_ * 4.0f;
-
   //Read index data from mesh
-  uint32_t indexBufferSize = (uint32_t)mesh.indexBuffer_.memory_.size_ - (uint32_t)mesh.indexBuffer_.memory_.offset_;
-  uint32_t* index = (uint32_t*)malloc(indexBufferSize);
-  memcpy(index, render::gpuBufferMap(context, mesh.indexBuffer_), indexBufferSize);
+  *index = (uint32_t*)malloc(sizeof(uint32_t) * mesh.indexCount_);
+  memcpy(*index, render::gpuBufferMap(context, mesh.indexBuffer_), sizeof(uint32_t) * mesh.indexCount_);
   gpuBufferUnmap(context, mesh.indexBuffer_);
 
   //Read vertex data from mesh
-  uint32_t vertexBufferSize = (uint32_t)mesh.vertexBuffer_.memory_.size_ - (uint32_t)mesh.vertexBuffer_.memory_.offset_;
-  u8* vertex = (u8*)malloc(vertexBufferSize);
-  memcpy(vertex, render::gpuBufferMap(context, mesh.vertexBuffer_), vertexBufferSize);
-  gpuBufferUnmap(context, mesh.vertexBuffer_);
-  vec3* vertexPosition = (vec3*)malloc(sizeof(vec3) * mesh.vertexCount_ );
+  u8* vertex = (u8*)render::gpuBufferMap(context, mesh.vertexBuffer_);
+  *vertexPosition = (vec3*)malloc(sizeof(vec3) * mesh.vertexCount_);
   for (u32 i(0); i < mesh.vertexCount_; ++i)
   {
-    vertexPosition[i] = *(vec3*)(vertex + i*mesh.vertexFormat_.vertexSize_);
+    (*vertexPosition)[i] = *(vec3*)(vertex + i*mesh.vertexFormat_.vertexSize_);
   }
-  
-  //Generate distance field
+  gpuBufferUnmap(context, mesh.vertexBuffer_);
+}
+
+static void distanceFieldFromMesh(const render::context_t& context, u32 width, u32 height, u32 depth, const bkk::mesh::mesh_t& mesh, render::gpu_buffer_t* buffer)
+{
+  //Compute distances for an area twice as big as the bounding box of the mesh
+  maths::vec3 aabbMinScaled = mesh.aabb_.min_ * 4.0f;
+  maths::vec3 aabbMaxScaled = mesh.aabb_.max_ * 4.0f;
+
+  uint32_t* index;
+  vec3* vertexPosition;
+  readMeshGeometry(context, mesh, &index, &vertexPosition);
+
+  //Build a bvh to accelerate closest point queries
+  mesh::bvh_t bvh;
+  mesh::bvhCreate(vertexPosition, mesh.vertexCount_, index, mesh.indexCount_, true, &gThreadPool, &bvh);
+
+  //Generate distance field. Each slice is computed in parallel
   f32* data = (f32*)malloc(sizeof(f32) * width * height * depth);
-  for (u32 z = 0; z<depth; ++z)
-  {
-    for (u32 y = 0; y<height; ++y)
+  thread::parallelFor(&gThreadPool, depth, 1u,
+    [&](u32 begin, u32 end)
     {
-      for (u32 x = 0; x<width; ++x)
+      for (u32 z = begin; z<end; ++z)
       {
-        float distance = signedDistancePointMesh(gridToLocal(x, y, z, width, height, depth, aabbMinScaled, aabbMaxScaled), index, mesh.indexCount_, vertexPosition, mesh.vertexCount_);
-        data[z*width*height + y*width + x] = distance;
+        for (u32 y = 0; y<height; ++y)
+        {
+          for (u32 x = 0; x<width; ++x)
+          {
+            float distance = signedDistancePointBVH(gridToLocal(x, y, z, width, height, depth, aabbMinScaled, aabbMaxScaled), bvh, index, vertexPosition);
+            data[z*width*height + y*width + x] = distance;
+          }
+        }
       }
     }
-  }
+  );
+
+  mesh::bvhDestroy(&bvh);
   
   //Upload data to the buffer
   struct distance_field_buffer_data_t
@@ -293,11 +331,114 @@ static void distanceFieldFromMesh(const render::context_t& context, u32 width, u
 
   
   free(index);
-  free(vertex);
   free(vertexPosition);
   free(data);
 }
 
+//Compares loading throughput of the native OBJ/PLY parser against Assimp
+static void benchmarkMeshLoading(const render::context_t& context, const char* file)
+{
+  FILE* f = fopen(file, "rb");
+  if (f == nullptr)
+  {
+    return;
+  }
+  fseek(f, 0, SEEK_END);
+  f32 fileSize = (f32)ftell(f) / (1024.0f * 1024.0f);
+  fclose(f);
+  printf("%s: %.2f MB\n", file, fileSize);
+
+  const char* method[] = { "Assimp", "Native (1 thread)", "Native (thread pool)" };
+  mesh::export_flags_e flags[] = { (mesh::export_flags_e)(mesh::EXPORT_NORMALS | mesh::EXPORT_DISABLE_NATIVE_PARSER), mesh::EXPORT_NORMALS, mesh::EXPORT_NORMALS };
+  thread::thread_pool_t* pool[] = { nullptr, nullptr, &gThreadPool };
+  for (u32 i(0); i<3; ++i)
+  {
+    mesh::mesh_t mesh;
+    timer::time_point_t start = timer::getCurrent();
+    mesh::createFromFile(context, file, flags[i], nullptr, 0u, &mesh, pool[i]);
+    f32 time = timer::getDifference(start, timer::getCurrent());
+    printf("  Load (%s): %.2f ms, %.2f MB/s, %u vertices\n", method[i], time, fileSize * 1000.0f / time, mesh.vertexCount_);
+    mesh::destroy(context, &mesh);
+  }
+}
+
+//Compares bvh build and query times against brute force for the given mesh
+static void benchmarkBVH(const render::context_t& context, const char* file)
+{
+  mesh::mesh_t mesh;
+  mesh::createFromFile(context, file, mesh::EXPORT_POSITION_ONLY, nullptr, 0u, &mesh, &gThreadPool);
+
+  uint32_t* index;
+  vec3* vertexPosition;
+  readMeshGeometry(context, mesh, &index, &vertexPosition);
+  printf("%s: %u triangles\n", file, mesh.indexCount_ / 3);
+
+  //Build
+  mesh::bvh_t bvh, wideBvh;
+  timer::time_point_t start = timer::getCurrent();
+  mesh::bvhCreate(vertexPosition, mesh.vertexCount_, index, mesh.indexCount_, false, nullptr, &bvh);
+  printf("  Build (1 thread): %.2f ms, %u nodes\n", timer::getDifference(start, timer::getCurrent()), bvh.nodeCount_);
+
+  start = timer::getCurrent();
+  mesh::bvhCreate(vertexPosition, mesh.vertexCount_, index, mesh.indexCount_, true, &gThreadPool, &wideBvh);
+  printf("  Build (%u threads, with 4-wide layout): %.2f ms, %u wide nodes\n", thread::poolGetThreadCount(&gThreadPool) + 1, timer::getDifference(start, timer::getCurrent()), wideBvh.wideNodeCount_);
+
+  //Generate random queries in a box twice as big as the bounding box of the mesh
+  const u32 queryCount = 100000u;
+  const u32 bruteForceQueryCount = 100u;
+  vec3 center = (mesh.aabb_.min_ + mesh.aabb_.max_) * 0.5f;
+  vec3 extent = mesh.aabb_.max_ - mesh.aabb_.min_;
+  std::vector<vec3> point(queryCount);
+  std::vector<vec3> direction(queryCount);
+  for (u32 i(0); i<queryCount; ++i)
+  {
+    point[i] = center + vec3(maths::random(-1.0f, 1.0f) * extent.x, maths::random(-1.0f, 1.0f) * extent.y, maths::random(-1.0f, 1.0f) * extent.z);
+    direction[i] = center + vec3(maths::random(-0.5f, 0.5f) * extent.x, maths::random(-0.5f, 0.5f) * extent.y, maths::random(-0.5f, 0.5f) * extent.z) - point[i];
+  }
+
+  //Ray queries
+  const mesh::bvh_t* bvhs[2] = { &bvh, &wideBvh };
+  const char* layout[2] = { "binary", "4-wide" };
+  for (u32 i(0); i<2; ++i)
+  {
+    u32 hitCount = 0u;
+    start = timer::getCurrent();
+    for (u32 query(0); query<queryCount; ++query)
+    {
+      mesh::bvh_ray_hit_t hit;
+      hitCount += mesh::bvhIntersectRay(*bvhs[i], point[query], direction[query], FLT_MAX, &hit) ? 1u : 0u;
+    }
+    f32 time = timer::getDifference(start, timer::getCurrent());
+    printf("  Ray queries (%s): %.2f Mrays/s, %u hits\n", layout[i], queryCount / (time * 1000.0f), hitCount);
+  }
+
+  //Closest point queries
+  for (u32 i(0); i<2; ++i)
+  {
+    start = timer::getCurrent();
+    for (u32 query(0); query<queryCount; ++query)
+    {
+      signedDistancePointBVH(point[query], *bvhs[i], index, vertexPosition);
+    }
+    f32 time = timer::getDifference(start, timer::getCurrent());
+    printf("  Closest point queries (%s): %.3f us per query\n", layout[i], time * 1000.0f / queryCount);
+  }
+
+  start = timer::getCurrent();
+  for (u32 query(0); query<bruteForceQueryCount; ++query)
+  {
+    signedDistancePointMesh(point[query], index, mesh.indexCount_, vertexPosition, mesh.vertexCount_);
+  }
+  f32 time = timer::getDifference(start, timer::getCurrent());
+  printf("  Closest point queries (brute force): %.3f us per query\n", time * 1000.0f / bruteForceQueryCount);
+
+  mesh::bvhDestroy(&bvh);
+  mesh::bvhDestroy(&wideBvh);
+  free(index);
+  free(vertexPosition);
+  mesh::destroy(context, &mesh);
+}
+
 bool createUniformBuffer()
 {
   //Create the texture
@@ -480,6 +621,7 @@ void exit()
   render::descriptorPoolDestroy(gContext, &gDescriptorPool);
 
   render::contextDestroy(&gContext);
+  thread::poolDestroy(&gThreadPool);
 
   //Close window
   window::destroy(&gWindow);
@@ -561,13 +703,30 @@ void onMouseMove(uint32_t x, uint32_t y)
   gMousePosition.y = (f32)y;
 }
 
-int main()
+int main(int argc, char** argv)
 {
   //Create a window
   window::create("Distance Field", gImageSize.x, gImageSize.y, &gWindow);
 
   //Initialize gContext
   render::contextCreate("Distance Field", "", gWindow, 3, &gContext);
+  thread::poolCreate(0u, &gThreadPool);
+
+  //Run "distance-field -benchmark" to measure mesh loading and bvh performance
+  if (argc > 1 && strcmp(argv[1], "-benchmark") == 0)
+  {
+    benchmarkMeshLoading(gContext, "../resources/bunny.ply");
+    benchmarkMeshLoading(gContext, "../resources/dragon.obj");
+    benchmarkMeshLoading(gContext, "../resources/buddha.obj");
+
+    benchmarkBVH(gContext, "../resources/dragon.obj");
+    benchmarkBVH(gContext, "../resources/buddha.obj");
+
+    render::contextDestroy(&gContext);
+    thread::poolDestroy(&gThreadPool);
+    window::destroy(&gWindow);
+    return 0;
+  }
   
   gFSQuad = mesh::fullScreenQuad(gContext);
   gCamera.position_ = vec3(0.0f, 0.0f, 5.0f);
@@ -31,11 +31,16 @@
 #include "transform-manager.h"
 #include "packed-freelist.h"
 #include "camera.h"
+#include "ibl-cache.h"
+#include "timer.h"
 
 
 using namespace bkk;
 using namespace maths;
 
+//Image based lighting maps are computed the first time the sample runs and loaded from here in the following runs
+static const char* gIBLCacheDirectory = "../resources/ibl-cache";
+
 static const char* gGeometryPassVertexShaderSource = R"(
   #version 440 core
 
@@ -274,7 +279,10 @@ static const char* gAmbientLightFragmentShaderSource = R"(
   layout(set = 1, binding = 0) uniform sampler2D RT0;
   layout(set = 1, binding = 1) uniform sampler2D RT1;
   layout(set = 1, binding = 2) uniform sampler2D RT2;
-  layout(set = 1, binding = 3) uniform samplerCube irradianceMap;
+  layout(set = 1, binding = 3) uniform IRRADIANCE
+  {
+    vec4 sh[9];
+  }irradiance;
   layout(set = 1, binding = 4) uniform samplerCube specularMap;
   layout(set = 1, binding = 5) uniform sampler2D brdfLUT;
   
@@ -298,6 +306,16 @@ static const char* gAmbientLightFragmentShaderSource = R"(
     return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(1.0 - cosTheta, 5.0);
   }   
 
+  //Irradiance (divided by PI) from its spherical harmonics projection
+  vec3 IrradianceSH9(vec3 n)
+  {
+    return irradiance.sh[0].rgb * 0.282095 +
+           (irradiance.sh[1].rgb * n.y + irradiance.sh[2].rgb * n.z + irradiance.sh[3].rgb * n.x) * 0.488603 +
+           (irradiance.sh[4].rgb * n.x * n.y + irradiance.sh[5].rgb * n.y * n.z + irradiance.sh[7].rgb * n.x * n.z) * 1.092548 +
+           irradiance.sh[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0) +
+           irradiance.sh[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+  }
+
   void main(void)
   {
     vec2 uv = gl_FragCoord.xy * scene.imageSize.zw;
@@ -318,8 +336,7 @@ static const char* gAmbientLightFragmentShaderSource = R"(
     kD *= 1.0 - metallic;
 
     vec3 normalWS = normalize( vec4( inverse( scene.view ) * vec4(N,0.0) ).xyz);
-    vec3 irradiance = texture(irradianceMap, normalWS).rgb;
-    vec3 diffuse = irradiance * albedo;
+    vec3 diffuse = max(IrradianceSH9(normalWS), vec3(0.0)) * albedo;
 
     const float MAX_REFLECTION_LOD = 4;
     vec3 reflection = reflect(-V, N);
@@ -483,15 +500,11 @@ struct pbr_renderer_t : public application_t
     bkk::render::textureChangeLayoutNow(context, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, &finalImage_);
     render::depthStencilBufferCreate(context, size.x, size.y, &depthStencilBuffer_);
 
-    //Load environment map
-    bkk::image::image2D_t image;
-    bkk::image::load("../resources/Tropical_Beach_3k.hdr", true, &image);
-
-    //Create cubemaps and brdf lut
-    render::textureCubemapCreateFromEquirectangularImage(context, image, 2046u, true, &cubemap_);
-    render::diffuseConvolution(context, cubemap_, 64u, &irradianceMap_);
-    render::specularConvolution(context, cubemap_, 256u, 4u, &specularMap_);
-    render::brdfConvolution(context, 512u, &brdfLut_);
+    //Create cubemaps and brdf lut from the environment map
+    timer::time_point_t iblStart = timer::getCurrent();
+    render::iblCreate(context, "../resources/Tropical_Beach_3k.hdr", render::ibl_description_t(), gIBLCacheDirectory, &ibl_);
+    printf("Image based lighting maps created in %.2f ms\n", timer::getDifference(iblStart, timer::getCurrent()));
+    render::gpuBufferCreate(context, render::gpu_buffer_t::usage::UNIFORM_BUFFER, (void*)&ibl_.irradiance_, sizeof(ibl_.irradiance_), &allocator_, &irradianceUbo_);
 
     //Presentation descriptor set layout and pipeline layout
     bkk::render::descriptor_binding_t presentationBindings[4] = {
@@ -508,7 +521,7 @@ struct pbr_renderer_t : public application_t
       bkk::render::getDescriptor(globalsUbo_),
       bkk::render::getDescriptor(finalImage_),
       bkk::render::getDescriptor(gBufferRT1_),
-      bkk::render::getDescriptor(cubemap_)
+      bkk::render::getDescriptor(ibl_.environment_)
     };
 
     bkk::render::descriptorSetCreate(context, descriptorPool_, presentationDescriptorSetLayout_, &presentationDescriptors[0], &presentationDescriptorSet_);
@@ -757,10 +770,7 @@ struct pbr_renderer_t : public application_t
     render::textureDestroy(context, &gBufferRT1_);
     render::textureDestroy(context, &gBufferRT2_);
     render::textureDestroy(context, &finalImage_);
-    render::textureDestroy(context, &brdfLut_);
-    render::textureDestroy(context, &irradianceMap_);
-    render::textureDestroy(context, &specularMap_);
-    render::textureDestroy(context, &cubemap_);
+    render::iblDestroy(context, &ibl_);
 
     render::depthStencilBufferDestroy(context, &depthStencilBuffer_);
 
@@ -772,6 +782,7 @@ struct pbr_renderer_t : public application_t
     render::renderPassDestroy(context, &renderPass_);
     render::vertexFormatDestroy(&vertexFormat_);
     render::gpuBufferDestroy(context, &allocator_, &globalsUbo_);
+    render::gpuBufferDestroy(context, &allocator_, &irradianceUbo_);
     render::gpuAllocatorDestroy(context, &allocator_);
     render::descriptorPoolDestroy(context, &descriptorPool_);
     vkDestroySemaphore(context.device_, renderComplete_, nullptr);
@@ -886,7 +897,7 @@ private:
     bindings[0] = { render::descriptor_t::type::COMBINED_IMAGE_SAMPLER, 0, render::descriptor_t::stage::FRAGMENT };
     bindings[1] = { render::descriptor_t::type::COMBINED_IMAGE_SAMPLER, 1, render::descriptor_t::stage::FRAGMENT };
     bindings[2] = { render::descriptor_t::type::COMBINED_IMAGE_SAMPLER, 2, render::descriptor_t::stage::FRAGMENT };
-    bindings[3] = { render::descriptor_t::type::COMBINED_IMAGE_SAMPLER, 3, render::descriptor_t::stage::FRAGMENT };
+    bindings[3] = { render::descriptor_t::type::UNIFORM_BUFFER, 3, render::descriptor_t::stage::FRAGMENT };
     bindings[4] = { render::descriptor_t::type::COMBINED_IMAGE_SAMPLER, 4, render::descriptor_t::stage::FRAGMENT };
     bindings[5] = { render::descriptor_t::type::COMBINED_IMAGE_SAMPLER, 5, render::descriptor_t::stage::FRAGMENT };
     render::descriptorSetLayoutCreate(context, bindings, 3u, &lightPassTexturesDescriptorSetLayout_);
@@ -900,9 +911,9 @@ private:
     descriptors[0] = render::getDescriptor(gBufferRT0_);
     descriptors[1] = render::getDescriptor(gBufferRT1_);
     descriptors[2] = render::getDescriptor(gBufferRT2_);
-    descriptors[3] = render::getDescriptor(irradianceMap_);
-    descriptors[4] = render::getDescriptor(specularMap_);
-    descriptors[5] = render::getDescriptor(brdfLut_);
+    descriptors[3] = render::getDescriptor(irradianceUbo_);
+    descriptors[4] = render::getDescriptor(ibl_.specular_);
+    descriptors[5] = render::getDescriptor(ibl_.brdfLut_);
     render::descriptorSetCreate(context, descriptorPool_, lightPassTexturesDescriptorSetLayout_, descriptors, &lightPassTexturesDescriptorSet_);
     render::descriptorSetCreate(context, descriptorPool_, ambientLightPassTexturesDescriptorSetLayout_, descriptors, &ambientLightPassTexturesDescriptorSet_);
 
@@ -1086,10 +1097,8 @@ private:
   render::texture_t gBufferRT2_;  //F0 + metallic
   render::texture_t finalImage_;
   render::depth_stencil_buffer_t depthStencilBuffer_;
-  render::texture_cubemap_t cubemap_;
-  render::texture_cubemap_t irradianceMap_;
-  render::texture_cubemap_t specularMap_;
-  render::texture_t brdfLut_;
+  render::ibl_maps_t ibl_;
+  render::gpu_buffer_t irradianceUbo_;  //Spherical harmonics of the irradiance
 
   render::shader_t gBufferVertexShader_;
   render::shader_t gBufferFragmentShader_;
@@ -32,6 +32,15 @@
 #include "timer.h"
 #include "transform-manager.h"
 #include "packed-freelist.h"
+#include "thread-pool.h"
+#include "texture-cache.h"
+#include <unordered_map>
+
+//Textures not used by any material are evicted once the resident textures go over this size
+static const uint64_t gTextureCacheBudget = 256u * 1024u * 1024u;
+
+//Size of the staging ring used to upload the textures of a scene. Bigger maps get a staging buffer of their own
+static const uint64_t gUploadBatchStagingSize = 64u * 1024u * 1024u;
 
 static const char* gGeometryPassVertexShaderSource = R"(
   #version 440 core
@@ -380,8 +389,6 @@ static const char* gShadowPassVertexShaderSource = R"(
   #version 440 core
 
   layout(location = 0) in vec3 aPosition;
-  layout(location = 1) in vec3 aNormal;
-  layout(location = 2) in vec2 aUV;
 
   layout (set = 0, binding = 0) uniform LIGHT
   {
@@ -491,7 +498,7 @@ public:
 
     uniforms_t uniforms_;
     render::gpu_buffer_t ubo_;
-    render::texture_t diffuseMap_;
+    bkk::handle_t diffuseMap_;    //Texture in the texture cache
     render::descriptor_set_t descriptorSet_;
   };
 
@@ -522,6 +529,10 @@ public:
     //Create allocator for uniform buffers and meshes
     render::gpuAllocatorCreate(context, 100 * 1024 * 1024, 0xFFFF, render::gpu_memory_type_e::HOST_VISIBLE_COHERENT, &allocator_);
 
+    //Create geometry pool. All the meshes in the scene share the same vertex and index buffers
+    //The pool keeps a position stream for the shadow pass. Vertices are 32 bytes so up to 2M vertices (24MB of positions) fit in the pool
+    mesh::geometryPoolCreate(context, 64 * 1024 * 1024, 32 * 1024 * 1024, &geometryPool_, 24 * 1024 * 1024);
+
     //Create descriptor pool
     render::descriptorPoolCreate(context, 1000u,
       render::combined_image_sampler_count(1000u),
@@ -537,6 +548,10 @@ public:
     { render::vertex_attribute_t::format::VEC2, 2 * sizeof(maths::vec3), vertexSize, false } };
     render::vertexFormatCreate(attributes, 3u, &vertexFormat_);
 
+    //Position only vertex format for the shadow pass
+    render::vertex_attribute_t positionAttribute = { render::vertex_attribute_t::format::VEC3, 0, sizeof(maths::vec3), false };
+    render::vertexFormatCreate(&positionAttribute, 1u, &positionVertexFormat_);
+
     //Load full-screen quad and sphere meshes
     fullScreenQuad_ = mesh::fullScreenQuad(context);
     mesh::createFromFile(context, "../resources/sphere.obj", mesh::EXPORT_POSITION_ONLY, nullptr, 0u, &sphereMesh_);
@@ -552,6 +567,9 @@ public:
     render::texture2DCreate(context, &defaultImage, 1u, bkk::render::texture_sampler_t(), &defaultDiffuseMap_);
     delete[] defaultImage.data_;
 
+    //Textures shared between materials
+    render::textureCacheCreate(gTextureCacheBudget, &textureCache_);
+
 
     //Create globals uniform buffer
     camera_.position_ = vec3(-1.1f, 0.6f, -0.1f);
@@ -626,7 +644,8 @@ public:
     load(url);
   }
     
-  bkk::handle_t addMaterial(const vec3& albedo, float metallic, const vec3& F0, float roughness, std::string diffuseMap)
+  //diffuseMap is a texture in the texture cache. The material takes ownership of the reference
+  bkk::handle_t addMaterial(const vec3& albedo, float metallic, const vec3& F0, float roughness, bkk::handle_t diffuseMap)
   {
     render::context_t& context = getRenderContext();
 
@@ -642,18 +661,11 @@ public:
 
     render::descriptor_t descriptors[2] = { render::getDescriptor(material.ubo_),render::getDescriptor(defaultDiffuseMap_) };
 
-    material.diffuseMap_ = {};
-    if (!diffuseMap.empty())
+    material.diffuseMap_ = diffuseMap;
+    render::texture_t* texture = render::textureCacheGet(diffuseMap, &textureCache_);
+    if (texture)
     {
-      bkk::image::image2D_t image = {};
-      std::string path = "../resources/" + diffuseMap;
-      if (bkk::image::load(path.c_str(), true, &image))
-      {
-        //Create the texture
-        bkk::render::texture2DCreateAndGenerateMipmaps(context, image, bkk::render::texture_sampler_t(), &material.diffuseMap_);
-        bkk::image::unload(&image);
-        descriptors[1] = render::getDescriptor(material.diffuseMap_);
-      }
+      descriptors[1] = render::getDescriptor(*texture);
     }
 
     render::descriptorSetCreate(context, descriptorPool_, materialDescriptorSetLayout_, descriptors, &material.descriptorSet_);
@@ -827,7 +839,8 @@ public:
     packed_freelist_iterator_t<mesh::mesh_t> meshIter = mesh_.begin();
     while (meshIter != mesh_.end())
     {
-      mesh::destroy(context, &meshIter.get(), &allocator_);
+      //Meshes are created without an allocator, either in the pool or with their own buffers if the pool is full
+      mesh::destroy(context, &meshIter.get());
       ++meshIter;
     }
 
@@ -836,13 +849,11 @@ public:
     while (materialIter != material_.end())
     {
       render::gpuBufferDestroy(context, &allocator_, &materialIter.get().ubo_);
-      if (&materialIter.get().diffuseMap_.image_ != VK_NULL_HANDLE)
-      {
-        render::textureDestroy(context, &materialIter.get().diffuseMap_);
-      }
+      render::textureCacheRelease(context, materialIter.get().diffuseMap_, &textureCache_);
       render::descriptorSetDestroy(context, &materialIter.get().descriptorSet_);
       ++materialIter;
     }
+    render::textureCacheDestroy(context, &textureCache_);
 
     //Destroy object resources
     packed_freelist_iterator_t<object_t> objectIter = object_.begin();
@@ -929,8 +940,10 @@ public:
     render::renderPassDestroy(context, &renderPass_);    
 
     render::vertexFormatDestroy(&vertexFormat_);
+    render::vertexFormatDestroy(&positionVertexFormat_);
     render::gpuBufferDestroy(context, &allocator_, &globalsUbo_);
     render::gpuAllocatorDestroy(context, &allocator_);
+    mesh::geometryPoolDestroy(context, &geometryPool_);
     render::descriptorPoolDestroy(context, &descriptorPool_);
     render::semaphoreDestroy(context, renderComplete_);
   }
@@ -941,13 +954,16 @@ private:
   {
     render::context_t& context = getRenderContext();
 
-    //Meshes
+    //Meshes. Submeshes sharing a material are merged into a single mesh
     mesh::mesh_t* mesh = nullptr;
-    uint32_t meshCount = mesh::createFromFile(context, url, mesh::EXPORT_ALL, &allocator_, &mesh);
+    mesh::export_flags_e exportFlags = (mesh::export_flags_e)(mesh::EXPORT_ALL | mesh::EXPORT_MERGE_BY_MATERIAL | mesh::EXPORT_PRETRANSFORM);
+    uint32_t meshCount = mesh::createFromFileInPool(context, url, exportFlags, &geometryPool_, &mesh);
     std::vector<bkk::handle_t> meshHandles(meshCount);
+    std::vector<uint32_t> meshMaterial(meshCount);
     for (u32 i(0); i < meshCount; ++i)
     {
       meshHandles[i] = mesh_.add(mesh[i]);
+      meshMaterial[i] = mesh[i].materialIndex_;
     }
     delete[] mesh;
 
@@ -957,23 +973,78 @@ private:
     uint32_t materialCount = mesh::loadMaterials(url, &materialIndex, &materials);
     std::vector<bkk::handle_t> materialHandles(materialCount);
 
+    //Diffuse maps are decoded in parallel and each material is created as soon as its map is ready.
+    //Maps already in the texture cache, or used by several materials, are decoded only once
+    thread::thread_pool_t threadPool;
+    thread::poolCreate(0u, &threadPool);
+    image::decode_queue_t decodeQueue;
+    image::decodeQueueCreate(&threadPool, &decodeQueue);
+
     std::string modelPath = url;
     modelPath = modelPath.substr(0u, modelPath.find_last_of("/") + 1);
+    std::vector<std::string> decodePath;
+    std::vector<std::vector<u32>> decodeMaterials;
+    std::unordered_map<std::string, u32> pathToDecode;
     for (u32 i(0); i < materialCount; ++i)
     {
-      std::string diffuseMapPath = "";
+      bkk::handle_t diffuseMap = bkk::INVALID_ID;
       if (!materials[i].diffuseMap_.empty())
       {
-        diffuseMapPath = modelPath + materials[i].diffuseMap_;
+        std::string path = "../resources/" + modelPath + materials[i].diffuseMap_;
+        auto it = pathToDecode.find(path);
+        if (it != pathToDecode.end())
+        {
+          decodeMaterials[it->second].push_back(i);
+          continue;
+        }
+
+        diffuseMap = render::textureCacheFind(path.c_str(), &textureCache_);
+        if (render::textureCacheGet(diffuseMap, &textureCache_) == nullptr)
+        {
+          pathToDecode[path] = image::decodeQueueAdd(path.c_str(), true, &decodeQueue);
+          decodePath.push_back(path);
+          decodeMaterials.push_back(std::vector<u32>(1u, i));
+          continue;
+        }
+      }
+
+      materialHandles[i] = addMaterial(materials[i].kd_, 0.0f, vec3(0.1f, 0.1f, 0.1f), 0.5f, diffuseMap);
+    }
+
+    //Uploads are recorded in a single batch, reusing its staging memory, and submitted once all the maps have been decoded
+    render::upload_batch_t uploadBatch;
+    render::uploadBatchCreate(context, gUploadBatchStagingSize, &uploadBatch);
+    image::decode_result_t decoded;
+    while (image::decodeQueuePop(true, &decodeQueue, &decoded))
+    {
+      const std::vector<u32>& materialIndices = decodeMaterials[decoded.id_];
+      for (u32 j(0); j < materialIndices.size(); ++j)
+      {
+        //The first material adds the texture to the cache and the rest get a new reference to it
+        bkk::handle_t diffuseMap = bkk::INVALID_ID;
+        if (decoded.success_)
+        {
+          diffuseMap = render::textureCacheAdd(context, decodePath[decoded.id_].c_str(), decoded.image_, true, render::texture_sampler_t(), &uploadBatch, &textureCache_);
+        }
+
+        u32 i = materialIndices[j];
+        materialHandles[i] = addMaterial(materials[i].kd_, 0.0f, vec3(0.1f, 0.1f, 0.1f), 0.5f, diffuseMap);
       }
-      materialHandles[i] = addMaterial(materials[i].kd_, 0.0f, vec3(0.1f, 0.1f, 0.1f), 0.5f, diffuseMapPath);
+      image::unload(&decoded.image_);
     }
+    render::uploadBatchDestroy(context, &uploadBatch);
+
+    const render::texture_cache_stats_t& stats = textureCache_.stats_;
+    printf("Texture cache: %u hits, %u misses, %u textures resident (%.2f MB)\n", stats.hits_, stats.misses_, stats.residentTextures_, stats.residentBytes_ / (1024.0f * 1024.0f));
+
+    image::decodeQueueDestroy(&decodeQueue);
+    thread::poolDestroy(&threadPool);
     delete[] materials;
 
     //Objects
     for (u32 i(0); i < meshCount; ++i)
     {
-      addObject(meshHandles[i], materialHandles[materialIndex[i]], maths::createTransform(maths::vec3(0.0f, 0.0f, 0.0f), maths::vec3(0.001f, 0.001f, 0.001f), maths::QUAT_UNIT));
+      addObject(meshHandles[i], materialHandles[meshMaterial[i]], maths::createTransform(maths::vec3(0.0f, 0.0f, 0.0f), maths::vec3(0.001f, 0.001f, 0.001f), maths::QUAT_UNIT));
     }
 
     delete[] materialIndex;
@@ -1047,7 +1118,7 @@ private:
     shadowPipelineDesc.depthTestFunction_ = VK_COMPARE_OP_LESS_OR_EQUAL;
     shadowPipelineDesc.vertexShader_ = shadowVertexShader_;
     shadowPipelineDesc.fragmentShader_ = shadowFragmentShader_;
-    render::graphicsPipelineCreate(context, shadowRenderPass_.handle_, 0u, vertexFormat_, shadowPipelineLayout_, shadowPipelineDesc, &shadowPipeline_);
+    render::graphicsPipelineCreate(context, shadowRenderPass_.handle_, 0u, positionVertexFormat_, shadowPipelineLayout_, shadowPipelineDesc, &shadowPipeline_);
   }
 
   void initializeOffscreenPass(render::context_t& context, const uvec2& size)
@@ -1227,12 +1298,26 @@ private:
           //Shadow pass
           bkk::render::graphicsPipelineBind(shadowCommandBuffer_.handle_, shadowPipeline_);
           bkk::render::descriptorSetBindForGraphics(shadowCommandBuffer_.handle_, shadowPipelineLayout_, 0, &shadowGlobalsDescriptorSet_, 1u);
+          bool poolBound = false;
           packed_freelist_iterator_t<object_t> objectIter = object_.begin();
           while (objectIter != object_.end())
           {
             bkk::render::descriptorSetBindForGraphics(shadowCommandBuffer_.handle_, gBufferPipelineLayout_, 1, &objectIter.get().descriptorSet_, 1u);
             mesh::mesh_t* mesh = mesh_.get(objectIter.get().mesh_);
-            mesh::draw(shadowCommandBuffer_.handle_, *mesh);
+            if (mesh->pool_ == nullptr)
+            {
+              mesh::drawPositionStream(shadowCommandBuffer_.handle_, *mesh);
+              poolBound = false;
+            }
+            else
+            {
+              if (!poolBound)
+              {
+                mesh::geometryPoolBindPositionStream(shadowCommandBuffer_.handle_, geometryPool_);
+                poolBound = true;
+              }
+              mesh::drawFromPool(shadowCommandBuffer_.handle_, *mesh);
+            }
             ++objectIter;
           }
 
@@ -1269,13 +1354,28 @@ private:
         //GBuffer pass
         bkk::render::graphicsPipelineBind(commandBuffer_.handle_, gBufferPipeline_);
         bkk::render::descriptorSetBindForGraphics(commandBuffer_.handle_, gBufferPipelineLayout_, 0, &globalsDescriptorSet_, 1u);
+        bool poolBound = false;
         packed_freelist_iterator_t<object_t> objectIter = object_.begin();
         while (objectIter != object_.end())
         {
           bkk::render::descriptorSetBindForGraphics(commandBuffer_.handle_, gBufferPipelineLayout_, 1, &objectIter.get().descriptorSet_, 1u);
           bkk::render::descriptorSetBindForGraphics(commandBuffer_.handle_, gBufferPipelineLayout_, 2, &material_.get(objectIter.get().material_)->descriptorSet_, 1u);
           mesh::mesh_t* mesh = mesh_.get(objectIter.get().mesh_);
-          mesh::draw(commandBuffer_.handle_, *mesh);
+          if (mesh->pool_ == nullptr)
+          {
+            //Meshes that didn't fit in the pool bind their own buffers
+            mesh::draw(commandBuffer_.handle_, *mesh);
+            poolBound = false;
+          }
+          else
+          {
+            if (!poolBound)
+            {
+              mesh::geometryPoolBind(commandBuffer_.handle_, geometryPool_, vertexFormat_.bindingCount_);
+              poolBound = true;
+            }
+            mesh::drawFromPool(commandBuffer_.handle_, *mesh);
+          }
           ++objectIter;
         }
 
@@ -1330,11 +1430,13 @@ private:
  private:
   bkk::transform_manager_t transformManager_;
   render::gpu_memory_allocator_t allocator_;
+  mesh::geometry_pool_t geometryPool_;
 
   packed_freelist_t<object_t> object_;
   packed_freelist_t<material_t> material_;
   packed_freelist_t<mesh::mesh_t> mesh_;
   packed_freelist_t<point_light_t> pointLight_;
+  render::texture_cache_t textureCache_;
 
   render::descriptor_pool_t descriptorPool_;
   render::descriptor_set_layout_t globalsDescriptorSetLayout_;
@@ -1350,6 +1452,7 @@ private:
   render::descriptor_set_t lightPassTexturesDescriptorSet_;
 
   render::vertex_format_t vertexFormat_;
+  render::vertex_format_t positionVertexFormat_;
 
   render::pipeline_layout_t gBufferPipelineLayout_;
   render::graphics_pipeline_t gBufferPipeline_;
@@ -27,9 +27,13 @@
 #include "window.h"
 #include "image.h"
 #include "mesh.h"
+#include "gpu-animator.h"
 #include "maths.h"
 #include "timer.h"
 #include "camera.h"
+#include "thread-pool.h"
+
+#include <vector>
 
 using namespace bkk;
 using namespace maths;
@@ -47,6 +51,8 @@ static const char* gVertexShaderSource = R"(
   {
     mat4 modelView;
     mat4 modelViewProjection;
+    uint boneCount;
+    uint crowdGridSize;
   }uniforms;
 
   layout(binding = 1)  readonly buffer BONESTX
@@ -63,16 +69,119 @@ static const char* gVertexShaderSource = R"(
 
   void main(void)
   {
-    mat4 transform = bonesTx.bones[int(aBonesId[0])] * aBonesWeight[0] +
-                     bonesTx.bones[int(aBonesId[1])] * aBonesWeight[1] +
-                     bonesTx.bones[int(aBonesId[2])] * aBonesWeight[2] +
-                     bonesTx.bones[int(aBonesId[3])] * aBonesWeight[3];
+    //Each instance has its own palette. Instances are placed in a grid
+    int firstBone = gl_InstanceIndex * int(uniforms.boneCount);
+    mat4 transform = bonesTx.bones[firstBone + int(aBonesId[0])] * aBonesWeight[0] +
+                     bonesTx.bones[firstBone + int(aBonesId[1])] * aBonesWeight[1] +
+                     bonesTx.bones[firstBone + int(aBonesId[2])] * aBonesWeight[2] +
+                     bonesTx.bones[firstBone + int(aBonesId[3])] * aBonesWeight[3];
+
+    float gridCenter = 0.5 * float(uniforms.crowdGridSize - 1u);
+    vec3 offset = vec3(float(uint(gl_InstanceIndex) % uniforms.crowdGridSize) - gridCenter, 0.0, float(uint(gl_InstanceIndex) / uniforms.crowdGridSize) - gridCenter) * 40.0;
 
     output_.normalViewSpace = normalize((mat4(inverse(transpose(uniforms.modelView * transform))) * vec4(aNormal,0.0)).xyz);
     output_.lightViewSpace = normalize((uniforms.modelView * vec4(normalize(vec3(0.0,0.0,1.0)),0.0)).xyz);
     output_.uv = aTexCoord;
 
-    gl_Position = uniforms.modelViewProjection * transform * vec4(aPosition,1.0);
+    gl_Position = uniforms.modelViewProjection * (transform * vec4(aPosition,1.0) + vec4(offset,0.0));
+  }
+)";
+
+//Vertex shader for a palette of dual quaternions (real part, dual part)
+static const char* gDualQuaternionVertexShaderSource = R"(
+  #version 440 core
+
+  layout(location = 0) in vec3 aPosition;
+  layout(location = 1) in vec3 aNormal;
+  layout(location = 2) in vec2 aTexCoord;
+  layout(location = 3) in vec4 aBonesWeight;
+  layout(location = 4) in vec4 aBonesId;
+
+  layout(binding = 0) uniform UNIFORMS
+  {
+    mat4 modelView;
+    mat4 modelViewProjection;
+    uint boneCount;
+    uint crowdGridSize;
+  }uniforms;
+
+  layout(std430, binding = 1)  readonly buffer BONESTX
+  {
+    mat2x4 bones[];
+  }bonesTx;
+
+  layout(location = 0) out OUTPUT
+  {
+    vec3 normalViewSpace;
+    vec3 lightViewSpace;
+    vec2 uv;
+  }output_;
+
+  vec3 rotate(vec4 q, vec3 v)
+  {
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+  }
+
+  void main(void)
+  {
+    //Blend the dual quaternions keeping all of them in the same hemisphere as the first one
+    mat2x4 bone0 = bonesTx.bones[int(aBonesId[0])];
+    mat2x4 dq = bone0 * aBonesWeight[0];
+    for (int i = 1; i < 4; ++i)
+    {
+      mat2x4 bone = bonesTx.bones[int(aBonesId[i])];
+      float weight = dot(bone0[0], bone[0]) < 0.0 ? -aBonesWeight[i] : aBonesWeight[i];
+      dq += bone * weight;
+    }
+
+    float invLength = 1.0 / length(dq[0]);
+    vec4 real = dq[0] * invLength;
+    vec4 dual = dq[1] * invLength;
+    vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+    vec3 position = rotate(real, aPosition) + translation;
+    vec3 normal = rotate(real, aNormal);
+
+    output_.normalViewSpace = normalize((uniforms.modelView * vec4(normal,0.0)).xyz);
+    output_.lightViewSpace = normalize((uniforms.modelView * vec4(normalize(vec3(0.0,0.0,1.0)),0.0)).xyz);
+    output_.uv = aTexCoord;
+
+    gl_Position = uniforms.modelViewProjection * vec4(position,1.0);
+  }
+)";
+
+//Vertex shader for vertices deformed by the compute pre-skinning pass
+static const char* gPreSkinnedVertexShaderSource = R"(
+  #version 440 core
+
+  layout(location = 0) in vec3 aPosition;
+  layout(location = 1) in vec3 aNormal;
+  layout(location = 2) in vec2 aTexCoord;
+
+  layout(binding = 0) uniform UNIFORMS
+  {
+    mat4 modelView;
+    mat4 modelViewProjection;
+    uint boneCount;
+    uint crowdGridSize;
+  }uniforms;
+
+  layout(location = 0) out OUTPUT
+  {
+    vec3 normalViewSpace;
+    vec3 lightViewSpace;
+    vec2 uv;
+  }output_;
+
+  void main(void)
+  {
+    float gridCenter = 0.5 * float(uniforms.crowdGridSize - 1u);
+    vec3 offset = vec3(float(uint(gl_InstanceIndex) % uniforms.crowdGridSize) - gridCenter, 0.0, float(uint(gl_InstanceIndex) / uniforms.crowdGridSize) - gridCenter) * 40.0;
+
+    output_.normalViewSpace = normalize((mat4(inverse(transpose(uniforms.modelView))) * vec4(aNormal,0.0)).xyz);
+    output_.lightViewSpace = normalize((uniforms.modelView * vec4(normalize(vec3(0.0,0.0,1.0)),0.0)).xyz);
+    output_.uv = aTexCoord;
+
+    gl_Position = uniforms.modelViewProjection * vec4(aPosition + offset, 1.0);
   }
 )";
 
@@ -98,31 +207,55 @@ static const char* gFragmentShaderSource = R"(
 )";
 
 
+//Characters per side of the grid when animating a crowd in the GPU
+static const u32 gCrowdGridSize = 8u;
+
+struct uniforms_t
+{
+  mat4 modelView_;
+  mat4 modelViewProjection_;
+  u32 boneCount_;
+  u32 crowdGridSize_;
+  u32 padding_[2];
+};
+
 class skinning_sample_t : public application_t
 {
 public:
-  skinning_sample_t()
+  skinning_sample_t(bool gpuCrowd, bool preSkinning, bool dualQuaternion)
   :application_t("Skinning", 1200u, 800u, 3u),
-   camera_(vec3(0.0f,0.0f,0.0f), 25.0f, vec2(0.8f, 0.0f), 0.01f)   
+   gpuCrowd_(gpuCrowd),
+   preSkinning_(preSkinning),
+   dualQuaternion_(dualQuaternion && !gpuCrowd && !preSkinning),
+   camera_(vec3(0.0f,0.0f,0.0f), gpuCrowd ? 250.0f : 25.0f, vec2(0.8f, 0.0f), 0.01f)
   {
     render::context_t& context = getRenderContext();
             
     projectionTx_ = perspectiveProjectionMatrix(1.5f, getWindow().width_ / (float)getWindow().height_, 1.0f, 1000.0f);
     modelTx_ = createTransform(vec3(0.0, -17.0, 0.0), VEC3_ONE, QUAT_UNIT);
 
+    //Create geometry and animator    
+    mesh::createFromFile(context, "../resources/mannequin/mannequin.fbx", (mesh::export_flags_e)(mesh::EXPORT_ALL | mesh::EXPORT_COMPRESS_ANIMATIONS), nullptr, 0u, &mesh_);
+    mesh::animatorCreate(context, mesh_, 0u, 1.0f, &animator_, dualQuaternion_ ? mesh::PALETTE_DUAL_QUATERNION : mesh::PALETTE_MATRIX);
+    for (u32 i(0); i<mesh_.animationCount_; ++i)
+    {
+      const mesh::compressed_animation_t& animation = mesh_.compressedAnimations_[i];
+      size_t uncompressedSize = sizeof(mesh::bone_transform_t) * animation.frameCount_ * animation.nodeCount_ + sizeof(u32) * animation.nodeCount_;
+      printf("Animation %u: %u frames, %u nodes. %zu bytes (%zu bytes uncompressed)\n", i, animation.frameCount_, animation.nodeCount_, mesh::animationGetSize(animation), uncompressedSize);
+    }
+
+    if (gpuCrowd_ || preSkinning_)
+    {
+      createGpuAnimation();
+    }
+
     //Create uniform buffer
-    mat4 matrices[2];
-    matrices[0] = modelTx_ * camera_.view_;
-    matrices[1] = matrices[0] * projectionTx_;
+    uniforms_t uniforms = getUniforms();
     render::gpuBufferCreate(context, render::gpu_buffer_t::usage::UNIFORM_BUFFER,
                             render::gpu_memory_type_e::HOST_VISIBLE_COHERENT,
-                            (void*)&matrices, sizeof(matrices) ,
+                            (void*)&uniforms, sizeof(uniforms),
                             nullptr, &globalUnifomBuffer_);
 
-    //Create geometry and animator    
-    mesh::createFromFile(context, "../resources/mannequin/mannequin.fbx", mesh::EXPORT_ALL, nullptr, 0u, &mesh_);
-    mesh::animatorCreate(context, mesh_, 0u, 1.0f, &animator_);
-
     //Load texture
     bkk::image::image2D_t image = {};
     if (!bkk::image::load("../resources/mannequin/diffuse.jpg", false, &image))
@@ -153,11 +286,12 @@ public:
       render::storage_image_count(0u),
       &descriptorPool_);
 
-    render::descriptor_t descriptors[3] = { render::getDescriptor(globalUnifomBuffer_), render::getDescriptor(animator_.buffer_), render::getDescriptor( texture_) };
+    render::gpu_buffer_t& palette = gpuCrowd_ ? gpuAnimator_.paletteBuffer_ : animator_.buffer_;
+    render::descriptor_t descriptors[3] = { render::getDescriptor(globalUnifomBuffer_), render::getDescriptor(palette), render::getDescriptor( texture_) };
     render::descriptorSetCreate(context, descriptorPool_, descriptorSetLayout_, descriptors, &descriptorSet_);
 
     //Create pipeline
-    bkk::render::shaderCreateFromGLSLSource(context, bkk::render::shader_t::VERTEX_SHADER, gVertexShaderSource, &vertexShader_);
+    bkk::render::shaderCreateFromGLSLSource(context, bkk::render::shader_t::VERTEX_SHADER, preSkinning_ ? gPreSkinnedVertexShaderSource : dualQuaternion_ ? gDualQuaternionVertexShaderSource : gVertexShaderSource, &vertexShader_);
     bkk::render::shaderCreateFromGLSLSource(context, bkk::render::shader_t::FRAGMENT_SHADER, gFragmentShaderSource, &fragmentShader_);
     bkk::render::graphics_pipeline_t::description_t pipelineDesc;
     pipelineDesc.viewPort_ = { 0.0f, 0.0f, (float)context.swapChain_.imageWidth_, (float)context.swapChain_.imageHeight_, 0.0f, 1.0f };
@@ -171,17 +305,107 @@ public:
     pipelineDesc.depthTestFunction_ = VK_COMPARE_OP_LESS_OR_EQUAL;
     pipelineDesc.vertexShader_ = vertexShader_;
     pipelineDesc.fragmentShader_ = fragmentShader_;
-    render::graphicsPipelineCreate(context, context.swapChain_.renderPass_, 0u, mesh_.vertexFormat_, pipelineLayout_, pipelineDesc, &pipeline_);
+    const render::vertex_format_t& vertexFormat = preSkinning_ ? gpuSkinning_.vertexFormat_ : mesh_.vertexFormat_;
+    render::graphicsPipelineCreate(context, context.swapChain_.renderPass_, 0u, vertexFormat, pipelineLayout_, pipelineDesc, &pipeline_);
 
     buildCommandBuffers();
   }
 
+  //Animates 'characterCount' characters sharing the mesh and its skeleton, and reports throughput of the batched update
+  void benchmark(u32 characterCount)
+  {
+    render::context_t& context = getRenderContext();
+    thread::thread_pool_t threadPool;
+    thread::poolCreate(0u, &threadPool);
+
+    //Each character has its own playback speed and start time
+    std::vector<mesh::skeletal_animator_t> animator(characterCount);
+    std::vector<mesh::skeletal_animator_t*> animatorPtr(characterCount);
+    for (u32 i(0); i<characterCount; ++i)
+    {
+      mesh::animatorCreate(context, mesh_, 0u, 0.5f + (i % 16) / 16.0f, &animator[i]);
+      animator[i].cursor_ = (i % 97) / 97.0f;
+      animatorPtr[i] = &animator[i];
+    }
+
+    const u32 frameCount = 100u;
+    timer::time_point_t start = timer::getCurrent();
+    for (u32 frame(0); frame<frameCount; ++frame)
+    {
+      for (u32 i(0); i<characterCount; ++i)
+      {
+        mesh::animatorUpdate(context, 16.0f, &animator[i]);
+      }
+    }
+    f32 elapsed = timer::getDifference(start, timer::getCurrent()) / frameCount;
+    printf("animatorUpdate (%u characters): %.3f ms per frame, %.1f characters/ms\n", characterCount, elapsed, characterCount / elapsed);
+
+    mesh::animator_batch_t batch;
+    mesh::animatorBatchCreate(context, animatorPtr.data(), characterCount, &batch);
+    thread::thread_pool_t* pool[] = { nullptr, &threadPool };
+    for (u32 p(0); p<2; ++p)
+    {
+      start = timer::getCurrent();
+      for (u32 frame(0); frame<frameCount; ++frame)
+      {
+        mesh::animatorBatchUpdate(16.0f, pool[p], &batch);
+      }
+      elapsed = timer::getDifference(start, timer::getCurrent()) / frameCount;
+      u32 threadCount = pool[p] ? thread::poolGetThreadCount(pool[p]) + 1 : 1u;
+      printf("animatorBatchUpdate (%u characters, %u threads): %.3f ms per frame, %.1f characters/ms\n", characterCount, threadCount, elapsed, characterCount / elapsed);
+    }
+
+    //Same batch with animation level of detail. Characters are placed in a grid in front of the camera,
+    //40 units apart, and their level of detail is selected from their screen size
+    mesh::animator_lod_policy_t lodPolicy;
+    u32 gridSize = (u32)ceilf(sqrtf((f32)characterCount));
+    u32 lodCount[4] = {};
+    for (u32 i(0); i<characterCount; ++i)
+    {
+      vec3 center((i % gridSize) * 40.0f - gridSize * 20.0f, 0.0f, -(f32)(i / gridSize) * 40.0f);
+      f32 screenSize = mesh::animatorScreenSize(center, 20.0f, camera_.view_, projectionTx_);
+      mesh::animatorSetLod(lodPolicy, screenSize, &animator[i]);
+      lodCount[animator[i].lod_]++;
+    }
+
+    start = timer::getCurrent();
+    for (u32 frame(0); frame<frameCount; ++frame)
+    {
+      mesh::animatorBatchUpdate(16.0f, &threadPool, &batch);
+    }
+    elapsed = timer::getDifference(start, timer::getCurrent()) / frameCount;
+    printf("animatorBatchUpdate with lod (%u full, %u reduced rate, %u reduced bones, %u frozen): %.3f ms per frame, %.1f characters/ms\n",
+      lodCount[0], lodCount[1], lodCount[2], lodCount[3], elapsed, characterCount / elapsed);
+
+    mesh::animatorBatchDestroy(context, &batch);
+    for (u32 i(0); i<characterCount; ++i)
+    {
+      mesh::animatorDestroy(context, &animator[i]);
+    }
+    thread::poolDestroy(&threadPool);
+  }
+
   void onQuit()
   {    
     render::context_t& context = getRenderContext();
 
     mesh::destroy(context, &mesh_);
     mesh::animatorDestroy(context, &animator_);
+    if (gpuCrowd_)
+    {
+      mesh::gpuAnimatorDestroy(context, &gpuAnimator_);
+    }
+
+    if (preSkinning_)
+    {
+      mesh::gpuSkinningDestroy(context, &gpuSkinning_);
+    }
+
+    if (gpuCrowd_ || preSkinning_)
+    {
+      render::commandBufferDestroy(context, &animationCommandBuffer_);
+      render::semaphoreDestroy(context, animationComplete_);
+    }
        
     render::shaderDestroy(context, &vertexShader_);
     render::shaderDestroy(context, &fragmentShader_);
@@ -200,16 +424,30 @@ public:
     render::context_t& context = getRenderContext();
 
     //Update uniform buffer
-    mat4 matrices[2];
-    matrices[0] = modelTx_ * camera_.view_;
-    matrices[1] = matrices[0] * projectionTx_;
-    render::gpuBufferUpdate(context, (void*)&matrices, 0, sizeof(matrices), &globalUnifomBuffer_);
+    uniforms_t uniforms = getUniforms();
+    render::gpuBufferUpdate(context, (void*)&uniforms, 0, sizeof(uniforms), &globalUnifomBuffer_);
     
-    //Update animator
-    mesh::animatorUpdate(context, getTimeDelta(), &animator_);
+    if (gpuCrowd_)
+    {
+      //Only the cursors are updated in the CPU. Palettes are computed in the GPU
+      mesh::gpuAnimatorUpdate(getTimeDelta(), crowdSpeed_.data(), &gpuAnimator_);
+    }
+    else
+    {
+      //Update animator
+      mesh::animatorUpdate(context, getTimeDelta(), &animator_);
+    }
 
     //Render frame
-    render::presentFrame(&context);
+    if (gpuCrowd_ || preSkinning_)
+    {
+      render::commandBufferSubmit(context, animationCommandBuffer_);
+      render::presentFrame(&context, &animationComplete_, 1u);
+    }
+    else
+    {
+      render::presentFrame(&context);
+    }
   }
   
   void onResize(u32 width, u32 height) 
@@ -266,17 +504,88 @@ public:
       render::beginPresentationCommandBuffer(context, i, clearValues);
       bkk::render::graphicsPipelineBind(commandBuffers[i], pipeline_);
       bkk::render::descriptorSetBindForGraphics(commandBuffers[i], pipelineLayout_, 0, &descriptorSet_, 1u);
-      mesh::draw(commandBuffers[i], mesh_);
+      u32 characterCount = gpuCrowd_ ? gCrowdGridSize * gCrowdGridSize : 1u;
+      if (preSkinning_)
+      {
+        for (u32 character(0); character<characterCount; ++character)
+        {
+          mesh::drawSkinned(commandBuffers[i], mesh_, gpuSkinning_, character);
+        }
+      }
+      else
+      {
+        mesh::drawInstanced(commandBuffers[i], characterCount, nullptr, 0u, mesh_);
+      }
       render::endPresentationCommandBuffer(context, i);
     }
   }
 
 private:
+
+  uniforms_t getUniforms()
+  {
+    uniforms_t uniforms;
+    uniforms.modelView_ = modelTx_ * camera_.view_;
+    uniforms.modelViewProjection_ = uniforms.modelView_ * projectionTx_;
+    uniforms.boneCount_ = mesh_.skeleton_->boneCount_;
+    uniforms.crowdGridSize_ = gpuCrowd_ ? gCrowdGridSize : 1u;
+    return uniforms;
+  }
+
+  //Creates the gpu animator for the crowd and/or the pre-skinning pass, and a command buffer with the compute work
+  //to execute before rendering each frame
+  void createGpuAnimation()
+  {
+    render::context_t& context = getRenderContext();
+
+    u32 characterCount = 1u;
+    if (gpuCrowd_)
+    {
+      characterCount = gCrowdGridSize * gCrowdGridSize;
+      mesh::gpuAnimatorCreate(context, mesh_, characterCount, &gpuAnimator_);
+      crowdSpeed_.resize(characterCount);
+      for (u32 i(0); i<characterCount; ++i)
+      {
+        crowdSpeed_[i] = 0.5f + (i % 16) / 16.0f;
+        gpuAnimator_.instance_[i].animation_ = i % mesh_.animationCount_;
+        gpuAnimator_.instance_[i].cursor_ = (i % 7) / 7.0f;
+      }
+    }
+
+    if (preSkinning_)
+    {
+      mesh::gpuSkinningCreate(context, mesh_, gpuCrowd_ ? gpuAnimator_.paletteBuffer_ : animator_.buffer_, characterCount, &gpuSkinning_);
+    }
+
+    animationComplete_ = render::semaphoreCreate(context);
+    render::commandBufferCreate(context, VK_COMMAND_BUFFER_LEVEL_PRIMARY, nullptr, nullptr, 0u, &animationComplete_, 1u, render::command_buffer_t::GRAPHICS, &animationCommandBuffer_);
+    render::commandBufferBegin(context, animationCommandBuffer_);
+    if (gpuCrowd_)
+    {
+      mesh::gpuAnimatorDispatch(animationCommandBuffer_.handle_, gpuAnimator_);
+    }
+
+    if (preSkinning_)
+    {
+      mesh::gpuSkinningDispatch(animationCommandBuffer_.handle_, gpuSkinning_);
+    }
+    render::commandBufferEnd(animationCommandBuffer_);
+  }
   
   render::gpu_buffer_t globalUnifomBuffer_;
 
   mesh::mesh_t mesh_;
   mesh::skeletal_animator_t animator_;  
+
+  bool gpuCrowd_;
+  bool preSkinning_;
+  bool dualQuaternion_;
+  mesh::gpu_animator_t gpuAnimator_;
+  mesh::gpu_skinning_t gpuSkinning_;
+  std::vector<f32> crowdSpeed_;
+  render::command_buffer_t animationCommandBuffer_;
+  VkSemaphore animationComplete_;
+
   render::texture_t texture_;
 
   render::pipeline_layout_t pipelineLayout_;
@@ -295,9 +604,31 @@ private:
 };
 
 //Entry point
-int main()
+int main(int argc, char** argv)
 {
-  skinning_sample_t sample;
+  //Options:
+  //  -crowd      Animate a crowd of characters in the GPU
+  //  -preskin    Deform the vertices in a compute pass instead of in the vertex shader
+  //  -dq         Skin with a dual quaternion palette (ignored with -crowd and -preskin)
+  //  -benchmark  Measure animation throughput before starting the sample
+  bool gpuCrowd = false;
+  bool preSkinning = false;
+  bool dualQuaternion = false;
+  bool benchmark = false;
+  for (int i(1); i<argc; ++i)
+  {
+    gpuCrowd |= strcmp(argv[i], "-crowd") == 0;
+    preSkinning |= strcmp(argv[i], "-preskin") == 0;
+    dualQuaternion |= strcmp(argv[i], "-dq") == 0;
+    benchmark |= strcmp(argv[i], "-benchmark") == 0;
+  }
+
+  skinning_sample_t sample(gpuCrowd, preSkinning, dualQuaternion);
+  if (benchmark)
+  {
+    sample.benchmark(1024u);
+  }
+
   sample.loop();
   return 0;
 }
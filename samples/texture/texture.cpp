@@ -28,6 +28,10 @@
 #include "image.h"
 #include "mesh.h"
 #include "camera.h"
+#include "block-compression.h"
+#include "thread-pool.h"
+#include "texture-streamer.h"
+#include <cstring>
 
 static const char* gVertexShaderSource = R"(
   #version 440 core
@@ -58,21 +62,38 @@ static const char* gFragmentShaderSource = R"(
 )";
 
 
-bkk::render::texture_t createTexture(const bkk::render::context_t& context)
+bkk::render::texture_t createTexture(const bkk::render::context_t& context, bool blockCompression)
 {
   bkk::render::texture_t texture;
+  if (!blockCompression)
+  {
+    //The image is decoded directly in the staging buffer of the texture
+    if (!bkk::render::texture2DCreate(context, "../resources/brokkr.png", false, bkk::render::texture_sampler_t(), &texture))
+    {
+      printf("Error loading texture\n");
+    }
+
+    return texture;
+  }
+
   bkk::image::image2D_t image = {};
   if (!bkk::image::load("../resources/brokkr.png", false, &image))
   {
     printf("Error loading texture\n");
-  }
-  else
-  {
-    //Create the texture
-    bkk::render::texture2DCreate(context, &image, 1, bkk::render::texture_sampler_t(), &texture);
-    bkk::image::unload(&image);
+    return texture;
   }
 
+  //Compress the image in the workers of a thread pool
+  bkk::thread::thread_pool_t threadPool;
+  bkk::thread::poolCreate(0u, &threadPool);
+  uint32_t uncompressedSize = image.dataSize_;
+  bkk::image::compression_e compression = bkk::image::compressionSelect(image, false);
+  bkk::image::compress(image, compression, bkk::image::COMPRESSION_QUALITY_HIGH, &threadPool, &image);
+  bkk::thread::poolDestroy(&threadPool);
+  printf("Texture compressed from %u to %u bytes\n", uncompressedSize, image.dataSize_);
+
+  bkk::render::texture2DCreate(context, &image, 1, bkk::render::texture_sampler_t(), &texture);
+  bkk::image::unload(&image);
   return texture;
 }
 
@@ -92,7 +113,10 @@ void buildCommandBuffers(const bkk::render::context_t& context,const bkk::mesh::
   }
 }
 
-int main()
+//Options:
+//  -bc       Use a block compressed texture, if the device supports BC formats
+//  -stream   Create the texture with its smallest levels and stream in the rest, one level per frame
+int main(int argc, char** argv)
 {
   //Create a window
   bkk::window::window_t window;
@@ -104,7 +128,44 @@ int main()
 
   //Create a quad and a texture
   bkk::mesh::mesh_t mesh = bkk::mesh::fullScreenQuad(context);
-  bkk::render::texture_t texture = createTexture(context);
+  bool blockCompression = false;
+  bool streaming = false;
+  for (int i(1); i<argc; ++i)
+  {
+    blockCompression |= strcmp(argv[i], "-bc") == 0;
+    streaming |= strcmp(argv[i], "-stream") == 0;
+  }
+
+  bkk::render::texture_t texture = {};
+  bkk::render::texture_streamer_t streamer;
+  bkk::handle_t streamedTexture = bkk::INVALID_ID;
+  if (streaming)
+  {
+    bkk::render::textureStreamerCreate(context, 16u, 4u * 1024u * 1024u, context.swapChain_.imageCount_, &streamer);
+    streamedTexture = bkk::render::textureStreamerAdd(context, "../resources/brokkr.png", false, bkk::render::texture_sampler_t(), &streamer);
+    bkk::render::texture_t* streamedTextureData = bkk::render::textureStreamerGet(streamedTexture, &streamer);
+    if (streamedTextureData)
+    {
+      texture = *streamedTextureData;
+    }
+    else
+    {
+      //The image can't be streamed. Fall back to a regular texture
+      bkk::render::textureStreamerDestroy(context, &streamer);
+      streaming = false;
+    }
+  }
+
+  if (!streaming)
+  {
+    if (blockCompression && !context.enabledFeatures_.textureCompressionBC)
+    {
+      printf("The device doesn't support BC formats. Using an uncompressed texture\n");
+      blockCompression = false;
+    }
+
+    texture = createTexture(context, blockCompression);
+  }
 
   //Create descriptor pool
   bkk::render::descriptor_pool_t descriptorPool;
@@ -171,6 +232,19 @@ int main()
       }
     }
 
+    if (streaming)
+    {
+      //The quad covers the whole window
+      bkk::render::textureStreamerSetScreenSize(streamedTexture, (float)bkk::maths::maxValue(context.swapChain_.imageWidth_, context.swapChain_.imageHeight_), &streamer);
+      if (bkk::render::textureStreamerUpdate(context, &streamer) > 0u)
+      {
+        //Point the descriptor set to the new view. presentFrame waits for the frame to finish, so the descriptor set is not in use
+        descriptorSet.descriptors_[0] = bkk::render::getDescriptor(*bkk::render::textureStreamerGet(streamedTexture, &streamer));
+        bkk::render::descriptorSetUpdate(context, descriptorSetLayout, &descriptorSet);
+        buildCommandBuffers(context, mesh, &descriptorSet, &pipelineLayout, &pipeline);
+      }
+    }
+
     bkk::render::presentFrame(&context);
   }
 
@@ -179,7 +253,14 @@ int main()
 
   //Destroy all resources
   bkk::mesh::destroy(context, &mesh);
-  bkk::render::textureDestroy(context, &texture);
+  if (streaming)
+  {
+    bkk::render::textureStreamerDestroy(context, &streamer);
+  }
+  else
+  {
+    bkk::render::textureDestroy(context, &texture);
+  }
 
   bkk::render::shaderDestroy(context, &vertexShader);
   bkk::render::shaderDestroy(context, &fragmentShader);
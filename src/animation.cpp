@@ -0,0 +1,313 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "animation.h"
+#include "mesh.h"
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+using namespace bkk;
+using namespace bkk::mesh;
+using namespace bkk::maths;
+
+//Helper functions
+static quat Nlerp(const quat& q0, const quat& q1, f32 t)
+{
+  quat result = q0 * (1.0f - t) + q1 * t;
+  result.normalize();
+  return result;
+}
+
+static f32 OrientationError(const quat& q0, const quat& q1)
+{
+  f32 cosHalfAngle = fabsf(q0.x * q1.x + q0.y * q1.y + q0.z * q1.z + q0.w * q1.w);
+  return 2.0f * acosf(maths::minValue(cosHalfAngle, 1.0f));
+}
+
+static u16 QuantizeUnsigned(f32 value)
+{
+  return (u16)(maths::minValue(maths::maxValue(value, 0.0f), 1.0f) * 65535.0f + 0.5f);
+}
+
+static u16 QuantizeSigned(f32 value)
+{
+  return (u16)(s16)floorf(maths::minValue(maths::maxValue(value, -1.0f), 1.0f) * 32767.0f + 0.5f);
+}
+
+static f32 DequantizeSigned(u16 value)
+{
+  return (f32)(s16)value / 32767.0f;
+}
+
+//Selects the frames to keep so that interpolating between them reproduces every frame of the track within 'tolerance'
+template <typename T, typename Interpolate, typename Error>
+static void ReduceKeys(const std::vector<T>& values, f32 tolerance, Interpolate interpolate, Error error, std::vector<u32>* keys)
+{
+  keys->clear();
+  keys->push_back(0u);
+
+  //Constant tracks only need one key
+  u32 frameCount = (u32)values.size();
+  bool constant = true;
+  for (u32 i(1); i<frameCount && constant; ++i)
+  {
+    constant = error(values[0], values[i]) <= tolerance;
+  }
+
+  if (constant)
+  {
+    return;
+  }
+
+  //Extend the segment starting at the last key while all the frames it skips can be interpolated
+  u32 lastKey = 0u;
+  for (u32 frame(2); frame<frameCount; ++frame)
+  {
+    for (u32 i(lastKey + 1); i<frame; ++i)
+    {
+      f32 t = (f32)(i - lastKey) / (f32)(frame - lastKey);
+      if (error(interpolate(values[lastKey], values[frame], t), values[i]) > tolerance)
+      {
+        lastKey = frame - 1;
+        keys->push_back(lastKey);
+        break;
+      }
+    }
+  }
+  keys->push_back(frameCount - 1);
+}
+
+//Finds the key preceding 'frame' in the track and the interpolation factor between that key and the next one
+static u32 FindKey(const compressed_animation_t& animation, const compressed_track_t& track, f32 frame, f32* t)
+{
+  const u16* firstKey = animation.keyFrame_ + track.firstKey_;
+  const u16* lastKey = firstKey + track.keyCount_;
+  const u16* nextKey = std::upper_bound(firstKey + 1, lastKey, frame, [](f32 value, u16 keyFrame) { return value < (f32)keyFrame; });
+  if (nextKey == lastKey)
+  {
+    *t = 0.0f;
+    return track.keyCount_ - 1;
+  }
+
+  u32 key = (u32)(nextKey - firstKey) - 1;
+  *t = (frame - firstKey[key]) / (f32)(firstKey[key + 1] - firstKey[key]);
+  return key;
+}
+
+static vec3 DecodeVector(const compressed_animation_t& animation, const compressed_track_t& track, u32 key)
+{
+  const u16* value = animation.keyValue_ + track.firstValue_ + key * 3;
+  return vec3(track.min_[0] + track.extent_[0] * (value[0] / 65535.0f),
+              track.min_[1] + track.extent_[1] * (value[1] / 65535.0f),
+              track.min_[2] + track.extent_[2] * (value[2] / 65535.0f));
+}
+
+static quat DecodeOrientation(const compressed_animation_t& animation, const compressed_track_t& track, u32 key)
+{
+  const u16* value = animation.keyValue_ + track.firstValue_ + key * 4;
+  quat result(DequantizeSigned(value[0]), DequantizeSigned(value[1]), DequantizeSigned(value[2]), DequantizeSigned(value[3]));
+  result.normalize();
+  return result;
+}
+
+static vec3 SampleVector(const compressed_animation_t& animation, const compressed_track_t& track, f32 frame)
+{
+  if (track.keyCount_ == 1)
+  {
+    return DecodeVector(animation, track, 0u);
+  }
+
+  f32 t;
+  u32 key = FindKey(animation, track, frame, &t);
+  return (t > 0.0f) ? maths::lerp(DecodeVector(animation, track, key), DecodeVector(animation, track, key + 1), t) : DecodeVector(animation, track, key);
+}
+
+static quat SampleOrientation(const compressed_animation_t& animation, const compressed_track_t& track, f32 frame)
+{
+  if (track.keyCount_ == 1)
+  {
+    return DecodeOrientation(animation, track, 0u);
+  }
+
+  f32 t;
+  u32 key = FindKey(animation, track, frame, &t);
+  return (t > 0.0f) ? Nlerp(DecodeOrientation(animation, track, key), DecodeOrientation(animation, track, key + 1), t) : DecodeOrientation(animation, track, key);
+}
+
+//Adds the keys of a position or scale track, quantized to the range of values of the track
+static void AddVectorTrack(const std::vector<vec3>& values, f32 tolerance, std::vector<u32>& keys, std::vector<u16>* keyFrame, std::vector<u16>* keyValue, compressed_track_t* track)
+{
+  ReduceKeys(values, tolerance,
+    [](const vec3& v0, const vec3& v1, f32 t) { return maths::lerp(v0, v1, t); },
+    [](const vec3& v0, const vec3& v1) { return maths::length(v1 - v0); },
+    &keys);
+
+  vec3 rangeMin = values[keys[0]];
+  vec3 rangeMax = values[keys[0]];
+  for (u32 i(1); i<keys.size(); ++i)
+  {
+    const vec3& value = values[keys[i]];
+    rangeMin = vec3(maths::minValue(rangeMin.x, value.x), maths::minValue(rangeMin.y, value.y), maths::minValue(rangeMin.z, value.z));
+    rangeMax = vec3(maths::maxValue(rangeMax.x, value.x), maths::maxValue(rangeMax.y, value.y), maths::maxValue(rangeMax.z, value.z));
+  }
+
+  track->firstKey_ = (u32)keyFrame->size();
+  track->keyCount_ = (u32)keys.size();
+  track->firstValue_ = (u32)keyValue->size();
+  for (u32 c(0); c<3; ++c)
+  {
+    track->min_[c] = rangeMin[c];
+    track->extent_[c] = rangeMax[c] - rangeMin[c];
+  }
+
+  for (u32 i(0); i<keys.size(); ++i)
+  {
+    keyFrame->push_back((u16)keys[i]);
+    for (u32 c(0); c<3; ++c)
+    {
+      f32 value = values[keys[i]][c];
+      keyValue->push_back(track->extent_[c] > 0.0f ? QuantizeUnsigned((value - track->min_[c]) / track->extent_[c]) : 0u);
+    }
+  }
+}
+
+
+/*********************
+* API Implementation
+**********************/
+
+void mesh::animationCompress(const skeletal_animation_t& animation, const animation_compression_settings_t& settings, compressed_animation_t* compressedAnimation)
+{
+  //Key frames are stored in 16 bits
+  assert(animation.frameCount_ <= 65536);
+
+  u32 frameCount = animation.frameCount_;
+  u32 nodeCount = animation.nodeCount_;
+  compressedAnimation->frameCount_ = frameCount;
+  compressedAnimation->nodeCount_ = nodeCount;
+  compressedAnimation->duration_ = animation.duration_;
+  compressedAnimation->nodes_ = new u32[nodeCount];
+  std::copy(animation.nodes_, animation.nodes_ + nodeCount, compressedAnimation->nodes_);
+  compressedAnimation->tracks_ = new compressed_track_t[nodeCount * 3];
+
+  std::vector<u16> keyFrame;
+  std::vector<u16> keyValue;
+  std::vector<u32> keys;
+  std::vector<vec3> vectors(frameCount);
+  std::vector<quat> orientations(frameCount);
+  for (u32 node(0); node<nodeCount; ++node)
+  {
+    compressed_track_t* track = compressedAnimation->tracks_ + node * 3;
+
+    //Position
+    for (u32 frame(0); frame<frameCount; ++frame)
+    {
+      vectors[frame] = animation.data_[frame * nodeCount + node].position_;
+    }
+    AddVectorTrack(vectors, settings.positionTolerance_, keys, &keyFrame, &keyValue, &track[0]);
+
+    //Scale
+    for (u32 frame(0); frame<frameCount; ++frame)
+    {
+      vectors[frame] = animation.data_[frame * nodeCount + node].scale_;
+    }
+    AddVectorTrack(vectors, settings.scaleTolerance_, keys, &keyFrame, &keyValue, &track[1]);
+
+    //Orientation. Consecutive frames are kept in the same hemisphere so linear interpolation takes the shortest path
+    for (u32 frame(0); frame<frameCount; ++frame)
+    {
+      quat orientation = animation.data_[frame * nodeCount + node].orientation_;
+      orientation.normalize();
+      if (frame > 0 && dot(orientation.AsVec4(), orientations[frame - 1].AsVec4()) < 0.0f)
+      {
+        orientation = -orientation;
+      }
+      orientations[frame] = orientation;
+    }
+
+    ReduceKeys(orientations, settings.orientationTolerance_, Nlerp, OrientationError, &keys);
+    track[2].firstKey_ = (u32)keyFrame.size();
+    track[2].keyCount_ = (u32)keys.size();
+    track[2].firstValue_ = (u32)keyValue.size();
+    for (u32 i(0); i<keys.size(); ++i)
+    {
+      const quat& orientation = orientations[keys[i]];
+      keyFrame.push_back((u16)keys[i]);
+      keyValue.push_back(QuantizeSigned(orientation.x));
+      keyValue.push_back(QuantizeSigned(orientation.y));
+      keyValue.push_back(QuantizeSigned(orientation.z));
+      keyValue.push_back(QuantizeSigned(orientation.w));
+    }
+  }
+
+  compressedAnimation->keyCount_ = (u32)keyFrame.size();
+  compressedAnimation->keyValueCount_ = (u32)keyValue.size();
+  compressedAnimation->keyFrame_ = new u16[keyFrame.size()];
+  compressedAnimation->keyValue_ = new u16[keyValue.size()];
+  std::copy(keyFrame.begin(), keyFrame.end(), compressedAnimation->keyFrame_);
+  std::copy(keyValue.begin(), keyValue.end(), compressedAnimation->keyValue_);
+}
+
+void mesh::animationDestroy(compressed_animation_t* animation)
+{
+  delete[] animation->nodes_;
+  delete[] animation->tracks_;
+  delete[] animation->keyFrame_;
+  delete[] animation->keyValue_;
+  animation->nodes_ = nullptr;
+  animation->tracks_ = nullptr;
+  animation->keyFrame_ = nullptr;
+  animation->keyValue_ = nullptr;
+}
+
+void mesh::animationSample(const compressed_animation_t& animation, f32 cursor, bone_transform_t* transforms, const u32* nodeDepth, u32 maxNodeDepth)
+{
+  f32 frame = maths::minValue(maths::maxValue(cursor, 0.0f), 1.0f) * (f32)(maths::maxValue(animation.frameCount_, 1u) - 1u);
+  for (u32 node(0); node<animation.nodeCount_; ++node)
+  {
+    if (nodeDepth && nodeDepth[animation.nodes_[node]] > maxNodeDepth)
+    {
+      continue;
+    }
+
+    const compressed_track_t* track = animation.tracks_ + node * 3;
+    transforms[node].position_ = SampleVector(animation, track[0], frame);
+    transforms[node].scale_ = SampleVector(animation, track[1], frame);
+    transforms[node].orientation_ = SampleOrientation(animation, track[2], frame);
+  }
+}
+
+size_t mesh::animationGetSize(const skeletal_animation_t& animation)
+{
+  return sizeof(bone_transform_t) * animation.frameCount_ * animation.nodeCount_ + sizeof(u32) * animation.nodeCount_;
+}
+
+size_t mesh::animationGetSize(const compressed_animation_t& animation)
+{
+  return sizeof(compressed_track_t) * animation.nodeCount_ * 3 +
+         sizeof(u16) * (animation.keyCount_ + animation.keyValueCount_) +
+         sizeof(u32) * animation.nodeCount_;
+}
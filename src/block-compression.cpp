@@ -0,0 +1,680 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "block-compression.h"
+#include "thread-pool.h"
+#include "maths.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+using namespace bkk;
+using namespace bkk::image;
+
+//Interpolation weights (out of 64) of the 4 bit indices of BC6H and BC7
+static const u32 gWeights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+//Largest finite half float, as an integer
+static const f32 gMaxHalf = 31743.0f;
+
+//Pixels of a 4x4 block. Values are in [0,1], except in BC6H blocks where they are the bits of the half float as an integer
+struct block_t
+{
+  f32 pixel_[16][4];
+  u32 channelCount_;
+};
+
+//Encodes a block with the given endpoints. Writes the encoded block in 'output' and the interpolation weight between e0 and e1 of
+//the palette entry chosen for each pixel in 't'. Returns the squared error
+typedef f32(*block_encoder_t)(const block_t& block, const f32* e0, const f32* e1, u8* output, f32* t);
+
+struct bit_writer_t
+{
+  u8* data_;
+  u32 bit_;
+};
+
+static void WriteBits(u32 value, u32 count, bit_writer_t* writer)
+{
+  for (u32 i(0); i<count; ++i)
+  {
+    if ((value >> i) & 1u)
+    {
+      writer->data_[writer->bit_ >> 3] |= (u8)(1u << (writer->bit_ & 7u));
+    }
+    writer->bit_++;
+  }
+}
+
+static s32 Quantize(f32 value, s32 maxValue)
+{
+  return maths::maxValue(0, maths::minValue((s32)floorf(value + 0.5f), maxValue));
+}
+
+//Index of the palette entry closest to each pixel. Returns the squared error
+static f32 SelectIndices(const block_t& block, const f32(*palette)[4], u32 paletteSize, u32* index)
+{
+  f32 error = 0.0f;
+  for (u32 i(0); i<16; ++i)
+  {
+    f32 bestDistance = FLT_MAX;
+    for (u32 entry(0); entry<paletteSize; ++entry)
+    {
+      f32 distance = 0.0f;
+      for (u32 c(0); c<block.channelCount_; ++c)
+      {
+        f32 d = block.pixel_[i][c] - palette[entry][c];
+        distance += d * d;
+      }
+
+      if (distance < bestDistance)
+      {
+        bestDistance = distance;
+        index[i] = entry;
+      }
+    }
+    error += bestDistance;
+  }
+
+  return error;
+}
+
+//Initial endpoints of the block. Fast quality uses the bounding box of the pixels, otherwise the extremes of the pixels along the principal axis
+static void FitEndpoints(const block_t& block, compression_quality_e quality, f32* e0, f32* e1)
+{
+  u32 channelCount = block.channelCount_;
+  f32 mean[4] = {}, axis[4] = {};
+  for (u32 c(0); c<channelCount; ++c)
+  {
+    e0[c] = e1[c] = block.pixel_[0][c];
+    for (u32 i(0); i<16; ++i)
+    {
+      e0[c] = maths::minValue(e0[c], block.pixel_[i][c]);
+      e1[c] = maths::maxValue(e1[c], block.pixel_[i][c]);
+      mean[c] += block.pixel_[i][c] / 16.0f;
+    }
+    axis[c] = e1[c] - e0[c];
+  }
+
+  if (quality == COMPRESSION_QUALITY_FAST || channelCount == 1)
+  {
+    return;
+  }
+
+  f32 covariance[4][4] = {};
+  for (u32 i(0); i<16; ++i)
+  {
+    for (u32 row(0); row<channelCount; ++row)
+    {
+      for (u32 column(0); column<channelCount; ++column)
+      {
+        covariance[row][column] += (block.pixel_[i][row] - mean[row]) * (block.pixel_[i][column] - mean[column]);
+      }
+    }
+  }
+
+  //Principal axis by power iteration, starting from the diagonal of the bounding box
+  for (u32 iteration(0); iteration<8; ++iteration)
+  {
+    f32 next[4] = {};
+    f32 length = 0.0f;
+    for (u32 row(0); row<channelCount; ++row)
+    {
+      for (u32 column(0); column<channelCount; ++column)
+      {
+        next[row] += covariance[row][column] * axis[column];
+      }
+      length += next[row] * next[row];
+    }
+
+    if (length < 1e-12f)
+    {
+      break;
+    }
+
+    length = 1.0f / sqrtf(length);
+    for (u32 c(0); c<channelCount; ++c)
+    {
+      axis[c] = next[c] * length;
+    }
+  }
+
+  f32 axisLength = 0.0f;
+  for (u32 c(0); c<channelCount; ++c)
+  {
+    axisLength += axis[c] * axis[c];
+  }
+
+  if (axisLength < 1e-12f)
+  {
+    return;
+  }
+
+  //Extremes of the projection of the pixels on the axis
+  axisLength = 1.0f / sqrtf(axisLength);
+  f32 minT = FLT_MAX, maxT = -FLT_MAX;
+  for (u32 i(0); i<16; ++i)
+  {
+    f32 t = 0.0f;
+    for (u32 c(0); c<channelCount; ++c)
+    {
+      t += (block.pixel_[i][c] - mean[c]) * axis[c] * axisLength;
+    }
+    minT = maths::minValue(minT, t);
+    maxT = maths::maxValue(maxT, t);
+  }
+
+  for (u32 c(0); c<channelCount; ++c)
+  {
+    e0[c] = mean[c] + axis[c] * axisLength * minT;
+    e1[c] = mean[c] + axis[c] * axisLength * maxT;
+  }
+}
+
+//Least squares endpoints for the interpolation weights chosen for each pixel. Returns false if the system is singular
+static bool RefineEndpoints(const block_t& block, const f32* t, f32* e0, f32* e1)
+{
+  f32 a = 0.0f, b = 0.0f, c = 0.0f;
+  for (u32 i(0); i<16; ++i)
+  {
+    a += (1.0f - t[i]) * (1.0f - t[i]);
+    b += (1.0f - t[i]) * t[i];
+    c += t[i] * t[i];
+  }
+
+  f32 determinant = a * c - b * b;
+  if (fabsf(determinant) < 1e-6f)
+  {
+    return false;
+  }
+
+  for (u32 channel(0); channel<block.channelCount_; ++channel)
+  {
+    f32 x0 = 0.0f, x1 = 0.0f;
+    for (u32 i(0); i<16; ++i)
+    {
+      x0 += (1.0f - t[i]) * block.pixel_[i][channel];
+      x1 += t[i] * block.pixel_[i][channel];
+    }
+    e0[channel] = (c * x0 - b * x1) / determinant;
+    e1[channel] = (a * x1 - b * x0) / determinant;
+  }
+
+  return true;
+}
+
+static u16 QuantizeRGB565(const f32* color)
+{
+  return (u16)((Quantize(color[0] * 31.0f, 31) << 11) | (Quantize(color[1] * 63.0f, 63) << 5) | Quantize(color[2] * 31.0f, 31));
+}
+
+static void DecodeRGB565(u16 color, f32* output)
+{
+  u32 r = (color >> 11) & 31u, g = (color >> 5) & 63u, b = color & 31u;
+  output[0] = ((r << 3) | (r >> 2)) / 255.0f;
+  output[1] = ((g << 2) | (g >> 4)) / 255.0f;
+  output[2] = ((b << 3) | (b >> 2)) / 255.0f;
+  output[3] = 1.0f;
+}
+
+//BC1 block in 4 color mode (color0 > color1). If both endpoints quantize to the same color all the pixels use index 0
+static f32 EncodeBC1(const block_t& block, const f32* e0, const f32* e1, u8* output, f32* t)
+{
+  static const f32 gIndexWeight[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+  u16 color0 = QuantizeRGB565(e0);
+  u16 color1 = QuantizeRGB565(e1);
+  bool swap = color0 < color1;
+  if (swap)
+  {
+    std::swap(color0, color1);
+  }
+
+  f32 palette[4][4];
+  DecodeRGB565(color0, palette[0]);
+  DecodeRGB565(color1, palette[1]);
+  for (u32 c(0); c<4; ++c)
+  {
+    palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+    palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+  }
+
+  u32 index[16];
+  f32 error = SelectIndices(block, palette, color0 == color1 ? 1u : 4u, index);
+
+  memset(output, 0, 8);
+  bit_writer_t writer = { output, 0u };
+  WriteBits(color0, 16, &writer);
+  WriteBits(color1, 16, &writer);
+  for (u32 i(0); i<16; ++i)
+  {
+    WriteBits(index[i], 2, &writer);
+    t[i] = swap ? 1.0f - gIndexWeight[index[i]] : gIndexWeight[index[i]];
+  }
+
+  return error;
+}
+
+//BC4 block in 8 value mode (red0 > red1). Also used for the alpha of BC3 and each channel of BC5
+static f32 EncodeBC4(const block_t& block, const f32* e0, const f32* e1, u8* output, f32* t)
+{
+  s32 red0 = Quantize(e0[0] * 255.0f, 255);
+  s32 red1 = Quantize(e1[0] * 255.0f, 255);
+  bool swap = red0 < red1;
+  if (swap)
+  {
+    std::swap(red0, red1);
+  }
+
+  f32 palette[8][4] = {};
+  palette[0][0] = red0 / 255.0f;
+  palette[1][0] = red1 / 255.0f;
+  for (u32 i(2); i<8; ++i)
+  {
+    palette[i][0] = ((8 - i) * red0 + (i - 1) * red1) / (7.0f * 255.0f);
+  }
+
+  u32 index[16];
+  f32 error = SelectIndices(block, palette, red0 == red1 ? 1u : 8u, index);
+
+  memset(output, 0, 8);
+  bit_writer_t writer = { output, 0u };
+  WriteBits(red0, 8, &writer);
+  WriteBits(red1, 8, &writer);
+  for (u32 i(0); i<16; ++i)
+  {
+    WriteBits(index[i], 3, &writer);
+    f32 weight = index[i] < 2 ? (f32)index[i] : (index[i] - 1) / 7.0f;
+    t[i] = swap ? 1.0f - weight : weight;
+  }
+
+  return error;
+}
+
+//Quantizes an RGBA endpoint to 7 bits per channel plus a shared p-bit, choosing the p-bit with less error
+static void QuantizeBC7Endpoint(const f32* endpoint, u32* quantized, u32* pBit)
+{
+  f32 bestError = FLT_MAX;
+  for (u32 p(0); p<2; ++p)
+  {
+    u32 candidate[4];
+    f32 error = 0.0f;
+    for (u32 c(0); c<4; ++c)
+    {
+      f32 value = endpoint[c] * 255.0f;
+      candidate[c] = Quantize((value - p) * 0.5f, 127);
+      f32 d = ((candidate[c] << 1) | p) - value;
+      error += d * d;
+    }
+
+    if (error < bestError)
+    {
+      bestError = error;
+      *pBit = p;
+      memcpy(quantized, candidate, sizeof(candidate));
+    }
+  }
+}
+
+//BC7 mode 6: one subset, RGBA endpoints with 7 bits and a p-bit per endpoint, 4 bit indices
+static f32 EncodeBC7(const block_t& block, const f32* e0, const f32* e1, u8* output, f32* t)
+{
+  u32 q0[4], q1[4], p0, p1;
+  QuantizeBC7Endpoint(e0, q0, &p0);
+  QuantizeBC7Endpoint(e1, q1, &p1);
+
+  f32 palette[16][4];
+  for (u32 i(0); i<16; ++i)
+  {
+    for (u32 c(0); c<4; ++c)
+    {
+      u32 a = (q0[c] << 1) | p0;
+      u32 b = (q1[c] << 1) | p1;
+      palette[i][c] = (((64 - gWeights4[i]) * a + gWeights4[i] * b + 32) >> 6) / 255.0f;
+    }
+  }
+
+  u32 index[16];
+  f32 error = SelectIndices(block, palette, 16u, index);
+
+  //The most significant bit of the first index is implicitly 0. If it is 1, swap the endpoints and invert the indices
+  bool swap = index[0] >= 8;
+  if (swap)
+  {
+    std::swap(q0, q1);
+    std::swap(p0, p1);
+    for (u32 i(0); i<16; ++i)
+    {
+      index[i] = 15 - index[i];
+    }
+  }
+
+  memset(output, 0, 16);
+  bit_writer_t writer = { output, 0u };
+  WriteBits(1u << 6, 7, &writer);
+  for (u32 c(0); c<4; ++c)
+  {
+    WriteBits(q0[c], 7, &writer);
+    WriteBits(q1[c], 7, &writer);
+  }
+  WriteBits(p0, 1, &writer);
+  WriteBits(p1, 1, &writer);
+  for (u32 i(0); i<16; ++i)
+  {
+    WriteBits(index[i], i == 0 ? 3 : 4, &writer);
+    f32 weight = gWeights4[index[i]] / 64.0f;
+    t[i] = swap ? 1.0f - weight : weight;
+  }
+
+  return error;
+}
+
+//Unquantization of a 10 bit unsigned BC6H endpoint to 16 bits
+static s32 UnquantizeBC6H(s32 value)
+{
+  if (value == 0)
+  {
+    return 0;
+  }
+  else if (value == 1023)
+  {
+    return 0xFFFF;
+  }
+
+  return ((value << 16) + 0x8000) >> 10;
+}
+
+//Maps an interpolated 16 bit value to the bits of the final half float
+static f32 FinishUnquantizeBC6H(s32 value)
+{
+  return (f32)((value * 31) >> 6);
+}
+
+static u32 QuantizeBC6H(f32 half)
+{
+  s32 value = maths::minValue((s32)(maths::maxValue(half, 0.0f) / 31.0f), 1022);
+  f32 error0 = fabsf(FinishUnquantizeBC6H(UnquantizeBC6H(value)) - half);
+  f32 error1 = fabsf(FinishUnquantizeBC6H(UnquantizeBC6H(value + 1)) - half);
+  return error1 < error0 ? value + 1 : value;
+}
+
+//BC6H mode 11: one region, unsigned 10 bit endpoints without deltas, 4 bit indices
+static f32 EncodeBC6H(const block_t& block, const f32* e0, const f32* e1, u8* output, f32* t)
+{
+  u32 q0[3], q1[3];
+  for (u32 c(0); c<3; ++c)
+  {
+    q0[c] = QuantizeBC6H(e0[c]);
+    q1[c] = QuantizeBC6H(e1[c]);
+  }
+
+  f32 palette[16][4] = {};
+  for (u32 i(0); i<16; ++i)
+  {
+    for (u32 c(0); c<3; ++c)
+    {
+      s32 value = ((64 - gWeights4[i]) * UnquantizeBC6H(q0[c]) + gWeights4[i] * UnquantizeBC6H(q1[c]) + 32) >> 6;
+      palette[i][c] = FinishUnquantizeBC6H(value);
+    }
+  }
+
+  u32 index[16];
+  f32 error = SelectIndices(block, palette, 16u, index);
+
+  bool swap = index[0] >= 8;
+  if (swap)
+  {
+    std::swap(q0, q1);
+    for (u32 i(0); i<16; ++i)
+    {
+      index[i] = 15 - index[i];
+    }
+  }
+
+  memset(output, 0, 16);
+  bit_writer_t writer = { output, 0u };
+  WriteBits(0x03, 5, &writer);
+  for (u32 c(0); c<3; ++c)
+  {
+    WriteBits(q0[c], 10, &writer);
+  }
+  for (u32 c(0); c<3; ++c)
+  {
+    WriteBits(q1[c], 10, &writer);
+  }
+  for (u32 i(0); i<16; ++i)
+  {
+    WriteBits(index[i], i == 0 ? 3 : 4, &writer);
+    f32 weight = gWeights4[index[i]] / 64.0f;
+    t[i] = swap ? 1.0f - weight : weight;
+  }
+
+  return error;
+}
+
+static void EncodeBlock(const block_t& block, compression_quality_e quality, block_encoder_t encoder, u32 blockSize, u8* output)
+{
+  f32 e0[4], e1[4], t[16];
+  FitEndpoints(block, quality, e0, e1);
+  f32 error = encoder(block, e0, e1, output, t);
+
+  if (quality == COMPRESSION_QUALITY_HIGH)
+  {
+    //Refine the endpoints for the indices chosen and keep the result while the error decreases
+    u8 candidate[16];
+    f32 candidateT[16];
+    for (u32 iteration(0); iteration<2 && RefineEndpoints(block, t, e0, e1); ++iteration)
+    {
+      f32 candidateError = encoder(block, e0, e1, candidate, candidateT);
+      if (candidateError >= error)
+      {
+        break;
+      }
+
+      error = candidateError;
+      memcpy(output, candidate, blockSize);
+      memcpy(t, candidateT, sizeof(t));
+    }
+  }
+}
+
+//Reads a pixel as RGBA. Missing components are 0 and missing alpha is 1. 8 bit components are normalized
+static void ReadPixel(const image2D_t& image, u32 x, u32 y, f32* rgba)
+{
+  rgba[0] = rgba[1] = rgba[2] = 0.0f;
+  rgba[3] = 1.0f;
+
+  const u8* pixel = image.data_ + (y * image.width_ + x) * image.componentCount_ * image.componentSize_;
+  for (u32 c(0); c<image.componentCount_; ++c)
+  {
+    if (image.componentSize_ == 4)
+    {
+      memcpy(&rgba[c], pixel + c * 4, sizeof(f32));
+    }
+    else if (image.componentSize_ == 2)
+    {
+      u16 half;
+      memcpy(&half, pixel + c * 2, sizeof(u16));
+      rgba[c] = halfToFloat(half);
+    }
+    else
+    {
+      rgba[c] = pixel[c] / 255.0f;
+    }
+  }
+}
+
+//Reads the block at (blockX,blockY) keeping the given channels. Pixels outside the image repeat the last row or column
+static void ReadBlock(const image2D_t& image, u32 blockX, u32 blockY, bool hdr, const u32* channels, u32 channelCount, block_t* block)
+{
+  block->channelCount_ = channelCount;
+  for (u32 i(0); i<16; ++i)
+  {
+    u32 x = maths::minValue(blockX * 4 + (i & 3u), image.width_ - 1);
+    u32 y = maths::minValue(blockY * 4 + (i >> 2), image.height_ - 1);
+    f32 rgba[4];
+    ReadPixel(image, x, y, rgba);
+    for (u32 c(0); c<channelCount; ++c)
+    {
+      f32 value = rgba[channels[c]];
+      block->pixel_[i][c] = hdr ? maths::minValue((f32)floatToHalf(maths::maxValue(value, 0.0f)), gMaxHalf) : maths::maxValue(0.0f, maths::minValue(value, 1.0f));
+    }
+  }
+}
+
+static void CompressBlock(const image2D_t& image, compression_e compression, compression_quality_e quality, u32 blockX, u32 blockY, u8* output)
+{
+  static const u32 gRGBA[4] = { 0, 1, 2, 3 };
+  block_t block;
+  switch (compression)
+  {
+  case COMPRESSION_BC1:
+    ReadBlock(image, blockX, blockY, false, gRGBA, 3u, &block);
+    EncodeBlock(block, quality, EncodeBC1, 8u, output);
+    break;
+
+  case COMPRESSION_BC3:
+    ReadBlock(image, blockX, blockY, false, gRGBA + 3, 1u, &block);
+    EncodeBlock(block, quality, EncodeBC4, 8u, output);
+    ReadBlock(image, blockX, blockY, false, gRGBA, 3u, &block);
+    EncodeBlock(block, quality, EncodeBC1, 8u, output + 8);
+    break;
+
+  case COMPRESSION_BC4:
+    ReadBlock(image, blockX, blockY, false, gRGBA, 1u, &block);
+    EncodeBlock(block, quality, EncodeBC4, 8u, output);
+    break;
+
+  case COMPRESSION_BC5:
+    ReadBlock(image, blockX, blockY, false, gRGBA, 1u, &block);
+    EncodeBlock(block, quality, EncodeBC4, 8u, output);
+    ReadBlock(image, blockX, blockY, false, gRGBA + 1, 1u, &block);
+    EncodeBlock(block, quality, EncodeBC4, 8u, output + 8);
+    break;
+
+  case COMPRESSION_BC6H:
+    ReadBlock(image, blockX, blockY, true, gRGBA, 3u, &block);
+    EncodeBlock(block, quality, EncodeBC6H, 16u, output);
+    break;
+
+  case COMPRESSION_BC7:
+    ReadBlock(image, blockX, blockY, false, gRGBA, 4u, &block);
+    EncodeBlock(block, quality, EncodeBC7, 16u, output);
+    break;
+
+  default:
+    break;
+  }
+}
+
+compression_e image::compressionSelect(const image2D_t& image, bool normalMap)
+{
+  if (image.compression_ != COMPRESSION_NONE)
+  {
+    return image.compression_;
+  }
+
+  if (image.componentSize_ > 1)
+  {
+    return COMPRESSION_BC6H;
+  }
+  else if (normalMap || image.componentCount_ == 2)
+  {
+    return COMPRESSION_BC5;
+  }
+  else if (image.componentCount_ == 1)
+  {
+    return COMPRESSION_BC4;
+  }
+  else if (image.componentCount_ == 4)
+  {
+    for (u32 i(0); i<image.width_ * image.height_; ++i)
+    {
+      if (image.data_[i * 4 + 3] != 255u)
+      {
+        return COMPRESSION_BC7;
+      }
+    }
+  }
+
+  return COMPRESSION_BC1;
+}
+
+uint32_t image::compressionGetBlockSize(compression_e compression)
+{
+  switch (compression)
+  {
+  case COMPRESSION_NONE:
+    return 0u;
+  case COMPRESSION_BC1:
+  case COMPRESSION_BC4:
+    return 8u;
+  default:
+    return 16u;
+  }
+}
+
+bool image::compress(const image2D_t& image, compression_e compression, compression_quality_e quality, thread::thread_pool_t* threadPool, image2D_t* compressed)
+{
+  if (compression == COMPRESSION_NONE || image.compression_ != COMPRESSION_NONE || image.data_ == nullptr || image.width_ == 0 || image.height_ == 0)
+  {
+    return false;
+  }
+
+  u32 blockCountX = (image.width_ + 3) / 4;
+  u32 blockCountY = (image.height_ + 3) / 4;
+  u32 blockSize = compressionGetBlockSize(compression);
+  u8* data = (u8*)malloc(blockCountX * blockCountY * blockSize);
+
+  //Rows of blocks are encoded in parallel
+  thread::parallelFor(threadPool, blockCountY, 1u,
+    [&](u32 begin, u32 end)
+    {
+      for (u32 blockY(begin); blockY<end; ++blockY)
+      {
+        u8* output = data + blockY * blockCountX * blockSize;
+        for (u32 blockX(0); blockX<blockCountX; ++blockX, output += blockSize)
+        {
+          CompressBlock(image, compression, quality, blockX, blockY, output);
+        }
+      }
+    }
+  );
+
+  //The source and destination can be the same image
+  image2D_t result = image;
+  result.dataSize_ = blockCountX * blockCountY * blockSize;
+  result.data_ = data;
+  result.compression_ = compression;
+  if (compressed->data_ != nullptr)
+  {
+    unload(compressed);
+  }
+
+  *compressed = result;
+  return true;
+}
@@ -0,0 +1,911 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "bvh.h"
+
+#include <float.h> //FLT_MAX
+#include <cstring> //memcpy
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <cassert>
+
+using namespace bkk;
+using namespace bkk::mesh;
+using namespace bkk::maths;
+
+static const u32 BIN_COUNT = 16u;
+static const u32 MAX_LEAF_SIZE = 8u;
+static const u32 MAX_DEPTH = 48u;                       //Nodes at this depth become leaves regardless of their size
+static const u32 STACK_SIZE = 3u * MAX_DEPTH + 4u;      //Enough for the 4-wide traversal, which pushes up to three children per level
+static const u32 PARALLEL_BINNING_THRESHOLD = 65536u;   //Nodes with more triangles are binned using all the workers
+static const u32 PARALLEL_BUILD_THRESHOLD = 4096u;      //Children of nodes with more triangles are built in parallel
+static const f32 TRAVERSAL_COST = 1.0f;                 //Relative to the cost of intersecting a triangle
+static const u32 INVALID_CHILD = ~0u;
+
+struct bin_t
+{
+  aabb_t bounds_;
+  u32 count_;
+};
+
+struct build_context_t
+{
+  const aabb_t* triangleBounds_;
+  const vec3* centroids_;
+  u32* primitives_;
+
+  bvh_node_t* nodes_;
+  std::atomic<u32> nodeCount_;
+
+  thread::thread_pool_t* pool_;
+};
+
+struct stack_entry_t
+{
+  u32 node_;
+  f32 distance_;
+};
+
+//Helper functions
+static aabb_t EmptyAABB()
+{
+  aabb_t aabb;
+  aabb.min_ = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+  aabb.max_ = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  return aabb;
+}
+
+static void Grow(aabb_t& aabb, const vec3& point)
+{
+  aabb.min_ = vec3(minValue(aabb.min_.x, point.x), minValue(aabb.min_.y, point.y), minValue(aabb.min_.z, point.z));
+  aabb.max_ = vec3(maxValue(aabb.max_.x, point.x), maxValue(aabb.max_.y, point.y), maxValue(aabb.max_.z, point.z));
+}
+
+static void Grow(aabb_t& aabb, const aabb_t& other)
+{
+  Grow(aabb, other.min_);
+  Grow(aabb, other.max_);
+}
+
+//Half the surface area of the box, enough for SAH ratios
+static f32 SurfaceArea(const aabb_t& aabb)
+{
+  if (aabb.min_.x > aabb.max_.x)
+  {
+    return 0.0f;
+  }
+
+  vec3 extent = aabb.max_ - aabb.min_;
+  return extent.x*extent.y + extent.y*extent.z + extent.z*extent.x;
+}
+
+static u32 BinIndex(f32 centroid, f32 min, f32 scale)
+{
+  return minValue((u32)((centroid - min) * scale), BIN_COUNT - 1u);
+}
+
+static void ComputeBoundsRange(const build_context_t& context, u32 begin, u32 end, aabb_t* bounds, aabb_t* centroidBounds)
+{
+  aabb_t b = EmptyAABB();
+  aabb_t cb = EmptyAABB();
+  for (u32 i(begin); i<end; ++i)
+  {
+    u32 primitive = context.primitives_[i];
+    Grow(b, context.triangleBounds_[primitive]);
+    Grow(cb, context.centroids_[primitive]);
+  }
+
+  *bounds = b;
+  *centroidBounds = cb;
+}
+
+static void ComputeBounds(build_context_t& context, u32 first, u32 count, aabb_t* bounds, aabb_t* centroidBounds)
+{
+  if (!context.pool_ || count < PARALLEL_BINNING_THRESHOLD)
+  {
+    ComputeBoundsRange(context, first, first + count, bounds, centroidBounds);
+    return;
+  }
+
+  const u32 grainSize = PARALLEL_BINNING_THRESHOLD / 4u;
+  u32 chunkCount = (count + grainSize - 1) / grainSize;
+  std::vector<aabb_t> chunkBounds(chunkCount);
+  std::vector<aabb_t> chunkCentroidBounds(chunkCount);
+  thread::parallelFor(context.pool_, count, grainSize,
+    [&](u32 begin, u32 end)
+    {
+      ComputeBoundsRange(context, first + begin, first + end, &chunkBounds[begin / grainSize], &chunkCentroidBounds[begin / grainSize]);
+    }
+  );
+
+  *bounds = EmptyAABB();
+  *centroidBounds = EmptyAABB();
+  for (u32 i(0); i<chunkCount; ++i)
+  {
+    Grow(*bounds, chunkBounds[i]);
+    Grow(*centroidBounds, chunkCentroidBounds[i]);
+  }
+}
+
+static void BinPrimitivesRange(const build_context_t& context, u32 begin, u32 end, const aabb_t& centroidBounds, const vec3& scale, bin_t bins[3][BIN_COUNT])
+{
+  for (u32 axis(0); axis<3; ++axis)
+  {
+    for (u32 i(0); i<BIN_COUNT; ++i)
+    {
+      bins[axis][i].bounds_ = EmptyAABB();
+      bins[axis][i].count_ = 0u;
+    }
+  }
+
+  for (u32 i(begin); i<end; ++i)
+  {
+    u32 primitive = context.primitives_[i];
+    const vec3& centroid = context.centroids_[primitive];
+    for (u32 axis(0); axis<3; ++axis)
+    {
+      bin_t& bin = bins[axis][BinIndex(centroid[axis], centroidBounds.min_[axis], scale[axis])];
+      Grow(bin.bounds_, context.triangleBounds_[primitive]);
+      bin.count_++;
+    }
+  }
+}
+
+static void BinPrimitives(build_context_t& context, u32 first, u32 count, const aabb_t& centroidBounds, const vec3& scale, bin_t bins[3][BIN_COUNT])
+{
+  if (!context.pool_ || count < PARALLEL_BINNING_THRESHOLD)
+  {
+    BinPrimitivesRange(context, first, first + count, centroidBounds, scale, bins);
+    return;
+  }
+
+  //Bin each chunk separately and merge the results
+  struct chunk_bins_t
+  {
+    bin_t bins_[3][BIN_COUNT];
+  };
+
+  const u32 grainSize = PARALLEL_BINNING_THRESHOLD / 4u;
+  u32 chunkCount = (count + grainSize - 1) / grainSize;
+  std::vector<chunk_bins_t> chunkBins(chunkCount);
+  thread::parallelFor(context.pool_, count, grainSize,
+    [&](u32 begin, u32 end)
+    {
+      BinPrimitivesRange(context, first + begin, first + end, centroidBounds, scale, chunkBins[begin / grainSize].bins_);
+    }
+  );
+
+  for (u32 axis(0); axis<3; ++axis)
+  {
+    for (u32 i(0); i<BIN_COUNT; ++i)
+    {
+      bins[axis][i] = chunkBins[0].bins_[axis][i];
+      for (u32 chunk(1); chunk<chunkCount; ++chunk)
+      {
+        Grow(bins[axis][i].bounds_, chunkBins[chunk].bins_[axis][i].bounds_);
+        bins[axis][i].count_ += chunkBins[chunk].bins_[axis][i].count_;
+      }
+    }
+  }
+}
+
+static void BuildNode(build_context_t& context, u32 nodeIndex, u32 first, u32 count, u32 depth)
+{
+  aabb_t bounds, centroidBounds;
+  ComputeBounds(context, first, count, &bounds, &centroidBounds);
+
+  bvh_node_t& node = context.nodes_[nodeIndex];
+  node.min_ = bounds.min_;
+  node.max_ = bounds.max_;
+
+  //Find the split with the lowest SAH cost
+  vec3 scale;
+  s32 bestAxis = -1;
+  u32 bestSplit = 0u;
+  f32 bestCost = FLT_MAX;
+  if (count > 1u && depth < MAX_DEPTH)
+  {
+    for (u32 axis(0); axis<3; ++axis)
+    {
+      f32 extent = centroidBounds.max_[axis] - centroidBounds.min_[axis];
+      scale[axis] = extent > 0.0f ? BIN_COUNT / extent : 0.0f;
+    }
+
+    bin_t bins[3][BIN_COUNT];
+    BinPrimitives(context, first, count, centroidBounds, scale, bins);
+
+    f32 inverseArea = 1.0f / maxValue(SurfaceArea(bounds), FLT_MIN);
+    for (u32 axis(0); axis<3; ++axis)
+    {
+      if (scale[axis] == 0.0f)
+      {
+        continue;
+      }
+
+      //Sweep from the right to get the cost of the right side of every split plane
+      f32 rightCost[BIN_COUNT];
+      aabb_t rightBounds = EmptyAABB();
+      u32 rightCount = 0u;
+      for (u32 i(BIN_COUNT - 1); i>0; --i)
+      {
+        Grow(rightBounds, bins[axis][i].bounds_);
+        rightCount += bins[axis][i].count_;
+        rightCost[i] = rightCount > 0u ? SurfaceArea(rightBounds) * rightCount : FLT_MAX;
+      }
+
+      aabb_t leftBounds = EmptyAABB();
+      u32 leftCount = 0u;
+      for (u32 i(1); i<BIN_COUNT; ++i)
+      {
+        Grow(leftBounds, bins[axis][i - 1].bounds_);
+        leftCount += bins[axis][i - 1].count_;
+        if (leftCount == 0u || rightCost[i] == FLT_MAX)
+        {
+          continue;
+        }
+
+        f32 cost = TRAVERSAL_COST + (SurfaceArea(leftBounds) * leftCount + rightCost[i]) * inverseArea;
+        if (cost < bestCost)
+        {
+          bestCost = cost;
+          bestAxis = axis;
+          bestSplit = i;
+        }
+      }
+    }
+  }
+
+  //Make a leaf if splitting is not worth it or not possible
+  bool canSplit = count > 1u && depth < MAX_DEPTH;
+  if (!canSplit || (count <= MAX_LEAF_SIZE && (bestAxis == -1 || bestCost >= (f32)count)))
+  {
+    node.leftFirst_ = first;
+    node.triangleCount_ = count;
+    return;
+  }
+
+  u32 leftCount;
+  if (bestAxis != -1)
+  {
+    u32* middle = std::partition(context.primitives_ + first, context.primitives_ + first + count,
+      [&](u32 primitive) { return BinIndex(context.centroids_[primitive][bestAxis], centroidBounds.min_[bestAxis], scale[bestAxis]) < bestSplit; });
+
+    leftCount = (u32)(middle - (context.primitives_ + first));
+  }
+  else
+  {
+    //All centroids are in the same place. Split the list in two halves
+    leftCount = count / 2;
+  }
+
+  u32 leftChild = context.nodeCount_.fetch_add(2u);
+  node.leftFirst_ = leftChild;
+  node.triangleCount_ = 0u;
+
+  if (context.pool_ && count >= PARALLEL_BUILD_THRESHOLD)
+  {
+    thread::parallelFor(context.pool_, 2u, 1u,
+      [&](u32 begin, u32 end)
+      {
+        for (u32 i(begin); i<end; ++i)
+        {
+          if (i == 0)
+            BuildNode(context, leftChild, first, leftCount, depth + 1);
+          else
+            BuildNode(context, leftChild + 1, first + leftCount, count - leftCount, depth + 1);
+        }
+      }
+    );
+  }
+  else
+  {
+    BuildNode(context, leftChild, first, leftCount, depth + 1);
+    BuildNode(context, leftChild + 1, first + leftCount, count - leftCount, depth + 1);
+  }
+}
+
+//Creates a 4-wide node from the binary subtree rooted at 'nodeIndex'. Returns the index of the new node
+static u32 CollapseNode(const bvh_node_t* nodes, u32 nodeIndex, std::vector<bvh_wide_node_t>& wideNodes)
+{
+  u32 children[4];
+  u32 childCount = 0u;
+  const bvh_node_t& node = nodes[nodeIndex];
+  if (node.triangleCount_ > 0u)
+  {
+    children[childCount++] = nodeIndex;
+  }
+  else
+  {
+    children[childCount++] = node.leftFirst_;
+    children[childCount++] = node.leftFirst_ + 1;
+
+    //Open the interior child with the largest surface area until there are four children
+    while (childCount < 4u)
+    {
+      s32 largest = -1;
+      f32 largestArea = -1.0f;
+      for (u32 i(0); i<childCount; ++i)
+      {
+        const bvh_node_t& child = nodes[children[i]];
+        aabb_t aabb = { child.min_, child.max_ };
+        if (child.triangleCount_ == 0u && SurfaceArea(aabb) > largestArea)
+        {
+          largest = i;
+          largestArea = SurfaceArea(aabb);
+        }
+      }
+
+      if (largest == -1)
+      {
+        break;
+      }
+
+      u32 opened = children[largest];
+      children[largest] = nodes[opened].leftFirst_;
+      children[childCount++] = nodes[opened].leftFirst_ + 1;
+    }
+  }
+
+  u32 wideIndex = (u32)wideNodes.size();
+  wideNodes.push_back(bvh_wide_node_t());
+
+  bvh_wide_node_t wideNode;
+  for (u32 i(0); i<4; ++i)
+  {
+    if (i < childCount)
+    {
+      const bvh_node_t& child = nodes[children[i]];
+      wideNode.minX_[i] = child.min_.x;
+      wideNode.minY_[i] = child.min_.y;
+      wideNode.minZ_[i] = child.min_.z;
+      wideNode.maxX_[i] = child.max_.x;
+      wideNode.maxY_[i] = child.max_.y;
+      wideNode.maxZ_[i] = child.max_.z;
+
+      if (child.triangleCount_ > 0u)
+      {
+        wideNode.child_[i] = child.leftFirst_;
+        wideNode.triangleCount_[i] = child.triangleCount_;
+      }
+      else
+      {
+        wideNode.child_[i] = CollapseNode(nodes, children[i], wideNodes);
+        wideNode.triangleCount_[i] = 0u;
+      }
+    }
+    else
+    {
+      wideNode.minX_[i] = wideNode.minY_[i] = wideNode.minZ_[i] = FLT_MAX;
+      wideNode.maxX_[i] = wideNode.maxY_[i] = wideNode.maxZ_[i] = -FLT_MAX;
+      wideNode.child_[i] = INVALID_CHILD;
+      wideNode.triangleCount_[i] = 0u;
+    }
+  }
+
+  //Recursive calls may have reallocated the vector
+  wideNodes[wideIndex] = wideNode;
+  return wideIndex;
+}
+
+//Interval of the ray between the two planes of a slab. A ray parallel to the planes is either always or never between them, which is
+//decided from the origin instead of multiplying by an infinite inverse direction (0 * inf would give NaN)
+static void IntersectSlab(f32 slabMin, f32 slabMax, f32 origin, f32 direction, f32 inverseDirection, f32* tEnter, f32* tExit)
+{
+  if (direction == 0.0f)
+  {
+    bool inside = origin >= slabMin && origin <= slabMax;
+    *tEnter = inside ? -FLT_MAX : FLT_MAX;
+    *tExit = inside ? FLT_MAX : -FLT_MAX;
+  }
+  else
+  {
+    f32 t0 = (slabMin - origin) * inverseDirection;
+    f32 t1 = (slabMax - origin) * inverseDirection;
+    *tEnter = minValue(t0, t1);
+    *tExit = maxValue(t0, t1);
+  }
+}
+
+//Returns the distance along the ray to the box, or FLT_MAX if the ray misses it or the box is farther than tMax
+static f32 IntersectAABB(const vec3& origin, const vec3& direction, const vec3& inverseDirection, f32 minX, f32 minY, f32 minZ, f32 maxX, f32 maxY, f32 maxZ, f32 tMax)
+{
+  f32 tx0, tx1, ty0, ty1, tz0, tz1;
+  IntersectSlab(minX, maxX, origin.x, direction.x, inverseDirection.x, &tx0, &tx1);
+  IntersectSlab(minY, maxY, origin.y, direction.y, inverseDirection.y, &ty0, &ty1);
+  IntersectSlab(minZ, maxZ, origin.z, direction.z, inverseDirection.z, &tz0, &tz1);
+
+  f32 tEnter = maxValue(maxValue(tx0, ty0), tz0);
+  f32 tExit = minValue(minValue(tx1, ty1), tz1);
+
+  return (tExit >= tEnter && tExit > 0.0f && tEnter < tMax) ? maxValue(tEnter, 0.0f) : FLT_MAX;
+}
+
+static f32 DistanceSquaredToAABB(const vec3& point, f32 minX, f32 minY, f32 minZ, f32 maxX, f32 maxY, f32 maxZ)
+{
+  f32 dx = maxValue(maxValue(minX - point.x, point.x - maxX), 0.0f);
+  f32 dy = maxValue(maxValue(minY - point.y, point.y - maxY), 0.0f);
+  f32 dz = maxValue(maxValue(minZ - point.z, point.z - maxZ), 0.0f);
+  return dx*dx + dy*dy + dz*dz;
+}
+
+static bool IntersectTriangle(const vec3& origin, const vec3& direction, const vec3& a, const vec3& b, const vec3& c, f32 tMax, bvh_ray_hit_t* hit)
+{
+  vec3 e1 = b - a;
+  vec3 e2 = c - a;
+  vec3 p = cross(direction, e2);
+  f32 determinant = dot(e1, p);
+  if (fabsf(determinant) < 1e-12f)
+  {
+    return false;
+  }
+
+  f32 inverseDeterminant = 1.0f / determinant;
+  vec3 s = origin - a;
+  f32 u = dot(s, p) * inverseDeterminant;
+  if (u < 0.0f || u > 1.0f)
+  {
+    return false;
+  }
+
+  vec3 q = cross(s, e1);
+  f32 v = dot(direction, q) * inverseDeterminant;
+  if (v < 0.0f || u + v > 1.0f)
+  {
+    return false;
+  }
+
+  f32 t = dot(e2, q) * inverseDeterminant;
+  if (t <= 0.0f || t >= tMax)
+  {
+    return false;
+  }
+
+  hit->t_ = t;
+  hit->u_ = u;
+  hit->v_ = v;
+  return true;
+}
+
+static vec3 ClosestPointOnTriangle(const vec3& p, const vec3& a, const vec3& b, const vec3& c)
+{
+  vec3 ab = b - a;
+  vec3 ac = c - a;
+  vec3 ap = p - a;
+  f32 d1 = dot(ab, ap);
+  f32 d2 = dot(ac, ap);
+  if (d1 <= 0.0f && d2 <= 0.0f)
+    return a;
+
+  vec3 bp = p - b;
+  f32 d3 = dot(ab, bp);
+  f32 d4 = dot(ac, bp);
+  if (d3 >= 0.0f && d4 <= d3)
+    return b;
+
+  f32 vc = d1*d4 - d3*d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    return a + ab * (d1 / (d1 - d3));
+
+  vec3 cp = p - c;
+  f32 d5 = dot(ab, cp);
+  f32 d6 = dot(ac, cp);
+  if (d6 >= 0.0f && d5 <= d6)
+    return c;
+
+  f32 vb = d5*d2 - d1*d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    return a + ac * (d2 / (d2 - d6));
+
+  f32 va = d3*d6 - d5*d4;
+  if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+  f32 denominator = 1.0f / (va + vb + vc);
+  return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+static void IntersectLeaf(const bvh_t& bvh, u32 first, u32 count, const vec3& origin, const vec3& direction, bvh_ray_hit_t* hit, bool* found)
+{
+  for (u32 i(first); i<first + count; ++i)
+  {
+    const u32* triangle = bvh.triangles_ + i * 3;
+    if (IntersectTriangle(origin, direction, bvh.vertices_[triangle[0]], bvh.vertices_[triangle[1]], bvh.vertices_[triangle[2]], hit->t_, hit))
+    {
+      hit->triangle_ = bvh.triangleId_[i];
+      *found = true;
+    }
+  }
+}
+
+static void ClosestPointLeaf(const bvh_t& bvh, u32 first, u32 count, const vec3& point, f32* bestDistanceSquared, bvh_closest_point_t* result, bool* found)
+{
+  for (u32 i(first); i<first + count; ++i)
+  {
+    const u32* triangle = bvh.triangles_ + i * 3;
+    vec3 closest = ClosestPointOnTriangle(point, bvh.vertices_[triangle[0]], bvh.vertices_[triangle[1]], bvh.vertices_[triangle[2]]);
+    f32 distanceSquared = lengthSquared(closest - point);
+    if (distanceSquared < *bestDistanceSquared)
+    {
+      *bestDistanceSquared = distanceSquared;
+      result->point_ = closest;
+      result->triangle_ = bvh.triangleId_[i];
+      *found = true;
+    }
+  }
+}
+
+//Sorts the four slots of a wide node by distance
+static void SortChildren(const f32 distance[4], u32 order[4])
+{
+  for (u32 i(0); i<4; ++i)
+  {
+    order[i] = i;
+    for (u32 j(i); j>0 && distance[order[j - 1]] > distance[order[j]]; --j)
+    {
+      std::swap(order[j - 1], order[j]);
+    }
+  }
+}
+
+void mesh::bvhCreate(const vec3* vertices, u32 vertexCount, const u32* index, u32 indexCount, bool wideLayout, thread::thread_pool_t* pool, bvh_t* bvh)
+{
+  u32 triangleCount = indexCount / 3;
+  assert(triangleCount > 0);
+
+  //Compute bounds and centroid of every triangle
+  aabb_t* triangleBounds = new aabb_t[triangleCount];
+  vec3* centroids = new vec3[triangleCount];
+  u32* primitives = new u32[triangleCount];
+  thread::parallelFor(pool, triangleCount, 4096u,
+    [&](u32 begin, u32 end)
+    {
+      for (u32 i(begin); i<end; ++i)
+      {
+        aabb_t aabb = EmptyAABB();
+        Grow(aabb, vertices[index[i * 3]]);
+        Grow(aabb, vertices[index[i * 3 + 1]]);
+        Grow(aabb, vertices[index[i * 3 + 2]]);
+        triangleBounds[i] = aabb;
+        centroids[i] = (aabb.min_ + aabb.max_) * 0.5f;
+        primitives[i] = i;
+      }
+    }
+  );
+
+  //Build the tree. A binary tree with N leaves has 2N-1 nodes and every leaf has at least one triangle
+  build_context_t context;
+  context.triangleBounds_ = triangleBounds;
+  context.centroids_ = centroids;
+  context.primitives_ = primitives;
+  context.nodes_ = new bvh_node_t[triangleCount * 2];
+  context.nodeCount_ = 1u;
+  context.pool_ = pool;
+  BuildNode(context, 0u, 0u, triangleCount, 0u);
+
+  bvh->nodeCount_ = context.nodeCount_;
+  bvh->nodes_ = new bvh_node_t[bvh->nodeCount_];
+  std::copy(context.nodes_, context.nodes_ + bvh->nodeCount_, bvh->nodes_);
+  delete[] context.nodes_;
+
+  //Sort triangles in the order they are referenced by the leaves
+  bvh->triangleCount_ = triangleCount;
+  bvh->triangles_ = new u32[triangleCount * 3];
+  bvh->triangleId_ = primitives;
+  thread::parallelFor(pool, triangleCount, 4096u,
+    [&](u32 begin, u32 end)
+    {
+      for (u32 i(begin); i<end; ++i)
+      {
+        memcpy(bvh->triangles_ + i * 3, index + primitives[i] * 3, sizeof(u32) * 3);
+      }
+    }
+  );
+
+  bvh->vertexCount_ = vertexCount;
+  bvh->vertices_ = new vec3[vertexCount];
+  std::copy(vertices, vertices + vertexCount, bvh->vertices_);
+
+  bvh->wideNodes_ = nullptr;
+  bvh->wideNodeCount_ = 0u;
+  if (wideLayout)
+  {
+    std::vector<bvh_wide_node_t> wideNodes;
+    wideNodes.reserve(bvh->nodeCount_ / 3 + 1);
+    CollapseNode(bvh->nodes_, 0u, wideNodes);
+
+    bvh->wideNodeCount_ = (u32)wideNodes.size();
+    bvh->wideNodes_ = new bvh_wide_node_t[bvh->wideNodeCount_];
+    std::copy(wideNodes.begin(), wideNodes.end(), bvh->wideNodes_);
+  }
+
+  delete[] triangleBounds;
+  delete[] centroids;
+}
+
+void mesh::bvhCreate(const render::context_t& context, const mesh_t& mesh, bool wideLayout, thread::thread_pool_t* pool, bvh_t* bvh)
+{
+  //Read positions from the vertex buffer. Meshes in a geometry pool only use a range of the buffers
+  u32 stride = mesh.vertexFormat_.vertexSize_;
+  u32 positionOffset = mesh.vertexFormat_.attributeCount_ > 0 ? mesh.vertexFormat_.attributes_[0].offset_ : 0u;
+  vec3* position = new vec3[mesh.vertexCount_];
+  const u8* vertex = (const u8*)render::gpuBufferMap(context, mesh.vertexBuffer_) + (size_t)mesh.vertexOffset_ * stride;
+  for (u32 i(0); i<mesh.vertexCount_; ++i)
+  {
+    position[i] = *(const vec3*)(vertex + i * stride + positionOffset);
+  }
+  render::gpuBufferUnmap(context, mesh.vertexBuffer_);
+
+  //Read index buffer
+  u32* index = new u32[mesh.indexCount_];
+  memcpy(index, (const u32*)render::gpuBufferMap(context, mesh.indexBuffer_) + mesh.firstIndex_, sizeof(u32) * mesh.indexCount_);
+  render::gpuBufferUnmap(context, mesh.indexBuffer_);
+
+  bvhCreate(position, mesh.vertexCount_, index, mesh.indexCount_, wideLayout, pool, bvh);
+
+  delete[] position;
+  delete[] index;
+}
+
+void mesh::bvhDestroy(bvh_t* bvh)
+{
+  delete[] bvh->nodes_;
+  delete[] bvh->wideNodes_;
+  delete[] bvh->vertices_;
+  delete[] bvh->triangles_;
+  delete[] bvh->triangleId_;
+
+  *bvh = bvh_t();
+}
+
+void mesh::bvhRefit(const vec3* vertices, bvh_t* bvh)
+{
+  std::copy(vertices, vertices + bvh->vertexCount_, bvh->vertices_);
+
+  //Children are always stored after their parent, so traversing the nodes backwards updates children first
+  for (u32 i(bvh->nodeCount_); i-- > 0u;)
+  {
+    bvh_node_t& node = bvh->nodes_[i];
+    aabb_t aabb = EmptyAABB();
+    if (node.triangleCount_ > 0u)
+    {
+      const u32* triangle = bvh->triangles_ + node.leftFirst_ * 3;
+      for (u32 j(0); j<node.triangleCount_ * 3; ++j)
+      {
+        Grow(aabb, vertices[triangle[j]]);
+      }
+    }
+    else
+    {
+      const bvh_node_t& left = bvh->nodes_[node.leftFirst_];
+      const bvh_node_t& right = bvh->nodes_[node.leftFirst_ + 1];
+      Grow(aabb, { left.min_, left.max_ });
+      Grow(aabb, { right.min_, right.max_ });
+    }
+
+    node.min_ = aabb.min_;
+    node.max_ = aabb.max_;
+  }
+
+  //The 4-wide layout is generated again from the refitted binary tree
+  if (bvh->wideNodes_)
+  {
+    std::vector<bvh_wide_node_t> wideNodes;
+    wideNodes.reserve(bvh->wideNodeCount_);
+    CollapseNode(bvh->nodes_, 0u, wideNodes);
+
+    delete[] bvh->wideNodes_;
+    bvh->wideNodeCount_ = (u32)wideNodes.size();
+    bvh->wideNodes_ = new bvh_wide_node_t[bvh->wideNodeCount_];
+    std::copy(wideNodes.begin(), wideNodes.end(), bvh->wideNodes_);
+  }
+}
+
+bool mesh::bvhIntersectRay(const bvh_t& bvh, const vec3& origin, const vec3& direction, f32 tMax, bvh_ray_hit_t* hit)
+{
+  vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+  bool found = false;
+  hit->t_ = tMax;
+
+  stack_entry_t stack[STACK_SIZE];
+  u32 stackSize = 0u;
+
+  if (bvh.wideNodes_)
+  {
+    stack[stackSize++] = { 0u, 0.0f };
+    while (stackSize > 0u)
+    {
+      stack_entry_t entry = stack[--stackSize];
+      if (entry.distance_ >= hit->t_)
+      {
+        continue;
+      }
+
+      const bvh_wide_node_t& node = bvh.wideNodes_[entry.node_];
+      f32 distance[4];
+      for (u32 i(0); i<4; ++i)
+      {
+        distance[i] = node.child_[i] == INVALID_CHILD ? FLT_MAX :
+          IntersectAABB(origin, direction, inverseDirection, node.minX_[i], node.minY_[i], node.minZ_[i], node.maxX_[i], node.maxY_[i], node.maxZ_[i], hit->t_);
+      }
+
+      u32 order[4];
+      SortChildren(distance, order);
+
+      //Test leaves front to back, then push interior children back to front so the closest one is visited first
+      for (u32 i(0); i<4; ++i)
+      {
+        u32 child = order[i];
+        if (node.triangleCount_[child] > 0u && distance[child] < hit->t_)
+        {
+          IntersectLeaf(bvh, node.child_[child], node.triangleCount_[child], origin, direction, hit, &found);
+        }
+      }
+
+      for (u32 i(4); i>0; --i)
+      {
+        u32 child = order[i - 1];
+        if (node.triangleCount_[child] == 0u && distance[child] < hit->t_)
+        {
+          stack[stackSize++] = { node.child_[child], distance[child] };
+        }
+      }
+    }
+  }
+  else
+  {
+    const bvh_node_t& root = bvh.nodes_[0];
+    f32 rootDistance = IntersectAABB(origin, direction, inverseDirection, root.min_.x, root.min_.y, root.min_.z, root.max_.x, root.max_.y, root.max_.z, hit->t_);
+    if (rootDistance != FLT_MAX)
+    {
+      stack[stackSize++] = { 0u, rootDistance };
+    }
+
+    while (stackSize > 0u)
+    {
+      stack_entry_t entry = stack[--stackSize];
+      if (entry.distance_ >= hit->t_)
+      {
+        continue;
+      }
+
+      const bvh_node_t& node = bvh.nodes_[entry.node_];
+      if (node.triangleCount_ > 0u)
+      {
+        IntersectLeaf(bvh, node.leftFirst_, node.triangleCount_, origin, direction, hit, &found);
+        continue;
+      }
+
+      u32 child[2] = { node.leftFirst_, node.leftFirst_ + 1 };
+      f32 distance[2];
+      for (u32 i(0); i<2; ++i)
+      {
+        const bvh_node_t& c = bvh.nodes_[child[i]];
+        distance[i] = IntersectAABB(origin, direction, inverseDirection, c.min_.x, c.min_.y, c.min_.z, c.max_.x, c.max_.y, c.max_.z, hit->t_);
+      }
+
+      //Push the farthest child first
+      u32 nearest = distance[0] <= distance[1] ? 0 : 1;
+      if (distance[1 - nearest] != FLT_MAX)
+      {
+        stack[stackSize++] = { child[1 - nearest], distance[1 - nearest] };
+      }
+      if (distance[nearest] != FLT_MAX)
+      {
+        stack[stackSize++] = { child[nearest], distance[nearest] };
+      }
+    }
+  }
+
+  return found;
+}
+
+bool mesh::bvhClosestPoint(const bvh_t& bvh, const vec3& point, f32 maxDistance, bvh_closest_point_t* result)
+{
+  f32 bestDistanceSquared = maxDistance * maxDistance;
+  bool found = false;
+
+  stack_entry_t stack[STACK_SIZE];
+  u32 stackSize = 0u;
+  stack[stackSize++] = { 0u, 0.0f };
+
+  if (bvh.wideNodes_)
+  {
+    while (stackSize > 0u)
+    {
+      stack_entry_t entry = stack[--stackSize];
+      if (entry.distance_ >= bestDistanceSquared)
+      {
+        continue;
+      }
+
+      const bvh_wide_node_t& node = bvh.wideNodes_[entry.node_];
+      f32 distance[4];
+      for (u32 i(0); i<4; ++i)
+      {
+        distance[i] = node.child_[i] == INVALID_CHILD ? FLT_MAX :
+          DistanceSquaredToAABB(point, node.minX_[i], node.minY_[i], node.minZ_[i], node.maxX_[i], node.maxY_[i], node.maxZ_[i]);
+      }
+
+      u32 order[4];
+      SortChildren(distance, order);
+
+      for (u32 i(0); i<4; ++i)
+      {
+        u32 child = order[i];
+        if (node.triangleCount_[child] > 0u && distance[child] < bestDistanceSquared)
+        {
+          ClosestPointLeaf(bvh, node.child_[child], node.triangleCount_[child], point, &bestDistanceSquared, result, &found);
+        }
+      }
+
+      for (u32 i(4); i>0; --i)
+      {
+        u32 child = order[i - 1];
+        if (node.triangleCount_[child] == 0u && distance[child] < bestDistanceSquared)
+        {
+          stack[stackSize++] = { node.child_[child], distance[child] };
+        }
+      }
+    }
+  }
+  else
+  {
+    while (stackSize > 0u)
+    {
+      stack_entry_t entry = stack[--stackSize];
+      if (entry.distance_ >= bestDistanceSquared)
+      {
+        continue;
+      }
+
+      const bvh_node_t& node = bvh.nodes_[entry.node_];
+      if (node.triangleCount_ > 0u)
+      {
+        ClosestPointLeaf(bvh, node.leftFirst_, node.triangleCount_, point, &bestDistanceSquared, result, &found);
+        continue;
+      }
+
+      u32 child[2] = { node.leftFirst_, node.leftFirst_ + 1 };
+      f32 distance[2];
+      for (u32 i(0); i<2; ++i)
+      {
+        const bvh_node_t& c = bvh.nodes_[child[i]];
+        distance[i] = DistanceSquaredToAABB(point, c.min_.x, c.min_.y, c.min_.z, c.max_.x, c.max_.y, c.max_.z);
+      }
+
+      //Push the farthest child first
+      u32 nearest = distance[0] <= distance[1] ? 0 : 1;
+      stack[stackSize++] = { child[1 - nearest], distance[1 - nearest] };
+      stack[stackSize++] = { child[nearest], distance[nearest] };
+    }
+  }
+
+  if (found)
+  {
+    result->distance_ = sqrtf(bestDistanceSquared);
+  }
+
+  return found;
+}
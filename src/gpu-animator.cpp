@@ -0,0 +1,621 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "gpu-animator.h"
+
+#include <vector>
+#include <cassert>
+
+using namespace bkk;
+using namespace bkk::mesh;
+using namespace bkk::maths;
+
+//Layout of the data buffer. Everything is stored in 32 bit words and offsets are in words.
+//The header is followed by the skeleton arrays, a table with ANIMATION_ENTRY_SIZE words per animation and the data of the animations
+enum data_header_e
+{
+  HEADER_INSTANCE_COUNT = 0,
+  HEADER_NODE_COUNT,
+  HEADER_BONE_COUNT,
+  HEADER_NODE_PARENT,
+  HEADER_BIND_POSE,
+  HEADER_BONE_NODE,
+  HEADER_BONE_OFFSET,
+  HEADER_GLOBAL_INVERSE,
+  HEADER_ANIMATION_TABLE,
+  HEADER_SIZE
+};
+
+//Animation table entry: frame count, animated node count, offset of the node indices, of the tracks, of the key frames and of the key values.
+//Tracks are TRACK_SIZE words (first key, key count, first value, min[3], extent[3]). Key frames and values are 16 bit, packed two per word
+static const u32 ANIMATION_ENTRY_SIZE = 6u;
+static const u32 TRACK_SIZE = 9u;
+
+static const char* gAnimationShaderSource = R"(
+  #version 440 core
+
+  layout (local_size_x = 64) in;
+
+  //Must match data_header_e, ANIMATION_ENTRY_SIZE and TRACK_SIZE
+  const uint HEADER_INSTANCE_COUNT = 0u;
+  const uint HEADER_NODE_COUNT = 1u;
+  const uint HEADER_BONE_COUNT = 2u;
+  const uint HEADER_NODE_PARENT = 3u;
+  const uint HEADER_BIND_POSE = 4u;
+  const uint HEADER_BONE_NODE = 5u;
+  const uint HEADER_BONE_OFFSET = 6u;
+  const uint HEADER_GLOBAL_INVERSE = 7u;
+  const uint HEADER_ANIMATION_TABLE = 8u;
+  const uint ANIMATION_ENTRY_SIZE = 6u;
+  const uint TRACK_SIZE = 9u;
+
+  layout (std430, binding = 0) readonly buffer DATA
+  {
+    uint data[];
+  };
+
+  struct instance_t
+  {
+    uint animation;
+    float cursor;
+  };
+
+  layout (std430, binding = 1) readonly buffer INSTANCES
+  {
+    instance_t instance[];
+  };
+
+  layout (std430, binding = 2) buffer POSE
+  {
+    mat4 pose[];
+  };
+
+  layout (std430, binding = 3) writeonly buffer PALETTE
+  {
+    mat4 palette[];
+  };
+
+  float ReadFloat(uint offset)
+  {
+    return uintBitsToFloat(data[offset]);
+  }
+
+  mat4 ReadMatrix(uint offset)
+  {
+    return mat4(ReadFloat(offset + 0u),  ReadFloat(offset + 1u),  ReadFloat(offset + 2u),  ReadFloat(offset + 3u),
+                ReadFloat(offset + 4u),  ReadFloat(offset + 5u),  ReadFloat(offset + 6u),  ReadFloat(offset + 7u),
+                ReadFloat(offset + 8u),  ReadFloat(offset + 9u),  ReadFloat(offset + 10u), ReadFloat(offset + 11u),
+                ReadFloat(offset + 12u), ReadFloat(offset + 13u), ReadFloat(offset + 14u), ReadFloat(offset + 15u));
+  }
+
+  uint ReadU16(uint offset, uint index)
+  {
+    return (data[offset + (index >> 1u)] >> ((index & 1u) * 16u)) & 0xFFFFu;
+  }
+
+  float DequantizeSigned(uint value)
+  {
+    return float(int(value << 16u) >> 16) / 32767.0;
+  }
+
+  //Finds the last key of the track not after 'frame' and the interpolation factor to the next key
+  uint FindKey(uint keyFrameOffset, uint firstKey, uint keyCount, float frame, out float t)
+  {
+    uint low = 0u;
+    uint high = keyCount - 1u;
+    while (low < high)
+    {
+      uint middle = (low + high + 1u) / 2u;
+      if (float(ReadU16(keyFrameOffset, firstKey + middle)) <= frame)
+      {
+        low = middle;
+      }
+      else
+      {
+        high = middle - 1u;
+      }
+    }
+
+    t = 0.0;
+    if (low < keyCount - 1u)
+    {
+      float frame0 = float(ReadU16(keyFrameOffset, firstKey + low));
+      float frame1 = float(ReadU16(keyFrameOffset, firstKey + low + 1u));
+      t = (frame - frame0) / (frame1 - frame0);
+    }
+    return low;
+  }
+
+  vec3 DecodeVector(uint track, uint keyValueOffset, uint key)
+  {
+    uint value = data[track + 2u] + key * 3u;
+    return vec3(ReadFloat(track + 3u) + ReadFloat(track + 6u) * (float(ReadU16(keyValueOffset, value)) / 65535.0),
+                ReadFloat(track + 4u) + ReadFloat(track + 7u) * (float(ReadU16(keyValueOffset, value + 1u)) / 65535.0),
+                ReadFloat(track + 5u) + ReadFloat(track + 8u) * (float(ReadU16(keyValueOffset, value + 2u)) / 65535.0));
+  }
+
+  vec4 DecodeOrientation(uint track, uint keyValueOffset, uint key)
+  {
+    uint value = data[track + 2u] + key * 4u;
+    return normalize(vec4(DequantizeSigned(ReadU16(keyValueOffset, value)),
+                          DequantizeSigned(ReadU16(keyValueOffset, value + 1u)),
+                          DequantizeSigned(ReadU16(keyValueOffset, value + 2u)),
+                          DequantizeSigned(ReadU16(keyValueOffset, value + 3u))));
+  }
+
+  vec3 SampleVector(uint track, uint keyFrameOffset, uint keyValueOffset, float frame)
+  {
+    float t;
+    uint key = FindKey(keyFrameOffset, data[track], data[track + 1u], frame, t);
+    vec3 value = DecodeVector(track, keyValueOffset, key);
+    return (t > 0.0) ? mix(value, DecodeVector(track, keyValueOffset, key + 1u), t) : value;
+  }
+
+  vec4 SampleOrientation(uint track, uint keyFrameOffset, uint keyValueOffset, float frame)
+  {
+    float t;
+    uint key = FindKey(keyFrameOffset, data[track], data[track + 1u], frame, t);
+    vec4 value = DecodeOrientation(track, keyValueOffset, key);
+    return (t > 0.0) ? normalize(mix(value, DecodeOrientation(track, keyValueOffset, key + 1u), t)) : value;
+  }
+
+  //Same memory layout as maths::createTransform
+  mat4 CreateTransform(vec3 position, vec3 scale, vec4 q)
+  {
+    return mat4(scale.x * (1.0 - 2.0 * (q.y * q.y + q.z * q.z)), scale.x * (2.0 * (q.x * q.y + q.z * q.w)), scale.x * (2.0 * (q.x * q.z - q.y * q.w)), 0.0,
+                scale.y * (2.0 * (q.x * q.y - q.z * q.w)), scale.y * (1.0 - 2.0 * (q.x * q.x + q.z * q.z)), scale.y * (2.0 * (q.y * q.z + q.x * q.w)), 0.0,
+                scale.z * (2.0 * (q.x * q.z + q.y * q.w)), scale.z * (2.0 * (q.y * q.z - q.x * q.w)), scale.z * (1.0 - 2.0 * (q.x * q.x + q.y * q.y)), 0.0,
+                position.x, position.y, position.z, 1.0);
+  }
+
+  void main()
+  {
+    uint instanceIndex = gl_GlobalInvocationID.x;
+    if (instanceIndex >= data[HEADER_INSTANCE_COUNT])
+    {
+      return;
+    }
+
+    uint nodeCount = data[HEADER_NODE_COUNT];
+    uint boneCount = data[HEADER_BONE_COUNT];
+    uint poseBase = instanceIndex * nodeCount;
+
+    //Start from the bind pose
+    for (uint node = 0u; node < nodeCount; ++node)
+    {
+      pose[poseBase + node] = ReadMatrix(data[HEADER_BIND_POSE] + node * 16u);
+    }
+
+    //Replace the local transform of the animated nodes
+    uint animation = data[HEADER_ANIMATION_TABLE] + instance[instanceIndex].animation * ANIMATION_ENTRY_SIZE;
+    uint animatedNodeCount = data[animation + 1u];
+    uint nodes = data[animation + 2u];
+    uint tracks = data[animation + 3u];
+    uint keyFrames = data[animation + 4u];
+    uint keyValues = data[animation + 5u];
+    float frame = clamp(instance[instanceIndex].cursor, 0.0, 1.0) * float(max(data[animation], 1u) - 1u);
+    for (uint i = 0u; i < animatedNodeCount; ++i)
+    {
+      uint track = tracks + i * 3u * TRACK_SIZE;
+      pose[poseBase + data[nodes + i]] = CreateTransform(SampleVector(track, keyFrames, keyValues, frame),
+                                                         SampleVector(track + TRACK_SIZE, keyFrames, keyValues, frame),
+                                                         SampleOrientation(track + 2u * TRACK_SIZE, keyFrames, keyValues, frame));
+    }
+
+    //Local to model transforms. Parents come before their children. Matrices are uploaded with the layout of the CPU,
+    //so products are written in reverse order
+    for (uint node = 1u; node < nodeCount; ++node)
+    {
+      pose[poseBase + node] = pose[poseBase + data[data[HEADER_NODE_PARENT] + node]] * pose[poseBase + node];
+    }
+
+    mat4 globalInverse = ReadMatrix(data[HEADER_GLOBAL_INVERSE]);
+    for (uint bone = 0u; bone < boneCount; ++bone)
+    {
+      palette[instanceIndex * boneCount + bone] = globalInverse * pose[poseBase + data[data[HEADER_BONE_NODE] + bone]] * ReadMatrix(data[HEADER_BONE_OFFSET] + bone * 16u);
+    }
+  }
+)";
+
+static const char* gSkinningShaderSource = R"(
+  #version 440 core
+
+  layout (local_size_x = 64) in;
+
+  layout (push_constant) uniform CONSTANTS
+  {
+    uint vertexCount;
+    uint boneCount;
+    uint firstVertex;       //First vertex of the mesh in the input buffer
+    uint inputStride;       //In floats
+    uint outputStride;      //In floats
+    uint boneWeightOffset;  //In floats. Weights are followed by the indices
+    uint hasNormals;
+  }constants;
+
+  layout (std430, binding = 0) readonly buffer INPUT
+  {
+    float inputVertex[];
+  };
+
+  layout (std430, binding = 1) readonly buffer PALETTE
+  {
+    mat4 palette[];
+  };
+
+  layout (std430, binding = 2) writeonly buffer OUTPUT
+  {
+    float outputVertex[];
+  };
+
+  void main()
+  {
+    uint vertex = gl_GlobalInvocationID.x;
+    uint instanceIndex = gl_GlobalInvocationID.y;
+    if (vertex >= constants.vertexCount)
+    {
+      return;
+    }
+
+    uint inputBase = (constants.firstVertex + vertex) * constants.inputStride;
+    uint outputBase = (instanceIndex * constants.vertexCount + vertex) * constants.outputStride;
+    uint firstBone = instanceIndex * constants.boneCount;
+    uint weights = inputBase + constants.boneWeightOffset;
+
+    mat4 transform = palette[firstBone + uint(inputVertex[weights + 4u])] * inputVertex[weights] +
+                     palette[firstBone + uint(inputVertex[weights + 5u])] * inputVertex[weights + 1u] +
+                     palette[firstBone + uint(inputVertex[weights + 6u])] * inputVertex[weights + 2u] +
+                     palette[firstBone + uint(inputVertex[weights + 7u])] * inputVertex[weights + 3u];
+
+    vec3 position = (transform * vec4(inputVertex[inputBase], inputVertex[inputBase + 1u], inputVertex[inputBase + 2u], 1.0)).xyz;
+    outputVertex[outputBase] = position.x;
+    outputVertex[outputBase + 1u] = position.y;
+    outputVertex[outputBase + 2u] = position.z;
+
+    uint i = 3u;
+    if (constants.hasNormals != 0u)
+    {
+      vec3 normal = normalize(mat3(transform) * vec3(inputVertex[inputBase + 3u], inputVertex[inputBase + 4u], inputVertex[inputBase + 5u]));
+      outputVertex[outputBase + 3u] = normal.x;
+      outputVertex[outputBase + 4u] = normal.y;
+      outputVertex[outputBase + 5u] = normal.z;
+      i = 6u;
+    }
+
+    //Rest of attributes are not affected by the skinning
+    for (; i < constants.outputStride; ++i)
+    {
+      outputVertex[outputBase + i] = inputVertex[inputBase + i];
+    }
+  }
+)";
+
+static void PushFloats(const f32* value, u32 count, std::vector<u32>* data)
+{
+  for (u32 i(0); i<count; ++i)
+  {
+    u32 word;
+    memcpy(&word, &value[i], sizeof(u32));
+    data->push_back(word);
+  }
+}
+
+//Packs 16 bit values two per word, the first one in the low bits
+static void PushU16(const u16* value, u32 count, std::vector<u32>* data)
+{
+  for (u32 i(0); i<count; i += 2)
+  {
+    u32 high = (i + 1 < count) ? value[i + 1] : 0u;
+    data->push_back(value[i] | (high << 16u));
+  }
+}
+
+
+/*********************
+* API Implementation
+**********************/
+
+void mesh::gpuAnimatorCreate(const render::context_t& context, const mesh_t& mesh, u32 instanceCount, gpu_animator_t* animator)
+{
+  assert(mesh.skeleton_ && mesh.compressedAnimations_);
+
+  const skeleton_t* skeleton = mesh.skeleton_;
+  animator->instanceCount_ = instanceCount;
+  animator->nodeCount_ = skeleton->nodeCount_;
+  animator->boneCount_ = skeleton->boneCount_;
+  animator->animationCount_ = mesh.animationCount_;
+  animator->duration_ = new f32[mesh.animationCount_];
+
+  //Build the data buffer
+  std::vector<u32> data(HEADER_SIZE);
+  data[HEADER_INSTANCE_COUNT] = instanceCount;
+  data[HEADER_NODE_COUNT] = skeleton->nodeCount_;
+  data[HEADER_BONE_COUNT] = skeleton->boneCount_;
+
+  data[HEADER_NODE_PARENT] = (u32)data.size();
+  data.insert(data.end(), skeleton->nodeParent_, skeleton->nodeParent_ + skeleton->nodeCount_);
+
+  data[HEADER_BIND_POSE] = (u32)data.size();
+  PushFloats(skeleton->bindPose_[0].data, skeleton->nodeCount_ * 16, &data);
+
+  data[HEADER_BONE_NODE] = (u32)data.size();
+  data.insert(data.end(), skeleton->boneNode_, skeleton->boneNode_ + skeleton->boneCount_);
+
+  data[HEADER_BONE_OFFSET] = (u32)data.size();
+  PushFloats(skeleton->offsets_[0].data, skeleton->boneCount_ * 16, &data);
+
+  data[HEADER_GLOBAL_INVERSE] = (u32)data.size();
+  PushFloats(skeleton->globalInverseTransform_.data, 16, &data);
+
+  u32 animationTable = (u32)data.size();
+  data[HEADER_ANIMATION_TABLE] = animationTable;
+  data.resize(data.size() + mesh.animationCount_ * ANIMATION_ENTRY_SIZE);
+  for (u32 i(0); i<mesh.animationCount_; ++i)
+  {
+    const compressed_animation_t& animation = mesh.compressedAnimations_[i];
+    animator->duration_[i] = animation.duration_;
+
+    u32* entry = &data[animationTable + i * ANIMATION_ENTRY_SIZE];
+    entry[0] = animation.frameCount_;
+    entry[1] = animation.nodeCount_;
+    entry[2] = (u32)data.size();
+    data.insert(data.end(), animation.nodes_, animation.nodes_ + animation.nodeCount_);
+
+    entry = &data[animationTable + i * ANIMATION_ENTRY_SIZE];
+    entry[3] = (u32)data.size();
+    for (u32 track(0); track<animation.nodeCount_ * 3; ++track)
+    {
+      const compressed_track_t& t = animation.tracks_[track];
+      data.push_back(t.firstKey_);
+      data.push_back(t.keyCount_);
+      data.push_back(t.firstValue_);
+      PushFloats(t.min_, 3, &data);
+      PushFloats(t.extent_, 3, &data);
+    }
+
+    entry = &data[animationTable + i * ANIMATION_ENTRY_SIZE];
+    entry[4] = (u32)data.size();
+    PushU16(animation.keyFrame_, animation.keyCount_, &data);
+
+    entry = &data[animationTable + i * ANIMATION_ENTRY_SIZE];
+    entry[5] = (u32)data.size();
+    PushU16(animation.keyValue_, animation.keyValueCount_, &data);
+  }
+
+  //The data doesn't change, so it is copied once to device local memory
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::STORAGE_BUFFER,
+    data.data(), sizeof(u32) * data.size(),
+    nullptr, nullptr, &animator->dataBuffer_);
+
+  //Instance data stays mapped so the CPU can write cursors every frame
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::STORAGE_BUFFER,
+    render::gpu_memory_type_e::HOST_VISIBLE_COHERENT,
+    nullptr, sizeof(gpu_animator_instance_t) * instanceCount,
+    nullptr, &animator->instanceBuffer_);
+
+  animator->instance_ = (gpu_animator_instance_t*)render::gpuBufferMap(context, animator->instanceBuffer_);
+  for (u32 i(0); i<instanceCount; ++i)
+  {
+    animator->instance_[i].animation_ = 0u;
+    animator->instance_[i].cursor_ = 0.0f;
+  }
+
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::STORAGE_BUFFER,
+    render::gpu_memory_type_e::DEVICE_LOCAL,
+    nullptr, sizeof(maths::mat4) * instanceCount * skeleton->nodeCount_,
+    nullptr, &animator->poseBuffer_);
+
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::STORAGE_BUFFER,
+    render::gpu_memory_type_e::DEVICE_LOCAL,
+    nullptr, sizeof(maths::mat4) * instanceCount * skeleton->boneCount_,
+    nullptr, &animator->paletteBuffer_);
+
+  //Compute pipeline
+  render::descriptorPoolCreate(context, 1u,
+    render::combined_image_sampler_count(0u),
+    render::uniform_buffer_count(0u),
+    render::storage_buffer_count(4u),
+    render::storage_image_count(0u),
+    &animator->descriptorPool_);
+
+  render::descriptor_binding_t bindings[4] = { { render::descriptor_t::type::STORAGE_BUFFER, 0, render::descriptor_t::stage::COMPUTE },
+                                               { render::descriptor_t::type::STORAGE_BUFFER, 1, render::descriptor_t::stage::COMPUTE },
+                                               { render::descriptor_t::type::STORAGE_BUFFER, 2, render::descriptor_t::stage::COMPUTE },
+                                               { render::descriptor_t::type::STORAGE_BUFFER, 3, render::descriptor_t::stage::COMPUTE } };
+
+  render::descriptorSetLayoutCreate(context, bindings, 4u, &animator->descriptorSetLayout_);
+  render::pipelineLayoutCreate(context, &animator->descriptorSetLayout_, 1u, nullptr, 0u, &animator->pipelineLayout_);
+
+  render::descriptor_t descriptors[4] = { render::getDescriptor(animator->dataBuffer_), render::getDescriptor(animator->instanceBuffer_),
+                                          render::getDescriptor(animator->poseBuffer_), render::getDescriptor(animator->paletteBuffer_) };
+  render::descriptorSetCreate(context, animator->descriptorPool_, animator->descriptorSetLayout_, descriptors, &animator->descriptorSet_);
+
+  render::shaderCreateFromGLSLSource(context, render::shader_t::COMPUTE_SHADER, gAnimationShaderSource, &animator->shader_);
+  render::computePipelineCreate(context, animator->pipelineLayout_, animator->shader_, &animator->pipeline_);
+}
+
+void mesh::gpuAnimatorDestroy(const render::context_t& context, gpu_animator_t* animator)
+{
+  render::gpuBufferUnmap(context, animator->instanceBuffer_);
+  render::gpuBufferDestroy(context, nullptr, &animator->dataBuffer_);
+  render::gpuBufferDestroy(context, nullptr, &animator->instanceBuffer_);
+  render::gpuBufferDestroy(context, nullptr, &animator->poseBuffer_);
+  render::gpuBufferDestroy(context, nullptr, &animator->paletteBuffer_);
+
+  render::descriptorSetDestroy(context, &animator->descriptorSet_);
+  render::descriptorSetLayoutDestroy(context, &animator->descriptorSetLayout_);
+  render::descriptorPoolDestroy(context, &animator->descriptorPool_);
+  render::computePipelineDestroy(context, &animator->pipeline_);
+  render::pipelineLayoutDestroy(context, &animator->pipelineLayout_);
+  render::shaderDestroy(context, &animator->shader_);
+
+  delete[] animator->duration_;
+  animator->duration_ = nullptr;
+  animator->instance_ = nullptr;
+}
+
+void mesh::gpuAnimatorUpdate(f32 deltaTime, const f32* speed, gpu_animator_t* animator)
+{
+  for (u32 i(0); i<animator->instanceCount_; ++i)
+  {
+    gpu_animator_instance_t& instance = animator->instance_[i];
+    f32 duration = animator->duration_[instance.animation_];
+    if (duration <= 0.0f)
+    {
+      continue;
+    }
+
+    f32 cursor = instance.cursor_ + (deltaTime / duration) * (speed ? speed[i] : 1.0f);
+    cursor -= floorf(cursor);
+    instance.cursor_ = cursor;
+  }
+}
+
+void mesh::gpuAnimatorDispatch(VkCommandBuffer commandBuffer, const gpu_animator_t& animator)
+{
+  render::computePipelineBind(commandBuffer, animator.pipeline_);
+  render::descriptor_set_t descriptorSet = animator.descriptorSet_;
+  render::descriptorSetBindForCompute(commandBuffer, animator.pipelineLayout_, 0u, &descriptorSet, 1u);
+  vkCmdDispatch(commandBuffer, (animator.instanceCount_ + 63) / 64, 1, 1);
+
+  //Make the palettes visible to the shaders that consume them
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = animator.paletteBuffer_.handle_;
+  barrier.offset = 0u;
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0u, 0u, nullptr, 1u, &barrier, 0u, nullptr);
+}
+
+void mesh::gpuSkinningCreate(const render::context_t& context, const mesh_t& mesh, const render::gpu_buffer_t& palette, u32 instanceCount, gpu_skinning_t* skinning)
+{
+  assert(mesh.skeleton_ && mesh.vertexFormat_.attributeCount_ >= 3);
+
+  //Bone weights and indices are the last two attributes of skinned meshes. Normals, if present, follow the position
+  const render::vertex_format_t& format = mesh.vertexFormat_;
+  u32 attributeCount = format.attributeCount_ - 2;
+  u32 inputStride = format.vertexSize_ / sizeof(f32);
+  u32 boneWeightOffset = format.attributes_[attributeCount].offset_ / sizeof(f32);
+  u32 outputStride = boneWeightOffset;
+  bool hasNormals = attributeCount > 1 && format.attributes_[1].format_ == render::vertex_attribute_t::format::VEC3;
+
+  skinning->vertexCount_ = mesh.vertexCount_;
+  skinning->instanceCount_ = instanceCount;
+
+  u32* constants = skinning->constants_;
+  constants[0] = mesh.vertexCount_;
+  constants[1] = mesh.skeleton_->boneCount_;
+  constants[2] = (u32)mesh.vertexOffset_;
+  constants[3] = inputStride;
+  constants[4] = outputStride;
+  constants[5] = boneWeightOffset;
+  constants[6] = hasNormals ? 1u : 0u;
+  constants[7] = 0u;
+
+  std::vector<render::vertex_attribute_t> attributes(format.attributes_, format.attributes_ + attributeCount);
+  for (u32 i(0); i<attributeCount; ++i)
+  {
+    attributes[i].stride_ = outputStride * sizeof(f32);
+  }
+  render::vertexFormatCreate(attributes.data(), attributeCount, &skinning->vertexFormat_);
+
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::VERTEX_BUFFER | render::gpu_buffer_t::usage::STORAGE_BUFFER,
+    render::gpu_memory_type_e::DEVICE_LOCAL,
+    nullptr, sizeof(f32) * outputStride * mesh.vertexCount_ * instanceCount,
+    nullptr, &skinning->vertexBuffer_);
+
+  //Compute pipeline
+  render::descriptorPoolCreate(context, 1u,
+    render::combined_image_sampler_count(0u),
+    render::uniform_buffer_count(0u),
+    render::storage_buffer_count(3u),
+    render::storage_image_count(0u),
+    &skinning->descriptorPool_);
+
+  render::descriptor_binding_t bindings[3] = { { render::descriptor_t::type::STORAGE_BUFFER, 0, render::descriptor_t::stage::COMPUTE },
+                                               { render::descriptor_t::type::STORAGE_BUFFER, 1, render::descriptor_t::stage::COMPUTE },
+                                               { render::descriptor_t::type::STORAGE_BUFFER, 2, render::descriptor_t::stage::COMPUTE } };
+
+  render::descriptorSetLayoutCreate(context, bindings, 3u, &skinning->descriptorSetLayout_);
+  render::push_constant_range_t pushConstantRange = { VK_SHADER_STAGE_COMPUTE_BIT, sizeof(skinning->constants_), 0u };
+  render::pipelineLayoutCreate(context, &skinning->descriptorSetLayout_, 1u, &pushConstantRange, 1u, &skinning->pipelineLayout_);
+
+  render::descriptor_t descriptors[3] = { render::getDescriptor(mesh.vertexBuffer_), render::getDescriptor(palette), render::getDescriptor(skinning->vertexBuffer_) };
+  render::descriptorSetCreate(context, skinning->descriptorPool_, skinning->descriptorSetLayout_, descriptors, &skinning->descriptorSet_);
+
+  render::shaderCreateFromGLSLSource(context, render::shader_t::COMPUTE_SHADER, gSkinningShaderSource, &skinning->shader_);
+  render::computePipelineCreate(context, skinning->pipelineLayout_, skinning->shader_, &skinning->pipeline_);
+}
+
+void mesh::gpuSkinningDestroy(const render::context_t& context, gpu_skinning_t* skinning)
+{
+  render::gpuBufferDestroy(context, nullptr, &skinning->vertexBuffer_);
+  render::vertexFormatDestroy(&skinning->vertexFormat_);
+
+  render::descriptorSetDestroy(context, &skinning->descriptorSet_);
+  render::descriptorSetLayoutDestroy(context, &skinning->descriptorSetLayout_);
+  render::descriptorPoolDestroy(context, &skinning->descriptorPool_);
+  render::computePipelineDestroy(context, &skinning->pipeline_);
+  render::pipelineLayoutDestroy(context, &skinning->pipelineLayout_);
+  render::shaderDestroy(context, &skinning->shader_);
+}
+
+void mesh::gpuSkinningDispatch(VkCommandBuffer commandBuffer, const gpu_skinning_t& skinning)
+{
+  render::computePipelineBind(commandBuffer, skinning.pipeline_);
+  render::descriptor_set_t descriptorSet = skinning.descriptorSet_;
+  render::descriptorSetBindForCompute(commandBuffer, skinning.pipelineLayout_, 0u, &descriptorSet, 1u);
+  render::pushConstants(commandBuffer, skinning.pipelineLayout_, 0u, skinning.constants_);
+  vkCmdDispatch(commandBuffer, (skinning.vertexCount_ + 63) / 64, skinning.instanceCount_, 1);
+
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = skinning.vertexBuffer_.handle_;
+  barrier.offset = 0u;
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                       0u, 0u, nullptr, 1u, &barrier, 0u, nullptr);
+}
+
+void mesh::drawSkinned(VkCommandBuffer commandBuffer, const mesh_t& mesh, const gpu_skinning_t& skinning, u32 instance)
+{
+  vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer_.handle_, 0, VK_INDEX_TYPE_UINT32);
+
+  uint32_t bindingCount = skinning.vertexFormat_.bindingCount_;
+  std::vector<VkBuffer> buffers(bindingCount, skinning.vertexBuffer_.handle_);
+  std::vector<VkDeviceSize> offsets(bindingCount, (VkDeviceSize)instance * skinning.vertexCount_ * skinning.vertexFormat_.vertexSize_);
+  vkCmdBindVertexBuffers(commandBuffer, 0, bindingCount, &buffers[0], &offsets[0]);
+
+  //Deformed vertices only contain the vertices of the mesh, so no vertex offset is needed
+  vkCmdDrawIndexed(commandBuffer, mesh.indexCount_, 1, mesh.firstIndex_, 0, instance);
+}
@@ -0,0 +1,399 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "ibl-cache.h"
+#include "render.h"
+#include "image.h"
+#include "mapped-file.h"
+#include "maths.h"
+#include "thread-pool.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace bkk;
+using namespace bkk::render;
+
+//Maps are computed as 32 bit float RGBA. The environment is stored as half float RGBA, since it is by far the biggest map
+//(about 256MB with the default size instead of 512MB) and it is only sampled to compute the other maps and draw the sky
+static const VkFormat gCacheFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+static const VkFormat gEnvironmentCacheFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+static const uint32_t gCacheVersion = 2u;
+
+//Size of a texel of the formats used in the cache, or 0 if the format is not one of them
+static uint32_t CacheTexelSize(uint32_t format)
+{
+  return format == (uint32_t)VK_FORMAT_R32G32B32A32_SFLOAT ? 16u : format == (uint32_t)VK_FORMAT_R16G16B16A16_SFLOAT ? 8u : 0u;
+}
+
+//Header of the cache files. Levels follow it, from the most detailed one, with all the layers of a level together
+struct cache_header_t
+{
+  char magic_[4];
+  uint32_t version_;
+  uint32_t format_;
+  uint32_t width_;
+  uint32_t height_;
+  uint32_t levelCount_;
+  uint32_t layerCount_;
+  uint32_t reserved_;
+  uint64_t dataSize_;
+};
+
+//FNV-1a hash of the contents of a file
+static bool HashFile(const char* path, uint64_t* hash)
+{
+  file::mapped_file_t file;
+  if (!file::mapFile(path, &file))
+  {
+    return false;
+  }
+
+  *hash = 14695981039346656037ull;
+  for (size_t i(0); i < file.size_; ++i)
+  {
+    *hash = (*hash ^ (uint8_t)file.data_[i]) * 1099511628211ull;
+  }
+
+  file::unmapFile(&file);
+  return true;
+}
+
+static void CreateDirectoryIfNeeded(const char* path)
+{
+#ifdef WIN32
+  CreateDirectoryA(path, nullptr);
+#else
+  mkdir(path, 0755);
+#endif
+}
+
+//Copies of each level, with all the layers, packed one after the other. Returns the size of all the levels
+static VkDeviceSize LevelCopies(uint32_t width, uint32_t height, uint32_t levelCount, uint32_t layerCount, uint32_t texelSize, std::vector<VkBufferImageCopy>* copies)
+{
+  VkDeviceSize size = 0u;
+  for (uint32_t level(0); level < levelCount; ++level)
+  {
+    VkBufferImageCopy copy = {};
+    copy.bufferOffset = size;
+    copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0u, layerCount };
+    copy.imageExtent = { maths::maxValue(width >> level, 1u), maths::maxValue(height >> level, 1u), 1u };
+    copies->push_back(copy);
+    size += (VkDeviceSize)copy.imageExtent.width * copy.imageExtent.height * layerCount * texelSize;
+  }
+
+  return size;
+}
+
+static VkImageSubresourceRange AllSubresources(const texture_t& texture, uint32_t layerCount)
+{
+  VkImageSubresourceRange range = {};
+  range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  range.levelCount = texture.mipLevels_;
+  range.layerCount = layerCount;
+  return range;
+}
+
+//Creates a texture with the size, levels and layers of a cache file
+static void CreateCacheTexture(const context_t& context, VkFormat format, uint32_t width, uint32_t height, uint32_t levelCount, uint32_t layerCount, texture_t* texture)
+{
+  if (layerCount == 6u)
+  {
+    textureCubemapCreate(context, format, width, height, levelCount,
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, texture_sampler_t(), (texture_cubemap_t*)texture);
+  }
+  else
+  {
+    texture2DCreate(context, width, height, levelCount, format,
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, texture_sampler_t(), texture);
+    texture->mipLevels_ = levelCount;
+  }
+}
+
+//Reads back all the levels and layers of the texture and writes them in the cache file. If 'format' is not the format of the texture,
+//the texture is converted with blits to a temporary image first, so the readback buffer has the size of the file
+static bool SaveTexture(const context_t& context, texture_t* texture, uint32_t layerCount, VkFormat format, const char* path)
+{
+  std::vector<VkBufferImageCopy> copies;
+  VkDeviceSize size = LevelCopies(texture->extent_.width, texture->extent_.height, texture->mipLevels_, layerCount, CacheTexelSize(format), &copies);
+  gpu_buffer_t buffer;
+  gpuBufferCreate(context, gpu_buffer_t::usage::TRANSFER_DST, HOST_VISIBLE_COHERENT, nullptr, (size_t)size, nullptr, &buffer);
+
+  command_buffer_t commandBuffer;
+  commandBufferCreate(context, VK_COMMAND_BUFFER_LEVEL_PRIMARY, nullptr, nullptr, 0u, nullptr, 0u, command_buffer_t::GRAPHICS, &commandBuffer);
+  commandBufferBegin(context, commandBuffer);
+  VkImageSubresourceRange range = AllSubresources(*texture, layerCount);
+  textureChangeLayout(commandBuffer.handle_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, range, texture);
+
+  texture_t converted = {};
+  texture_t* source = texture;
+  if (format != texture->format_)
+  {
+    CreateCacheTexture(context, format, texture->extent_.width, texture->extent_.height, texture->mipLevels_, layerCount, &converted);
+    textureChangeLayout(commandBuffer.handle_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, range, &converted);
+    for (uint32_t level(0); level < texture->mipLevels_; ++level)
+    {
+      int32_t width = (int32_t)copies[level].imageExtent.width;
+      int32_t height = (int32_t)copies[level].imageExtent.height;
+      VkImageBlit blit = {};
+      blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0u, layerCount };
+      blit.srcOffsets[1] = { width, height, 1 };
+      blit.dstSubresource = blit.srcSubresource;
+      blit.dstOffsets[1] = blit.srcOffsets[1];
+      vkCmdBlitImage(commandBuffer.handle_, texture->image_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, converted.image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1u, &blit, VK_FILTER_NEAREST);
+    }
+
+    textureChangeLayout(commandBuffer.handle_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, range, &converted);
+    source = &converted;
+  }
+
+  vkCmdCopyImageToBuffer(commandBuffer.handle_, source->image_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer.handle_, (uint32_t)copies.size(), copies.data());
+  textureChangeLayout(commandBuffer.handle_, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, range, texture);
+  commandBufferEnd(commandBuffer);
+  commandBufferSubmit(context, commandBuffer);
+  vkWaitForFences(context.device_, 1u, &commandBuffer.fence_, VK_TRUE, UINT64_MAX);
+  commandBufferDestroy(context, &commandBuffer);
+  if (source == &converted)
+  {
+    textureDestroy(context, &converted);
+  }
+
+  cache_header_t header = { { 'B', 'K', 'I', 'B' }, gCacheVersion, (uint32_t)format, texture->extent_.width, texture->extent_.height, texture->mipLevels_, layerCount, 0u, size };
+  bool result = false;
+  FILE* file = fopen(path, "wb");
+  if (file)
+  {
+    void* mapping = gpuBufferMap(context, buffer);
+    result = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(mapping, (size_t)size, 1, file) == 1;
+    gpuBufferUnmap(context, buffer);
+    fclose(file);
+
+    //Incomplete files would be rejected when loading them, but they would be read each time
+    if (!result)
+    {
+      remove(path);
+    }
+  }
+
+  gpuBufferDestroy(context, nullptr, &buffer);
+  return result;
+}
+
+static bool SaveSH(const image::irradiance_sh9_t& sh, const char* path)
+{
+  FILE* file = fopen(path, "wb");
+  if (!file)
+  {
+    return false;
+  }
+
+  bool result = fwrite("BKSH", 4, 1, file) == 1 && fwrite(&gCacheVersion, sizeof(gCacheVersion), 1, file) == 1 && fwrite(&sh, sizeof(sh), 1, file) == 1;
+  fclose(file);
+  if (!result)
+  {
+    remove(path);
+  }
+
+  return result;
+}
+
+static bool LoadSH(const char* path, image::irradiance_sh9_t* sh)
+{
+  file::mapped_file_t file;
+  if (!file::mapFile(path, &file))
+  {
+    return false;
+  }
+
+  bool valid = file.size_ == 4 + sizeof(gCacheVersion) + sizeof(*sh) && memcmp(file.data_, "BKSH", 4) == 0 && memcmp(file.data_ + 4, &gCacheVersion, sizeof(gCacheVersion)) == 0;
+  if (valid)
+  {
+    memcpy(sh, file.data_ + 4 + sizeof(gCacheVersion), sizeof(*sh));
+  }
+
+  file::unmapFile(&file);
+  return valid;
+}
+
+//Creates a texture from a cache file. The upload is recorded in the batch. Returns false if the file doesn't exist or doesn't match
+static bool LoadTexture(const context_t& context, const char* path, uint32_t layerCount, upload_batch_t* batch, texture_t* texture)
+{
+  file::mapped_file_t file;
+  if (!file::mapFile(path, &file))
+  {
+    return false;
+  }
+
+  cache_header_t header;
+  bool valid = file.size_ >= sizeof(header);
+  if (valid)
+  {
+    memcpy(&header, file.data_, sizeof(header));
+    valid = memcmp(header.magic_, "BKIB", 4) == 0 && header.version_ == gCacheVersion && CacheTexelSize(header.format_) != 0u &&
+            header.layerCount_ == layerCount && header.levelCount_ > 0u && header.dataSize_ == file.size_ - sizeof(header);
+  }
+
+  std::vector<VkBufferImageCopy> copies;
+  VkBuffer stagingBuffer;
+  VkDeviceSize stagingOffset;
+  if (valid)
+  {
+    valid = LevelCopies(header.width_, header.height_, header.levelCount_, layerCount, CacheTexelSize(header.format_), &copies) == header.dataSize_;
+  }
+
+  if (!valid)
+  {
+    file::unmapFile(&file);
+    return false;
+  }
+
+  uint8_t* staging = uploadBatchAllocate(context, header.dataSize_, CacheTexelSize(header.format_), batch, &stagingBuffer, &stagingOffset);
+  memcpy(staging, file.data_ + sizeof(header), (size_t)header.dataSize_);
+  file::unmapFile(&file);
+  for (uint32_t i(0); i < copies.size(); ++i)
+  {
+    copies[i].bufferOffset += stagingOffset;
+  }
+
+  CreateCacheTexture(context, (VkFormat)header.format_, header.width_, header.height_, header.levelCount_, layerCount, texture);
+
+  VkCommandBuffer commandBuffer = uploadBatchGetCommandBuffer(context, batch);
+  VkImageSubresourceRange range = AllSubresources(*texture, layerCount);
+  textureChangeLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, range, texture);
+  vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, texture->image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)copies.size(), copies.data());
+  textureChangeLayout(commandBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, range, texture);
+  return true;
+}
+
+bool render::iblCreate(const context_t& context, const char* imagePath, const ibl_description_t& description, const char* cacheDirectory, ibl_maps_t* maps)
+{
+  *maps = {};
+  uint64_t hash;
+  if (!HashFile(imagePath, &hash))
+  {
+    return false;
+  }
+
+  //Each map is keyed by the parameters of the maps it is computed from
+  std::string environmentPath, irradiancePath, specularPath, brdfLutPath;
+  if (cacheDirectory)
+  {
+    CreateDirectoryIfNeeded(cacheDirectory);
+
+    char name[128];
+    std::string directory = std::string(cacheDirectory) + "/";
+    snprintf(name, sizeof(name), "%016llx-%u-%u", (unsigned long long)hash, description.environmentSize_, description.environmentMipmaps_ ? 1u : 0u);
+    std::string environmentKey = directory + name;
+    environmentPath = environmentKey + "-environment.ibl";
+    irradiancePath = environmentKey + "-irradiance-sh9.ibl";
+    snprintf(name, sizeof(name), "-specular-%u-%u.ibl", description.specularSize_, description.specularMipLevels_);
+    specularPath = environmentKey + name;
+    snprintf(name, sizeof(name), "brdf-%u.ibl", description.brdfLutSize_);
+    brdfLutPath = directory + name;
+  }
+
+  //Cached maps are uploaded in a single batch
+  bool environmentCached = false, irradianceCached = false, specularCached = false, brdfLutCached = false;
+  if (cacheDirectory)
+  {
+    upload_batch_t batch;
+    uploadBatchCreate(context, 0u, &batch);
+    environmentCached = LoadTexture(context, environmentPath.c_str(), 6u, &batch, &maps->environment_);
+    specularCached = LoadTexture(context, specularPath.c_str(), 6u, &batch, &maps->specular_);
+    brdfLutCached = LoadTexture(context, brdfLutPath.c_str(), 1u, &batch, &maps->brdfLut_);
+    uploadBatchDestroy(context, &batch);
+    irradianceCached = LoadSH(irradiancePath.c_str(), &maps->irradiance_);
+  }
+
+  //The environment cubemap and the irradiance are computed from the image
+  if (!environmentCached || !irradianceCached)
+  {
+    image::image2D_t image;
+    if (!image::load(imagePath, true, &image))
+    {
+      iblDestroy(context, maps);
+      return false;
+    }
+
+    if (!environmentCached)
+    {
+      textureCubemapCreateFromEquirectangularImage(context, image, description.environmentSize_, description.environmentMipmaps_, &maps->environment_);
+      if (cacheDirectory)
+      {
+        SaveTexture(context, &maps->environment_, 6u, gEnvironmentCacheFormat, environmentPath.c_str());
+      }
+    }
+
+    if (!irradianceCached)
+    {
+      //Projected on the CPU instead of rendering an irradiance cubemap with diffuseConvolution
+      thread::thread_pool_t threadPool;
+      thread::poolCreate(0u, &threadPool);
+      image::projectIrradianceSH9(image, &threadPool, &maps->irradiance_);
+      thread::poolDestroy(&threadPool);
+      if (cacheDirectory)
+      {
+        SaveSH(maps->irradiance_, irradiancePath.c_str());
+      }
+    }
+
+    image::unload(&image);
+  }
+
+  if (!specularCached)
+  {
+    specularConvolution(context, maps->environment_, description.specularSize_, description.specularMipLevels_, &maps->specular_);
+    if (cacheDirectory)
+    {
+      SaveTexture(context, &maps->specular_, 6u, gCacheFormat, specularPath.c_str());
+    }
+  }
+
+  if (!brdfLutCached)
+  {
+    brdfConvolution(context, description.brdfLutSize_, &maps->brdfLut_);
+    if (cacheDirectory)
+    {
+      SaveTexture(context, &maps->brdfLut_, 1u, gCacheFormat, brdfLutPath.c_str());
+    }
+  }
+
+  return true;
+}
+
+void render::iblDestroy(const context_t& context, ibl_maps_t* maps)
+{
+  textureDestroy(context, &maps->brdfLut_);
+  textureDestroy(context, &maps->specular_);
+  textureDestroy(context, &maps->environment_);
+  *maps = {};
+}
@@ -23,10 +23,18 @@
 */
 
 #include "image.h"
+#include "thread-pool.h"
+#include "block-compression.h"
+
+//Failure strings are written to a global so they are disabled to make decoding thread-safe
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_STATIC
+#define STBI_NO_FAILURE_STRINGS
 #include "stb-image.h"
 #include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
 
 using namespace bkk;
 using namespace bkk::image;
@@ -38,77 +46,777 @@ static const char* getFileExtension(const char *filename)
   return dot + 1;
 }
 
-bool image::load( const char* path, bool flipVertical, image2D_t* image )
+//1 and 2 component images keep their number of components. 3 component images are expanded to 4, since
+//3 component formats are rarely supported for sampling and validation layers will complain
+static uint32_t GetComponentCount(int sourceComponentCount)
 {
-  if( image->data_ != nullptr )
+  return sourceComponentCount <= 2 ? (uint32_t)sourceComponentCount : 4u;
+}
+
+static bool IsHDR(const char* path)
+{
+  return strcmp(getFileExtension(path), "hdr") == 0;
+}
+
+uint16_t image::floatToHalf(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(float));
+  uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+  int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+  uint32_t mantissa = bits & 0x007FFFFF;
+
+  if (exponent <= 0)
   {
-    unload(image);
+    return sign;
+  }
+  else if (exponent >= 31)
+  {
+    //Keep NaNs as NaNs
+    return sign | 0x7C00 | (((bits & 0x7F800000) == 0x7F800000 && mantissa) ? 0x200 : 0);
   }
 
-  int width, height, componentCount;
-  stbi_set_flip_vertically_on_load(flipVertical);
+  return sign | (uint16_t)(exponent << 10) | (uint16_t)(mantissa >> 13);
+}
 
+float image::halfToFloat(uint16_t value)
+{
+  uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1F;
+  uint32_t mantissa = value & 0x3FF;
+
+  uint32_t bits = sign;
+  if (exponent == 31)
+  {
+    bits |= 0x7F800000 | (mantissa << 13);
+  }
+  else if (exponent != 0)
+  {
+    bits |= ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  }
+  else if (mantissa != 0)
+  {
+    //Denormal half. Normalize it
+    exponent = 127 - 15 + 1;
+    while ((mantissa & 0x400) == 0)
+    {
+      mantissa <<= 1;
+      exponent--;
+    }
+    bits |= (exponent << 23) | ((mantissa & 0x3FF) << 13);
+  }
+
+  float result;
+  memcpy(&result, &bits, sizeof(float));
+  return result;
+}
+
+//Decodes the image. HDR images with 1 or 2 components are stored as half precision floats
+static uint8_t* Decode(const char* path, image2D_t* image)
+{
+  int width, height, sourceComponentCount;
+  if (!stbi_info(path, &width, &height, &sourceComponentCount))
+  {
+    return nullptr;
+  }
+
+  uint32_t componentCount = GetComponentCount(sourceComponentCount);
   uint8_t* data = nullptr;
   uint32_t componentSize = 0;
-
-  if (strcmp(getFileExtension(path), "hdr") == 0 )
+  if (IsHDR(path))
   {
-    data = (uint8_t*)stbi_loadf(path, &width, &height, &componentCount, 0);
+    data = (uint8_t*)stbi_loadf(path, &width, &height, &sourceComponentCount, componentCount);
     componentSize = 4;
+    if (data && componentCount <= 2)
+    {
+      //Convert in place. Half floats are smaller so the conversion never overwrites values not yet read
+      const float* source = (const float*)data;
+      uint16_t* destination = (uint16_t*)data;
+      for (uint32_t i(0); i<width * height * componentCount; ++i)
+      {
+        destination[i] = floatToHalf(source[i]);
+      }
+      componentSize = 2;
+    }
   }
   else
   {
-    data = stbi_load(path, &width, &height, &componentCount, 0);    
+    data = stbi_load(path, &width, &height, &sourceComponentCount, componentCount);
     componentSize = 1;
   }
 
+  if (data != nullptr)
+  {
+    image->width_ = width;
+    image->height_ = height;
+    image->componentCount_ = componentCount;
+    image->componentSize_ = componentSize;
+    image->dataSize_ = width * height * componentCount * componentSize;
+    image->compression_ = COMPRESSION_NONE;
+  }
+
+  return data;
+}
+
+//Copies the rows of the image from 'source' to 'destination', flipping them if requested. Source and destination can be the same
+static void CopyRows(const image2D_t& image, const uint8_t* source, bool flipVertical, uint8_t* destination)
+{
+  size_t rowSize = image.width_ * image.componentCount_ * image.componentSize_;
+  if (!flipVertical)
+  {
+    if (source != destination)
+    {
+      memcpy(destination, source, image.dataSize_);
+    }
+    return;
+  }
+
+  uint8_t* row = new uint8_t[rowSize];
+  for (uint32_t y(0); y<(image.height_ + 1) / 2; ++y)
+  {
+    const uint8_t* top = source + y * rowSize;
+    const uint8_t* bottom = source + (image.height_ - 1 - y) * rowSize;
+    memcpy(row, top, rowSize);
+    memmove(destination + y * rowSize, bottom, rowSize);
+    memcpy(destination + (image.height_ - 1 - y) * rowSize, row, rowSize);
+  }
+  delete[] row;
+}
+
+bool image::load( const char* path, bool flipVertical, image2D_t* image )
+{
+  if( image->data_ != nullptr )
+  {
+    unload(image);
+  }
+
+  //The flip is done here instead of using stbi_set_flip_vertically_on_load, which sets a global flag shared by all threads
+  uint8_t* data = Decode(path, image);
   if (data == nullptr)
   {
     return false;
   }
 
+  CopyRows(*image, data, flipVertical, data);
+  image->data_ = data;
+  return true;
+}
+
+bool image::loadInfo(const char* path, image2D_t* image)
+{
+  int width, height, componentCount;
+  if (!stbi_info(path, &width, &height, &componentCount))
+  {
+    return false;
+  }
+
   image->width_ = width;
   image->height_ = height;
+  image->componentCount_ = GetComponentCount(componentCount);
+  image->componentSize_ = IsHDR(path) ? (image->componentCount_ <= 2 ? 2 : 4) : 1;
+  image->dataSize_ = width * height * image->componentCount_ * image->componentSize_;
+  image->data_ = nullptr;
+  image->compression_ = COMPRESSION_NONE;
+  return true;
+}
+
+bool image::loadInto(const char* path, bool flipVertical, void* destination, size_t destinationSize, image2D_t* image)
+{
+  uint8_t* data = Decode(path, image);
+  if (data == nullptr)
+  {
+    return false;
+  }
+
+  bool result = image->dataSize_ <= destinationSize;
+  if (result)
+  {
+    CopyRows(*image, data, flipVertical, (uint8_t*)destination);
+  }
+
+  image->data_ = nullptr;
+  free(data);
+  return result;
+}
+
+void image::unload( image2D_t* image )
+{
+  free( image->data_ );
+  image->data_ = nullptr;
+  image->width_ = image->height_ = image->componentCount_ = image->dataSize_ = 0u;
+  image->compression_ = COMPRESSION_NONE;
+}
+
+uint64_t image::mipLevelSize(const image2D_t& image, uint32_t level)
+{
+  uint64_t width = (image.width_ >> level) > 0u ? (image.width_ >> level) : 1u;
+  uint64_t height = (image.height_ >> level) > 0u ? (image.height_ >> level) : 1u;
+  if (image.compression_ != COMPRESSION_NONE)
+  {
+    return ((width + 3) / 4) * ((height + 3) / 4) * compressionGetBlockSize(image.compression_);
+  }
+
+  return width * height * image.componentCount_ * image.componentSize_;
+}
+
+//Size of a level of an image read from a file. Fails if the level is bigger than the file, or than the 32 bit sizes of the levels.
+//Dimensions are limited so the 64 bit size of a level can't overflow either
+static bool FileLevelSize(const image2D_t& image, uint32_t level, size_t fileSize, uint32_t* levelSize)
+{
+  static const uint32_t maxDimension = 65536u;
+  if (image.width_ > maxDimension || image.height_ > maxDimension)
+  {
+    return false;
+  }
+
+  uint64_t size = mipLevelSize(image, level);
+  if (size > fileSize || size > 0xFFFFFFFFu)
+  {
+    return false;
+  }
+
+  *levelSize = (uint32_t)size;
+  return true;
+}
+
+//Sets the format of the image. Returns false if it is not supported
+static bool SetImageFormat(uint32_t componentCount, uint32_t componentSize, compression_e compression, image2D_t* image)
+{
   image->componentCount_ = componentCount;
   image->componentSize_ = componentSize;
-  image->dataSize_ = width * height * componentCount * componentSize;
-  image->data_ = data;
+  image->compression_ = compression;
+  return componentCount != 0u;
+}
+
+//Converts a VkFormat to the format of the image
+static bool ImageFormatFromVulkan(uint32_t format, image2D_t* image)
+{
+  switch (format)
+  {
+  case 9:   return SetImageFormat(1u, 1u, COMPRESSION_NONE, image);   //VK_FORMAT_R8_UNORM
+  case 16:  return SetImageFormat(2u, 1u, COMPRESSION_NONE, image);   //VK_FORMAT_R8G8_UNORM
+  case 37:                                                            //VK_FORMAT_R8G8B8A8_UNORM
+  case 43:  return SetImageFormat(4u, 1u, COMPRESSION_NONE, image);   //VK_FORMAT_R8G8B8A8_SRGB
+  case 76:  return SetImageFormat(1u, 2u, COMPRESSION_NONE, image);   //VK_FORMAT_R16_SFLOAT
+  case 83:  return SetImageFormat(2u, 2u, COMPRESSION_NONE, image);   //VK_FORMAT_R16G16_SFLOAT
+  case 97:  return SetImageFormat(4u, 2u, COMPRESSION_NONE, image);   //VK_FORMAT_R16G16B16A16_SFLOAT
+  case 100: return SetImageFormat(1u, 4u, COMPRESSION_NONE, image);   //VK_FORMAT_R32_SFLOAT
+  case 103: return SetImageFormat(2u, 4u, COMPRESSION_NONE, image);   //VK_FORMAT_R32G32_SFLOAT
+  case 106: return SetImageFormat(3u, 4u, COMPRESSION_NONE, image);   //VK_FORMAT_R32G32B32_SFLOAT
+  case 109: return SetImageFormat(4u, 4u, COMPRESSION_NONE, image);   //VK_FORMAT_R32G32B32A32_SFLOAT
+  case 131:                                                           //VK_FORMAT_BC1_RGB_UNORM_BLOCK
+  case 132:                                                           //VK_FORMAT_BC1_RGB_SRGB_BLOCK
+  case 133:                                                           //VK_FORMAT_BC1_RGBA_UNORM_BLOCK
+  case 134: return SetImageFormat(3u, 1u, COMPRESSION_BC1, image);    //VK_FORMAT_BC1_RGBA_SRGB_BLOCK
+  case 137:                                                           //VK_FORMAT_BC3_UNORM_BLOCK
+  case 138: return SetImageFormat(4u, 1u, COMPRESSION_BC3, image);    //VK_FORMAT_BC3_SRGB_BLOCK
+  case 139: return SetImageFormat(1u, 1u, COMPRESSION_BC4, image);    //VK_FORMAT_BC4_UNORM_BLOCK
+  case 141: return SetImageFormat(2u, 1u, COMPRESSION_BC5, image);    //VK_FORMAT_BC5_UNORM_BLOCK
+  case 143: return SetImageFormat(3u, 2u, COMPRESSION_BC6H, image);   //VK_FORMAT_BC6H_UFLOAT_BLOCK
+  case 145:                                                           //VK_FORMAT_BC7_UNORM_BLOCK
+  case 146: return SetImageFormat(4u, 1u, COMPRESSION_BC7, image);    //VK_FORMAT_BC7_SRGB_BLOCK
+  default:  return false;
+  }
+}
+
+//Converts a DXGI_FORMAT to the format of the image
+static bool ImageFormatFromDXGI(uint32_t format, image2D_t* image)
+{
+  switch (format)
+  {
+  case 61:  return SetImageFormat(1u, 1u, COMPRESSION_NONE, image);   //DXGI_FORMAT_R8_UNORM
+  case 49:  return SetImageFormat(2u, 1u, COMPRESSION_NONE, image);   //DXGI_FORMAT_R8G8_UNORM
+  case 28:                                                            //DXGI_FORMAT_R8G8B8A8_UNORM
+  case 29:  return SetImageFormat(4u, 1u, COMPRESSION_NONE, image);   //DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
+  case 54:  return SetImageFormat(1u, 2u, COMPRESSION_NONE, image);   //DXGI_FORMAT_R16_FLOAT
+  case 34:  return SetImageFormat(2u, 2u, COMPRESSION_NONE, image);   //DXGI_FORMAT_R16G16_FLOAT
+  case 10:  return SetImageFormat(4u, 2u, COMPRESSION_NONE, image);   //DXGI_FORMAT_R16G16B16A16_FLOAT
+  case 41:  return SetImageFormat(1u, 4u, COMPRESSION_NONE, image);   //DXGI_FORMAT_R32_FLOAT
+  case 16:  return SetImageFormat(2u, 4u, COMPRESSION_NONE, image);   //DXGI_FORMAT_R32G32_FLOAT
+  case 6:   return SetImageFormat(3u, 4u, COMPRESSION_NONE, image);   //DXGI_FORMAT_R32G32B32_FLOAT
+  case 2:   return SetImageFormat(4u, 4u, COMPRESSION_NONE, image);   //DXGI_FORMAT_R32G32B32A32_FLOAT
+  case 71:                                                            //DXGI_FORMAT_BC1_UNORM
+  case 72:  return SetImageFormat(3u, 1u, COMPRESSION_BC1, image);    //DXGI_FORMAT_BC1_UNORM_SRGB
+  case 77:                                                            //DXGI_FORMAT_BC3_UNORM
+  case 78:  return SetImageFormat(4u, 1u, COMPRESSION_BC3, image);    //DXGI_FORMAT_BC3_UNORM_SRGB
+  case 80:  return SetImageFormat(1u, 1u, COMPRESSION_BC4, image);    //DXGI_FORMAT_BC4_UNORM
+  case 83:  return SetImageFormat(2u, 1u, COMPRESSION_BC5, image);    //DXGI_FORMAT_BC5_UNORM
+  case 95:  return SetImageFormat(3u, 2u, COMPRESSION_BC6H, image);   //DXGI_FORMAT_BC6H_UF16
+  case 98:                                                            //DXGI_FORMAT_BC7_UNORM
+  case 99:  return SetImageFormat(4u, 1u, COMPRESSION_BC7, image);    //DXGI_FORMAT_BC7_UNORM_SRGB
+  default:  return false;
+  }
+}
 
- //Add missing channels, otherwise Vulkan validation layers will complain
-  if( componentCount < 4 )
-  {    
-    image->componentCount_ = 4;
-    image->dataSize_ = width * height * 4 * componentSize;
-    image->data_ = (uint8_t*)malloc(image->dataSize_);
+//Converts the pixel format of a DDS file without DX10 header to the format of the image
+static bool ImageFormatFromDDSPixelFormat(const uint32_t* pixelFormat, image2D_t* image)
+{
+  static const uint32_t DDPF_FOURCC = 0x4;
+  static const uint32_t DDPF_RGB = 0x40;
+  static const uint32_t DDPF_LUMINANCE = 0x20000;
 
-    if (componentSize == 1)
+  uint32_t flags = pixelFormat[1];
+  uint32_t fourCC = pixelFormat[2];
+  uint32_t bitCount = pixelFormat[3];
+  if (flags & DDPF_FOURCC)
+  {
+    switch (fourCC)
     {
-      for (int i(0); i < width*height; ++i)
-      { 
-        for (int component(0); component<4; ++component)
-          image->data_[4*i + component] = component < componentCount ? data[componentCount*i + component] : 0u;
-      }
+    case 0x31545844: return SetImageFormat(3u, 1u, COMPRESSION_BC1, image);   //"DXT1"
+    case 0x35545844: return SetImageFormat(4u, 1u, COMPRESSION_BC3, image);   //"DXT5"
+    case 0x31495441:                                                          //"ATI1"
+    case 0x55344342: return SetImageFormat(1u, 1u, COMPRESSION_BC4, image);   //"BC4U"
+    case 0x32495441:                                                          //"ATI2"
+    case 0x55354342: return SetImageFormat(2u, 1u, COMPRESSION_BC5, image);   //"BC5U"
+    case 111: return SetImageFormat(1u, 2u, COMPRESSION_NONE, image);         //D3DFMT_R16F
+    case 112: return SetImageFormat(2u, 2u, COMPRESSION_NONE, image);         //D3DFMT_G16R16F
+    case 113: return SetImageFormat(4u, 2u, COMPRESSION_NONE, image);         //D3DFMT_A16B16G16R16F
+    case 114: return SetImageFormat(1u, 4u, COMPRESSION_NONE, image);         //D3DFMT_R32F
+    case 115: return SetImageFormat(2u, 4u, COMPRESSION_NONE, image);         //D3DFMT_G32R32F
+    case 116: return SetImageFormat(4u, 4u, COMPRESSION_NONE, image);         //D3DFMT_A32B32G32R32F
+    default:  return false;
+    }
+  }
+
+  //Only layouts that match a Vulkan format are supported, since the data is not swizzled
+  if ((flags & DDPF_RGB) && bitCount == 32 && pixelFormat[4] == 0x000000FF && pixelFormat[5] == 0x0000FF00 && pixelFormat[6] == 0x00FF0000)
+  {
+    return SetImageFormat(4u, 1u, COMPRESSION_NONE, image);
+  }
+  else if ((flags & DDPF_LUMINANCE) && bitCount == 8)
+  {
+    return SetImageFormat(1u, 1u, COMPRESSION_NONE, image);
+  }
+
+  return false;
+}
+
+static bool ParseKTX2(const file::mapped_file_t& file, mip_chain_t* mipChain)
+{
+  static const uint8_t identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+  static const size_t headerSize = 80u;
+  static const size_t levelIndexEntrySize = 24u;
+  if (file.size_ < headerSize || memcmp(file.data_, identifier, sizeof(identifier)) != 0)
+  {
+    return false;
+  }
+
+  //vkFormat, typeSize, pixelWidth, pixelHeight, pixelDepth, layerCount, faceCount, levelCount, supercompressionScheme
+  uint32_t header[9];
+  memcpy(header, file.data_ + sizeof(identifier), sizeof(header));
+  if (header[4] > 0u || header[5] > 1u || header[6] != 1u || header[8] != 0u || !ImageFormatFromVulkan(header[0], &mipChain->image_))
+  {
+    return false;
+  }
+
+  //A level count of 0 means the mipmaps have to be generated, but the file still stores the base level
+  uint32_t levelCount = header[7] > 0u ? header[7] : 1u;
+  if (file.size_ < headerSize + levelCount * levelIndexEntrySize)
+  {
+    return false;
+  }
+
+  mipChain->image_.width_ = header[2];
+  mipChain->image_.height_ = header[3] > 0u ? header[3] : 1u;
+  mipChain->levelCount_ = levelCount < MAX_MIP_LEVELS ? levelCount : MAX_MIP_LEVELS;
+  for (uint32_t level(0); level < mipChain->levelCount_; ++level)
+  {
+    //byteOffset, byteLength, uncompressedByteLength
+    uint64_t levelIndex[3];
+    memcpy(levelIndex, file.data_ + headerSize + level * levelIndexEntrySize, sizeof(levelIndex));
+
+    uint32_t levelSize;
+    if (!FileLevelSize(mipChain->image_, level, file.size_, &levelSize) ||
+        levelIndex[1] < levelSize || levelIndex[0] > file.size_ || file.size_ - levelIndex[0] < levelSize)
+    {
+      return false;
+    }
+
+    mipChain->levelData_[level] = (const uint8_t*)file.data_ + levelIndex[0];
+    mipChain->levelSize_[level] = levelSize;
+  }
+
+  return true;
+}
+
+static bool ParseDDS(const file::mapped_file_t& file, mip_chain_t* mipChain)
+{
+  static const size_t headerSize = 128u;
+  static const size_t dx10HeaderSize = 20u;
+  static const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+  static const uint32_t DDSCAPS2_VOLUME = 0x200000;
+  if (file.size_ < headerSize || memcmp(file.data_, "DDS ", 4) != 0)
+  {
+    return false;
+  }
+
+  //Header after the magic number. Height is at index 2, width at 3, mip count at 6, pixel format from 18 and caps2 at 27
+  uint32_t header[31];
+  memcpy(header, file.data_ + 4, sizeof(header));
+  if (header[27] & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME))
+  {
+    return false;
+  }
+
+  size_t offset = headerSize;
+  const uint32_t* pixelFormat = header + 18;
+  if (pixelFormat[2] == 0x30315844)  //"DX10"
+  {
+    //dxgiFormat, resourceDimension, miscFlag, arraySize, miscFlags2
+    uint32_t dx10Header[5];
+    if (file.size_ < headerSize + dx10HeaderSize)
+    {
+      return false;
     }
-    else if (componentSize == 4)
+
+    memcpy(dx10Header, file.data_ + headerSize, sizeof(dx10Header));
+    if (dx10Header[1] != 3u || dx10Header[3] > 1u || !ImageFormatFromDXGI(dx10Header[0], &mipChain->image_))
     {
-      float* imageDataPtr = (float*)image->data_;
-      float* dataPtr = (float*)data;
-      for (int i(0); i < width*height; ++i)
+      return false;
+    }
+    offset += dx10HeaderSize;
+  }
+  else if (!ImageFormatFromDDSPixelFormat(pixelFormat, &mipChain->image_))
+  {
+    return false;
+  }
+
+  mipChain->image_.width_ = header[3];
+  mipChain->image_.height_ = header[2];
+  uint32_t levelCount = header[6] > 0u ? header[6] : 1u;
+  mipChain->levelCount_ = levelCount < MAX_MIP_LEVELS ? levelCount : MAX_MIP_LEVELS;
+
+  //Levels are stored consecutively, largest first
+  for (uint32_t level(0); level < mipChain->levelCount_; ++level)
+  {
+    uint32_t levelSize;
+    if (!FileLevelSize(mipChain->image_, level, file.size_, &levelSize) || file.size_ - offset < levelSize)
+    {
+      return false;
+    }
+
+    mipChain->levelData_[level] = (const uint8_t*)file.data_ + offset;
+    mipChain->levelSize_[level] = levelSize;
+    offset += levelSize;
+  }
+
+  return true;
+}
+
+bool image::loadMipChain(const char* path, mip_chain_t* mipChain)
+{
+  *mipChain = {};
+
+  //Other files are not mapped, since they are decoded by load()
+  const char* extension = getFileExtension(path);
+  bool ktx2 = strcmp(extension, "ktx2") == 0;
+  if ((!ktx2 && strcmp(extension, "dds") != 0) || !file::mapFile(path, &mipChain->file_))
+  {
+    return false;
+  }
+
+  bool result = ktx2 ? ParseKTX2(mipChain->file_, mipChain) : ParseDDS(mipChain->file_, mipChain);
+
+  if (!result || mipChain->image_.width_ == 0u)
+  {
+    unloadMipChain(mipChain);
+    return false;
+  }
+
+  mipChain->image_.dataSize_ = mipChain->levelSize_[0];
+  mipChain->image_.data_ = nullptr;
+  return true;
+}
+
+void image::unloadMipChain(mip_chain_t* mipChain)
+{
+  if (mipChain->file_.data_ != nullptr)
+  {
+    file::unmapFile(&mipChain->file_);
+  }
+
+  free(mipChain->levelStorage_);
+  *mipChain = {};
+}
+
+static float ReadComponent(const uint8_t* data, uint32_t componentSize)
+{
+  if (componentSize == 4)
+  {
+    float value;
+    memcpy(&value, data, 4);
+    return value;
+  }
+  else if (componentSize == 2)
+  {
+    uint16_t value;
+    memcpy(&value, data, 2);
+    return halfToFloat(value);
+  }
+
+  return *data / 255.0f;
+}
+
+static void WriteComponent(float value, uint32_t componentSize, uint8_t* data)
+{
+  if (componentSize == 4)
+  {
+    memcpy(data, &value, 4);
+  }
+  else if (componentSize == 2)
+  {
+    uint16_t half = floatToHalf(value);
+    memcpy(data, &half, 2);
+  }
+  else
+  {
+    *data = (uint8_t)(value * 255.0f + 0.5f);
+  }
+}
+
+bool image::buildMipChain(const image2D_t& image, mip_chain_t* mipChain)
+{
+  *mipChain = {};
+  if (image.compression_ != COMPRESSION_NONE || image.data_ == nullptr || image.width_ == 0 || image.height_ == 0)
+  {
+    return false;
+  }
+
+  mipChain->image_ = image;
+  mipChain->image_.data_ = nullptr;
+  mipChain->image_.componentSize_ = image.componentSize_ > 0u ? image.componentSize_ : 1u;
+
+  uint32_t levelCount = 1u;
+  size_t storageSize = mipLevelSize(mipChain->image_, 0u);
+  while (levelCount < MAX_MIP_LEVELS && ((image.width_ >> levelCount) > 0u || (image.height_ >> levelCount) > 0u))
+  {
+    storageSize += mipLevelSize(mipChain->image_, levelCount);
+    ++levelCount;
+  }
+
+  mipChain->levelStorage_ = (uint8_t*)malloc(storageSize);
+  mipChain->levelCount_ = levelCount;
+  uint8_t* level = mipChain->levelStorage_;
+  memcpy(level, image.data_, mipLevelSize(mipChain->image_, 0u));
+
+  //Each level averages 2x2 pixels of the previous one. The last row or column is repeated in odd sizes
+  uint32_t componentCount = image.componentCount_;
+  uint32_t componentSize = mipChain->image_.componentSize_;
+  uint32_t pixelSize = componentCount * componentSize;
+  for (uint32_t i(0); i < levelCount; ++i)
+  {
+    mipChain->levelData_[i] = level;
+    mipChain->levelSize_[i] = (uint32_t)mipLevelSize(mipChain->image_, i);
+    if (i + 1 == levelCount)
+    {
+      break;
+    }
+
+    uint8_t* nextLevel = level + mipChain->levelSize_[i];
+    uint32_t width = maths::maxValue(image.width_ >> i, 1u);
+    uint32_t height = maths::maxValue(image.height_ >> i, 1u);
+    uint32_t nextWidth = maths::maxValue(width >> 1, 1u);
+    uint32_t nextHeight = maths::maxValue(height >> 1, 1u);
+    for (uint32_t y(0); y < nextHeight; ++y)
+    {
+      uint32_t y0 = maths::minValue(2 * y, height - 1);
+      uint32_t y1 = maths::minValue(2 * y + 1, height - 1);
+      for (uint32_t x(0); x < nextWidth; ++x)
       {
-        for (int component(0); component<4; ++component)
-          imageDataPtr[4*i + component] = component < componentCount ? dataPtr[componentCount*i + component] : 0.0f;
+        uint32_t x0 = maths::minValue(2 * x, width - 1);
+        uint32_t x1 = maths::minValue(2 * x + 1, width - 1);
+        const uint8_t* pixels[4] = { level + (y0 * width + x0) * pixelSize, level + (y0 * width + x1) * pixelSize,
+                                     level + (y1 * width + x0) * pixelSize, level + (y1 * width + x1) * pixelSize };
+
+        uint8_t* output = nextLevel + (y * nextWidth + x) * pixelSize;
+        for (uint32_t component(0); component < componentCount; ++component)
+        {
+          uint32_t offset = component * componentSize;
+          float sum = 0.0f;
+          for (uint32_t j(0); j < 4; ++j)
+          {
+            sum += ReadComponent(pixels[j] + offset, componentSize);
+          }
+          WriteComponent(sum * 0.25f, componentSize, output + offset);
+        }
       }
     }
 
-    free(data);
+    level = nextLevel;
   }
-  
+
+  mipChain->image_.dataSize_ = mipChain->levelSize_[0];
   return true;
 }
 
-void image::unload( image2D_t* image )
+void image::projectIrradianceSH9(const image2D_t& image, thread::thread_pool_t* threadPool, irradiance_sh9_t* sh)
 {
-  free( image->data_ );
-  image->data_ = nullptr;
-  image->width_ = image->height_ = image->componentCount_ = image->dataSize_ = 0u;
+  *sh = {};
+  if (image.compression_ != COMPRESSION_NONE || image.componentCount_ < 3 || image.data_ == nullptr)
+  {
+    return;
+  }
+
+  //Each texel is weighted by the solid angle it covers, which shrinks with the cosine of the latitude
+  const float pi = 3.14159265f;
+  std::vector<float> cosLongitude(image.width_), sinLongitude(image.width_);
+  for (uint32_t column(0); column < image.width_; ++column)
+  {
+    float longitude = ((column + 0.5f) / image.width_ - 0.5f) * 2.0f * pi;
+    cosLongitude[column] = cosf(longitude);
+    sinLongitude[column] = sinf(longitude);
+  }
+
+  float texelSolidAngle = (2.0f * pi / image.width_) * (pi / image.height_);
+  uint32_t texelSize = image.componentCount_ * image.componentSize_;
+  std::mutex mutex;
+  float total[9][3] = {};
+  thread::parallelFor(threadPool, image.height_, 16u, [&](uint32_t begin, uint32_t end)
+  {
+    float sum[9][3] = {};
+    for (uint32_t row(begin); row < end; ++row)
+    {
+      float latitude = ((row + 0.5f) / image.height_ - 0.5f) * pi;
+      float y = sinf(latitude);
+      float cosLatitude = cosf(latitude);
+      float weight = texelSolidAngle * cosLatitude;
+      //The basis functions are products of a term that depends on the row and one that depends on the column, so the radiance of the row is
+      //first accumulated for each of the column terms: 1, cos, sin, cos^2, cos*sin and sin^2 of the longitude
+      float rowSum[6][3] = {};
+      const uint8_t* texel = image.data_ + (size_t)row * image.width_ * texelSize;
+      for (uint32_t column(0); column < image.width_; ++column, texel += texelSize)
+      {
+        float radiance[3];
+        if (image.componentSize_ == 4)
+        {
+          memcpy(radiance, texel, sizeof(radiance));
+        }
+        else
+        {
+          radiance[0] = ReadComponent(texel, image.componentSize_);
+          radiance[1] = ReadComponent(texel + image.componentSize_, image.componentSize_);
+          radiance[2] = ReadComponent(texel + 2 * image.componentSize_, image.componentSize_);
+        }
+
+        float c = cosLongitude[column];
+        float s = sinLongitude[column];
+        float columnTerm[6] = { 1.0f, c, s, c * c, c * s, s * s };
+        for (uint32_t i(0); i < 6; ++i)
+        {
+          rowSum[i][0] += columnTerm[i] * radiance[0];
+          rowSum[i][1] += columnTerm[i] * radiance[1];
+          rowSum[i][2] += columnTerm[i] * radiance[2];
+        }
+      }
+
+      for (uint32_t channel(0); channel < 3; ++channel)
+      {
+        float l = rowSum[0][channel] * weight;
+        float lc = rowSum[1][channel] * weight * cosLatitude;
+        float ls = rowSum[2][channel] * weight * cosLatitude;
+        float lcc = rowSum[3][channel] * weight * cosLatitude * cosLatitude;
+        float lcs = rowSum[4][channel] * weight * cosLatitude * cosLatitude;
+        float lss = rowSum[5][channel] * weight * cosLatitude * cosLatitude;
+        sum[0][channel] += 0.282095f * l;
+        sum[1][channel] += 0.488603f * y * l;
+        sum[2][channel] += 0.488603f * ls;
+        sum[3][channel] += 0.488603f * lc;
+        sum[4][channel] += 1.092548f * y * lc;
+        sum[5][channel] += 1.092548f * y * ls;
+        sum[6][channel] += 0.315392f * (3.0f * lss - l);
+        sum[7][channel] += 1.092548f * lcs;
+        sum[8][channel] += 0.546274f * (lcc - y * y * l);
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t i(0); i < 9; ++i)
+    {
+      for (uint32_t channel(0); channel < 3; ++channel)
+      {
+        total[i][channel] += sum[i][channel];
+      }
+    }
+  });
+
+  //Convolution with the clamped cosine (PI, 2PI/3 and PI/4 for each band), divided by PI
+  const float bandScale[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+  for (uint32_t i(0); i < 9; ++i)
+  {
+    for (uint32_t channel(0); channel < 3; ++channel)
+    {
+      sh->coefficients_[i][channel] = total[i][channel] * bandScale[i];
+    }
+  }
+}
+
+void image::decodeQueueCreate(thread::thread_pool_t* threadPool, decode_queue_t* queue)
+{
+  queue->threadPool_ = threadPool;
+  queue->decoded_.clear();
+  queue->nextId_ = 0u;
+  queue->pending_ = 0u;
+}
+
+void image::decodeQueueDestroy(decode_queue_t* queue)
+{
+  decode_result_t result;
+  while (decodeQueuePop(true, queue, &result))
+  {
+    unload(&result.image_);
+  }
+
+  queue->threadPool_ = nullptr;
+}
+
+uint32_t image::decodeQueueAdd(const char* path, bool flipVertical, decode_queue_t* queue)
+{
+  uint32_t id;
+  {
+    std::lock_guard<std::mutex> lock(queue->mutex_);
+    id = queue->nextId_++;
+    queue->pending_++;
+  }
+
+  std::string file(path);
+  auto job = [queue, file, flipVertical, id]()
+  {
+    decode_result_t result = {};
+    result.id_ = id;
+    result.success_ = load(file.c_str(), flipVertical, &result.image_);
+
+    std::lock_guard<std::mutex> lock(queue->mutex_);
+    queue->decoded_.push_back(result);
+    queue->imageDecoded_.notify_all();
+  };
+
+  if (queue->threadPool_)
+  {
+    thread::poolAddJob(queue->threadPool_, job);
+  }
+  else
+  {
+    job();
+  }
+
+  return id;
+}
+
+bool image::decodeQueuePop(bool wait, decode_queue_t* queue, decode_result_t* result)
+{
+  std::unique_lock<std::mutex> lock(queue->mutex_);
+  if (wait)
+  {
+    queue->imageDecoded_.wait(lock, [queue] { return !queue->decoded_.empty() || queue->pending_ == 0u; });
+  }
+
+  if (queue->decoded_.empty())
+  {
+    return false;
+  }
+
+  *result = queue->decoded_.front();
+  queue->decoded_.pop_front();
+  queue->pending_--;
+  return true;
 }
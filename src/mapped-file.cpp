@@ -0,0 +1,119 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "mapped-file.h"
+
+#ifdef WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace bkk;
+using namespace bkk::file;
+
+bool file::mapFile(const char* path, mapped_file_t* file)
+{
+  *file = {};
+
+#ifdef WIN32
+  HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (fileHandle == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+  {
+    CloseHandle(fileHandle);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (data == nullptr)
+  {
+    if (mapping)
+    {
+      CloseHandle(mapping);
+    }
+    CloseHandle(fileHandle);
+    return false;
+  }
+
+  file->data_ = (const char*)data;
+  file->size_ = (size_t)fileSize.QuadPart;
+  file->file_ = fileHandle;
+  file->mapping_ = mapping;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+  {
+    return false;
+  }
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    return false;
+  }
+
+  madvise(data, (size_t)fileStat.st_size, MADV_SEQUENTIAL);
+  file->data_ = (const char*)data;
+  file->size_ = (size_t)fileStat.st_size;
+#endif
+
+  return true;
+}
+
+void file::unmapFile(mapped_file_t* file)
+{
+  if (file->data_ == nullptr)
+  {
+    return;
+  }
+
+#ifdef WIN32
+  UnmapViewOfFile(file->data_);
+  CloseHandle((HANDLE)file->mapping_);
+  CloseHandle((HANDLE)file->file_);
+#else
+  munmap((void*)file->data_, file->size_);
+#endif
+
+  *file = {};
+}
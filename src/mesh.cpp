@@ -23,6 +23,7 @@
 */
 
 #include "mesh.h"
+#include "mapped-file.h"
 
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
@@ -30,7 +31,10 @@
 #include <assimp/Importer.hpp>
 
 #include <float.h> //FLT_MAX
+#include <string.h> //memchr
 #include <map>
+#include <mutex>
+#include <algorithm>
 #include <cassert>
 
 using namespace bkk;
@@ -43,104 +47,129 @@ static size_t GetNextMultiple(size_t from, size_t multiple)
   return ((from + multiple - 1) / multiple) * multiple;
 }
 
-static void CountNodes(aiNode* node, u32& total)
+static bool IsBone(const aiNode* pNode, const aiMesh* mesh)
 {
-  if (node)
+  for (uint32_t i = 0; i < mesh->mNumBones; i++)
   {
-    total++;
-    for (u32 i(0); i<node->mNumChildren; ++i)
+    if (pNode->mName == mesh->mBones[i]->mName)
     {
-      CountNodes(node->mChildren[i], total);
+      return true;
     }
   }
+
+  return false;
 }
 
-static void TraverseScene(const aiNode* pNode, std::map<std::string, bkk::handle_t>& nodeNameToHandle,  const aiMesh* mesh, skeleton_t* skeleton, u32& boneIndex, bkk::handle_t parentHandle)
+//Collects the nodes which are bones or ancestors of a bone in depth-first order, so parents are always before their children.
+//Returns true if there is a bone in the subtree of pNode
+static bool CollectSkeletonNodes(const aiNode* pNode, const aiMesh* mesh, u32 parent, std::vector<const aiNode*>& nodes, std::vector<u32>& nodeParent)
 {
-  std::string nodeName = pNode->mName.data;
-
-  aiMatrix4x4 localTransform = pNode->mTransformation;
-  localTransform.Transpose();
-  bkk::maths::mat4 tx = (f32*)&localTransform.a1;
-  bkk::handle_t nodeHandle = skeleton->txManager_.createTransform(tx);
-  nodeNameToHandle[nodeName] = nodeHandle;
-
+  u32 nodeIndex = (u32)nodes.size();
+  nodes.push_back(pNode);
+  nodeParent.push_back(parent);
 
-  for (uint32_t i = 0; i < mesh->mNumBones; i++)
+  bool hasBone = IsBone(pNode, mesh);
+  for (u32 i(0); i<pNode->mNumChildren; ++i)
   {
-    std::string boneName(mesh->mBones[i]->mName.data);
-    if (boneName == nodeName)
-    {
-      skeleton->bones_[boneIndex] = nodeHandle;
-      skeleton->offsets_[boneIndex] = (f32*)&mesh->mBones[i]->mOffsetMatrix.Transpose().a1;
-      boneIndex++;
-      break;
-    }
+    hasBone |= CollectSkeletonNodes(pNode->mChildren[i], mesh, nodeIndex, nodes, nodeParent);
   }
 
-  skeleton->txManager_.setParent(nodeHandle, parentHandle);
-
-  //Recurse on the children
-  for (u32 i(0); i<pNode->mNumChildren; ++i)
+  //Subtrees without bones don't affect the skeleton. Their nodes are always the last ones added
+  if (!hasBone)
   {
-    TraverseScene(pNode->mChildren[i], nodeNameToHandle, mesh, skeleton, boneIndex, nodeHandle);
+    nodes.resize(nodeIndex);
+    nodeParent.resize(nodeIndex);
   }
+
+  return hasBone;
 }
 
-static void LoadSkeleton(const aiScene* scene, const aiMesh* mesh, std::map<std::string, bkk::handle_t>& nodeNameToHandle,  skeleton_t* skeleton)
+static void LoadSkeleton(const aiScene* scene, const aiMesh* mesh, std::map<std::string, u32>& nodeNameToIndex, skeleton_t* skeleton)
 {
-  u32 nodeCount(0);
-  CountNodes(scene->mRootNode, nodeCount);
+  std::vector<const aiNode*> nodes;
+  std::vector<u32> nodeParent;
+  CollectSkeletonNodes(scene->mRootNode, mesh, 0u, nodes, nodeParent);
+
+  u32 nodeCount = (u32)nodes.size();
+  skeleton->nodeParent_ = new u32[nodeCount];
+  skeleton->bindPose_ = new maths::mat4[nodeCount];
+  skeleton->nodeDepth_ = new u32[nodeCount];
+  for (u32 i(0); i<nodeCount; ++i)
+  {
+    aiMatrix4x4 localTransform = nodes[i]->mTransformation;
+    localTransform.Transpose();
+    skeleton->bindPose_[i] = (f32*)&localTransform.a1;
+    skeleton->nodeParent_[i] = nodeParent[i];
+    skeleton->nodeDepth_[i] = i == 0 ? 0u : skeleton->nodeDepth_[nodeParent[i]] + 1;
+    nodeNameToIndex[nodes[i]->mName.data] = i;
+  }
 
-  skeleton->bones_ = new bkk::handle_t[mesh->mNumBones];
+  //Bones keep the order of the mesh, which is the one used by the bone indices of the vertices
   skeleton->offsets_ = new maths::mat4[mesh->mNumBones];
-  
+  skeleton->boneNode_ = new u32[mesh->mNumBones];
+  for (u32 i(0); i<mesh->mNumBones; ++i)
+  {
+    skeleton->boneNode_[i] = nodeNameToIndex[mesh->mBones[i]->mName.data];
+    skeleton->offsets_[i] = (f32*)&mesh->mBones[i]->mOffsetMatrix.Transpose().a1;
+  }
+
   aiMatrix4x4 globalInverse = scene->mRootNode->mTransformation;
   globalInverse.Inverse();
   skeleton->globalInverseTransform_ = (f32*)&globalInverse.Transpose().a1;
   skeleton->boneCount_ = mesh->mNumBones;
   skeleton->nodeCount_ = nodeCount;
-
-  u32 boneIndex = 0;
-  TraverseScene(scene->mRootNode, nodeNameToHandle, mesh, skeleton, boneIndex, bkk::INVALID_ID);
-
-  skeleton->txManager_.update();
 }
 
-static void LoadAnimation(const aiScene* scene, u32 animationIndex, std::map<std::string, bkk::handle_t>& nodeNameToIndex, u32 boneCount, skeletal_animation_t* animation)
+static void LoadAnimation(const aiScene* scene, u32 animationIndex, std::map<std::string, u32>& nodeNameToIndex, skeletal_animation_t* animation)
 {
   const aiAnimation* pAnimation = scene->mAnimations[animationIndex];
 
+  //Channels of nodes pruned from the skeleton are ignored
   u32 frameCount = 0;
+  u32 nodeCount = 0;
   if (pAnimation)
   {
     for (u32 channel(0); channel < pAnimation->mNumChannels; ++channel)
     {
-      frameCount = maths::maxValue(frameCount, pAnimation->mChannels[channel]->mNumPositionKeys);
+      if (nodeNameToIndex.find(pAnimation->mChannels[channel]->mNodeName.data) != nodeNameToIndex.end())
+      {
+        frameCount = maths::maxValue(frameCount, pAnimation->mChannels[channel]->mNumPositionKeys);
+        nodeCount++;
+      }
     }
   }
 
+  animation->frameCount_ = 0u;
+  animation->nodeCount_ = 0u;
+  animation->duration_ = 0.0f;
+  animation->nodes_ = nullptr;
+  animation->data_ = nullptr;
   if (frameCount > 0 )
   {
     animation->frameCount_ = frameCount;
-    animation->nodeCount_ = pAnimation->mNumChannels;
+    animation->nodeCount_ = nodeCount;
     animation->data_ = new bone_transform_t[animation->frameCount_*animation->nodeCount_];
-    animation->nodes_ = new bkk::handle_t[animation->nodeCount_];
+    animation->nodes_ = new u32[animation->nodeCount_];
     animation->duration_ = f32( pAnimation->mDuration / pAnimation->mTicksPerSecond ) * 1000.0f;
 
+    u32 node = 0;
     for (u32 channel(0); channel<pAnimation->mNumChannels; ++channel)
     {
       std::string nodeName(pAnimation->mChannels[channel]->mNodeName.data);
-      std::map<std::string, bkk::handle_t>::iterator it = nodeNameToIndex.find(nodeName);
+      std::map<std::string, u32>::iterator it = nodeNameToIndex.find(nodeName);
+      if (it == nodeNameToIndex.end())
+      {
+        continue;
+      }
       
-      animation->nodes_[channel] = it->second;
+      animation->nodes_[node] = it->second;
         
       //Read animation data for the bone
       vec3 position, scale;
       quat orientation;
       for (u32 frame = 0; frame<animation->frameCount_; ++frame)
       {
-        size_t index = frame*animation->nodeCount_ + channel;
+        size_t index = frame*animation->nodeCount_ + node;
           
         if ( frame < pAnimation->mChannels[channel]->mNumPositionKeys )
         { 
@@ -168,196 +197,233 @@ static void LoadAnimation(const aiScene* scene, u32 animationIndex, std::map<std
         }
         animation->data_[index].orientation_ = orientation;
       }
+
+      node++;
     }
   }
 }
 
-static void loadMesh(const render::context_t& context, const struct aiScene* scene, uint32_t submesh, mesh_t* mesh, export_flags_e flags, render::gpu_memory_allocator_t* allocator)
+//Fills the attribute descriptions for the interleaved vertex layout used by imported meshes. Returns the vertex size in floats
+static u32 VertexAttributes(bool importNormals, bool importUV, bool importBoneWeights, std::vector<render::vertex_attribute_t>* attributes)
 {
-
-  const struct aiMesh* aimesh = scene->mMeshes[submesh];
-  size_t vertexCount = aimesh->mNumVertices;
-
-  bool bHasNormal(aimesh->HasNormals());
-  bool bHasUV(aimesh->HasTextureCoords(0));
-  u32 boneCount(aimesh->mNumBones);
-
-  u32 vertexSize = 3;
-  u32 attributeCount = 1;
-
-  bool importNormals = (((flags & EXPORT_NORMALS) != 0) && bHasNormal);
-  bool importUV = (((flags & EXPORT_UV) != 0) && bHasUV );
-  bool importBoneWeights = (((flags & EXPORT_BONE_WEIGHTS) != 0) && (boneCount > 0));
-
-  if (importNormals)
-  {
-    vertexSize += 3;
-    ++attributeCount;
-  }
-  if (importUV)
-  {
-    vertexSize += 2;
-    ++attributeCount;
-  }
-  if (boneCount > 0 && importBoneWeights)
-  {
-    vertexSize += 8;  //4 weights and 4 bone index
-    attributeCount += 2;
-  }
-
-  //Attributes description
-  std::vector<render::vertex_attribute_t> attributes(attributeCount);
+  u32 vertexSize = 3 + (importNormals ? 3 : 0) + (importUV ? 2 : 0) + (importBoneWeights ? 8 : 0);  //4 weights and 4 bone index
+  attributes->clear();
 
   //First attribute is position
-  attributes[0].format_ = render::vertex_attribute_t::format::VEC3;
-  attributes[0].offset_ = 0;
-  attributes[0].stride_ = vertexSize * sizeof(f32);
-  attributes[0].instanced_ = false;
+  render::vertex_attribute_t attribute;
+  attribute.format_ = render::vertex_attribute_t::format::VEC3;
+  attribute.offset_ = 0;
+  attribute.stride_ = vertexSize * sizeof(f32);
+  attribute.instanced_ = false;
+  attributes->push_back(attribute);
 
-  u32 attribute = 1;
   u32 attributeOffset = 3;
   if (importNormals)
   {
-    attributes[attribute].format_ = render::vertex_attribute_t::format::VEC3;
-    attributes[attribute].offset_ = sizeof(f32)*attributeOffset;
-    attributes[attribute].stride_ = vertexSize * sizeof(f32);
-    attributes[attribute].instanced_ = false;
-    ++attribute;
+    attribute.format_ = render::vertex_attribute_t::format::VEC3;
+    attribute.offset_ = sizeof(f32)*attributeOffset;
+    attributes->push_back(attribute);
     attributeOffset += 3;
   }
   if (importUV)
   {
-    attributes[attribute].format_ = render::vertex_attribute_t::format::VEC2;
-    attributes[attribute].offset_ = sizeof(f32)*attributeOffset;
-    attributes[attribute].stride_ = vertexSize * sizeof(f32);
-    attributes[attribute].instanced_ = false;
-    ++attribute;
+    attribute.format_ = render::vertex_attribute_t::format::VEC2;
+    attribute.offset_ = sizeof(f32)*attributeOffset;
+    attributes->push_back(attribute);
     attributeOffset += 2;
   }
-
-  u32 boneWeightOffset = attributeOffset;
-  if (boneCount > 0 && importBoneWeights)
+  if (importBoneWeights)
   {
-    attributes[attribute].format_ = render::vertex_attribute_t::format::VEC4;
-    attributes[attribute].offset_ = sizeof(f32)*attributeOffset;
-    attributes[attribute].stride_ = vertexSize * sizeof(f32);
-    attributes[attribute].instanced_ = false;
-
-    ++attribute;
+    attribute.format_ = render::vertex_attribute_t::format::VEC4;
+    attribute.offset_ = sizeof(f32)*attributeOffset;
+    attributes->push_back(attribute);
     attributeOffset += 4;
 
-    attributes[attribute].format_ = render::vertex_attribute_t::format::VEC4;
-    attributes[attribute].offset_ = sizeof(f32)*attributeOffset;
-    attributes[attribute].stride_ = vertexSize * sizeof(f32);
-    attributes[attribute].instanced_ = false;
+    attribute.offset_ = sizeof(f32)*attributeOffset;
+    attributes->push_back(attribute);
+  }
+
+  return vertexSize;
+}
+
+//Writes position, normal and uv of every vertex in the mesh. Bone weights, if present, are left untouched
+static void WriteVertices(const aiMesh* aimesh, const aiMatrix4x4* transform, bool importNormals, bool importUV, u32 vertexSize, f32* vertexData, aabb_t* aabb)
+{
+  aiMatrix3x3 normalTransform;
+  if (transform)
+  {
+    normalTransform = aiMatrix3x3(*transform);
+    normalTransform.Inverse().Transpose();
   }
 
   vec3 aabbMin(FLT_MAX, FLT_MAX, FLT_MAX);
   vec3 aabbMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
-  size_t vertexBufferSize(vertexCount * vertexSize * sizeof(f32));
-  f32* vertexData = new f32[vertexCount * vertexSize];
-  memset((u32*)vertexData, 0, vertexBufferSize);
-
-  u32 index = 0;
-  for (u32 vertex(0); vertex<vertexCount; ++vertex)
+  for (u32 vertex(0); vertex<aimesh->mNumVertices; ++vertex)
   {
-    aabbMin = vec3(maths::minValue(aimesh->mVertices[vertex].x, aabbMin.x),
-                   maths::minValue(aimesh->mVertices[vertex].y, aabbMin.y),
-                   maths::minValue(aimesh->mVertices[vertex].z, aabbMin.z));
+    aiVector3D position = transform ? (*transform) * aimesh->mVertices[vertex] : aimesh->mVertices[vertex];
+    aabbMin = vec3(maths::minValue(position.x, aabbMin.x),
+                   maths::minValue(position.y, aabbMin.y),
+                   maths::minValue(position.z, aabbMin.z));
 
-    aabbMax = vec3(maths::maxValue(aimesh->mVertices[vertex].x, aabbMax.x),
-                   maths::maxValue(aimesh->mVertices[vertex].y, aabbMax.y),
-                   maths::maxValue(aimesh->mVertices[vertex].z, aabbMax.z));
+    aabbMax = vec3(maths::maxValue(position.x, aabbMax.x),
+                   maths::maxValue(position.y, aabbMax.y),
+                   maths::maxValue(position.z, aabbMax.z));
 
-    vertexData[index++] = aimesh->mVertices[vertex].x;
-    vertexData[index++] = aimesh->mVertices[vertex].y;
-    vertexData[index++] = aimesh->mVertices[vertex].z;
+    f32* data = vertexData + vertex * vertexSize;
+    *data++ = position.x;
+    *data++ = position.y;
+    *data++ = position.z;
 
     if (importNormals)
     {
-      if (bHasNormal)
-      {
-        vertexData[index] = aimesh->mNormals[vertex].x;
-        vertexData[index+1] = aimesh->mNormals[vertex].y;
-        vertexData[index+2] = aimesh->mNormals[vertex].z;
-      }
-
-      index += 3;
+      aiVector3D normal = transform ? (normalTransform * aimesh->mNormals[vertex]).Normalize() : aimesh->mNormals[vertex];
+      *data++ = normal.x;
+      *data++ = normal.y;
+      *data++ = normal.z;
     }
 
     if (importUV)
     {
-      if (bHasUV)
+      *data++ = aimesh->mTextureCoords[0][vertex].x;
+      *data++ = aimesh->mTextureCoords[0][vertex].y;
+    }
+  }
+
+  aabb->min_ = aabbMin;
+  aabb->max_ = aabbMax;
+}
+
+//Copies the position (first attribute) of every vertex to a tightly packed array
+static void ExtractPositions(const void* vertexData, size_t vertexDataSize, const render::vertex_attribute_t& positionAttribute, std::vector<f32>* positions)
+{
+  assert(positionAttribute.format_ == render::vertex_attribute_t::format::VEC3);
+
+  size_t vertexCount = vertexDataSize / positionAttribute.stride_;
+  positions->resize(vertexCount * 3);
+  const u8* position = (const u8*)vertexData + positionAttribute.offset_;
+  for (size_t i(0); i<vertexCount; ++i)
+  {
+    memcpy(positions->data() + i * 3, position, 3 * sizeof(f32));
+    position += positionAttribute.stride_;
+  }
+}
+
+//Meshes created in a pool get a position stream if the pool has a position buffer. If the mesh doesn't fit in the pool it gets its own buffers instead
+static void CreateMesh(const render::context_t& context,
+  const uint32_t* indexData, uint32_t indexDataSize,
+  const void* vertexData, size_t vertexDataSize,
+  render::vertex_attribute_t* attribute, uint32_t attributeCount,
+  render::gpu_memory_allocator_t* allocator, geometry_pool_t* pool, bool positionStream, mesh_t* mesh)
+{
+  if (pool)
+  {
+    if (!createInPool(context, indexData, indexDataSize, vertexData, vertexDataSize, attribute, attributeCount, pool, mesh))
+    {
+      create(context, indexData, indexDataSize, vertexData, vertexDataSize, attribute, attributeCount, allocator, mesh);
+      if (pool->positionBufferSize_ > 0u)
       {
-        vertexData[index] = aimesh->mTextureCoords[0][vertex].x;
-        vertexData[index+1] = aimesh->mTextureCoords[0][vertex].y;
+        createPositionStream(context, vertexData, vertexDataSize, allocator, mesh);
       }
-
-      index += 2;
     }
-
-    if (boneCount > 0 && importBoneWeights)
+  }
+  else
+  {
+    create(context, indexData, indexDataSize, vertexData, vertexDataSize, attribute, attributeCount, allocator, mesh);
+    if (positionStream)
     {
-      index += 8; //Bone weight and index will be filled when loading skeleton
+      createPositionStream(context, vertexData, vertexDataSize, allocator, mesh);
     }
   }
+}
+
+static void loadMesh(const render::context_t& context, const struct aiScene* scene, uint32_t submesh, mesh_t* mesh, export_flags_e flags, render::gpu_memory_allocator_t* allocator, geometry_pool_t* pool = nullptr)
+{
+
+  const struct aiMesh* aimesh = scene->mMeshes[submesh];
+  size_t vertexCount = aimesh->mNumVertices;
+  u32 boneCount(aimesh->mNumBones);
+
+  bool importNormals = (((flags & EXPORT_NORMALS) != 0) && aimesh->HasNormals());
+  bool importUV = (((flags & EXPORT_UV) != 0) && aimesh->HasTextureCoords(0));
+  bool importBoneWeights = (((flags & EXPORT_BONE_WEIGHTS) != 0) && (boneCount > 0));
+
+  //Attributes description
+  std::vector<render::vertex_attribute_t> attributes;
+  u32 vertexSize = VertexAttributes(importNormals, importUV, importBoneWeights, &attributes);
+  u32 boneWeightOffset = vertexSize - 8;
+
+  size_t vertexBufferSize(vertexCount * vertexSize * sizeof(f32));
+  f32* vertexData = new f32[vertexCount * vertexSize];
+  memset((u32*)vertexData, 0, vertexBufferSize);
+  WriteVertices(aimesh, nullptr, importNormals, importUV, vertexSize, vertexData, &mesh->aabb_);
 
   //Load skeleton
   mesh->skeleton_ = nullptr;
   mesh->animations_ = nullptr;
-  if (boneCount > 0 && importBoneWeights)
+  mesh->compressedAnimations_ = nullptr;
+  if (importBoneWeights)
   {
-    std::map<std::string, bkk::handle_t> nodeNameToHandle;
+    std::map<std::string, u32> nodeNameToIndex;
     if (boneCount > 0)
     {
       mesh->skeleton_ = new skeleton_t;
-      LoadSkeleton(scene, aimesh, nodeNameToHandle, mesh->skeleton_);
+      LoadSkeleton(scene, aimesh, nodeNameToIndex, mesh->skeleton_);
     }
 
-    //Read weights and bone indices for each vertex
+    //Read weights and bone indices for each vertex. Bone i of the mesh is bone i of the skeleton
     for (uint32_t i = 0; i < boneCount; i++)
     {
-      std::string boneName(aimesh->mBones[i]->mName.data);
-      std::map<std::string, bkk::handle_t>::iterator it;
-      it = nodeNameToHandle.find(boneName);
-      if (it != nodeNameToHandle.end())
+      u32 vertexCount = aimesh->mBones[i]->mNumWeights;
+      for (u32 vertex(0); vertex < vertexCount; ++vertex)
       {
-        u32 boneIndex = 0;
-        for (; boneIndex < mesh->skeleton_->boneCount_; ++boneIndex)
-        {
-          if (it->second.index_ == mesh->skeleton_->bones_[boneIndex].index_ )
-          {
-            break;
-          }
-        }
+        u32 vertexId = aimesh->mBones[i]->mWeights[vertex].mVertexId;
+        f32 weight = aimesh->mBones[i]->mWeights[vertex].mWeight;
 
-        u32 vertexCount = aimesh->mBones[i]->mNumWeights;
-        for (u32 vertex(0); vertex < vertexCount; ++vertex)
+        size_t vertexWeightOffset = vertexId * vertexSize + boneWeightOffset;
+        size_t vertexBoneIdOffset = vertexId * vertexSize + boneWeightOffset + 4;
+        while (vertexData[vertexWeightOffset] != 0.0f)
         {
-          u32 vertexId = aimesh->mBones[i]->mWeights[vertex].mVertexId;
-          f32 weight = aimesh->mBones[i]->mWeights[vertex].mWeight;
-
-          size_t vertexWeightOffset = vertexId * vertexSize + boneWeightOffset;
-          size_t vertexBoneIdOffset = vertexId * vertexSize + boneWeightOffset + 4;
-          while (vertexData[vertexWeightOffset] != 0.0f)
-          {
-            vertexWeightOffset++;
-            vertexBoneIdOffset++;
-          }
-          vertexData[vertexWeightOffset] = weight;
-          vertexData[vertexBoneIdOffset] = (f32)boneIndex;
+          vertexWeightOffset++;
+          vertexBoneIdOffset++;
         }
+        vertexData[vertexWeightOffset] = weight;
+        vertexData[vertexBoneIdOffset] = (f32)i;
       }
     }
 
     //Load skeletal animations
     if (scene->HasAnimations())
     {
-      mesh->animationCount_ = scene->mNumAnimations;
-      mesh->animations_ = new skeletal_animation_t[mesh->animationCount_];
-      for (u32 i(0); i < mesh->animationCount_; ++i)
+      //Clips that don't animate any node of the skeleton are skipped
+      mesh->animationCount_ = 0u;
+      mesh->animations_ = new skeletal_animation_t[scene->mNumAnimations];
+      for (u32 i(0); i < scene->mNumAnimations; ++i)
+      {
+        LoadAnimation(scene, i, nodeNameToIndex, &mesh->animations_[mesh->animationCount_]);
+        if (mesh->animations_[mesh->animationCount_].frameCount_ > 0u)
+        {
+          mesh->animationCount_++;
+        }
+      }
+
+      if (mesh->animationCount_ == 0u)
       {
-        LoadAnimation(scene, i, nodeNameToHandle, boneCount, &mesh->animations_[i]);
+        delete[] mesh->animations_;
+        mesh->animations_ = nullptr;
+      }
+
+      if ((flags & EXPORT_COMPRESS_ANIMATIONS) != 0 && mesh->animationCount_ > 0u)
+      {
+        mesh->compressedAnimations_ = new compressed_animation_t[mesh->animationCount_];
+        for (u32 i(0); i < mesh->animationCount_; ++i)
+        {
+          animationCompress(mesh->animations_[i], animation_compression_settings_t(), &mesh->compressedAnimations_[i]);
+          delete[] mesh->animations_[i].data_;
+          delete[] mesh->animations_[i].nodes_;
+        }
+
+        delete[] mesh->animations_;
+        mesh->animations_ = nullptr;
       }
     }
   }
@@ -377,198 +443,1753 @@ static void loadMesh(const render::context_t& context, const struct aiScene* sce
     }
   }
 
-  mesh->aabb_.min_ = aabbMin;
-  mesh->aabb_.max_ = aabbMax;
-
-  create(context, indices, indexBufferSize, vertexData, vertexBufferSize, &attributes[0], attributeCount, allocator, mesh);
+  mesh->materialIndex_ = aimesh->mMaterialIndex;
+  CreateMesh(context, indices, indexBufferSize, vertexData, vertexBufferSize, &attributes[0], (u32)attributes.size(), allocator, pool, (flags & EXPORT_POSITION_STREAM) != 0, mesh);
 
   delete[] vertexData;
   delete[] indices;
 }
 
-
-
-/*********************
-* API Implementation
-**********************/
-
-
-void mesh::create(const render::context_t& context,
-  const uint32_t* indexData, uint32_t indexDataSize,
-  const void* vertexData, size_t vertexDataSize,
-  render::vertex_attribute_t* attribute, uint32_t attributeCount,
-  render::gpu_memory_allocator_t* allocator,
-  mesh_t* mesh)
+struct mesh_instance_t
 {
-  //Create vertex format
-  render::vertexFormatCreate(attribute, attributeCount, &mesh->vertexFormat_);
-
-  mesh->indexCount_ = (u32)indexDataSize / sizeof(uint32_t);
-  mesh->vertexCount_ = (u32)vertexDataSize / mesh->vertexFormat_.vertexSize_;
-
-  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::INDEX_BUFFER, (void*)indexData, (size_t)indexDataSize, allocator, &mesh->indexBuffer_);
-  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::VERTEX_BUFFER, (void*)vertexData, (size_t)vertexDataSize, allocator, &mesh->vertexBuffer_);
-}
-
+  u32 mesh_;
+  aiMatrix4x4 transform_;
+};
 
-void mesh::createFromFile(const render::context_t& context, const char* file, export_flags_e exportFlags, render::gpu_memory_allocator_t* allocator, uint32_t submesh, mesh_t* mesh)
+static void CollectMeshInstances(const aiNode* node, const aiMatrix4x4& parentTransform, std::vector<mesh_instance_t>* instances)
 {
-  Assimp::Importer Importer;
-  int flags = aiProcess_Triangulate | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights | aiProcess_GenSmoothNormals;
-  const struct aiScene* scene = Importer.ReadFile(file, flags);
-  assert(scene && scene->mNumMeshes > submesh);
+  aiMatrix4x4 transform = parentTransform * node->mTransformation;
+  for (u32 i(0); i<node->mNumMeshes; ++i)
+  {
+    instances->push_back({ node->mMeshes[i], transform });
+  }
 
-  loadMesh(context, scene, submesh, mesh, exportFlags, allocator);
+  for (u32 i(0); i<node->mNumChildren; ++i)
+  {
+    CollectMeshInstances(node->mChildren[i], transform, instances);
+  }
 }
 
-uint32_t mesh::createFromFile(const render::context_t& context, const char* file, export_flags_e exportFlags, render::gpu_memory_allocator_t* allocator, mesh_t** meshes)
+//Loads a group of static submeshes sharing the same material and vertex layout as a single mesh
+static void loadMergedMesh(const render::context_t& context, const struct aiScene* scene, const std::vector<mesh_instance_t>& instances, mesh_t* mesh, export_flags_e flags, render::gpu_memory_allocator_t* allocator, geometry_pool_t* pool)
 {
-  Assimp::Importer Importer;
-  int flags = aiProcess_Triangulate | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights | aiProcess_GenSmoothNormals;
-  const struct aiScene* scene = Importer.ReadFile(file, flags);
-  assert(scene && scene->mNumMeshes > 0);
+  const struct aiMesh* firstMesh = scene->mMeshes[instances[0].mesh_];
+  bool importNormals = (((flags & EXPORT_NORMALS) != 0) && firstMesh->HasNormals());
+  bool importUV = (((flags & EXPORT_UV) != 0) && firstMesh->HasTextureCoords(0));
+  bool pretransform = (flags & EXPORT_PRETRANSFORM) != 0;
 
-  uint32_t meshCount = scene->mNumMeshes;
-  *meshes = new mesh_t[meshCount];
-  for (uint32_t i(0); i<meshCount; ++i)
+  std::vector<render::vertex_attribute_t> attributes;
+  u32 vertexSize = VertexAttributes(importNormals, importUV, false, &attributes);
+
+  size_t vertexCount = 0u;
+  size_t indexCount = 0u;
+  for (u32 i(0); i<instances.size(); ++i)
   {
-    loadMesh(context, scene, i, *meshes + i, exportFlags, allocator);
+    vertexCount += scene->mMeshes[instances[i].mesh_]->mNumVertices;
+    indexCount += scene->mMeshes[instances[i].mesh_]->mNumFaces * 3; //@WARNING: Assuming triangles!
   }
 
-  return meshCount;
-}
+  f32* vertexData = new f32[vertexCount * vertexSize];
+  u32* indices = new u32[indexCount];
 
-uint32_t mesh::loadMaterials(const char* file, uint32_t** materialIndices, material_t** materials)
-{
-  Assimp::Importer Importer;
-  int flags = aiProcess_Triangulate | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights | aiProcess_GenSmoothNormals;
-  const struct aiScene* scene = Importer.ReadFile(file, flags);
-  assert(scene && scene->mNumMeshes > 0);
+  mesh->submeshCount_ = (u32)instances.size();
+  mesh->submeshes_ = new submesh_t[mesh->submeshCount_];
+  mesh->aabb_.min_ = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+  mesh->aabb_.max_ = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 
-  uint32_t meshCount = scene->mNumMeshes;
-  *materialIndices = new uint32_t[meshCount];
-  for (uint32_t i(0); i<meshCount; ++i)
+  u32 vertexBase = 0u;
+  u32 indexBase = 0u;
+  for (u32 i(0); i<instances.size(); ++i)
   {
-    *(*materialIndices + i) = scene->mMeshes[i]->mMaterialIndex;
-  }
+    const struct aiMesh* aimesh = scene->mMeshes[instances[i].mesh_];
+    submesh_t& submesh = mesh->submeshes_[i];
+    WriteVertices(aimesh, pretransform ? &instances[i].transform_ : nullptr, importNormals, importUV, vertexSize, vertexData + vertexBase * vertexSize, &submesh.aabb_);
 
-  uint32_t materialCount = scene->mNumMaterials;
-  *materials = new material_t[materialCount];
+    mesh->aabb_.min_ = vec3(maths::minValue(submesh.aabb_.min_.x, mesh->aabb_.min_.x),
+                            maths::minValue(submesh.aabb_.min_.y, mesh->aabb_.min_.y),
+                            maths::minValue(submesh.aabb_.min_.z, mesh->aabb_.min_.z));
 
-  aiColor3D color;
-  aiString path;
-  for (uint32_t i(0); i < materialCount; ++i)
-  {
-    //Diffuse color
-    if (scene->mMaterials[i]->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS)
-    {
-      (*(*materials + i)).kd_ = vec3(color.r, color.g, color.b);
-    }
+    mesh->aabb_.max_ = vec3(maths::maxValue(submesh.aabb_.max_.x, mesh->aabb_.max_.x),
+                            maths::maxValue(submesh.aabb_.max_.y, mesh->aabb_.max_.y),
+                            maths::maxValue(submesh.aabb_.max_.z, mesh->aabb_.max_.z));
 
-    //Diffuse map
-    if (scene->mMaterials[i]->Get(AI_MATKEY_TEXTURE_DIFFUSE(0), path) == AI_SUCCESS)
+    submesh.firstIndex_ = indexBase;
+    submesh.indexCount_ = aimesh->mNumFaces * 3;
+    for (u32 face(0); face<aimesh->mNumFaces; ++face)
     {
-      (*(*materials + i)).diffuseMap_ = path.C_Str();
+      indices[indexBase++] = vertexBase + aimesh->mFaces[face].mIndices[0];
+      indices[indexBase++] = vertexBase + aimesh->mFaces[face].mIndices[1];
+      indices[indexBase++] = vertexBase + aimesh->mFaces[face].mIndices[2];
     }
+
+    vertexBase += aimesh->mNumVertices;
   }
 
-  return materialCount;
+  mesh->skeleton_ = nullptr;
+  mesh->animations_ = nullptr;
+  mesh->materialIndex_ = firstMesh->mMaterialIndex;
+  CreateMesh(context, indices, (u32)(indexCount * sizeof(u32)), vertexData, vertexCount * vertexSize * sizeof(f32), &attributes[0], (u32)attributes.size(), allocator, pool, (flags & EXPORT_POSITION_STREAM) != 0, mesh);
+
+  delete[] vertexData;
+  delete[] indices;
 }
 
-void mesh::destroy(const render::context_t& context, mesh_t* mesh, render::gpu_memory_allocator_t* allocator)
+//Loads all the meshes in the scene merging static submeshes which share material and vertex layout. Skinned meshes are loaded individually
+static uint32_t loadMeshesMerged(const render::context_t& context, const struct aiScene* scene, export_flags_e flags, render::gpu_memory_allocator_t* allocator, geometry_pool_t* pool, mesh_t** meshes)
 {
-  render::gpuBufferDestroy(context, allocator, &mesh->indexBuffer_);
-  render::gpuBufferDestroy(context, allocator, &mesh->vertexBuffer_);
+  bool importBoneWeights = (flags & EXPORT_BONE_WEIGHTS) != 0;
 
-  if (mesh->skeleton_)
+  //Find the meshes to load. When pretransforming, every node referencing a mesh generates an instance of the mesh
+  std::vector<mesh_instance_t> instances;
+  if ((flags & EXPORT_PRETRANSFORM) != 0)
   {
-    delete[] mesh->skeleton_->offsets_;
-    delete[] mesh->skeleton_->bones_;
-    delete mesh->skeleton_;
+    CollectMeshInstances(scene->mRootNode, aiMatrix4x4(), &instances);
+  }
+  else
+  {
+    for (u32 i(0); i<scene->mNumMeshes; ++i)
+    {
+      instances.push_back({ i, aiMatrix4x4() });
+    }
   }
 
-  if (mesh->animationCount_ > 0)
+  //Group static instances by material and vertex layout
+  std::map<u32, u32> keyToGroup;
+  std::vector< std::vector<mesh_instance_t> > groups;
+  std::vector<u32> skinnedMeshes;
+  for (u32 i(0); i<instances.size(); ++i)
   {
-    for (u32 i(0); i<mesh->animationCount_; ++i)
+    const aiMesh* aimesh = scene->mMeshes[instances[i].mesh_];
+    if (importBoneWeights && aimesh->mNumBones > 0)
     {
-      delete[] mesh->animations_[i].data_;
+      if (std::find(skinnedMeshes.begin(), skinnedMeshes.end(), instances[i].mesh_) == skinnedMeshes.end())
+      {
+        skinnedMeshes.push_back(instances[i].mesh_);
+      }
+      continue;
     }
 
-    delete mesh->animations_;
+    u32 key = aimesh->mMaterialIndex * 4 + (aimesh->HasNormals() ? 1 : 0) + (aimesh->HasTextureCoords(0) ? 2 : 0);
+    std::map<u32, u32>::iterator it = keyToGroup.find(key);
+    if (it == keyToGroup.end())
+    {
+      it = keyToGroup.insert(std::make_pair(key, (u32)groups.size())).first;
+      groups.push_back(std::vector<mesh_instance_t>());
+    }
+    groups[it->second].push_back(instances[i]);
   }
 
-  vertexFormatDestroy(&mesh->vertexFormat_);
-}
-
-void mesh::draw(VkCommandBuffer commandBuffer, const mesh_t& mesh)
-{
-  vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer_.handle_, 0, VK_INDEX_TYPE_UINT32);
+  uint32_t meshCount = (uint32_t)(groups.size() + skinnedMeshes.size());
+  *meshes = new mesh_t[meshCount];
+  for (u32 i(0); i<groups.size(); ++i)
+  {
+    loadMergedMesh(context, scene, groups[i], *meshes + i, flags, allocator, pool);
+  }
 
-  uint32_t attributeCount = mesh.vertexFormat_.attributeCount_;
-  std::vector<VkBuffer> buffers(attributeCount);
-  std::vector<VkDeviceSize> offsets(attributeCount);
-  for (uint32_t i(0); i<attributeCount; ++i)
+  for (u32 i(0); i<skinnedMeshes.size(); ++i)
   {
-    buffers[i] = mesh.vertexBuffer_.handle_;
-    offsets[i] = 0u;
+    loadMesh(context, scene, skinnedMeshes[i], *meshes + groups.size() + i, flags, allocator, pool);
   }
 
-  vkCmdBindVertexBuffers(commandBuffer, 0, attributeCount, &buffers[0], &offsets[0]);
-  vkCmdDrawIndexed(commandBuffer, mesh.indexCount_, 1, 0, 0, 0);
+  return meshCount;
 }
 
-void mesh::drawInstanced(VkCommandBuffer commandBuffer, u32 instanceCount, render::gpu_buffer_t* instanceBuffer, u32 instancedAttributesCount, const mesh_t& mesh)
-{
-  vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer_.handle_, 0, VK_INDEX_TYPE_UINT32);
 
-  uint32_t attributeCount = mesh.vertexFormat_.attributeCount_;
-  std::vector<VkBuffer> buffers(attributeCount);
-  std::vector<VkDeviceSize> offsets(attributeCount);
-  for (uint32_t i(0); i<attributeCount; ++i)
-  {
-    buffers[i] = mesh.vertexBuffer_.handle_;
-    offsets[i] = 0u;
-  }
-  vkCmdBindVertexBuffers(commandBuffer, 0, attributeCount, &buffers[0], &offsets[0]);
 
-  if (instancedAttributesCount > 0 && instanceBuffer)
-  {
-    std::vector<VkBuffer> instancedBuffers(instancedAttributesCount);
-    std::vector<VkDeviceSize> instancedOffsets(instancedAttributesCount);
-    for (uint32_t i(0); i < instancedAttributesCount; ++i)
-    {
-      instancedBuffers[i] = instanceBuffer->handle_;
-      instancedOffsets[i] = 0u;
-    }
-    vkCmdBindVertexBuffers(commandBuffer, attributeCount, instancedAttributesCount, &instancedBuffers[0], &instancedOffsets[0]);
-  }
+/*********************
+* Native OBJ/PLY parser
+**********************/
 
-  //Draw command
-  vkCmdDrawIndexed(commandBuffer, mesh.indexCount_, instanceCount, 0, 0, 0);
+//Geometry read by the native parsers. All the attributes use the same index
+struct native_mesh_t
+{
+  std::vector<f32> position_;
+  std::vector<f32> normal_;   //Empty if the file has no normals
+  std::vector<f32> uv_;       //Empty if the file has no texture coordinates
+  std::vector<u32> index_;
 };
 
+//Range of a text file processed by a single job. Chunks always start at the beginning of a line
+struct parse_chunk_t
+{
+  const char* begin_;
+  const char* end_;
+  u32 count_[6];    //Number of elements of each kind found in the chunk
+  u32 first_[6];    //Index of the first element of each kind in the chunk
+  bool separateIndices_;
+  bool error_;
+};
 
-void mesh::animatorCreate(const render::context_t& context, const mesh_t& mesh, u32 animationIndex, float speed, skeletal_animator_t* animator)
+enum obj_element_e
 {
-  animator->cursor_ = 0.0f;
-  animator->speed_ = speed;
+  OBJ_POSITION = 0,
+  OBJ_NORMAL = 1,
+  OBJ_UV = 2,
+  OBJ_TRIANGLE = 3,
+  OBJ_GROUP = 4,
+  OBJ_MATERIAL = 5
+};
 
-  animator->skeleton_ = mesh.skeleton_;
-  animator->animation_ = &mesh.animations_[animationIndex];
+enum ply_element_e
+{
+  PLY_LINE = 0,
+  PLY_TRIANGLE = 1
+};
 
-  animator->boneTransform_ = new maths::mat4[mesh.skeleton_->boneCount_];
+static const u32 INVALID_INDEX = 0xFFFFFFFF;
 
-  //Create an uninitialized uniform buffer
-  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::STORAGE_BUFFER,
-    render::gpu_memory_type_e::HOST_VISIBLE_COHERENT,
-    nullptr, sizeof(maths::mat4) * mesh.skeleton_->boneCount_,
-    nullptr, &animator->buffer_);
+static bool IsSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
 }
 
-
-void mesh::animatorUpdate(const render::context_t& context, f32 deltaTime, skeletal_animator_t* animator)
+static const char* SkipSpaces(const char* s, const char* end)
 {
-  animator->cursor_ += ( deltaTime / animator->animation_->duration_ ) * animator->speed_;
+  while (s < end && IsSpace(*s))
+  {
+    ++s;
+  }
+  return s;
+}
+
+static const char* SkipToken(const char* s, const char* end)
+{
+  s = SkipSpaces(s, end);
+  while (s < end && !IsSpace(*s) && *s != '\n')
+  {
+    ++s;
+  }
+  return s;
+}
+
+static const char* NextLine(const char* s, const char* end)
+{
+  const char* newLine = (const char*)memchr(s, '\n', end - s);
+  return newLine ? newLine + 1 : end;
+}
+
+//Number of whitespace separated tokens until the end of the line or the beginning of a comment
+static u32 CountTokens(const char* s, const char* end)
+{
+  u32 count = 0u;
+  while (true)
+  {
+    s = SkipSpaces(s, end);
+    if (s == end || *s == '\n' || *s == '#')
+    {
+      return count;
+    }
+    s = SkipToken(s, end);
+    count++;
+  }
+}
+
+//Splits [begin,end) in 'chunkCount' chunks of roughly the same size
+static void SplitLines(const char* begin, const char* end, u32 chunkCount, std::vector<parse_chunk_t>* chunks)
+{
+  chunks->clear();
+  size_t size = end - begin;
+  const char* chunkBegin = begin;
+  for (u32 i(1); i <= chunkCount && chunkBegin < end; ++i)
+  {
+    const char* chunkEnd = end;
+    if (i < chunkCount)
+    {
+      chunkEnd = NextLine(maths::maxValue(begin + (size * i) / chunkCount, chunkBegin), end);
+    }
+
+    parse_chunk_t chunk = {};
+    chunk.begin_ = chunkBegin;
+    chunk.end_ = chunkEnd;
+    chunks->push_back(chunk);
+    chunkBegin = chunkEnd;
+  }
+}
+
+//Number of chunks to split a file in. Chunks of ~256KB give enough jobs to balance the work between threads
+static u32 GetChunkCount(size_t size)
+{
+  return (u32)maths::minValue(maths::maxValue(size / (256u * 1024u), (size_t)1u), (size_t)4096u);
+}
+
+//Computes first_ for each chunk as the exclusive prefix sum of count_. Returns the total count
+static u32 PrefixSum(std::vector<parse_chunk_t>& chunks, u32 element)
+{
+  u32 total = 0u;
+  for (u32 i(0); i<chunks.size(); ++i)
+  {
+    chunks[i].first_[element] = total;
+    total += chunks[i].count_[element];
+  }
+  return total;
+}
+
+//Fast decimal to float conversion. Accepts the same syntax as strtof except for hexadecimal, infinity and nan
+static const char* ParseFloat(const char* s, const char* end, f32* value)
+{
+  static const f64 POWER_OF_TEN[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+  s = SkipSpaces(s, end);
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+'))
+  {
+    negative = (*s == '-');
+    ++s;
+  }
+
+  //Only the first 19 significant digits are kept in the mantissa
+  uint64_t mantissa = 0u;
+  u32 digitCount = 0u;
+  s32 exponent = 0;
+  for (; s < end && *s >= '0' && *s <= '9'; ++s)
+  {
+    if (digitCount < 19)
+    {
+      mantissa = mantissa * 10 + (*s - '0');
+      digitCount += (mantissa != 0) ? 1 : 0;
+    }
+    else
+    {
+      exponent++;
+    }
+  }
+
+  if (s < end && *s == '.')
+  {
+    for (++s; s < end && *s >= '0' && *s <= '9'; ++s)
+    {
+      if (digitCount < 19)
+      {
+        mantissa = mantissa * 10 + (*s - '0');
+        digitCount += (mantissa != 0) ? 1 : 0;
+        exponent--;
+      }
+    }
+  }
+
+  if (s < end && (*s == 'e' || *s == 'E'))
+  {
+    ++s;
+    bool negativeExponent = false;
+    if (s < end && (*s == '-' || *s == '+'))
+    {
+      negativeExponent = (*s == '-');
+      ++s;
+    }
+
+    s32 value = 0;
+    for (; s < end && *s >= '0' && *s <= '9'; ++s)
+    {
+      value = maths::minValue(value * 10 + (*s - '0'), 10000);
+    }
+    exponent += negativeExponent ? -value : value;
+  }
+
+  f64 result = (f64)mantissa;
+  if (mantissa != 0u)
+  {
+    for (; exponent > 22; exponent -= 22)
+    {
+      result *= 1e22;
+    }
+    for (; exponent < -22; exponent += 22)
+    {
+      result /= 1e22;
+    }
+    result = (exponent < 0) ? result / POWER_OF_TEN[-exponent] : result * POWER_OF_TEN[exponent];
+  }
+
+  *value = (f32)(negative ? -result : result);
+  return s;
+}
+
+static const char* ParseInt(const char* s, const char* end, s32* value)
+{
+  s = SkipSpaces(s, end);
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+'))
+  {
+    negative = (*s == '-');
+    ++s;
+  }
+
+  s32 result = 0;
+  for (; s < end && *s >= '0' && *s <= '9'; ++s)
+  {
+    result = result * 10 + (*s - '0');
+  }
+
+  *value = negative ? -result : result;
+  return s;
+}
+
+//Area weighted vertex normals, used when the file doesn't provide them (equivalent to aiProcess_GenSmoothNormals)
+static void ComputeSmoothNormals(thread::thread_pool_t* threadPool, native_mesh_t* mesh)
+{
+  const f32* position = mesh->position_.data();
+  mesh->normal_.assign(mesh->position_.size(), 0.0f);
+  f32* normal = mesh->normal_.data();
+  for (size_t i(0); i<mesh->index_.size(); i += 3)
+  {
+    const f32* a = position + mesh->index_[i] * 3;
+    const f32* b = position + mesh->index_[i + 1] * 3;
+    const f32* c = position + mesh->index_[i + 2] * 3;
+    vec3 faceNormal = cross(vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]), vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+    for (u32 j(0); j<3; ++j)
+    {
+      f32* n = normal + mesh->index_[i + j] * 3;
+      n[0] += faceNormal.x;
+      n[1] += faceNormal.y;
+      n[2] += faceNormal.z;
+    }
+  }
+
+  thread::parallelFor(threadPool, (u32)(mesh->normal_.size() / 3), 65536u,
+    [normal](u32 begin, u32 end)
+    {
+      for (u32 i(begin); i<end; ++i)
+      {
+        f32* n = normal + i * 3;
+        f32 length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length > 0.0f)
+        {
+          n[0] /= length;
+          n[1] /= length;
+          n[2] /= length;
+        }
+      }
+    }
+  );
+}
+
+static void CountOBJElements(parse_chunk_t* chunk)
+{
+  const char* end = chunk->end_;
+  for (const char* line = chunk->begin_; line < end; line = NextLine(line, end))
+  {
+    const char* s = SkipSpaces(line, end);
+    if (end - s < 2)
+    {
+      continue;
+    }
+
+    if (s[0] == 'v')
+    {
+      if (IsSpace(s[1]))
+      {
+        chunk->count_[OBJ_POSITION]++;
+      }
+      else if (s[1] == 'n')
+      {
+        chunk->count_[OBJ_NORMAL]++;
+      }
+      else if (s[1] == 't')
+      {
+        chunk->count_[OBJ_UV]++;
+      }
+    }
+    else if (s[0] == 'f' && IsSpace(s[1]))
+    {
+      u32 cornerCount = CountTokens(s + 1, end);
+      chunk->count_[OBJ_TRIANGLE] += (cornerCount > 2) ? cornerCount - 2 : 0;
+    }
+    else if ((s[0] == 'o' || s[0] == 'g') && IsSpace(s[1]))
+    {
+      chunk->count_[OBJ_GROUP]++;
+    }
+    else if (end - s > 6 && strncmp(s, "usemtl", 6) == 0)
+    {
+      chunk->count_[OBJ_MATERIAL]++;
+    }
+  }
+}
+
+//Converts a one-based (or negative, relative to the last element read) OBJ index to a zero-based index
+static u32 GetOBJIndex(s32 index, u32 currentCount)
+{
+  if (index > 0)
+  {
+    return (u32)(index - 1);
+  }
+  return (index < 0) ? (u32)((s32)currentCount + index) : INVALID_INDEX;
+}
+
+//Parses the chunk writing vertex attributes and per-corner indices (position, uv and normal) at the offsets of the chunk
+static void ParseOBJChunk(parse_chunk_t* chunk, bool hasUV, bool hasNormals, f32* position, f32* normal, f32* uv, u32* cornerIndex)
+{
+  u32 positionCount = chunk->first_[OBJ_POSITION];
+  u32 normalCount = chunk->first_[OBJ_NORMAL];
+  u32 uvCount = chunk->first_[OBJ_UV];
+  u32* corner = cornerIndex + chunk->first_[OBJ_TRIANGLE] * 9;
+
+  const char* end = chunk->end_;
+  for (const char* line = chunk->begin_; line < end; line = NextLine(line, end))
+  {
+    const char* s = SkipSpaces(line, end);
+    if (end - s < 2)
+    {
+      continue;
+    }
+
+    if (s[0] == 'v')
+    {
+      if (IsSpace(s[1]))
+      {
+        f32* p = position + 3 * positionCount++;
+        s = ParseFloat(s + 1, end, p);
+        s = ParseFloat(s, end, p + 1);
+        ParseFloat(s, end, p + 2);
+      }
+      else if (s[1] == 'n')
+      {
+        f32* n = normal + 3 * normalCount++;
+        s = ParseFloat(s + 2, end, n);
+        s = ParseFloat(s, end, n + 1);
+        ParseFloat(s, end, n + 2);
+      }
+      else if (s[1] == 't')
+      {
+        f32* t = uv + 2 * uvCount++;
+        s = ParseFloat(s + 2, end, t);
+        ParseFloat(s, end, t + 1);
+      }
+    }
+    else if (s[0] == 'f' && IsSpace(s[1]))
+    {
+      //Faces are triangulated as fans. Each corner is stored as (position, uv, normal)
+      u32 firstCorner[3];
+      u32 previousCorner[3];
+      u32 cornerCount = 0u;
+      s = s + 1;
+      while (true)
+      {
+        s = SkipSpaces(s, end);
+        if (s == end || *s == '\n' || *s == '#')
+        {
+          break;
+        }
+
+        s32 index[3] = { 0, 0, 0 };
+        s = ParseInt(s, end, &index[0]);
+        if (s < end && *s == '/')
+        {
+          ++s;
+          if (s < end && *s != '/')
+          {
+            s = ParseInt(s, end, &index[1]);
+          }
+          if (s < end && *s == '/')
+          {
+            s = ParseInt(s + 1, end, &index[2]);
+          }
+        }
+        while (s < end && !IsSpace(*s) && *s != '\n')
+        {
+          ++s;
+        }
+
+        u32 currentCorner[3] = { GetOBJIndex(index[0], positionCount), GetOBJIndex(index[1], uvCount), GetOBJIndex(index[2], normalCount) };
+        if ((hasUV && currentCorner[1] != currentCorner[0]) || (hasNormals && currentCorner[2] != currentCorner[0]))
+        {
+          chunk->separateIndices_ = true;
+        }
+
+        if (cornerCount == 0)
+        {
+          std::copy(currentCorner, currentCorner + 3, firstCorner);
+        }
+        else if (cornerCount > 1)
+        {
+          corner = std::copy(firstCorner, firstCorner + 3, corner);
+          corner = std::copy(previousCorner, previousCorner + 3, corner);
+          corner = std::copy(currentCorner, currentCorner + 3, corner);
+        }
+        std::copy(currentCorner, currentCorner + 3, previousCorner);
+        cornerCount++;
+      }
+    }
+  }
+}
+
+static bool ParseOBJ(const char* data, size_t size, thread::thread_pool_t* threadPool, native_mesh_t* mesh)
+{
+  std::vector<parse_chunk_t> chunks;
+  SplitLines(data, data + size, GetChunkCount(size), &chunks);
+
+  //First pass counts the elements in each chunk so every chunk knows where to write its data
+  thread::parallelFor(threadPool, (u32)chunks.size(), 1u,
+    [&chunks](u32 begin, u32 end)
+    {
+      for (u32 i(begin); i<end; ++i)
+      {
+        CountOBJElements(&chunks[i]);
+      }
+    }
+  );
+
+  u32 positionCount = PrefixSum(chunks, OBJ_POSITION);
+  u32 normalCount = PrefixSum(chunks, OBJ_NORMAL);
+  u32 uvCount = PrefixSum(chunks, OBJ_UV);
+  u32 triangleCount = PrefixSum(chunks, OBJ_TRIANGLE);
+
+  //Files with several objects or materials are split in submeshes by Assimp, leave them to it
+  if (PrefixSum(chunks, OBJ_GROUP) > 1 || PrefixSum(chunks, OBJ_MATERIAL) > 1 || positionCount == 0 || triangleCount == 0)
+  {
+    return false;
+  }
+
+  bool hasNormals = normalCount > 0;
+  bool hasUV = uvCount > 0;
+  std::vector<f32> position(positionCount * 3);
+  std::vector<f32> normal(normalCount * 3);
+  std::vector<f32> uv(uvCount * 2);
+  std::vector<u32> cornerIndex(triangleCount * 9);
+
+  //Second pass parses the chunks in parallel
+  thread::parallelFor(threadPool, (u32)chunks.size(), 1u,
+    [&](u32 begin, u32 end)
+    {
+      for (u32 i(begin); i<end; ++i)
+      {
+        ParseOBJChunk(&chunks[i], hasUV, hasNormals, position.data(), normal.data(), uv.data(), cornerIndex.data());
+      }
+    }
+  );
+
+  bool separateIndices = false;
+  for (u32 i(0); i<chunks.size(); ++i)
+  {
+    separateIndices |= chunks[i].separateIndices_;
+  }
+
+  u32 cornerCount = triangleCount * 3;
+  mesh->index_.resize(cornerCount);
+  if (!separateIndices)
+  {
+    //Position, normal and uv share the index. Use the attributes as they are in the file
+    if (hasNormals && normalCount != positionCount)
+    {
+      normal.clear();
+    }
+    if (hasUV && uvCount != positionCount)
+    {
+      uv.clear();
+    }
+
+    for (u32 i(0); i<cornerCount; ++i)
+    {
+      mesh->index_[i] = cornerIndex[i * 3];
+      if (mesh->index_[i] >= positionCount)
+      {
+        return false;
+      }
+    }
+
+    mesh->position_.swap(position);
+    mesh->normal_.swap(normal);
+    mesh->uv_.swap(uv);
+    return true;
+  }
+
+  //Generate a vertex for each distinct (position, uv, normal) tuple. Vertices sharing position are kept in a linked list
+  std::vector<u32> firstVertex(positionCount, INVALID_INDEX);
+  std::vector<u32> nextVertex;
+  std::vector<u32> vertexCorner;
+  nextVertex.reserve(positionCount);
+  vertexCorner.reserve(positionCount);
+  for (u32 i(0); i<cornerCount; ++i)
+  {
+    const u32* corner = &cornerIndex[i * 3];
+    if (corner[0] >= positionCount ||
+       (corner[1] != INVALID_INDEX && corner[1] >= uvCount) ||
+       (corner[2] != INVALID_INDEX && corner[2] >= normalCount))
+    {
+      return false;
+    }
+
+    u32 vertex = firstVertex[corner[0]];
+    while (vertex != INVALID_INDEX)
+    {
+      const u32* vertexAttributes = &cornerIndex[vertexCorner[vertex] * 3];
+      if (vertexAttributes[1] == corner[1] && vertexAttributes[2] == corner[2])
+      {
+        break;
+      }
+      vertex = nextVertex[vertex];
+    }
+
+    if (vertex == INVALID_INDEX)
+    {
+      vertex = (u32)vertexCorner.size();
+      vertexCorner.push_back(i);
+      nextVertex.push_back(firstVertex[corner[0]]);
+      firstVertex[corner[0]] = vertex;
+    }
+    mesh->index_[i] = vertex;
+  }
+
+  u32 vertexCount = (u32)vertexCorner.size();
+  mesh->position_.resize(vertexCount * 3);
+  mesh->normal_.resize(hasNormals ? vertexCount * 3 : 0u, 0.0f);
+  mesh->uv_.resize(hasUV ? vertexCount * 2 : 0u, 0.0f);
+  for (u32 i(0); i<vertexCount; ++i)
+  {
+    const u32* corner = &cornerIndex[vertexCorner[i] * 3];
+    std::copy(&position[corner[0] * 3], &position[corner[0] * 3] + 3, &mesh->position_[i * 3]);
+    if (hasUV && corner[1] != INVALID_INDEX)
+    {
+      std::copy(&uv[corner[1] * 2], &uv[corner[1] * 2] + 2, &mesh->uv_[i * 2]);
+    }
+    if (hasNormals && corner[2] != INVALID_INDEX)
+    {
+      std::copy(&normal[corner[2] * 3], &normal[corner[2] * 3] + 3, &mesh->normal_[i * 3]);
+    }
+  }
+
+  return true;
+}
+
+enum ply_type_e
+{
+  PLY_TYPE_INVALID = 0,
+  PLY_TYPE_INT8,
+  PLY_TYPE_UINT8,
+  PLY_TYPE_INT16,
+  PLY_TYPE_UINT16,
+  PLY_TYPE_INT32,
+  PLY_TYPE_UINT32,
+  PLY_TYPE_FLOAT32,
+  PLY_TYPE_FLOAT64
+};
+
+struct ply_property_t
+{
+  ply_type_e type_;
+  ply_type_e countType_;    //Type of the element count for list properties. PLY_TYPE_INVALID for scalar properties
+  s32 attribute_;           //Index of the vertex attribute (x,y,z,nx,ny,nz,u,v) or -1
+  bool isIndexList_;        //Vertex indices of a face
+};
+
+static ply_type_e GetPLYType(const std::string& name)
+{
+  if (name == "char" || name == "int8") return PLY_TYPE_INT8;
+  if (name == "uchar" || name == "uint8") return PLY_TYPE_UINT8;
+  if (name == "short" || name == "int16") return PLY_TYPE_INT16;
+  if (name == "ushort" || name == "uint16") return PLY_TYPE_UINT16;
+  if (name == "int" || name == "int32") return PLY_TYPE_INT32;
+  if (name == "uint" || name == "uint32") return PLY_TYPE_UINT32;
+  if (name == "float" || name == "float32") return PLY_TYPE_FLOAT32;
+  if (name == "double" || name == "float64") return PLY_TYPE_FLOAT64;
+  return PLY_TYPE_INVALID;
+}
+
+static u32 GetPLYTypeSize(ply_type_e type)
+{
+  static const u32 TYPE_SIZE[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+  return TYPE_SIZE[type];
+}
+
+static f64 ReadPLYValue(const char* data, ply_type_e type)
+{
+  switch (type)
+  {
+    case PLY_TYPE_INT8:    { s8 value;  memcpy(&value, data, sizeof(value)); return value; }
+    case PLY_TYPE_UINT8:   { u8 value;  memcpy(&value, data, sizeof(value)); return value; }
+    case PLY_TYPE_INT16:   { s16 value; memcpy(&value, data, sizeof(value)); return value; }
+    case PLY_TYPE_UINT16:  { u16 value; memcpy(&value, data, sizeof(value)); return value; }
+    case PLY_TYPE_INT32:   { s32 value; memcpy(&value, data, sizeof(value)); return value; }
+    case PLY_TYPE_UINT32:  { u32 value; memcpy(&value, data, sizeof(value)); return value; }
+    case PLY_TYPE_FLOAT32: { f32 value; memcpy(&value, data, sizeof(value)); return value; }
+    case PLY_TYPE_FLOAT64: { f64 value; memcpy(&value, data, sizeof(value)); return value; }
+    default: return 0.0;
+  }
+}
+
+static s32 GetPLYAttribute(const std::string& name)
+{
+  static const char* ATTRIBUTE_NAMES[] = { "x", "y", "z", "nx", "ny", "nz", "u", "v", "s", "t", "texture_u", "texture_v", "texture_s", "texture_t" };
+  static const s32 ATTRIBUTE_INDEX[] = { 0, 1, 2, 3, 4, 5, 6, 7, 6, 7, 6, 7, 6, 7 };
+  for (u32 i(0); i<sizeof(ATTRIBUTE_INDEX) / sizeof(ATTRIBUTE_INDEX[0]); ++i)
+  {
+    if (name == ATTRIBUTE_NAMES[i])
+    {
+      return ATTRIBUTE_INDEX[i];
+    }
+  }
+  return -1;
+}
+
+struct ply_header_t
+{
+  bool binary_;
+  u32 vertexCount_;
+  u32 faceCount_;
+  std::vector<ply_property_t> vertexProperties_;
+  std::vector<ply_property_t> faceProperties_;
+  u32 attributeMask_;   //Bit i set if attribute i is present
+  const char* body_;
+};
+
+//Parses the header of a PLY file. Only files with a vertex element followed by a face element are supported
+static bool ParsePLYHeader(const char* data, const char* end, ply_header_t* header)
+{
+  header->binary_ = false;
+  header->vertexCount_ = header->faceCount_ = 0u;
+  header->attributeMask_ = 0u;
+
+  const char* line = data;
+  if (end - line < 3 || strncmp(line, "ply", 3) != 0)
+  {
+    return false;
+  }
+
+  std::vector<ply_property_t>* properties = nullptr;
+  bool formatFound = false;
+  for (line = NextLine(line, end); line < end; line = NextLine(line, end))
+  {
+    const char* lineEnd = NextLine(line, end);
+    std::vector<std::string> tokens;
+    for (const char* s = SkipSpaces(line, lineEnd); s < lineEnd && *s != '\n'; s = SkipSpaces(s, lineEnd))
+    {
+      const char* tokenBegin = s;
+      s = SkipToken(s, lineEnd);
+      tokens.push_back(std::string(tokenBegin, s));
+    }
+
+    if (tokens.empty() || tokens[0] == "comment" || tokens[0] == "obj_info")
+    {
+      continue;
+    }
+
+    if (tokens[0] == "end_header")
+    {
+      header->body_ = lineEnd;
+      break;
+    }
+    else if (tokens[0] == "format" && tokens.size() > 1)
+    {
+      //Big endian files are left to Assimp
+      if (tokens[1] != "ascii" && tokens[1] != "binary_little_endian")
+      {
+        return false;
+      }
+      header->binary_ = (tokens[1] != "ascii");
+      formatFound = true;
+    }
+    else if (tokens[0] == "element" && tokens.size() > 2)
+    {
+      u32 count = (u32)strtoul(tokens[2].c_str(), nullptr, 10);
+      if (tokens[1] == "vertex" && properties == nullptr)
+      {
+        header->vertexCount_ = count;
+        properties = &header->vertexProperties_;
+      }
+      else if (tokens[1] == "face" && properties == &header->vertexProperties_)
+      {
+        header->faceCount_ = count;
+        properties = &header->faceProperties_;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    else if (tokens[0] == "property" && properties != nullptr)
+    {
+      ply_property_t property = { PLY_TYPE_INVALID, PLY_TYPE_INVALID, -1, false };
+      if (tokens.size() == 5 && tokens[1] == "list")
+      {
+        property.countType_ = GetPLYType(tokens[2]);
+        property.type_ = GetPLYType(tokens[3]);
+        property.isIndexList_ = (properties == &header->faceProperties_) && (tokens[4] == "vertex_indices" || tokens[4] == "vertex_index");
+        if (property.countType_ == PLY_TYPE_INVALID || properties == &header->vertexProperties_)
+        {
+          return false;
+        }
+      }
+      else if (tokens.size() == 3)
+      {
+        property.type_ = GetPLYType(tokens[1]);
+        if (properties == &header->vertexProperties_)
+        {
+          property.attribute_ = GetPLYAttribute(tokens[2]);
+          if (property.attribute_ != -1)
+          {
+            header->attributeMask_ |= 1 << property.attribute_;
+          }
+        }
+      }
+
+      if (property.type_ == PLY_TYPE_INVALID)
+      {
+        return false;
+      }
+      properties->push_back(property);
+    }
+  }
+
+  bool hasIndexList = false;
+  for (u32 i(0); i<header->faceProperties_.size(); ++i)
+  {
+    hasIndexList |= header->faceProperties_[i].isIndexList_;
+  }
+
+  return formatFound && line < end && hasIndexList && (header->attributeMask_ & 7) == 7 && header->vertexCount_ > 0 && header->faceCount_ > 0;
+}
+
+//Parses the properties of an ascii face. Writes the triangles in 'index' (if not null) and returns the number of triangles
+static u32 ParsePLYFace(const char* s, const char* end, const std::vector<ply_property_t>& properties, u32 vertexCount, u32* index, bool* error)
+{
+  u32 triangleCount = 0u;
+  for (u32 i(0); i<properties.size(); ++i)
+  {
+    if (properties[i].countType_ == PLY_TYPE_INVALID)
+    {
+      s = SkipToken(s, end);
+      continue;
+    }
+
+    s32 count;
+    s = ParseInt(s, end, &count);
+    if (!properties[i].isIndexList_)
+    {
+      for (s32 j(0); j<count; ++j)
+      {
+        s = SkipToken(s, end);
+      }
+      continue;
+    }
+
+    s32 firstIndex = 0;
+    s32 previousIndex = 0;
+    for (s32 j(0); j<count; ++j)
+    {
+      s32 vertexIndex;
+      s = ParseInt(s, end, &vertexIndex);
+      if (vertexIndex < 0 || (u32)vertexIndex >= vertexCount)
+      {
+        *error = true;
+        vertexIndex = 0;
+      }
+
+      if (j == 0)
+      {
+        firstIndex = vertexIndex;
+      }
+      else if (j > 1 && index)
+      {
+        *index++ = firstIndex;
+        *index++ = previousIndex;
+        *index++ = vertexIndex;
+      }
+      previousIndex = vertexIndex;
+    }
+    triangleCount += (count > 2) ? count - 2 : 0;
+  }
+
+  return triangleCount;
+}
+
+static bool ParsePLYAscii(const ply_header_t& header, const char* end, thread::thread_pool_t* threadPool, native_mesh_t* mesh)
+{
+  std::vector<parse_chunk_t> chunks;
+  SplitLines(header.body_, end, GetChunkCount(end - header.body_), &chunks);
+
+  //Elements are one per line, so the index of the first line of each chunk determines which elements it contains
+  thread::parallelFor(threadPool, (u32)chunks.size(), 1u,
+    [&chunks](u32 begin, u32 end)
+    {
+      for (u32 i(begin); i<end; ++i)
+      {
+        for (const char* line = chunks[i].begin_; line < chunks[i].end_; line = NextLine(line, chunks[i].end_))
+        {
+          const char* s = SkipSpaces(line, chunks[i].end_);
+          chunks[i].count_[PLY_LINE] += (s < chunks[i].end_ && *s != '\n') ? 1 : 0;
+        }
+      }
+    }
+  );
+
+  u32 vertexCount = header.vertexCount_;
+  u32 lastLine = vertexCount + header.faceCount_;
+  if (PrefixSum(chunks, PLY_LINE) < lastLine)
+  {
+    return false;
+  }
+
+  mesh->position_.resize(vertexCount * 3);
+  mesh->normal_.resize(((header.attributeMask_ & 0x38) == 0x38) ? vertexCount * 3 : 0u);
+  mesh->uv_.resize(((header.attributeMask_ & 0xC0) == 0xC0) ? vertexCount * 2 : 0u);
+  f32* attributeData[] = { mesh->position_.data(), mesh->normal_.data(), mesh->uv_.data() };
+
+  //Vertices are written directly. Faces are counted in this pass and written in the next one
+  thread::parallelFor(threadPool, (u32)chunks.size(), 1u,
+    [&](u32 begin, u32 end)
+    {
+      for (u32 i(begin); i<end; ++i)
+      {
+        parse_chunk_t& chunk = chunks[i];
+        u32 lineIndex = chunk.first_[PLY_LINE];
+        for (const char* line = chunk.begin_; line < chunk.end_ && lineIndex < lastLine; line = NextLine(line, chunk.end_))
+        {
+          const char* s = SkipSpaces(line, chunk.end_);
+          if (s == chunk.end_ || *s == '\n')
+          {
+            continue;
+          }
+
+          if (lineIndex < vertexCount)
+          {
+            for (u32 p(0); p<header.vertexProperties_.size(); ++p)
+            {
+              f32 value;
+              s = ParseFloat(s, chunk.end_, &value);
+              s32 attribute = header.vertexProperties_[p].attribute_;
+              if (attribute < 3)
+              {
+                if (attribute >= 0)
+                {
+                  attributeData[0][lineIndex * 3 + attribute] = value;
+                }
+              }
+              else if (attribute < 6)
+              {
+                if (!mesh->normal_.empty())
+                {
+                  attributeData[1][lineIndex * 3 + attribute - 3] = value;
+                }
+              }
+              else if (!mesh->uv_.empty())
+              {
+                attributeData[2][lineIndex * 2 + attribute - 6] = value;
+              }
+            }
+          }
+          else
+          {
+            chunk.count_[PLY_TRIANGLE] += ParsePLYFace(s, chunk.end_, header.faceProperties_, vertexCount, nullptr, &chunk.error_);
+          }
+          lineIndex++;
+        }
+      }
+    }
+  );
+
+  mesh->index_.resize(PrefixSum(chunks, PLY_TRIANGLE) * 3);
+  thread::parallelFor(threadPool, (u32)chunks.size(), 1u,
+    [&](u32 begin, u32 end)
+    {
+      for (u32 i(begin); i<end; ++i)
+      {
+        parse_chunk_t& chunk = chunks[i];
+        if (chunk.count_[PLY_TRIANGLE] == 0)
+        {
+          continue;
+        }
+
+        u32* index = mesh->index_.data() + chunk.first_[PLY_TRIANGLE] * 3;
+        u32 lineIndex = chunk.first_[PLY_LINE];
+        for (const char* line = chunk.begin_; line < chunk.end_ && lineIndex < lastLine; line = NextLine(line, chunk.end_))
+        {
+          const char* s = SkipSpaces(line, chunk.end_);
+          if (s == chunk.end_ || *s == '\n')
+          {
+            continue;
+          }
+
+          if (lineIndex >= vertexCount)
+          {
+            index += 3 * ParsePLYFace(s, chunk.end_, header.faceProperties_, vertexCount, index, &chunk.error_);
+          }
+          lineIndex++;
+        }
+      }
+    }
+  );
+
+  for (u32 i(0); i<chunks.size(); ++i)
+  {
+    if (chunks[i].error_)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ParsePLYBinary(const ply_header_t& header, const char* end, thread::thread_pool_t* threadPool, native_mesh_t* mesh)
+{
+  u32 vertexCount = header.vertexCount_;
+  u32 vertexStride = 0u;
+  for (u32 i(0); i<header.vertexProperties_.size(); ++i)
+  {
+    vertexStride += GetPLYTypeSize(header.vertexProperties_[i].type_);
+  }
+
+  if ((size_t)(end - header.body_) < (size_t)vertexStride * vertexCount)
+  {
+    return false;
+  }
+
+  mesh->position_.resize(vertexCount * 3);
+  mesh->normal_.resize(((header.attributeMask_ & 0x38) == 0x38) ? vertexCount * 3 : 0u);
+  mesh->uv_.resize(((header.attributeMask_ & 0xC0) == 0xC0) ? vertexCount * 2 : 0u);
+
+  //Vertices have a fixed size so they can be converted in parallel
+  thread::parallelFor(threadPool, vertexCount, 65536u,
+    [&](u32 begin, u32 end)
+    {
+      for (u32 v(begin); v<end; ++v)
+      {
+        const char* data = header.body_ + (size_t)v * vertexStride;
+        for (u32 p(0); p<header.vertexProperties_.size(); ++p)
+        {
+          const ply_property_t& property = header.vertexProperties_[p];
+          if (property.attribute_ >= 0 && property.attribute_ < 3)
+          {
+            mesh->position_[v * 3 + property.attribute_] = (f32)ReadPLYValue(data, property.type_);
+          }
+          else if (property.attribute_ >= 3 && property.attribute_ < 6 && !mesh->normal_.empty())
+          {
+            mesh->normal_[v * 3 + property.attribute_ - 3] = (f32)ReadPLYValue(data, property.type_);
+          }
+          else if (property.attribute_ >= 6 && !mesh->uv_.empty())
+          {
+            mesh->uv_[v * 2 + property.attribute_ - 6] = (f32)ReadPLYValue(data, property.type_);
+          }
+          data += GetPLYTypeSize(property.type_);
+        }
+      }
+    }
+  );
+
+  //Faces have variable size and are read sequentially
+  const char* data = header.body_ + (size_t)vertexStride * vertexCount;
+  mesh->index_.reserve(header.faceCount_ * 3);
+  for (u32 face(0); face<header.faceCount_; ++face)
+  {
+    for (u32 p(0); p<header.faceProperties_.size(); ++p)
+    {
+      const ply_property_t& property = header.faceProperties_[p];
+      u32 countSize = GetPLYTypeSize(property.countType_);
+      u32 typeSize = GetPLYTypeSize(property.type_);
+      if (property.countType_ == PLY_TYPE_INVALID)
+      {
+        data += typeSize;
+        continue;
+      }
+
+      if ((size_t)(end - data) < countSize)
+      {
+        return false;
+      }
+
+      u32 count = (u32)ReadPLYValue(data, property.countType_);
+      data += countSize;
+      if ((size_t)(end - data) < (size_t)count * typeSize)
+      {
+        return false;
+      }
+
+      if (property.isIndexList_)
+      {
+        for (u32 i(2); i<count; ++i)
+        {
+          mesh->index_.push_back((u32)ReadPLYValue(data, property.type_));
+          mesh->index_.push_back((u32)ReadPLYValue(data + (i - 1) * typeSize, property.type_));
+          mesh->index_.push_back((u32)ReadPLYValue(data + i * typeSize, property.type_));
+        }
+      }
+      data += count * typeSize;
+    }
+  }
+
+  for (u32 i(0); i<mesh->index_.size(); ++i)
+  {
+    if (mesh->index_[i] >= vertexCount)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ParsePLY(const char* data, size_t size, thread::thread_pool_t* threadPool, native_mesh_t* mesh)
+{
+  ply_header_t header;
+  if (!ParsePLYHeader(data, data + size, &header))
+  {
+    return false;
+  }
+
+  return header.binary_ ? ParsePLYBinary(header, data + size, threadPool, mesh) : ParsePLYAscii(header, data + size, threadPool, mesh);
+}
+
+//Fast path for OBJ and PLY files with a single mesh. The file is memory mapped and parsed in parallel.
+//Returns false if the file can't be handled, in which case it has to be loaded with Assimp
+static bool loadMeshNative(const render::context_t& context, const char* file, export_flags_e flags, render::gpu_memory_allocator_t* allocator, thread::thread_pool_t* threadPool, mesh_t* mesh)
+{
+  const char* extension = strrchr(file, '.');
+  if (extension == nullptr)
+  {
+    return false;
+  }
+
+  std::string format(extension);
+  std::transform(format.begin(), format.end(), format.begin(), ::tolower);
+  if (format != ".obj" && format != ".ply")
+  {
+    return false;
+  }
+
+  file::mapped_file_t mappedFile;
+  if (!file::mapFile(file, &mappedFile))
+  {
+    return false;
+  }
+
+  native_mesh_t nativeMesh;
+  bool result = (format == ".obj") ? ParseOBJ(mappedFile.data_, mappedFile.size_, threadPool, &nativeMesh) :
+                                     ParsePLY(mappedFile.data_, mappedFile.size_, threadPool, &nativeMesh);
+  file::unmapFile(&mappedFile);
+  if (!result || nativeMesh.index_.empty())
+  {
+    return false;
+  }
+
+  bool importNormals = (flags & EXPORT_NORMALS) != 0;
+  bool importUV = ((flags & EXPORT_UV) != 0) && !nativeMesh.uv_.empty();
+  if (importNormals && nativeMesh.normal_.empty())
+  {
+    ComputeSmoothNormals(threadPool, &nativeMesh);
+  }
+
+  //Interleave the attributes in the same layout loadMesh uses
+  std::vector<render::vertex_attribute_t> attributes;
+  u32 vertexSize = VertexAttributes(importNormals, importUV, false, &attributes);
+  u32 vertexCount = (u32)(nativeMesh.position_.size() / 3);
+  f32* vertexData = new f32[vertexCount * vertexSize];
+
+  std::mutex aabbLock;
+  mesh->aabb_.min_ = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+  mesh->aabb_.max_ = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  thread::parallelFor(threadPool, vertexCount, 65536u,
+    [&](u32 begin, u32 end)
+    {
+      vec3 aabbMin(FLT_MAX, FLT_MAX, FLT_MAX);
+      vec3 aabbMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+      for (u32 vertex(begin); vertex<end; ++vertex)
+      {
+        const f32* position = &nativeMesh.position_[vertex * 3];
+        aabbMin = vec3(maths::minValue(position[0], aabbMin.x), maths::minValue(position[1], aabbMin.y), maths::minValue(position[2], aabbMin.z));
+        aabbMax = vec3(maths::maxValue(position[0], aabbMax.x), maths::maxValue(position[1], aabbMax.y), maths::maxValue(position[2], aabbMax.z));
+
+        f32* data = std::copy(position, position + 3, vertexData + vertex * vertexSize);
+        if (importNormals)
+        {
+          data = std::copy(&nativeMesh.normal_[vertex * 3], &nativeMesh.normal_[vertex * 3] + 3, data);
+        }
+        if (importUV)
+        {
+          std::copy(&nativeMesh.uv_[vertex * 2], &nativeMesh.uv_[vertex * 2] + 2, data);
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(aabbLock);
+      mesh->aabb_.min_ = vec3(maths::minValue(aabbMin.x, mesh->aabb_.min_.x), maths::minValue(aabbMin.y, mesh->aabb_.min_.y), maths::minValue(aabbMin.z, mesh->aabb_.min_.z));
+      mesh->aabb_.max_ = vec3(maths::maxValue(aabbMax.x, mesh->aabb_.max_.x), maths::maxValue(aabbMax.y, mesh->aabb_.max_.y), maths::maxValue(aabbMax.z, mesh->aabb_.max_.z));
+    }
+  );
+
+  mesh->skeleton_ = nullptr;
+  mesh->animations_ = nullptr;
+  mesh->materialIndex_ = 0u;
+  CreateMesh(context, nativeMesh.index_.data(), (u32)(nativeMesh.index_.size() * sizeof(u32)), vertexData, (size_t)vertexCount * vertexSize * sizeof(f32), &attributes[0], (u32)attributes.size(), allocator, nullptr, (flags & EXPORT_POSITION_STREAM) != 0, mesh);
+
+  delete[] vertexData;
+  return true;
+}
+
+
+/*********************
+* API Implementation
+**********************/
+
+
+void mesh::create(const render::context_t& context,
+  const uint32_t* indexData, uint32_t indexDataSize,
+  const void* vertexData, size_t vertexDataSize,
+  render::vertex_attribute_t* attribute, uint32_t attributeCount,
+  render::gpu_memory_allocator_t* allocator,
+  mesh_t* mesh)
+{
+  //Create vertex format
+  render::vertexFormatCreate(attribute, attributeCount, &mesh->vertexFormat_);
+
+  mesh->indexCount_ = (u32)indexDataSize / sizeof(uint32_t);
+  mesh->vertexCount_ = (u32)vertexDataSize / mesh->vertexFormat_.vertexSize_;
+  mesh->firstIndex_ = 0u;
+  mesh->vertexOffset_ = 0;
+  mesh->pool_ = nullptr;
+  mesh->hasPositionStream_ = false;
+
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::INDEX_BUFFER, (void*)indexData, (size_t)indexDataSize, allocator, &mesh->indexBuffer_);
+  //Vertex buffers can also be read as storage buffers by compute passes (e.g gpu skinning)
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::VERTEX_BUFFER | render::gpu_buffer_t::usage::STORAGE_BUFFER, (void*)vertexData, (size_t)vertexDataSize, allocator, &mesh->vertexBuffer_);
+}
+
+bool mesh::createInPool(const render::context_t& context,
+  const uint32_t* indexData, uint32_t indexDataSize,
+  const void* vertexData, size_t vertexDataSize,
+  render::vertex_attribute_t* attribute, uint32_t attributeCount,
+  geometry_pool_t* pool, mesh_t* mesh)
+{
+  //Vertices are placed at a multiple of the vertex size so the mesh can be addressed with a vertex offset
+  uint32_t vertexSize = attribute[0].stride_;
+  size_t vertexBufferOffset = GetNextMultiple(pool->vertexBufferUsed_, vertexSize);
+
+  //Positions are stored at the same vertex index than the vertex so both streams can be addressed with the same vertex offset.
+  //Meshes in the pool can have different strides, so the vertex index of the mesh also has to be past the positions already in use
+  bool positionStream = pool->positionBufferSize_ > 0u;
+  if (positionStream)
+  {
+    size_t positionsUsed = pool->positionBufferUsed_ / (3 * sizeof(f32));
+    vertexBufferOffset = maxValue(vertexBufferOffset, positionsUsed * vertexSize);
+  }
+
+  if (vertexBufferOffset + vertexDataSize > pool->vertexBufferSize_ ||
+      pool->indexBufferUsed_ + indexDataSize > pool->indexBufferSize_)
+  {
+    return false;
+  }
+
+  size_t positionBufferOffset = (vertexBufferOffset / vertexSize) * 3 * sizeof(f32);
+  size_t positionDataSize = (vertexDataSize / vertexSize) * 3 * sizeof(f32);
+  if (positionStream && positionBufferOffset + positionDataSize > pool->positionBufferSize_)
+  {
+    return false;
+  }
+
+  render::vertexFormatCreate(attribute, attributeCount, &mesh->vertexFormat_);
+
+  mesh->indexCount_ = (u32)indexDataSize / sizeof(uint32_t);
+  mesh->vertexCount_ = (u32)vertexDataSize / mesh->vertexFormat_.vertexSize_;
+  mesh->firstIndex_ = (u32)(pool->indexBufferUsed_ / sizeof(uint32_t));
+  mesh->vertexOffset_ = (s32)(vertexBufferOffset / vertexSize);
+  mesh->pool_ = pool;
+  mesh->vertexBuffer_ = pool->vertexBuffer_;
+  mesh->indexBuffer_ = pool->indexBuffer_;
+  mesh->hasPositionStream_ = positionStream;
+
+  render::gpuBufferUpdate(context, (void*)indexData, pool->indexBufferUsed_, (size_t)indexDataSize, &pool->indexBuffer_);
+  render::gpuBufferUpdate(context, (void*)vertexData, vertexBufferOffset, vertexDataSize, &pool->vertexBuffer_);
+  if (positionStream)
+  {
+    std::vector<f32> positions;
+    ExtractPositions(vertexData, vertexDataSize, attribute[0], &positions);
+    render::gpuBufferUpdate(context, positions.data(), positionBufferOffset, positionDataSize, &pool->positionBuffer_);
+    mesh->positionBuffer_ = pool->positionBuffer_;
+    pool->positionBufferUsed_ = positionBufferOffset + positionDataSize;
+  }
+
+  pool->indexBufferUsed_ += indexDataSize;
+  pool->vertexBufferUsed_ = vertexBufferOffset + vertexDataSize;
+  return true;
+}
+
+void mesh::createPositionStream(const render::context_t& context, const void* vertexData, size_t vertexDataSize, render::gpu_memory_allocator_t* allocator, mesh_t* mesh)
+{
+  assert(mesh->pool_ == nullptr);
+
+  std::vector<f32> positions;
+  ExtractPositions(vertexData, vertexDataSize, mesh->vertexFormat_.attributes_[0], &positions);
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::VERTEX_BUFFER, positions.data(), positions.size() * sizeof(f32), allocator, &mesh->positionBuffer_);
+  mesh->hasPositionStream_ = true;
+}
+
+
+void mesh::createFromFile(const render::context_t& context, const char* file, export_flags_e exportFlags, render::gpu_memory_allocator_t* allocator, uint32_t submesh, mesh_t* mesh, thread::thread_pool_t* threadPool)
+{
+  if (submesh == 0 && (exportFlags & EXPORT_DISABLE_NATIVE_PARSER) == 0 && loadMeshNative(context, file, exportFlags, allocator, threadPool, mesh))
+  {
+    return;
+  }
+
+  Assimp::Importer Importer;
+  int flags = aiProcess_Triangulate | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights | aiProcess_GenSmoothNormals;
+  const struct aiScene* scene = Importer.ReadFile(file, flags);
+  assert(scene && scene->mNumMeshes > submesh);
+
+  loadMesh(context, scene, submesh, mesh, exportFlags, allocator);
+}
+
+uint32_t mesh::createFromFile(const render::context_t& context, const char* file, export_flags_e exportFlags, render::gpu_memory_allocator_t* allocator, mesh_t** meshes)
+{
+  Assimp::Importer Importer;
+  int flags = aiProcess_Triangulate | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights | aiProcess_GenSmoothNormals;
+  const struct aiScene* scene = Importer.ReadFile(file, flags);
+  assert(scene && scene->mNumMeshes > 0);
+
+  if ((exportFlags & EXPORT_MERGE_BY_MATERIAL) != 0)
+  {
+    return loadMeshesMerged(context, scene, exportFlags, allocator, nullptr, meshes);
+  }
+
+  uint32_t meshCount = scene->mNumMeshes;
+  *meshes = new mesh_t[meshCount];
+  for (uint32_t i(0); i<meshCount; ++i)
+  {
+    loadMesh(context, scene, i, *meshes + i, exportFlags, allocator);
+  }
+
+  return meshCount;
+}
+
+uint32_t mesh::createFromFileInPool(const render::context_t& context, const char* file, export_flags_e exportFlags, geometry_pool_t* pool, mesh_t** meshes)
+{
+  Assimp::Importer Importer;
+  int flags = aiProcess_Triangulate | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights | aiProcess_GenSmoothNormals;
+  const struct aiScene* scene = Importer.ReadFile(file, flags);
+  assert(scene && scene->mNumMeshes > 0);
+
+  if ((exportFlags & EXPORT_MERGE_BY_MATERIAL) != 0)
+  {
+    return loadMeshesMerged(context, scene, exportFlags, nullptr, pool, meshes);
+  }
+
+  uint32_t meshCount = scene->mNumMeshes;
+  *meshes = new mesh_t[meshCount];
+  for (uint32_t i(0); i<meshCount; ++i)
+  {
+    loadMesh(context, scene, i, *meshes + i, exportFlags, nullptr, pool);
+  }
+
+  return meshCount;
+}
+
+uint32_t mesh::loadMaterials(const char* file, uint32_t** materialIndices, material_t** materials)
+{
+  Assimp::Importer Importer;
+  int flags = aiProcess_Triangulate | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights | aiProcess_GenSmoothNormals;
+  const struct aiScene* scene = Importer.ReadFile(file, flags);
+  assert(scene && scene->mNumMeshes > 0);
+
+  uint32_t meshCount = scene->mNumMeshes;
+  *materialIndices = new uint32_t[meshCount];
+  for (uint32_t i(0); i<meshCount; ++i)
+  {
+    *(*materialIndices + i) = scene->mMeshes[i]->mMaterialIndex;
+  }
+
+  uint32_t materialCount = scene->mNumMaterials;
+  *materials = new material_t[materialCount];
+
+  aiColor3D color;
+  aiString path;
+  for (uint32_t i(0); i < materialCount; ++i)
+  {
+    //Diffuse color
+    if (scene->mMaterials[i]->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS)
+    {
+      (*(*materials + i)).kd_ = vec3(color.r, color.g, color.b);
+    }
+
+    //Diffuse map
+    if (scene->mMaterials[i]->Get(AI_MATKEY_TEXTURE_DIFFUSE(0), path) == AI_SUCCESS)
+    {
+      (*(*materials + i)).diffuseMap_ = path.C_Str();
+    }
+  }
+
+  return materialCount;
+}
+
+void mesh::destroy(const render::context_t& context, mesh_t* mesh, render::gpu_memory_allocator_t* allocator)
+{
+  //Buffers of meshes in a pool are owned by the pool
+  if (mesh->pool_ == nullptr)
+  {
+    render::gpuBufferDestroy(context, allocator, &mesh->indexBuffer_);
+    render::gpuBufferDestroy(context, allocator, &mesh->vertexBuffer_);
+    if (mesh->hasPositionStream_)
+    {
+      render::gpuBufferDestroy(context, allocator, &mesh->positionBuffer_);
+    }
+  }
+  mesh->hasPositionStream_ = false;
+
+  if (mesh->skeleton_)
+  {
+    delete[] mesh->skeleton_->offsets_;
+    delete[] mesh->skeleton_->boneNode_;
+    delete[] mesh->skeleton_->nodeParent_;
+    delete[] mesh->skeleton_->bindPose_;
+    delete[] mesh->skeleton_->nodeDepth_;
+    delete mesh->skeleton_;
+  }
+
+  if (mesh->animationCount_ > 0)
+  {
+    for (u32 i(0); i<mesh->animationCount_; ++i)
+    {
+      if (mesh->animations_)
+      {
+        delete[] mesh->animations_[i].data_;
+      }
+
+      if (mesh->compressedAnimations_)
+      {
+        animationDestroy(&mesh->compressedAnimations_[i]);
+      }
+    }
+
+    delete[] mesh->animations_;
+    delete[] mesh->compressedAnimations_;
+    mesh->animations_ = nullptr;
+    mesh->compressedAnimations_ = nullptr;
+    mesh->animationCount_ = 0u;
+  }
+
+  delete[] mesh->submeshes_;
+  mesh->submeshes_ = nullptr;
+  mesh->submeshCount_ = 0u;
+
+  vertexFormatDestroy(&mesh->vertexFormat_);
+}
+
+void mesh::draw(VkCommandBuffer commandBuffer, const mesh_t& mesh)
+{
+  vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer_.handle_, 0, VK_INDEX_TYPE_UINT32);
+
+  uint32_t bindingCount = mesh.vertexFormat_.bindingCount_;
+  std::vector<VkBuffer> buffers(bindingCount);
+  std::vector<VkDeviceSize> offsets(bindingCount);
+  for (uint32_t i(0); i<bindingCount; ++i)
+  {
+    buffers[i] = mesh.vertexBuffer_.handle_;
+    offsets[i] = 0u;
+  }
+
+  vkCmdBindVertexBuffers(commandBuffer, 0, bindingCount, &buffers[0], &offsets[0]);
+  vkCmdDrawIndexed(commandBuffer, mesh.indexCount_, 1, mesh.firstIndex_, mesh.vertexOffset_, 0);
+}
+
+void mesh::drawPositionStream(VkCommandBuffer commandBuffer, const mesh_t& mesh)
+{
+  assert(mesh.hasPositionStream_);
+
+  VkDeviceSize offset = 0u;
+  vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer_.handle_, 0, VK_INDEX_TYPE_UINT32);
+  vkCmdBindVertexBuffers(commandBuffer, 0, 1u, &mesh.positionBuffer_.handle_, &offset);
+  vkCmdDrawIndexed(commandBuffer, mesh.indexCount_, 1, mesh.firstIndex_, mesh.vertexOffset_, 0);
+}
+
+void mesh::drawInstanced(VkCommandBuffer commandBuffer, u32 instanceCount, render::gpu_buffer_t* instanceBuffer, u32 instancedAttributesCount, const mesh_t& mesh)
+{
+  vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer_.handle_, 0, VK_INDEX_TYPE_UINT32);
+
+  uint32_t bindingCount = mesh.vertexFormat_.bindingCount_;
+  std::vector<VkBuffer> buffers(bindingCount);
+  std::vector<VkDeviceSize> offsets(bindingCount);
+  for (uint32_t i(0); i<bindingCount; ++i)
+  {
+    buffers[i] = mesh.vertexBuffer_.handle_;
+    offsets[i] = 0u;
+  }
+  vkCmdBindVertexBuffers(commandBuffer, 0, bindingCount, &buffers[0], &offsets[0]);
+
+  if (instancedAttributesCount > 0 && instanceBuffer)
+  {
+    std::vector<VkBuffer> instancedBuffers(instancedAttributesCount);
+    std::vector<VkDeviceSize> instancedOffsets(instancedAttributesCount);
+    for (uint32_t i(0); i < instancedAttributesCount; ++i)
+    {
+      instancedBuffers[i] = instanceBuffer->handle_;
+      instancedOffsets[i] = 0u;
+    }
+    vkCmdBindVertexBuffers(commandBuffer, bindingCount, instancedAttributesCount, &instancedBuffers[0], &instancedOffsets[0]);
+  }
+
+  //Draw command
+  vkCmdDrawIndexed(commandBuffer, mesh.indexCount_, instanceCount, mesh.firstIndex_, mesh.vertexOffset_, 0);
+};
+
+void mesh::geometryPoolCreate(const render::context_t& context, size_t vertexBufferSize, size_t indexBufferSize, geometry_pool_t* pool, size_t positionBufferSize)
+{
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::VERTEX_BUFFER | render::gpu_buffer_t::usage::STORAGE_BUFFER, render::gpu_memory_type_e::HOST_VISIBLE_COHERENT, nullptr, vertexBufferSize, nullptr, &pool->vertexBuffer_);
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::INDEX_BUFFER, render::gpu_memory_type_e::HOST_VISIBLE_COHERENT, nullptr, indexBufferSize, nullptr, &pool->indexBuffer_);
+  if (positionBufferSize > 0u)
+  {
+    render::gpuBufferCreate(context, render::gpu_buffer_t::usage::VERTEX_BUFFER, render::gpu_memory_type_e::HOST_VISIBLE_COHERENT, nullptr, positionBufferSize, nullptr, &pool->positionBuffer_);
+  }
+
+  pool->vertexBufferSize_ = vertexBufferSize;
+  pool->indexBufferSize_ = indexBufferSize;
+  pool->positionBufferSize_ = positionBufferSize;
+  pool->vertexBufferUsed_ = 0u;
+  pool->indexBufferUsed_ = 0u;
+  pool->positionBufferUsed_ = 0u;
+}
+
+void mesh::geometryPoolDestroy(const render::context_t& context, geometry_pool_t* pool)
+{
+  render::gpuBufferDestroy(context, nullptr, &pool->vertexBuffer_);
+  render::gpuBufferDestroy(context, nullptr, &pool->indexBuffer_);
+  if (pool->positionBufferSize_ > 0u)
+  {
+    render::gpuBufferDestroy(context, nullptr, &pool->positionBuffer_);
+    pool->positionBufferSize_ = 0u;
+  }
+  pool->vertexBufferUsed_ = 0u;
+  pool->indexBufferUsed_ = 0u;
+  pool->positionBufferUsed_ = 0u;
+}
+
+void mesh::geometryPoolBind(VkCommandBuffer commandBuffer, const geometry_pool_t& pool, u32 bindingCount)
+{
+  vkCmdBindIndexBuffer(commandBuffer, pool.indexBuffer_.handle_, 0, VK_INDEX_TYPE_UINT32);
+
+  std::vector<VkBuffer> buffers(bindingCount, pool.vertexBuffer_.handle_);
+  std::vector<VkDeviceSize> offsets(bindingCount, 0u);
+  vkCmdBindVertexBuffers(commandBuffer, 0, bindingCount, &buffers[0], &offsets[0]);
+}
+
+void mesh::geometryPoolBindPositionStream(VkCommandBuffer commandBuffer, const geometry_pool_t& pool)
+{
+  assert(pool.positionBufferSize_ > 0u);
+
+  VkDeviceSize offset = 0u;
+  vkCmdBindIndexBuffer(commandBuffer, pool.indexBuffer_.handle_, 0, VK_INDEX_TYPE_UINT32);
+  vkCmdBindVertexBuffers(commandBuffer, 0, 1u, &pool.positionBuffer_.handle_, &offset);
+}
+
+void mesh::drawFromPool(VkCommandBuffer commandBuffer, const mesh_t& mesh)
+{
+  vkCmdDrawIndexed(commandBuffer, mesh.indexCount_, 1, mesh.firstIndex_, mesh.vertexOffset_, 0);
+}
+
+VkDrawIndexedIndirectCommand mesh::getDrawIndirectCommand(const mesh_t& mesh, u32 instanceCount, u32 firstInstance)
+{
+  VkDrawIndexedIndirectCommand command = {};
+  command.indexCount = mesh.indexCount_;
+  command.instanceCount = instanceCount;
+  command.firstIndex = mesh.firstIndex_;
+  command.vertexOffset = mesh.vertexOffset_;
+  command.firstInstance = firstInstance;
+  return command;
+}
+
+
+void mesh::animatorCreate(const render::context_t& context, const mesh_t& mesh, u32 animationIndex, float speed, skeletal_animator_t* animator, palette_format_e paletteFormat)
+{
+  animator->cursor_ = 0.0f;
+  animator->speed_ = speed;
+  animator->lod_ = ANIMATOR_LOD_FULL;
+  animator->updateInterval_ = 1u;
+  animator->maxNodeDepth_ = 0xFFFFFFFF;
+  animator->lodDepth_ = 0xFFFFFFFF;
+  animator->lodAncestor_ = nullptr;
+  animator->lodOffset_ = nullptr;
+  animator->updateCount_ = 0u;
+  animator->evaluated_ = false;
+
+  animator->skeleton_ = mesh.skeleton_;
+  animator->animation_ = nullptr;
+  animator->compressedAnimation_ = nullptr;
+  animator->localPose_ = nullptr;
+  if (mesh.compressedAnimations_)
+  {
+    animator->compressedAnimation_ = &mesh.compressedAnimations_[animationIndex];
+    animator->localPose_ = new bone_transform_t[animator->compressedAnimation_->nodeCount_];
+  }
+  else
+  {
+    animator->animation_ = &mesh.animations_[animationIndex];
+  }
+
+  animator->boneTransform_ = new maths::mat4[mesh.skeleton_->boneCount_];
+  animator->localTransform_ = new maths::mat4[mesh.skeleton_->nodeCount_];
+  animator->globalTransform_ = new maths::mat4[mesh.skeleton_->nodeCount_];
+
+  animator->paletteFormat_ = paletteFormat;
+  animator->dualQuaternion_ = nullptr;
+  size_t boneSize = sizeof(maths::mat4);
+  if (paletteFormat == PALETTE_DUAL_QUATERNION)
+  {
+    animator->dualQuaternion_ = new dual_quaternion_t[mesh.skeleton_->boneCount_];
+    boneSize = sizeof(dual_quaternion_t);
+  }
+
+  //Create an uninitialized uniform buffer
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::STORAGE_BUFFER,
+    render::gpu_memory_type_e::HOST_VISIBLE_COHERENT,
+    nullptr, boneSize * mesh.skeleton_->boneCount_,
+    nullptr, &animator->buffer_);
+}
+
+
+//Converts a rigid transform to a dual quaternion. Scale of the transform is discarded
+static dual_quaternion_t DualQuaternionFromTransform(const maths::mat4& transform)
+{
+  //Rotation part without scale. Row i of the matrix is the transformed i axis
+  f32 m[3][3];
+  for (u32 row(0); row<3; ++row)
+  {
+    const f32* axis = transform.data + row * 4;
+    f32 inverseLength = 1.0f / sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    for (u32 column(0); column<3; ++column)
+    {
+      m[row][column] = axis[column] * inverseLength;
+    }
+  }
+
+  //Inverse of the conversion in maths::createTransform
+  quat q;
+  f32 trace = m[0][0] + m[1][1] + m[2][2];
+  if (trace > 0.0f)
+  {
+    f32 s = 0.5f / sqrtf(trace + 1.0f);
+    q = quat((m[1][2] - m[2][1]) * s, (m[2][0] - m[0][2]) * s, (m[0][1] - m[1][0]) * s, 0.25f / s);
+  }
+  else if (m[0][0] > m[1][1] && m[0][0] > m[2][2])
+  {
+    f32 s = 2.0f * sqrtf(1.0f + m[0][0] - m[1][1] - m[2][2]);
+    q = quat(0.25f * s, (m[1][0] + m[0][1]) / s, (m[2][0] + m[0][2]) / s, (m[1][2] - m[2][1]) / s);
+  }
+  else if (m[1][1] > m[2][2])
+  {
+    f32 s = 2.0f * sqrtf(1.0f + m[1][1] - m[0][0] - m[2][2]);
+    q = quat((m[1][0] + m[0][1]) / s, 0.25f * s, (m[2][1] + m[1][2]) / s, (m[2][0] - m[0][2]) / s);
+  }
+  else
+  {
+    f32 s = 2.0f * sqrtf(1.0f + m[2][2] - m[0][0] - m[1][1]);
+    q = quat((m[2][0] + m[0][2]) / s, (m[2][1] + m[1][2]) / s, 0.25f * s, (m[0][1] - m[1][0]) / s);
+  }
+  q.normalize();
+
+  //Dual part is half the translation (as a pure quaternion) times the rotation
+  const f32* t = transform.data + 12;
+  dual_quaternion_t result;
+  result.real_ = q;
+  result.dual_ = quat(0.5f * ( t[0] * q.w + t[1] * q.z - t[2] * q.y),
+                      0.5f * (-t[0] * q.z + t[1] * q.w + t[2] * q.x),
+                      0.5f * ( t[0] * q.y - t[1] * q.x + t[2] * q.w),
+                      -0.5f * (t[0] * q.x + t[1] * q.y + t[2] * q.z));
+  return result;
+}
+
+//Advances the cursor of the animator
+static void AnimatorAdvance(f32 deltaTime, skeletal_animator_t* animator)
+{
+  f32 duration = animator->compressedAnimation_ ? animator->compressedAnimation_->duration_ : animator->animation_->duration_;
+  if (duration <= 0.0f)
+  {
+    return;
+  }
+
+  animator->cursor_ += ( deltaTime / duration ) * animator->speed_;
 
   if (animator->cursor_ > 1.0f)
   {
@@ -579,54 +2200,274 @@ void mesh::animatorUpdate(const render::context_t& context, f32 deltaTime, skele
   {
     animator->cursor_ = 1.0f - animator->cursor_;
   }
+}
+
+//Returns true if the pose of the animator has to be evaluated in this update, depending on its level of detail
+static bool AnimatorNeedsEvaluation(skeletal_animator_t* animator)
+{
+  u32 updateCount = animator->updateCount_++;
+  if (!animator->evaluated_)
+  {
+    animator->evaluated_ = true;
+    return true;
+  }
+
+  return animator->lod_ != ANIMATOR_LOD_FROZEN && (updateCount % animator->updateInterval_) == 0;
+}
+
+//Bones deeper than maxNodeDepth_ are attached rigidly to their ancestor at that depth. The bind pose between them is folded into the
+//offset of the bone, so the pose of the deep nodes doesn't need to be sampled or propagated down the hierarchy
+static void AnimatorUpdateLodOffsets(skeletal_animator_t* animator)
+{
+  const skeleton_t* skeleton = animator->skeleton_;
+  if (animator->lodAncestor_ == nullptr)
+  {
+    animator->lodAncestor_ = new u32[skeleton->boneCount_];
+    animator->lodOffset_ = new maths::mat4[skeleton->boneCount_];
+  }
+
+  for (u32 i(0); i<skeleton->boneCount_; ++i)
+  {
+    u32 node = skeleton->boneNode_[i];
+    maths::mat4 offset = skeleton->offsets_[i];
+    while (skeleton->nodeDepth_[node] > animator->maxNodeDepth_)
+    {
+      offset = offset * skeleton->bindPose_[node];
+      node = skeleton->nodeParent_[node];
+    }
+
+    animator->lodAncestor_[i] = node;
+    animator->lodOffset_[i] = offset;
+  }
+
+  animator->lodDepth_ = animator->maxNodeDepth_;
+}
+
+//Evaluates the pose of the animator for its current cursor and writes the final transform of each bone in 'palette'
+static void AnimatorEvaluate(skeletal_animator_t* animator, maths::mat4* palette)
+{
+  //Start from the bind pose so nodes not animated by the clip keep their local transform.
+  //The pose is evaluated in the animator's own buffers, so animators sharing a skeleton don't interfere
+  const skeleton_t* skeleton = animator->skeleton_;
+  maths::mat4* localTransform = animator->localTransform_;
+  std::copy(skeleton->bindPose_, skeleton->bindPose_ + skeleton->nodeCount_, localTransform);
+
+  if (animator->compressedAnimation_)
+  {
+    //Decode the local transforms directly from the compressed animation
+    const compressed_animation_t* animation = animator->compressedAnimation_;
+    animationSample(*animation, animator->cursor_, animator->localPose_, skeleton->nodeDepth_, animator->maxNodeDepth_);
+    for (u32 i(0); i<animation->nodeCount_; ++i)
+    {
+      if (skeleton->nodeDepth_[animation->nodes_[i]] <= animator->maxNodeDepth_)
+      {
+        const bone_transform_t& transform = animator->localPose_[i];
+        localTransform[animation->nodes_[i]] = maths::createTransform(transform.position_, transform.scale_, transform.orientation_);
+      }
+    }
+  }
+  else
+  {
+    //Find out frames between which we need to interpolate
+    u32 frameCount = animator->animation_->frameCount_ - 1;
+    u32 frame0 = (u32)floor((frameCount)* animator->cursor_);
+    u32 frame1 = maths::minValue(frame0 + 1, frameCount);
+
+    //Local cursor between frames
+    f32 t = (animator->cursor_ - ((f32)frame0 / (f32)frameCount)) / (((f32)frame1 / (f32)frameCount) - ((f32)frame0 / (f32)frameCount));
+
+    //Pointers to animation data
+    bone_transform_t* transform0 = &animator->animation_->data_[frame0 * animator->animation_->nodeCount_];
+    bone_transform_t* transform1 = &animator->animation_->data_[frame1 * animator->animation_->nodeCount_];
 
-  //Find out frames between which we need to interpolate
-  u32 frameCount = animator->animation_->frameCount_ - 1;
-  u32 frame0 = (u32)floor((frameCount)* animator->cursor_);
-  u32 frame1 = maths::minValue(frame0 + 1, frameCount);
+    //Compute new local transforms
+    for (u32 i(0); i<animator->animation_->nodeCount_; ++i, ++transform0, ++transform1)
+    {
+      if (skeleton->nodeDepth_[animator->animation_->nodes_[i]] > animator->maxNodeDepth_)
+      {
+        continue;
+      }
 
-  //Local cursor between frames
-  f32 t = (animator->cursor_ - ((f32)frame0 / (f32)frameCount)) / (((f32)frame1 / (f32)frameCount) - ((f32)frame0 / (f32)frameCount));
+      //Compute new local transform of the bone
+      mat4 nodeLocalTx = maths::createTransform(maths::lerp(transform0->position_, transform1->position_, t),
+                                               maths::lerp(transform0->scale_, transform1->scale_, t),
+                                               maths::slerp(transform0->orientation_, transform1->orientation_, t));
 
-  //Pointers to animation data
-  bone_transform_t* transform0 = &animator->animation_->data_[frame0 * animator->animation_->nodeCount_];
-  bone_transform_t* transform1 = &animator->animation_->data_[frame1 * animator->animation_->nodeCount_];
+      localTransform[animator->animation_->nodes_[i]] = nodeLocalTx;
+    }
+  }
 
-  //Compute new local transforms
-  for (u32 i(0); i<animator->animation_->nodeCount_; ++i)
+  //Update global transforms. Node 0 is the root and parents are always evaluated before their children
+  maths::mat4* globalTransform = animator->globalTransform_;
+  globalTransform[0] = localTransform[0];
+  if (animator->maxNodeDepth_ == 0xFFFFFFFF)
   {
-    //Compute new local transform of the bone
-    mat4 nodeLocalTx = maths::createTransform(maths::lerp(transform0->position_, transform1->position_, t),
-                                             maths::lerp(transform0->scale_, transform1->scale_, t),
-                                             maths::slerp(transform0->orientation_, transform1->orientation_, t));
+    for (u32 i(1); i<skeleton->nodeCount_; ++i)
+    {
+      globalTransform[i] = localTransform[i] * globalTransform[skeleton->nodeParent_[i]];
+    }
 
-    animator->skeleton_->txManager_.setTransform(animator->animation_->nodes_[i], nodeLocalTx);
-  
-    //Increment pointers to read next bone's animation data
-    transform0++;
-    transform1++;
+    //Compute final transformation for each bone
+    for (u32 i = 0; i < skeleton->boneCount_; ++i)
+    {
+      palette[i] = skeleton->offsets_[i] * globalTransform[skeleton->boneNode_[i]] * skeleton->globalInverseTransform_;
+    }
   }
+  else
+  {
+    if (animator->lodDepth_ != animator->maxNodeDepth_)
+    {
+      AnimatorUpdateLodOffsets(animator);
+    }
 
-  //Update global transforms
-  animator->skeleton_->txManager_.update();
+    //Only nodes up to maxNodeDepth_ are evaluated. Deeper bones use the transform of their ancestor
+    for (u32 i(1); i<skeleton->nodeCount_; ++i)
+    {
+      if (skeleton->nodeDepth_[i] <= animator->maxNodeDepth_)
+      {
+        globalTransform[i] = localTransform[i] * globalTransform[skeleton->nodeParent_[i]];
+      }
+    }
+
+    for (u32 i = 0; i < skeleton->boneCount_; ++i)
+    {
+      palette[i] = animator->lodOffset_[i] * globalTransform[animator->lodAncestor_[i]] * skeleton->globalInverseTransform_;
+    }
+  }
+}
 
-  //Compute final transformation for each bone
-  for (u32 i = 0; i < animator->skeleton_->boneCount_; ++i)
+void mesh::animatorUpdate(const render::context_t& context, f32 deltaTime, skeletal_animator_t* animator)
+{
+  AnimatorAdvance(deltaTime, animator);
+  if (!AnimatorNeedsEvaluation(animator))
   {
-    maths::mat4* boneGlobalTx = animator->skeleton_->txManager_.getWorldMatrix(animator->skeleton_->bones_[i]);
-    animator->boneTransform_[i] = animator->skeleton_->offsets_[i] * (*boneGlobalTx) * animator->skeleton_->globalInverseTransform_;
+    return;
   }
 
+  AnimatorEvaluate(animator, animator->boneTransform_);
+
   //Upload bone transforms to the uniform buffer
-  render::gpuBufferUpdate(context, (void*)animator->boneTransform_, 0u, sizeof(maths::mat4)*animator->skeleton_->boneCount_, &animator->buffer_);
+  u32 boneCount = animator->skeleton_->boneCount_;
+  if (animator->paletteFormat_ == PALETTE_DUAL_QUATERNION)
+  {
+    for (u32 i(0); i<boneCount; ++i)
+    {
+      animator->dualQuaternion_[i] = DualQuaternionFromTransform(animator->boneTransform_[i]);
+    }
+    render::gpuBufferUpdate(context, (void*)animator->dualQuaternion_, 0u, sizeof(dual_quaternion_t)*boneCount, &animator->buffer_);
+  }
+  else
+  {
+    render::gpuBufferUpdate(context, (void*)animator->boneTransform_, 0u, sizeof(maths::mat4)*boneCount, &animator->buffer_);
+  }
 }
 
 void mesh::animatorDestroy(const render::context_t& context, skeletal_animator_t* animator)
 {
   delete[] animator->boneTransform_;
+  delete[] animator->localPose_;
+  delete[] animator->localTransform_;
+  delete[] animator->globalTransform_;
+  delete[] animator->dualQuaternion_;
+  delete[] animator->lodAncestor_;
+  delete[] animator->lodOffset_;
+  animator->dualQuaternion_ = nullptr;
+  animator->lodAncestor_ = nullptr;
+  animator->lodOffset_ = nullptr;
+  animator->localPose_ = nullptr;
+  animator->localTransform_ = nullptr;
+  animator->globalTransform_ = nullptr;
   render::gpuBufferDestroy(context, nullptr, &animator->buffer_);
 }
 
+f32 mesh::animatorScreenSize(const maths::vec3& center, f32 radius, const maths::mat4& view, const maths::mat4& projection)
+{
+  //Camera looks down the negative z axis in view space
+  f32 distance = -(maths::vec4(center.x, center.y, center.z, 1.0f) * view).z;
+  if (distance <= radius)
+  {
+    return 1.0f;
+  }
+
+  return radius * fabsf(projection.data[5]) / distance;
+}
+
+void mesh::animatorSetLod(const animator_lod_policy_t& policy, f32 screenSize, skeletal_animator_t* animator)
+{
+  animator->lod_ = ANIMATOR_LOD_FULL;
+  if (screenSize < policy.frozenSize_)
+  {
+    animator->lod_ = ANIMATOR_LOD_FROZEN;
+  }
+  else if (screenSize < policy.reducedBonesSize_)
+  {
+    animator->lod_ = ANIMATOR_LOD_REDUCED_BONES;
+  }
+  else if (screenSize < policy.reducedRateSize_)
+  {
+    animator->lod_ = ANIMATOR_LOD_REDUCED_RATE;
+  }
+
+  animator->updateInterval_ = animator->lod_ == ANIMATOR_LOD_FULL ? 1u : maths::maxValue(policy.updateInterval_, 1u);
+  animator->maxNodeDepth_ = animator->lod_ == ANIMATOR_LOD_REDUCED_BONES ? policy.maxNodeDepth_ : 0xFFFFFFFF;
+}
+
+void mesh::animatorBatchCreate(const render::context_t& context, skeletal_animator_t** animators, u32 animatorCount, animator_batch_t* batch)
+{
+  batch->animator_ = new skeletal_animator_t*[animatorCount];
+  batch->paletteOffset_ = new u32[animatorCount];
+  batch->animatorCount_ = animatorCount;
+  batch->boneCount_ = 0u;
+  for (u32 i(0); i<animatorCount; ++i)
+  {
+    batch->animator_[i] = animators[i];
+    batch->paletteOffset_[i] = batch->boneCount_;
+    batch->boneCount_ += animators[i]->skeleton_->boneCount_;
+
+    //Stagger the animators so the ones with a reduced update rate are evaluated in different frames
+    animators[i]->updateCount_ = i;
+    animators[i]->evaluated_ = false;
+  }
+
+  //The buffer is owned by the batch (not sub-allocated) so it can stay mapped for its whole lifetime
+  render::gpuBufferCreate(context, render::gpu_buffer_t::usage::STORAGE_BUFFER,
+    render::gpu_memory_type_e::HOST_VISIBLE_COHERENT,
+    nullptr, sizeof(maths::mat4) * maths::maxValue(batch->boneCount_, 1u),
+    nullptr, &batch->buffer_);
+
+  batch->palette_ = (maths::mat4*)render::gpuBufferMap(context, batch->buffer_);
+}
+
+void mesh::animatorBatchUpdate(f32 deltaTime, thread::thread_pool_t* threadPool, animator_batch_t* batch)
+{
+  thread::parallelFor(threadPool, batch->animatorCount_, 16u,
+    [&](u32 begin, u32 end)
+    {
+      for (u32 i(begin); i<end; ++i)
+      {
+        AnimatorAdvance(deltaTime, batch->animator_[i]);
+        if (AnimatorNeedsEvaluation(batch->animator_[i]))
+        {
+          AnimatorEvaluate(batch->animator_[i], batch->palette_ + batch->paletteOffset_[i]);
+        }
+      }
+    }
+  );
+}
+
+void mesh::animatorBatchDestroy(const render::context_t& context, animator_batch_t* batch)
+{
+  render::gpuBufferUnmap(context, batch->buffer_);
+  render::gpuBufferDestroy(context, nullptr, &batch->buffer_);
+
+  delete[] batch->animator_;
+  delete[] batch->paletteOffset_;
+  batch->animator_ = nullptr;
+  batch->paletteOffset_ = nullptr;
+  batch->palette_ = nullptr;
+  batch->animatorCount_ = batch->boneCount_ = 0u;
+}
+
 
 mesh::mesh_t mesh::fullScreenQuad(const bkk::render::context_t& context)
 {
@@ -26,9 +26,12 @@
 #include "mesh.h"
 #include "window.h"
 #include "image.h"
+#include "block-compression.h"
 
 #include <cstring>  //memcpy
 #include <cassert>
+#include <algorithm>
+#include <functional>
 
 using namespace bkk;
 using namespace bkk::render;
@@ -175,7 +178,8 @@ static void CreateDeviceAndQueues(VkInstance instance,
   VkPhysicalDevice* physicalDevice,
   VkDevice* logicalDevice,
   queue_t* graphicsQueue,
-  queue_t* computeQueue)
+  queue_t* computeQueue,
+  VkPhysicalDeviceFeatures* enabledFeatures)
 {
   uint32_t physicalDeviceCount = 0;
   vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, nullptr);
@@ -218,6 +222,15 @@ static void CreateDeviceAndQueues(VkInstance instance,
 
   std::vector<const char*> deviceExtensions = { "VK_KHR_swapchain" };
 
+  //Enable optional features if the device supports them
+  VkPhysicalDeviceFeatures supportedFeatures = {};
+  vkGetPhysicalDeviceFeatures(*physicalDevice, &supportedFeatures);
+  *enabledFeatures = {};
+  enabledFeatures->multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+  enabledFeatures->drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+  enabledFeatures->textureCompressionBC = supportedFeatures.textureCompressionBC;
+  deviceCreateInfo.pEnabledFeatures = enabledFeatures;
+
   deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
   deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t> (deviceExtensions.size());
 
@@ -554,7 +567,7 @@ void render::contextCreate(const char* applicationName,
   context_t* context)
 {
   context->instance_ = CreateInstance(applicationName, engineName);
-  CreateDeviceAndQueues(context->instance_, &context->physicalDevice_, &context->device_, &context->graphicsQueue_, &context->computeQueue_);
+  CreateDeviceAndQueues(context->instance_, &context->physicalDevice_, &context->device_, &context->graphicsQueue_, &context->computeQueue_, &context->enabledFeatures_);
 
   //Get memory properties of the physical device
   vkGetPhysicalDeviceMemoryProperties(context->physicalDevice_, &context->memoryProperties_);
@@ -948,50 +961,387 @@ void render::gpuAllocatorDestroy(const context_t& context, gpu_memory_allocator_
   vkFreeMemory(context.device_, allocator->memory_, nullptr);
 }
 
-static VkFormat getImageFormat(const image::image2D_t& image)
+VkFormat render::getImageFormat(const image::image2D_t& image)
 {
-  VkFormat format = VK_FORMAT_UNDEFINED;
-  if (image.componentCount_ == 3)
+  //Formats indexed by component count. Component size 4 is float, 2 is half float and anything else 8 bit unorm
+  static const VkFormat format8[4] = { VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_R8G8B8A8_UNORM };
+  static const VkFormat format16[4] = { VK_FORMAT_R16_SFLOAT, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16B16_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT };
+  static const VkFormat format32[4] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+
+  switch (image.compression_)
   {
-    if (image.componentSize_ == 4)
-    {
-      format = VK_FORMAT_R32G32B32_SFLOAT;
-    }
-    else
-    {
-      format = VK_FORMAT_R8G8B8_UNORM;
-    }
+  case image::COMPRESSION_BC1:  return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+  case image::COMPRESSION_BC3:  return VK_FORMAT_BC3_UNORM_BLOCK;
+  case image::COMPRESSION_BC4:  return VK_FORMAT_BC4_UNORM_BLOCK;
+  case image::COMPRESSION_BC5:  return VK_FORMAT_BC5_UNORM_BLOCK;
+  case image::COMPRESSION_BC6H: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+  case image::COMPRESSION_BC7:  return VK_FORMAT_BC7_UNORM_BLOCK;
+  default: break;
   }
-  else if (image.componentCount_ == 4)
+
+  if (image.componentCount_ == 0 || image.componentCount_ > 4)
   {
-    if (image.componentSize_ == 4)
-    {
-      format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    }
-    else
+    return VK_FORMAT_UNDEFINED;
+  }
+
+  if (image.componentSize_ == 4)
+  {
+    return format32[image.componentCount_ - 1];
+  }
+  else if (image.componentSize_ == 2)
+  {
+    return format16[image.componentCount_ - 1];
+  }
+
+  return format8[image.componentCount_ - 1];
+}
+
+static bool isFormatSampleable(const context_t& context, VkFormat format)
+{
+  VkFormatProperties properties = {};
+  vkGetPhysicalDeviceFormatProperties(context.physicalDevice_, format, &properties);
+  return (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+}
+
+//Uncompressed 1 and 2 component images are gray and gray + alpha. The swizzle makes them sample as (g,g,g,1) and (g,g,g,a).
+//Images expanded to RGBA in the staging buffer keep gray in R and alpha in G, so the same swizzle applies
+static VkComponentMapping getComponentMapping(const image::image2D_t& image)
+{
+  VkComponentMapping mapping = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
+  if (image.compression_ == image::COMPRESSION_NONE && image.componentCount_ == 1)
+  {
+    mapping = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE };
+  }
+  else if (image.compression_ == image::COMPRESSION_NONE && image.componentCount_ == 2)
+  {
+    mapping = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G };
+  }
+
+  return mapping;
+}
+
+//Expands 'pixelCount' pixels of 'componentCount' components to 4 components, in place. Missing color components are set to 0 and alpha to 1
+static void expandToRGBA(uint8_t* data, uint32_t pixelCount, uint32_t componentCount, uint32_t componentSize)
+{
+  uint8_t one[4] = { 0xFF, 0, 0, 0 };
+  if (componentSize == 2)
+  {
+    uint16_t half = 0x3C00;
+    memcpy(one, &half, 2);
+  }
+  else if (componentSize == 4)
+  {
+    float value = 1.0f;
+    memcpy(one, &value, 4);
+  }
+
+  //Back to front, so the expanded pixels never overwrite pixels not yet expanded
+  for (uint32_t i(pixelCount); i-- > 0;)
+  {
+    uint8_t* source = data + i * componentCount * componentSize;
+    uint8_t* destination = data + i * 4 * componentSize;
+    memmove(destination, source, componentCount * componentSize);
+    for (uint32_t component(componentCount); component < 4; ++component)
     {
-      format = VK_FORMAT_R8G8B8A8_UNORM;
+      if (component == 3)
+      {
+        memcpy(destination + component * componentSize, one, componentSize);
+      }
+      else
+      {
+        memset(destination + component * componentSize, 0, componentSize);
+      }
     }
   }
+}
+
+//Writes a mip level of the texture in the mapped memory of the staging buffer. Returns false if the data could not be written
+typedef std::function<bool(uint32_t level, uint8_t* mapping, size_t size)> staging_write_t;
+
+static bool isFormatBlittable(const context_t& context, VkFormat format)
+{
+  VkFormatProperties properties = {};
+  vkGetPhysicalDeviceFormatProperties(context.physicalDevice_, format, &properties);
+  VkFormatFeatureFlags features = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  return (properties.optimalTilingFeatures & features) == features;
+}
+
+//Blits each level from the previous one in all the layers of the texture. See textureGenerateMipmaps
+static void GenerateMipmaps(VkCommandBuffer commandBuffer, texture_t* texture, uint32_t layerCount, VkFilter filter)
+{
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = texture->image_;
+  barrier.subresourceRange.aspectMask = texture->aspectFlags_;
+  barrier.subresourceRange.layerCount = layerCount;
+
+  //Base level becomes the source of the first blit. The rest of the levels are overwritten so their contents can be discarded
+  VkImageMemoryBarrier barriers[2] = { barrier, barrier };
+  barriers[0].oldLayout = texture->layout_;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barriers[0].subresourceRange.baseMipLevel = 0;
+  barriers[0].subresourceRange.levelCount = 1;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers[1].srcAccessMask = 0;
+  barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[1].subresourceRange.baseMipLevel = 1;
+  barriers[1].subresourceRange.levelCount = texture->mipLevels_ - 1;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+    texture->mipLevels_ > 1 ? 2u : 1u, barriers);
+
+  //Each level is blitted from the previous one, which works for any aspect ratio
+  int32_t width = (int32_t)texture->extent_.width;
+  int32_t height = (int32_t)texture->extent_.height;
+  for (uint32_t level(1); level < texture->mipLevels_; ++level)
+  {
+    int32_t levelWidth = maths::maxValue(width / 2, 1);
+    int32_t levelHeight = maths::maxValue(height / 2, 1);
+
+    VkImageBlit blit = {};
+    blit.srcSubresource = { texture->aspectFlags_, level - 1, 0, layerCount };
+    blit.srcOffsets[1] = { width, height, 1 };
+    blit.dstSubresource = { texture->aspectFlags_, level, 0, layerCount };
+    blit.dstOffsets[1] = { levelWidth, levelHeight, 1 };
+    vkCmdBlitImage(commandBuffer, texture->image_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture->image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, filter);
+
+    //The level just written is the source of the next blit
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.subresourceRange.baseMipLevel = level;
+    barrier.subresourceRange.levelCount = 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    width = levelWidth;
+    height = levelHeight;
+  }
 
-  return format;
+  //All the levels are in transfer source layout now
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = texture->mipLevels_;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  texture->layout_ = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  texture->descriptor_.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 }
 
-void render::texture2DCreate(const context_t& context, const image::image2D_t* images, uint32_t imageCount, texture_sampler_t sampler, texture_t* texture)
+void render::uploadBatchCreate(const context_t& context, VkDeviceSize stagingSize, upload_batch_t* batch)
+{
+  batch->stagingSize_ = stagingSize;
+  batch->stagingHead_ = 0u;
+  batch->stagingMapping_ = nullptr;
+  if (stagingSize > 0u)
+  {
+    //The ring stays mapped during the life of the batch
+    gpuBufferCreate(context, gpu_buffer_t::usage::TRANSFER_SRC, HOST_VISIBLE_COHERENT, nullptr, (size_t)stagingSize, nullptr, &batch->staging_);
+    batch->stagingMapping_ = (uint8_t*)gpuBufferMap(context, batch->staging_);
+  }
+
+  VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+  commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  commandBufferAllocateInfo.commandBufferCount = 1;
+  commandBufferAllocateInfo.commandPool = context.commandPool_;
+  commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  vkAllocateCommandBuffers(context.device_, &commandBufferAllocateInfo, &batch->commandBuffer_);
+
+  VkFenceCreateInfo fenceCreateInfo = {};
+  fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  vkCreateFence(context.device_, &fenceCreateInfo, nullptr, &batch->fence_);
+  batch->recording_ = false;
+  batch->submitted_ = false;
+}
+
+void render::uploadBatchDestroy(const context_t& context, upload_batch_t* batch)
+{
+  uploadBatchSubmit(context, true, batch);
+  vkDestroyFence(context.device_, batch->fence_, nullptr);
+  vkFreeCommandBuffers(context.device_, context.commandPool_, 1, &batch->commandBuffer_);
+  if (batch->stagingMapping_ != nullptr)
+  {
+    gpuBufferUnmap(context, batch->staging_);
+    gpuBufferDestroy(context, nullptr, &batch->staging_);
+  }
+
+  *batch = {};
+}
+
+void render::uploadBatchSubmit(const context_t& context, bool wait, upload_batch_t* batch)
+{
+  if (batch->recording_)
+  {
+    vkEndCommandBuffer(batch->commandBuffer_);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch->commandBuffer_;
+    vkQueueSubmit(context.graphicsQueue_.handle_, 1, &submitInfo, batch->fence_);
+    batch->recording_ = false;
+    batch->submitted_ = true;
+  }
+
+  if (wait)
+  {
+    uploadBatchWait(context, batch);
+  }
+}
+
+void render::uploadBatchWait(const context_t& context, upload_batch_t* batch)
+{
+  if (!batch->submitted_)
+  {
+    return;
+  }
+
+  //Staging memory can be reused once the copies have finished
+  vkWaitForFences(context.device_, 1u, &batch->fence_, VK_TRUE, UINT64_MAX);
+  vkResetFences(context.device_, 1u, &batch->fence_);
+  for (uint32_t i(0); i < batch->overflow_.size(); ++i)
+  {
+    gpuBufferUnmap(context, batch->overflow_[i]);
+    gpuBufferDestroy(context, nullptr, &batch->overflow_[i]);
+  }
+  batch->overflow_.clear();
+  batch->stagingHead_ = 0u;
+  batch->submitted_ = false;
+}
+
+bool render::uploadBatchFinished(const context_t& context, const upload_batch_t& batch)
+{
+  return !batch.submitted_ || vkGetFenceStatus(context.device_, batch.fence_) == VK_SUCCESS;
+}
+
+VkCommandBuffer render::uploadBatchGetCommandBuffer(const context_t& context, upload_batch_t* batch)
+{
+  if (!batch->recording_)
+  {
+    uploadBatchWait(context, batch);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(batch->commandBuffer_, &beginInfo);
+    batch->recording_ = true;
+  }
+
+  return batch->commandBuffer_;
+}
+
+uint8_t* render::uploadBatchAllocate(const context_t& context, VkDeviceSize size, VkDeviceSize alignment, upload_batch_t* batch, VkBuffer* buffer, VkDeviceSize* offset)
+{
+  uploadBatchGetCommandBuffer(context, batch);
+
+  //Alignment doesn't need to be a power of two (3 component formats)
+  VkDeviceSize start = (batch->stagingHead_ + alignment - 1) / alignment * alignment;
+  if (start + size > batch->stagingSize_ && size <= batch->stagingSize_)
+  {
+    //The ring is full. Wait for the uploads using it and start again from the beginning
+    uploadBatchSubmit(context, true, batch);
+    uploadBatchGetCommandBuffer(context, batch);
+    start = 0u;
+  }
+
+  if (size > batch->stagingSize_)
+  {
+    //Allocations that don't fit in the ring get a buffer of their own
+    gpu_buffer_t overflow;
+    gpuBufferCreate(context, gpu_buffer_t::usage::TRANSFER_SRC, HOST_VISIBLE_COHERENT, nullptr, (size_t)size, nullptr, &overflow);
+    batch->overflow_.push_back(overflow);
+    *buffer = overflow.handle_;
+    *offset = 0u;
+    return (uint8_t*)gpuBufferMap(context, overflow);
+  }
+
+  batch->stagingHead_ = start + size;
+  *buffer = batch->staging_.handle_;
+  *offset = start;
+  return batch->stagingMapping_ + start;
+}
+
+//Creates a texture and uploads its data through staging memory of the batch filled by 'writeStaging', once for each of the 'imageCount' mip levels.
+//'image' describes the base level (data_ is not used). If generateMipmaps is true the full mip chain is generated from the base level with blits,
+//in the same command buffer as the upload. If the data can't be written the texture is destroyed and nothing is recorded in the batch
+static bool Texture2DCreateStaged(const context_t& context, const image::image2D_t& image, uint32_t imageCount, bool generateMipmaps, const staging_write_t& writeStaging, texture_sampler_t sampler, upload_batch_t* batch, texture_t* texture)
 {
   //Get base level image width and height
-  VkExtent3D extents = { images[0].width_, images[0].height_, 1u };
-  VkFormat format = getImageFormat(images[0]);
+  VkExtent3D extents = { image.width_, image.height_, 1u };
+  VkFormat format = getImageFormat(image);
+
+  //Block compressed images require the textureCompressionBC feature. They can't be expanded, so the texture is not created
+  if (image.compression_ != image::COMPRESSION_NONE && !context.enabledFeatures_.textureCompressionBC)
+  {
+    *texture = {};
+    return false;
+  }
+
+  //If the device can't sample the format of the image, the image is expanded to 4 components in the staging buffer
+  uint32_t expandComponentCount = 0u;
+  if (image.compression_ == image::COMPRESSION_NONE && image.componentCount_ < 4 && !isFormatSampleable(context, format))
+  {
+    image::image2D_t expanded = image;
+    expanded.componentCount_ = 4u;
+    format = getImageFormat(expanded);
+    expandComponentCount = image.componentCount_;
+  }
+
+  //Formats that can't be blitted with linear filtering get only the base level
+  uint32_t mipLevels = imageCount;
+  if (generateMipmaps)
+  {
+    mipLevels = 1u;
+    generateMipmaps = isFormatBlittable(context, format);
+    if (generateMipmaps)
+    {
+      mipLevels = 1u + (uint32_t)floor(log2(maths::maxValue(image.width_, image.height_)));
+    }
+  }
+
+  //Levels are placed in the staging buffer at offsets multiple of the texel (or block) size and of 4 bytes, as required by vkCmdCopyBufferToImage.
+  //The space reserved for each level is the one of the expanded format, so levels can be expanded in place
+  image::image2D_t stagingImage = image;
+  stagingImage.componentCount_ = expandComponentCount != 0u ? 4u : image.componentCount_;
+  stagingImage.componentSize_ = maths::maxValue(image.componentSize_, 1u);
+  uint32_t texelSize = image.compression_ != image::COMPRESSION_NONE ? image::compressionGetBlockSize(image.compression_) : stagingImage.componentCount_ * stagingImage.componentSize_;
+  uint32_t alignment = texelSize;
+  while (alignment % 4 != 0)
+  {
+    alignment += texelSize;
+  }
+
+  uint32_t uploadLevels = generateMipmaps ? 1u : imageCount;
+  std::vector<VkBufferImageCopy> bufferImageCopies(uploadLevels);
+  VkDeviceSize stagingSize = 0u;
+  for (uint32_t level(0); level < uploadLevels; ++level)
+  {
+    bufferImageCopies[level] = {};
+    bufferImageCopies[level].bufferOffset = stagingSize;
+    bufferImageCopies[level].imageExtent = { maths::maxValue(image.width_ >> level, 1u), maths::maxValue(image.height_ >> level, 1u), 1u };
+    bufferImageCopies[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    bufferImageCopies[level].imageSubresource.mipLevel = level;
+    bufferImageCopies[level].imageSubresource.layerCount = 1;
+    stagingSize += (image::mipLevelSize(stagingImage, level) + alignment - 1) / alignment * alignment;
+  }
 
   //Create the image
   VkImageCreateInfo imageCreateInfo = {};
   imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
   imageCreateInfo.pNext = nullptr;
-  imageCreateInfo.mipLevels = imageCount;
+  imageCreateInfo.mipLevels = mipLevels;
   imageCreateInfo.format = format;
   imageCreateInfo.arrayLayers = 1;
   imageCreateInfo.extent = extents;
-  imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | (generateMipmaps ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
   imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
   imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
   imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
@@ -1007,52 +1357,33 @@ void render::texture2DCreate(const context_t& context, const image::image2D_t* i
   texture->memory_ = gpuMemoryAllocate(context, requirements.size, requirements.alignment, requirements.memoryTypeBits, DEVICE_LOCAL);
   vkBindImageMemory(context.device_, texture->image_, texture->memory_.handle_, texture->memory_.offset_);
 
-  //Upload data to the texture using an staging buffer
-
-  //Create a staging buffer and memory store for the buffer
+  //Write the levels in staging memory of the batch
   VkBuffer stagingBuffer;
-
-
-  VkBufferCreateInfo bufferCreateInfo = {};
-  bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferCreateInfo.pNext = nullptr;
-  bufferCreateInfo.size = requirements.size;
-  bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-  bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  vkCreateBuffer(context.device_, &bufferCreateInfo, nullptr, &stagingBuffer);
-
-  //Allocate and bind memory to the buffer
-  vkGetBufferMemoryRequirements(context.device_, stagingBuffer, &requirements);
-  gpu_memory_t stagingBufferMemory;
-  stagingBufferMemory = gpuMemoryAllocate(context, requirements.size, requirements.alignment, requirements.memoryTypeBits, HOST_VISIBLE);
-  vkBindBufferMemory(context.device_, stagingBuffer, stagingBufferMemory.handle_, stagingBufferMemory.offset_);
-
-  //Map buffer memory and copy image data
-  unsigned char* mapping = (unsigned char*)gpuMemoryMap(context, stagingBufferMemory);
-  if (mapping)
-  {
-    for (uint32_t i(0); i < imageCount; ++i)
+  VkDeviceSize stagingOffset;
+  uint8_t* mapping = uploadBatchAllocate(context, stagingSize, alignment, batch, &stagingBuffer, &stagingOffset);
+  bool result = true;
+  for (uint32_t level(0); level < uploadLevels && result; ++level)
+  {
+    VkDeviceSize offset = bufferImageCopies[level].bufferOffset;
+    VkDeviceSize levelSize = (level + 1 < uploadLevels ? bufferImageCopies[level + 1].bufferOffset : stagingSize) - offset;
+    result = writeStaging(level, mapping + offset, (size_t)levelSize);
+    if (result && expandComponentCount != 0u)
     {
-      memcpy(mapping, images[i].data_, images[i].dataSize_);
-      mapping += images[i].dataSize_;
+      VkExtent3D levelExtent = bufferImageCopies[level].imageExtent;
+      expandToRGBA(mapping + offset, levelExtent.width * levelExtent.height, expandComponentCount, stagingImage.componentSize_);
     }
-
-    gpuMemoryUnmap(context, stagingBufferMemory);
+    bufferImageCopies[level].bufferOffset += stagingOffset;
   }
 
-  //Create command buffer
-  VkCommandBuffer uploadCommandBuffer;
-  VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
-  commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  commandBufferAllocateInfo.commandBufferCount = 1;
-  commandBufferAllocateInfo.commandPool = context.commandPool_;
-  commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  vkAllocateCommandBuffers(context.device_, &commandBufferAllocateInfo, &uploadCommandBuffer);
+  if (!result)
+  {
+    vkDestroyImage(context.device_, texture->image_, nullptr);
+    gpuMemoryDeallocate(context, nullptr, texture->memory_);
+    *texture = {};
+    return false;
+  }
 
-  //Begin command buffer
-  VkCommandBufferBeginInfo beginInfo = {};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  vkBeginCommandBuffer(uploadCommandBuffer, &beginInfo);
+  VkCommandBuffer uploadCommandBuffer = uploadBatchGetCommandBuffer(context, batch);
 
   ////Copy data from the buffer to the image
   //Transition image layout from undefined to optimal-for-transfer-destination
@@ -1066,7 +1397,7 @@ void render::texture2DCreate(const context_t& context, const image::image2D_t* i
   imageBarrier.image = texture->image_;
   imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   imageBarrier.subresourceRange.layerCount = 1;
-  imageBarrier.subresourceRange.levelCount = 1;
+  imageBarrier.subresourceRange.levelCount = uploadLevels;
 
   vkCmdPipelineBarrier(uploadCommandBuffer,
     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
@@ -1074,62 +1405,44 @@ void render::texture2DCreate(const context_t& context, const image::image2D_t* i
     0, 0, nullptr, 0, nullptr,
     1, &imageBarrier);
 
-  //Copy from buffer to image
-  //@ToDO : Copy mipmaps. Currently only base level is copied to the image
-  VkBufferImageCopy bufferImageCopy = {};
-  bufferImageCopy.imageExtent = extents;
-  bufferImageCopy.bufferOffset = 0;
-  bufferImageCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  bufferImageCopy.imageSubresource.mipLevel = 0;
-  bufferImageCopy.imageSubresource.layerCount = 1;
+  //Copy all the levels from the buffer to the image
   vkCmdCopyBufferToImage(uploadCommandBuffer, stagingBuffer,
     texture->image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-    1, &bufferImageCopy);
-
-  //Transition image layout from optimal-for-transfer to optimal-for-shader-reads
-  imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-  imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-  imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-
-  vkCmdPipelineBarrier(uploadCommandBuffer,
-    VK_PIPELINE_STAGE_TRANSFER_BIT,
-    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-    0, 0, nullptr, 0, nullptr,
-    1, &imageBarrier);
-
-  //End command buffer
-  vkEndCommandBuffer(uploadCommandBuffer);
-
-  ////Queue uploadCommandBuffer for execution
-  VkSubmitInfo submitInfo = {};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &uploadCommandBuffer;
+    uploadLevels, bufferImageCopies.data());
 
-  VkFenceCreateInfo fenceCreateInfo = {};
-  fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-  VkFence fence;
-  vkCreateFence(context.device_, &fenceCreateInfo, nullptr, &fence);
-  vkResetFences(context.device_, 1u, &fence);
-  vkQueueSubmit(context.graphicsQueue_.handle_, 1, &submitInfo, fence);
+  if (generateMipmaps)
+  {
+    //Blit the rest of the levels from the base level. Leaves the texture in shader read-only layout
+    texture->layout_ = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    texture->aspectFlags_ = VK_IMAGE_ASPECT_COLOR_BIT;
+    texture->extent_ = extents;
+    texture->mipLevels_ = mipLevels;
+    textureGenerateMipmaps(uploadCommandBuffer, texture);
+  }
+  else
+  {
+    //Transition all the levels from optimal-for-transfer to optimal-for-shader-reads
+    imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    vkCmdPipelineBarrier(uploadCommandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      0, 0, nullptr, 0, nullptr,
+      1, &imageBarrier);
+  }
 
-  //Destroy temporary resources
-  vkWaitForFences(context.device_, 1u, &fence, VK_TRUE, UINT64_MAX);
-  vkDestroyFence(context.device_, fence, nullptr);
-  vkFreeCommandBuffers(context.device_, context.commandPool_, 1, &uploadCommandBuffer);
-  gpuMemoryDeallocate(context, nullptr, stagingBufferMemory);
-  vkDestroyBuffer(context.device_, stagingBuffer, nullptr);
 
   //Create imageview
   VkImageViewCreateInfo imageViewCreateInfo = {};
   imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
   imageViewCreateInfo.format = imageCreateInfo.format;
   imageViewCreateInfo.image = texture->image_;
+  imageViewCreateInfo.components = getComponentMapping(image);
   imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  imageViewCreateInfo.subresourceRange.levelCount = 1;
+  imageViewCreateInfo.subresourceRange.levelCount = mipLevels;
   imageViewCreateInfo.subresourceRange.layerCount = 1;
   imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
   vkCreateImageView(context.device_, &imageViewCreateInfo, nullptr, &texture->imageView_);
@@ -1146,22 +1459,119 @@ void render::texture2DCreate(const context_t& context, const image::image2D_t* i
   samplerCreateInfo.mipLodBias = 0.0f;
   samplerCreateInfo.compareOp = VK_COMPARE_OP_NEVER;
   samplerCreateInfo.minLod = 0.0f;
-  samplerCreateInfo.maxLod = imageCount - 1.0f;
+  samplerCreateInfo.maxLod = mipLevels - 1.0f;
   samplerCreateInfo.maxAnisotropy = 1.0;
   vkCreateSampler(context.device_, &samplerCreateInfo, nullptr, &texture->sampler_);
 
   
   texture->descriptor_ = {};
-  texture->descriptor_.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
   texture->descriptor_.imageView = texture->imageView_;
   texture->descriptor_.sampler = texture->sampler_;
-  texture->layout_ = VK_IMAGE_LAYOUT_GENERAL;
   texture->extent_ = extents;
-  texture->mipLevels_ = 1;
+  texture->mipLevels_ = mipLevels;
   texture->aspectFlags_ = VK_IMAGE_ASPECT_COLOR_BIT;
   texture->format_ = format;
 
-  textureChangeLayoutNow(context, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, texture);
+  //All the levels were left in shader read-only layout by the upload command buffer
+  texture->layout_ = texture->descriptor_.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  return result;
+}
+
+//Records the upload in a temporary batch and waits for it to finish
+template <typename F>
+static bool UploadNow(const context_t& context, F record)
+{
+  upload_batch_t batch;
+  uploadBatchCreate(context, 0u, &batch);
+  bool result = record(&batch);
+  uploadBatchDestroy(context, &batch);
+  return result;
+}
+
+void render::texture2DCreate(const context_t& context, const image::image2D_t* images, uint32_t imageCount, texture_sampler_t sampler, texture_t* texture)
+{
+  texture2DCreate(context, images, imageCount, sampler, nullptr, texture);
+}
+
+void render::texture2DCreate(const context_t& context, const image::image2D_t* images, uint32_t imageCount, texture_sampler_t sampler, upload_batch_t* batch, texture_t* texture)
+{
+  if (batch == nullptr)
+  {
+    UploadNow(context, [&](upload_batch_t* temporaryBatch) { texture2DCreate(context, images, imageCount, sampler, temporaryBatch, texture); return true; });
+    return;
+  }
+
+  Texture2DCreateStaged(context, images[0], imageCount, false,
+    [images](uint32_t level, uint8_t* mapping, size_t size)
+    {
+      memcpy(mapping, images[level].data_, maths::minValue((size_t)images[level].dataSize_, size));
+      return true;
+    },
+    sampler, batch, texture);
+}
+
+bool render::texture2DCreate(const context_t& context, const image::mip_chain_t& mipChain, texture_sampler_t sampler, texture_t* texture)
+{
+  return texture2DCreate(context, mipChain, sampler, nullptr, texture);
+}
+
+bool render::texture2DCreate(const context_t& context, const image::mip_chain_t& mipChain, texture_sampler_t sampler, upload_batch_t* batch, texture_t* texture)
+{
+  if (batch == nullptr)
+  {
+    return UploadNow(context, [&](upload_batch_t* temporaryBatch) { return texture2DCreate(context, mipChain, sampler, temporaryBatch, texture); });
+  }
+
+  //Levels are copied from the mapped file to the staging memory as they are stored
+  return Texture2DCreateStaged(context, mipChain.image_, mipChain.levelCount_, false,
+    [&mipChain](uint32_t level, uint8_t* mapping, size_t size)
+    {
+      if (mipChain.levelSize_[level] > size)
+      {
+        return false;
+      }
+
+      memcpy(mapping, mipChain.levelData_[level], mipChain.levelSize_[level]);
+      return true;
+    },
+    sampler, batch, texture);
+}
+
+bool render::texture2DCreate(const context_t& context, const char* file, bool flipVertical, texture_sampler_t sampler, texture_t* texture)
+{
+  return texture2DCreate(context, file, flipVertical, sampler, nullptr, texture);
+}
+
+bool render::texture2DCreate(const context_t& context, const char* file, bool flipVertical, texture_sampler_t sampler, upload_batch_t* batch, texture_t* texture)
+{
+  if (batch == nullptr)
+  {
+    return UploadNow(context, [&](upload_batch_t* temporaryBatch) { return texture2DCreate(context, file, flipVertical, sampler, temporaryBatch, texture); });
+  }
+
+  //KTX2 and DDS files already contain the mip chain, so they are copied as they are.
+  //The data is written in the staging memory before returning, so the file can be unmapped straight away
+  image::mip_chain_t mipChain;
+  if (image::loadMipChain(file, &mipChain))
+  {
+    bool result = texture2DCreate(context, mipChain, sampler, batch, texture);
+    image::unloadMipChain(&mipChain);
+    return result;
+  }
+
+  //Only the header is read here. The image is decoded directly in the staging memory
+  image::image2D_t image = {};
+  if (!image::loadInfo(file, &image))
+  {
+    return false;
+  }
+
+  return Texture2DCreateStaged(context, image, 1u, false,
+    [file, flipVertical, &image](uint32_t, uint8_t* mapping, size_t size)
+    {
+      return image::loadInto(file, flipVertical, mapping, size, &image);
+    },
+    sampler, batch, texture);
 }
 
 void render::texture2DCreate(const context_t& context,
@@ -1242,6 +1652,11 @@ void render::texture2DCreate(const context_t& context,
 }
 
 void render::textureCubemapCreate(const context_t& context, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, texture_sampler_t sampler, texture_cubemap_t* texture)
+{
+  textureCubemapCreate(context, format, width, height, mipLevels, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, sampler, texture);
+}
+
+void render::textureCubemapCreate(const context_t& context, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, VkImageUsageFlags usage, texture_sampler_t sampler, texture_cubemap_t* texture)
 {
   //Get base level image width and height
   VkExtent3D extents = { width, height, 1u };
@@ -1254,7 +1669,7 @@ void render::textureCubemapCreate(const context_t& context, VkFormat format, uin
   imageCreateInfo.format = format;
   imageCreateInfo.arrayLayers = 6;  //Cubemap faces
   imageCreateInfo.extent = extents;
-  imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  imageCreateInfo.usage = usage;
   imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
   imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
   imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
@@ -1312,80 +1727,58 @@ void render::textureCubemapCreate(const context_t& context, VkFormat format, uin
 
 void render::textureCubemapCreate(const context_t& context, const image::image2D_t* images, uint32_t mipLevels, texture_sampler_t sampler, texture_cubemap_t* texture)
 {
+  textureCubemapCreate(context, images, mipLevels, sampler, nullptr, texture);
+}
+
+void render::textureCubemapCreate(const context_t& context, const image::image2D_t* images, uint32_t mipLevels, texture_sampler_t sampler, upload_batch_t* batch, texture_cubemap_t* texture)
+{
+  if (batch == nullptr)
+  {
+    UploadNow(context, [&](upload_batch_t* temporaryBatch) { textureCubemapCreate(context, images, mipLevels, sampler, temporaryBatch, texture); return true; });
+    return;
+  }
+
+  //The base level of each face is uploaded and the rest of the levels are generated from it with blits.
+  //Formats that can't be blitted with linear filtering get only the base level
   VkExtent3D extents = { images[0].width_, images[0].height_, 1u };
   VkFormat format = getImageFormat(images[0]);
+  mipLevels = maths::minValue(maths::maxValue(mipLevels, 1u), 1u + (uint32_t)floor(log2(maths::maxValue(extents.width, extents.height))));
+  if (mipLevels > 1u && !isFormatBlittable(context, format))
+  {
+    mipLevels = 1u;
+  }
   textureCubemapCreate(context, format, images[0].width_, images[0].height_, mipLevels, sampler, texture);
-  
-  //Create a staging buffer and memory store for the buffer  
-  VkMemoryRequirements requirements = {};
-  vkGetImageMemoryRequirements(context.device_, texture->image_, &requirements);
-  VkBuffer stagingBuffer;
-  VkBufferCreateInfo bufferCreateInfo = {};
-  bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferCreateInfo.pNext = nullptr;
-  bufferCreateInfo.size = requirements.size;
-  bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-  bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  vkCreateBuffer(context.device_, &bufferCreateInfo, nullptr, &stagingBuffer);
-
-  //Allocate and bind memory to the buffer
-  vkGetBufferMemoryRequirements(context.device_, stagingBuffer, &requirements);
-  gpu_memory_t stagingBufferMemory;
-  stagingBufferMemory = gpuMemoryAllocate(context, requirements.size, requirements.alignment, requirements.memoryTypeBits, HOST_VISIBLE);
-  vkBindBufferMemory(context.device_, stagingBuffer, stagingBufferMemory.handle_, stagingBufferMemory.offset_);
-
-  //@TODO: Handle mipmaps
-  //Map buffer memory and copy image data
-  unsigned char* mapping = (unsigned char*)gpuMemoryMap(context, stagingBufferMemory);
-  if (mapping)
-  {
-    for (uint32_t i(0); i < 6; ++i)
-    {
-      memcpy(mapping, images[i].data_, images[i].dataSize_);
-      mapping += images[i].dataSize_;
-    }
 
-    gpuMemoryUnmap(context, stagingBufferMemory);
+  //Faces are placed in the staging memory at offsets multiple of the texel size and of 4 bytes
+  uint32_t texelSize = maths::maxValue(images[0].componentCount_ * images[0].componentSize_, 1u);
+  uint32_t alignment = texelSize;
+  while (alignment % 4 != 0)
+  {
+    alignment += texelSize;
   }
 
-  std::vector<VkBufferImageCopy> bufferCopyRegions;
-  size_t offset = 0;
+  VkDeviceSize faceSize = (images[0].dataSize_ + alignment - 1) / alignment * alignment;
+  VkBuffer stagingBuffer;
+  VkDeviceSize stagingOffset;
+  uint8_t* mapping = uploadBatchAllocate(context, faceSize * 6, alignment, batch, &stagingBuffer, &stagingOffset);
+
+  VkBufferImageCopy bufferCopyRegions[6] = {};
   for (uint32_t face = 0; face < 6; face++)
   {
-    for (uint32_t level = 0; level < mipLevels; level++)
-    {
-      VkBufferImageCopy bufferCopyRegion = {};
-      bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-      bufferCopyRegion.imageSubresource.mipLevel = level;
-      bufferCopyRegion.imageSubresource.baseArrayLayer = face;
-      bufferCopyRegion.imageSubresource.layerCount = 1;
-      bufferCopyRegion.imageExtent.width = extents.width;
-      bufferCopyRegion.imageExtent.height = extents.height;
-      bufferCopyRegion.imageExtent.depth = 1;
-      bufferCopyRegion.bufferOffset = offset;
-
-      bufferCopyRegions.push_back(bufferCopyRegion);
-
-      offset += images[0].dataSize_;
-    }
+    memcpy(mapping + face * faceSize, images[face].data_, maths::minValue(images[face].dataSize_, images[0].dataSize_));
+
+    bufferCopyRegions[face].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    bufferCopyRegions[face].imageSubresource.mipLevel = 0;
+    bufferCopyRegions[face].imageSubresource.baseArrayLayer = face;
+    bufferCopyRegions[face].imageSubresource.layerCount = 1;
+    bufferCopyRegions[face].imageExtent = extents;
+    bufferCopyRegions[face].bufferOffset = stagingOffset + face * faceSize;
   }
 
-  //Create command buffer
-  VkCommandBuffer uploadCommandBuffer;
-  VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
-  commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  commandBufferAllocateInfo.commandBufferCount = 1;
-  commandBufferAllocateInfo.commandPool = context.commandPool_;
-  commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  vkAllocateCommandBuffers(context.device_, &commandBufferAllocateInfo, &uploadCommandBuffer);
-
-  //Begin command buffer
-  VkCommandBufferBeginInfo beginInfo = {};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  vkBeginCommandBuffer(uploadCommandBuffer, &beginInfo);
+  VkCommandBuffer uploadCommandBuffer = uploadBatchGetCommandBuffer(context, batch);
 
   ////Copy data from the buffer to the image
-  //Transition image layout from undefined to optimal-for-transfer-destination
+  //Transition all the faces from undefined to optimal-for-transfer-destination
   VkImageMemoryBarrier imageBarrier = {};
   imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
   imageBarrier.pNext = nullptr;
@@ -1395,8 +1788,8 @@ void render::textureCubemapCreate(const context_t& context, const image::image2D
   imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
   imageBarrier.image = texture->image_;
   imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  imageBarrier.subresourceRange.layerCount = 1;
-  imageBarrier.subresourceRange.levelCount = 1;
+  imageBarrier.subresourceRange.layerCount = 6;
+  imageBarrier.subresourceRange.levelCount = mipLevels;
 
   vkCmdPipelineBarrier(uploadCommandBuffer,
     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
@@ -1404,17 +1797,23 @@ void render::textureCubemapCreate(const context_t& context, const image::image2D
     0, 0, nullptr, 0, nullptr,
     1, &imageBarrier);
 
-  //Copy from buffer to image
-  //@ToDO : Copy mipmaps. Currently only base level is copied to the image
   vkCmdCopyBufferToImage(uploadCommandBuffer, stagingBuffer,
     texture->image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-    6, bufferCopyRegions.data() );
+    6, bufferCopyRegions);
+
+  if (mipLevels > 1u)
+  {
+    //Leaves all the levels in shader read-only layout
+    texture->layout_ = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    GenerateMipmaps(uploadCommandBuffer, texture, 6u, VK_FILTER_LINEAR);
+    return;
+  }
 
-  //Transition image layout from optimal-for-transfer to optimal-for-shader-reads
+  //Transition all the faces from optimal-for-transfer to optimal-for-shader-reads
   imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
   imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
   imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-  imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
   vkCmdPipelineBarrier(uploadCommandBuffer,
     VK_PIPELINE_STAGE_TRANSFER_BIT,
@@ -1422,32 +1821,7 @@ void render::textureCubemapCreate(const context_t& context, const image::image2D
     0, 0, nullptr, 0, nullptr,
     1, &imageBarrier);
 
-  //End command buffer
-  vkEndCommandBuffer(uploadCommandBuffer);
-
-  ////Queue uploadCommandBuffer for execution
-  VkSubmitInfo submitInfo = {};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &uploadCommandBuffer;
-
-  VkFenceCreateInfo fenceCreateInfo = {};
-  fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-  VkFence fence;
-  vkCreateFence(context.device_, &fenceCreateInfo, nullptr, &fence);
-  vkResetFences(context.device_, 1u, &fence);
-  vkQueueSubmit(context.graphicsQueue_.handle_, 1, &submitInfo, fence);
-
-  //Destroy temporary resources
-  vkWaitForFences(context.device_, 1u, &fence, VK_TRUE, UINT64_MAX);
-  vkDestroyFence(context.device_, fence, nullptr);
-  vkFreeCommandBuffers(context.device_, context.commandPool_, 1, &uploadCommandBuffer);
-  gpuMemoryDeallocate(context, nullptr, stagingBufferMemory);
-  vkDestroyBuffer(context.device_, stagingBuffer, nullptr);
-
-  textureChangeLayoutNow(context, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, texture);
+  texture->layout_ = texture->descriptor_.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 }
 
 
@@ -1543,6 +1917,12 @@ void render::textureChangeLayout(VkCommandBuffer cmdBuffer, VkImageLayout newLay
     // Make sure any shader reads from the image have been finished
     imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
     break;
+
+  case VK_IMAGE_LAYOUT_GENERAL:
+    // Image is a storage image
+    // Make sure any shader writes to the image have been finished
+    imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    break;
   default:
     // Other source layouts aren't handled (yet)
     break;
@@ -1585,6 +1965,11 @@ void render::textureChangeLayout(VkCommandBuffer cmdBuffer, VkImageLayout newLay
     }
     imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
     break;
+
+  case VK_IMAGE_LAYOUT_GENERAL:
+    // Image will be read and written in a shader as a storage image
+    imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    break;
   default:
     // Other source layouts aren't handled (yet)
     break;
@@ -1718,6 +2103,43 @@ void render::gpuBufferCreate(const context_t& context, uint32_t usage, void* dat
   return gpuBufferCreate(context, usage, HOST_VISIBLE, data, size, allocator, buffer);
 }
 
+void render::gpuBufferCreate(const context_t& context, uint32_t usage, const void* data, size_t size, gpu_memory_allocator_t* allocator, upload_batch_t* batch, gpu_buffer_t* buffer)
+{
+  if (batch == nullptr)
+  {
+    UploadNow(context, [&](upload_batch_t* temporaryBatch) { gpuBufferCreate(context, usage, data, size, allocator, temporaryBatch, buffer); return true; });
+    return;
+  }
+
+  //The buffer lives in device local memory and is filled with a copy from the staging memory of the batch
+  gpuBufferCreate(context, usage | gpu_buffer_t::usage::TRANSFER_DST, DEVICE_LOCAL, nullptr, size, allocator, buffer);
+
+  VkBuffer stagingBuffer;
+  VkDeviceSize stagingOffset;
+  uint8_t* mapping = uploadBatchAllocate(context, size, 4u, batch, &stagingBuffer, &stagingOffset);
+  memcpy(mapping, data, size);
+
+  VkCommandBuffer uploadCommandBuffer = uploadBatchGetCommandBuffer(context, batch);
+  VkBufferCopy copyRegion = {};
+  copyRegion.srcOffset = stagingOffset;
+  copyRegion.size = size;
+  vkCmdCopyBuffer(uploadCommandBuffer, stagingBuffer, buffer->handle_, 1u, &copyRegion);
+
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = buffer->handle_;
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(uploadCommandBuffer,
+    VK_PIPELINE_STAGE_TRANSFER_BIT,
+    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+    0, 0, nullptr, 1, &barrier,
+    0, nullptr);
+}
+
 void render::gpuBufferDestroy(const context_t& context, gpu_memory_allocator_t* allocator, gpu_buffer_t* buffer)
 {
   vkDestroyBuffer(context.device_, buffer->handle_, nullptr);
@@ -2141,32 +2563,56 @@ static const uint32_t AttributeFormatSizeLUT[] = { 4u, 4u, 4u,
                                                  };
 
 void render::vertexFormatCreate(vertex_attribute_t* attribute, uint32_t attributeCount, vertex_format_t* format)
+{
+  vertexFormatCreate(attribute, attributeCount, nullptr, format);
+}
+
+void render::vertexFormatCreate(vertex_attribute_t* attribute, uint32_t attributeCount, const uint32_t* attributeBinding, vertex_format_t* format)
 {
   format->vertexSize_ = 0u;
 
   format->attributes_ = new vertex_attribute_t[attributeCount];
   memcpy(format->attributes_, attribute, sizeof(vertex_attribute_t)*attributeCount);
 
-  VkVertexInputAttributeDescription* attributeDescription = new VkVertexInputAttributeDescription[attributeCount];;
-  VkVertexInputBindingDescription* bindingDescription = new VkVertexInputBindingDescription[attributeCount];
+  //Without explicit bindings every attribute uses its own binding
+  uint32_t bindingCount = attributeCount;
+  if (attributeBinding)
+  {
+    bindingCount = 0u;
+    for (uint32_t i = 0; i < attributeCount; ++i)
+    {
+      bindingCount = maths::maxValue(bindingCount, attributeBinding[i] + 1);
+    }
+  }
+
+  VkVertexInputAttributeDescription* attributeDescription = new VkVertexInputAttributeDescription[attributeCount];
+  VkVertexInputBindingDescription* bindingDescription = new VkVertexInputBindingDescription[bindingCount];
+  std::vector<bool> bindingUsed(bindingCount, false);
   for (uint32_t i = 0; i < attributeCount; ++i)
   {
+    uint32_t binding = attributeBinding ? attributeBinding[i] : i;
     VkFormat attributeFormat = AttributeFormatLUT[attribute[i].format_];
-    bindingDescription[i].binding = i;
-    bindingDescription[i].inputRate = attribute[i].instanced_ ? VK_VERTEX_INPUT_RATE_INSTANCE : VK_VERTEX_INPUT_RATE_VERTEX;
-    bindingDescription[i].stride = (uint32_t)attribute[i].stride_;
-    attributeDescription[i].binding = i;
+
+    //Attributes sharing a binding must have the same stride and input rate
+    assert(!bindingUsed[binding] || bindingDescription[binding].stride == (uint32_t)attribute[i].stride_);
+    bindingDescription[binding].binding = binding;
+    bindingDescription[binding].inputRate = attribute[i].instanced_ ? VK_VERTEX_INPUT_RATE_INSTANCE : VK_VERTEX_INPUT_RATE_VERTEX;
+    bindingDescription[binding].stride = (uint32_t)attribute[i].stride_;
+    bindingUsed[binding] = true;
+
+    attributeDescription[i].binding = binding;
     attributeDescription[i].format = attributeFormat;
     attributeDescription[i].location = i;
     attributeDescription[i].offset = attribute[i].offset_;
     format->vertexSize_ += AttributeFormatSizeLUT[attribute[i].format_];
   }
+  assert(std::find(bindingUsed.begin(), bindingUsed.end(), false) == bindingUsed.end());
 
   format->vertexInputState_ = {};
   format->vertexInputState_.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
   format->vertexInputState_.vertexAttributeDescriptionCount = attributeCount;
   format->vertexInputState_.pVertexAttributeDescriptions = attributeDescription;
-  format->vertexInputState_.vertexBindingDescriptionCount = attributeCount;
+  format->vertexInputState_.vertexBindingDescriptionCount = bindingCount;
   format->vertexInputState_.pVertexBindingDescriptions = bindingDescription;
 
   format->inputAssemblyState_ = {};
@@ -2174,11 +2620,18 @@ void render::vertexFormatCreate(vertex_attribute_t* attribute, uint32_t attribut
   format->inputAssemblyState_.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 
   format->attributeCount_ = attributeCount;
+  format->bindingCount_ = bindingCount;
 }
 
 void render::vertexFormatCopy(const vertex_format_t* formatSrc, vertex_format_t* formatDst)
 {
-  vertexFormatCreate(formatSrc->attributes_, formatSrc->attributeCount_, formatDst);
+  std::vector<uint32_t> binding(formatSrc->attributeCount_);
+  for (uint32_t i = 0; i < formatSrc->attributeCount_; ++i)
+  {
+    binding[i] = formatSrc->vertexInputState_.pVertexAttributeDescriptions[i].binding;
+  }
+
+  vertexFormatCreate(formatSrc->attributes_, formatSrc->attributeCount_, binding.data(), formatDst);
 };
 
 void render::vertexFormatAddAttributes(vertex_attribute_t* newAttribute, uint32_t newattributeCount, vertex_format_t* format)
@@ -2186,60 +2639,23 @@ void render::vertexFormatAddAttributes(vertex_attribute_t* newAttribute, uint32_
   u32 oldAttributeCount = format->attributeCount_;
   u32 attributeCount = newattributeCount + oldAttributeCount;
 
-  vertex_attribute_t* oldAttributes = format->attributes_;
-  format->vertexSize_ = 0u;
+  std::vector<vertex_attribute_t> attribute(attributeCount);
+  std::vector<uint32_t> binding(attributeCount);
+  memcpy(attribute.data(), format->attributes_, sizeof(vertex_attribute_t)*oldAttributeCount);
+  memcpy(attribute.data() + oldAttributeCount, newAttribute, sizeof(vertex_attribute_t)*newattributeCount);
 
-  format->attributes_ = new vertex_attribute_t[attributeCount];
-  memcpy(format->attributes_, oldAttributes, sizeof(vertex_attribute_t)*oldAttributeCount);
-  memcpy(format->attributes_+ oldAttributeCount, newAttribute, sizeof(vertex_attribute_t)*newattributeCount);
-
-  delete[] format->vertexInputState_.pVertexAttributeDescriptions;
-  delete[] format->vertexInputState_.pVertexBindingDescriptions;
-  VkVertexInputAttributeDescription* attributeDescription = new VkVertexInputAttributeDescription[attributeCount];
-  VkVertexInputBindingDescription* bindingDescription = new VkVertexInputBindingDescription[attributeCount];
-
-  //Old attributes
-  uint32_t i = 0;
-  for (; i < oldAttributeCount; ++i)
+  //Old attributes keep their bindings. New attributes get a binding each, after the existing ones
+  for (uint32_t i = 0; i < oldAttributeCount; ++i)
   {
-    VkFormat attributeFormat = AttributeFormatLUT[oldAttributes[i].format_];
-    bindingDescription[i].binding = i;
-    bindingDescription[i].inputRate = oldAttributes[i].instanced_ ? VK_VERTEX_INPUT_RATE_INSTANCE : VK_VERTEX_INPUT_RATE_VERTEX;
-    bindingDescription[i].stride = (uint32_t)oldAttributes[i].stride_;
-    attributeDescription[i].binding = i;
-    attributeDescription[i].format = attributeFormat;
-    attributeDescription[i].location = i;
-    attributeDescription[i].offset = oldAttributes[i].offset_;
-    format->vertexSize_ += AttributeFormatSizeLUT[oldAttributes[i].format_];
+    binding[i] = format->vertexInputState_.pVertexAttributeDescriptions[i].binding;
   }
-
-  //New attributes
-  for (u32 j = 0; i < attributeCount; ++i, ++j)
+  for (uint32_t i = 0; i < newattributeCount; ++i)
   {
-    VkFormat attributeFormat = AttributeFormatLUT[newAttribute[j].format_];
-    bindingDescription[i].binding = i;
-    bindingDescription[i].inputRate = newAttribute[j].instanced_ ? VK_VERTEX_INPUT_RATE_INSTANCE : VK_VERTEX_INPUT_RATE_VERTEX;
-    bindingDescription[i].stride = (uint32_t)newAttribute[j].stride_;
-    attributeDescription[i].binding = i;
-    attributeDescription[i].format = attributeFormat;
-    attributeDescription[i].location = i;
-    attributeDescription[i].offset = newAttribute[j].offset_;
-    format->vertexSize_ += AttributeFormatSizeLUT[newAttribute[j].format_];
+    binding[oldAttributeCount + i] = format->bindingCount_ + i;
   }
 
-  format->vertexInputState_ = {};
-  format->vertexInputState_.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  format->vertexInputState_.vertexAttributeDescriptionCount = attributeCount;
-  format->vertexInputState_.pVertexAttributeDescriptions = attributeDescription;
-  format->vertexInputState_.vertexBindingDescriptionCount = attributeCount;
-  format->vertexInputState_.pVertexBindingDescriptions = bindingDescription;
-
-  format->inputAssemblyState_ = {};
-  format->inputAssemblyState_.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  format->inputAssemblyState_.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-
-  format->attributeCount_ = attributeCount;
-  delete[] oldAttributes;
+  vertexFormatDestroy(format);
+  vertexFormatCreate(attribute.data(), attributeCount, binding.data(), format);
 }
 
 void render::vertexFormatDestroy(vertex_format_t* format)
@@ -3007,85 +3423,71 @@ void render::diffuseConvolution(const context_t& context, texture_cubemap_t envi
 
 void render::specularConvolution(const context_t& context, texture_cubemap_t environmentMap, uint32_t size, uint32_t maxMipmapLevels, texture_cubemap_t* specularMap)
 {
-  mesh::mesh_t cube = mesh::unitCube(context);
-
+  //Each level is prefiltered by a compute shader that writes all its faces through a storage image, so the whole map takes one dispatch per level
+  //and a single submission
   u32 mipLevels = maths::minValue((u32)(1 + floor(log2(size))), maxMipmapLevels);
-  bkk::render::textureCubemapCreate(context, VK_FORMAT_R32G32B32A32_SFLOAT, size, size, mipLevels, bkk::render::texture_sampler_t(), specularMap);
-  //Change cubemap layout for transfer
-  VkImageSubresourceRange subresourceRange = {};
-  subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  subresourceRange.baseMipLevel = 0;
-  subresourceRange.levelCount = mipLevels;
-  subresourceRange.layerCount = 6;
-  render::textureChangeLayoutNow(context, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, subresourceRange, specularMap);
+  bkk::render::textureCubemapCreate(context, VK_FORMAT_R32G32B32A32_SFLOAT, size, size, mipLevels,
+    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, bkk::render::texture_sampler_t(), specularMap);
+
+  //The compute shader sees each level as an array of 6 layers
+  std::vector<VkImageView> levelViews(mipLevels);
+  for (u32 mipLevel = 0; mipLevel < mipLevels; ++mipLevel)
+  {
+    VkImageViewCreateInfo imageViewCreateInfo = {};
+    imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCreateInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    imageViewCreateInfo.image = specularMap->image_;
+    imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewCreateInfo.subresourceRange.baseMipLevel = mipLevel;
+    imageViewCreateInfo.subresourceRange.levelCount = 1;
+    imageViewCreateInfo.subresourceRange.layerCount = 6;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    vkCreateImageView(context.device_, &imageViewCreateInfo, nullptr, &levelViews[mipLevel]);
+  }
 
   //Create descriptor pool
   render::descriptor_pool_t descriptorPool;
-  render::descriptorPoolCreate(context, 1u,
-    render::combined_image_sampler_count(1u),
+  render::descriptorPoolCreate(context, mipLevels,
+    render::combined_image_sampler_count(mipLevels),
     render::uniform_buffer_count(0u),
     render::storage_buffer_count(0u),
-    render::storage_image_count(0u),
+    render::storage_image_count(mipLevels),
     &descriptorPool);
 
   //Create pipeline
-  render::graphics_pipeline_t pipeline;
+  render::compute_pipeline_t pipeline;
   render::pipeline_layout_t pipelineLayout;
   render::descriptor_set_layout_t descriptorSetLayout;
-  render::descriptor_binding_t bindings = { render::descriptor_t::type::COMBINED_IMAGE_SAMPLER, 0, VK_SHADER_STAGE_FRAGMENT_BIT };
-  render::descriptorSetLayoutCreate(context, &bindings, 1u, &descriptorSetLayout);
+  render::descriptor_binding_t bindings[2] = { { render::descriptor_t::type::COMBINED_IMAGE_SAMPLER, 0, render::descriptor_t::stage::COMPUTE },
+                                               { render::descriptor_t::type::STORAGE_IMAGE, 1, render::descriptor_t::stage::COMPUTE } };
+  render::descriptorSetLayoutCreate(context, bindings, 2u, &descriptorSetLayout);
 
   struct push_constants_t
   {
-    maths::mat4 viewProjection_;
     float roughness_;
     float sourceCubemapResolution_;
+    uint32_t levelSize_;
   }pushConstants;
 
   pushConstants.sourceCubemapResolution_ = (float)environmentMap.extent_.width;
 
-  render::push_constant_range_t pushConstantsRange = { VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(pushConstants), 0u };
+  render::push_constant_range_t pushConstantsRange = { VK_SHADER_STAGE_COMPUTE_BIT, sizeof(pushConstants), 0u };
   render::pipelineLayoutCreate(context, &descriptorSetLayout, 1u, &pushConstantsRange, 1u, &pipelineLayout);
 
-  render::render_pass_t::attachment_t attachments = { VK_FORMAT_R32G32B32A32_SFLOAT, VK_SAMPLE_COUNT_1_BIT,
-    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
-    VK_ATTACHMENT_STORE_OP_STORE,VK_ATTACHMENT_LOAD_OP_CLEAR };
-  render::render_pass_t renderPass = {};
-  render::renderPassCreate(context, &attachments, 1u, nullptr, 0u, nullptr, 0u, &renderPass);
-
-  //Load shaders
-  render::shader_t vertexShader;
-  const char* vsSource = R"(  
+  //Load shader
+  render::shader_t computeShader;
+  const char* csSource = R"(  
                                 #version 440 core
+                                layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
                                 layout(push_constant) uniform PushConstants
                                 {
-	                                layout (offset = 0) mat4 viewProjection;
-                                  layout (offset = 64) float roughness;
-                                  layout (offset = 68) float sourceCubemapResolution;
+                                  layout (offset = 0) float roughness;
+                                  layout (offset = 4) float sourceCubemapResolution;
+                                  layout (offset = 8) uint levelSize;
                                 }pushConstants;
-                                layout(location = 0) in vec3 aPosition;
-                                layout(location = 0) out vec3 localPos;
-                                void main(void)
-                                {
-                                  localPos = aPosition;
-                                  gl_Position = pushConstants.viewProjection * vec4(aPosition,1.0);
-                                })";
-  render::shaderCreateFromGLSLSource(context, render::shader_t::VERTEX_SHADER, vsSource, &vertexShader);
 
-  render::shader_t fragmentShader;
-  const char* fsSource = R"(  
-                                #version 440 core
-                                layout(push_constant) uniform PushConstants
-                                {
-	                                layout (offset = 0) mat4 viewProjection;
-                                  layout (offset = 64) float roughness;
-                                  layout (offset = 68) float sourceCubemapResolution;
-                                }pushConstants;
-
-                                layout(location = 0) in vec3 localPos;
                                 layout (set = 0, binding = 0) uniform samplerCube uTexture;
-                                layout(location = 0) out vec4 color;
-                                const vec2 invAtan = vec2(0.1591, 0.3183);
+                                layout (set = 0, binding = 1, rgba32f) uniform writeonly image2DArray uResult;
                                 const float PI = 3.14159265359;
 
                                 float RadicalInverse_VdC(uint bits) 
@@ -3138,12 +3540,40 @@ void render::specularConvolution(const context_t& context, texture_cubemap_t env
                                   return nom / denom;
                                 }
 
+                                // Direction of the center of a texel of a face (layer), following the cubemap sampling rules
+                                vec3 TexelDirection(uvec3 texel, uint size)
+                                {
+                                  vec2 st = (vec2(texel.xy) + 0.5) / float(size) * 2.0 - 1.0;
+                                  switch(texel.z)
+                                  {
+                                    case 0: return normalize(vec3(1.0, -st.y, -st.x));
+                                    case 1: return normalize(vec3(-1.0, -st.y, st.x));
+                                    case 2: return normalize(vec3(st.x, 1.0, st.y));
+                                    case 3: return normalize(vec3(st.x, -1.0, -st.y));
+                                    case 4: return normalize(vec3(st.x, -st.y, 1.0));
+                                    default: return normalize(vec3(-st.x, -st.y, -1.0));
+                                  }
+                                }
+
                                 void main()
-                                {		
-                                    vec3 N = normalize(localPos);    
+                                {
+                                    uvec3 texel = gl_GlobalInvocationID;
+                                    if(texel.x >= pushConstants.levelSize || texel.y >= pushConstants.levelSize)
+                                    {
+                                      return;
+                                    }
+
+                                    vec3 N = TexelDirection(texel, pushConstants.levelSize);
                                     vec3 R = N;
                                     vec3 V = R;
 
+                                    // A perfect mirror only needs the environment in the direction of the texel
+                                    if(pushConstants.roughness == 0.0)
+                                    {
+                                      imageStore(uResult, ivec3(texel), vec4(textureLod(uTexture, N, 0.0).rgb, 1.0));
+                                      return;
+                                    }
+
                                     const uint SAMPLE_COUNT = 1024u;
                                     float totalWeight = 0.0;   
                                     vec3 prefilteredColor = vec3(0.0);     
@@ -3165,107 +3595,70 @@ void render::specularConvolution(const context_t& context, texture_cubemap_t env
                                             float saTexel  = 4.0 * PI / (6.0 * resolution * resolution);
                                             float saSample = 1.0 / (float(SAMPLE_COUNT) * pdf + 0.0001);
 
-                                            float mipLevel = pushConstants.roughness == 0.0 ? 0.0 : 0.5 * log2(saSample / saTexel); 
+                                            float mipLevel = 0.5 * log2(saSample / saTexel); 
                                             prefilteredColor += textureLod(uTexture, L, mipLevel).rgb * NdotL;
                                             totalWeight      += NdotL;
                                         }
                                     }
                                     prefilteredColor = prefilteredColor / totalWeight;
-                                    color = vec4(prefilteredColor, 1.0);
+                                    imageStore(uResult, ivec3(texel), vec4(prefilteredColor, 1.0));
                                 }
                           )";
-  render::shaderCreateFromGLSLSource(context, render::shader_t::FRAGMENT_SHADER, fsSource, &fragmentShader);
-
-  render::graphics_pipeline_t::description_t pipelineDesc = {};
-  pipelineDesc.viewPort_ = { 0.0f, 0.0f, (float)size, (float)size, 0.0f, 1.0f };
-  pipelineDesc.scissorRect_ = { { 0,0 },{ size, size } };
-  pipelineDesc.blendState_.resize(1);
-  pipelineDesc.blendState_[0].colorWriteMask = 0xF;
-  pipelineDesc.blendState_[0].blendEnable = VK_FALSE;
-  pipelineDesc.cullMode_ = VK_CULL_MODE_FRONT_BIT;
-  pipelineDesc.depthTestEnabled_ = false;
-  pipelineDesc.depthWriteEnabled_ = false;
-  pipelineDesc.vertexShader_ = vertexShader;
-  pipelineDesc.fragmentShader_ = fragmentShader;
-  render::graphicsPipelineCreate(context, renderPass.handle_, 0u, cube.vertexFormat_, pipelineLayout, pipelineDesc, &pipeline);
+  render::shaderCreateFromGLSLSource(context, render::shader_t::COMPUTE_SHADER, csSource, &computeShader);
+  render::computePipelineCreate(context, pipelineLayout, computeShader, &pipeline);
 
-  //Create descriptor set
-  render::descriptor_t texture = render::getDescriptor(environmentMap);
-  render::descriptor_set_t descriptorSet;
-  render::descriptorSetCreate(context, descriptorPool, descriptorSetLayout, &texture, &descriptorSet);
+  //Create a descriptor set for each level
+  std::vector<render::descriptor_set_t> descriptorSets(mipLevels);
+  for (u32 mipLevel = 0; mipLevel < mipLevels; ++mipLevel)
+  {
+    render::descriptor_t descriptors[2] = { render::getDescriptor(environmentMap), {} };
+    descriptors[1].imageDescriptor_ = { VK_NULL_HANDLE, levelViews[mipLevel], VK_IMAGE_LAYOUT_GENERAL };
+    render::descriptorSetCreate(context, descriptorPool, descriptorSetLayout, descriptors, &descriptorSets[mipLevel]);
+  }
 
-  //Create command buffer
-  VkClearValue clearValue;
-  clearValue.color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+  //Record all the levels in a single command buffer
+  VkImageSubresourceRange subresourceRange = {};
+  subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  subresourceRange.baseMipLevel = 0;
+  subresourceRange.levelCount = mipLevels;
+  subresourceRange.layerCount = 6;
 
   render::command_buffer_t commandBuffer = {};
   render::commandBufferCreate(context, VK_COMMAND_BUFFER_LEVEL_PRIMARY, nullptr, nullptr, 0u, nullptr, 0u, render::command_buffer_t::GRAPHICS, &commandBuffer);
+  render::commandBufferBegin(context, commandBuffer);
+  render::textureChangeLayout(commandBuffer.handle_, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, subresourceRange, specularMap);
+  render::computePipelineBind(commandBuffer.handle_, pipeline);
 
-  maths::mat4 projection = maths::perspectiveProjectionMatrix(1.57f, 1.0f, 0.1f, 1.0f);
-  maths::mat4 view[6] = { maths::lookAtMatrix(maths::vec3(0.0f, 0.0f, 0.0f), maths::vec3(1.0f, 0.0f, 0.0f),  maths::vec3(0.0f, 1.0f, 0.0f)),
-                          maths::lookAtMatrix(maths::vec3(0.0f, 0.0f, 0.0f), maths::vec3(-1.0f, 0.0f, 0.0f), maths::vec3(0.0f, 1.0f, 0.0f)),
-                          maths::lookAtMatrix(maths::vec3(0.0f, 0.0f, 0.0f), maths::vec3(0.0f, 1.0f, 0.0f),  maths::vec3(0.0f, 0.0f, 1.0f)),
-                          maths::lookAtMatrix(maths::vec3(0.0f, 0.0f, 0.0f), maths::vec3(0.0f, -1.0f, 0.0f), maths::vec3(0.0f, 0.0f,-1.0f)),
-                          maths::lookAtMatrix(maths::vec3(0.0f, 0.0f, 0.0f), maths::vec3(0.0f, 0.0f, -1.0f), maths::vec3(0.0f, 1.0f, 0.0f)),
-                          maths::lookAtMatrix(maths::vec3(0.0f, 0.0f, 0.0f), maths::vec3(0.0f, 0.0f, 1.0f),  maths::vec3(0.0f, 1.0f, 0.0f)) };
-
-  std::vector<render::frame_buffer_t> frameBuffers(mipLevels);
-  std::vector<render::texture_t> renderTargets(mipLevels);
   u32 mipSize = size;
   for (u32 mipLevel = 0; mipLevel < mipLevels; ++mipLevel)
   {
-    //Create render target and framebuffer
-    frameBuffers[mipLevel] = {};
-    render::texture2DCreate(context, mipSize, mipSize, 1u, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, render::texture_sampler_t(), &renderTargets[mipLevel]);
-    bkk::render::textureChangeLayoutNow(context, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, &renderTargets[mipLevel]);
-    render::frameBufferCreate(context, mipSize, mipSize, renderPass, &renderTargets[mipLevel].imageView_, &frameBuffers[mipLevel]);
-
-    pushConstants.roughness_ = (float)mipLevel / (float)(mipLevels - 1);
-    for (u32 i(0); i < 6; ++i)
-    {
-      pushConstants.viewProjection_ = view[i] * projection;
-
-      render::commandBufferBegin(context, commandBuffer);
-      render::commandBufferRenderPassBegin(context, &frameBuffers[mipLevel], &clearValue, 1u, commandBuffer);
-      render::pushConstants(commandBuffer.handle_, pipelineLayout, 0u, &pushConstants);
-      render::graphicsPipelineBind(commandBuffer.handle_, pipeline);
-      bkk::render::descriptorSetBindForGraphics(commandBuffer.handle_, pipelineLayout, 0, &descriptorSet, 1u);
-      mesh::draw(commandBuffer.handle_, cube);
-      render::commandBufferRenderPassEnd(commandBuffer);
-
-      //Copy render target to cubemap layer
-      renderTargets[mipLevel].layout_ = VK_IMAGE_LAYOUT_UNDEFINED;
-      render::textureChangeLayout(commandBuffer.handle_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, &renderTargets[mipLevel]);
-      render::textureCopy(commandBuffer, &renderTargets[mipLevel], specularMap, mipSize, mipSize, mipLevel, i);      
-      render::textureChangeLayout(commandBuffer.handle_, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, &renderTargets[mipLevel]);
-      
-      render::commandBufferEnd(commandBuffer);
-      render::commandBufferSubmit(context, commandBuffer);
-    }
-    mipSize /= 2;
+    pushConstants.roughness_ = mipLevels > 1 ? (float)mipLevel / (float)(mipLevels - 1) : 0.0f;
+    pushConstants.levelSize_ = mipSize;
+    render::pushConstants(commandBuffer.handle_, pipelineLayout, 0u, &pushConstants);
+    render::descriptorSetBindForCompute(commandBuffer.handle_, pipelineLayout, 0, &descriptorSets[mipLevel], 1u);
+    vkCmdDispatch(commandBuffer.handle_, (mipSize + 7) / 8, (mipSize + 7) / 8, 6);
+    mipSize = maths::maxValue(mipSize / 2, 1u);
   }
 
   //Change cubemap layout for shader access
-  render::textureChangeLayoutNow(context, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, subresourceRange, specularMap);
+  render::textureChangeLayout(commandBuffer.handle_, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, subresourceRange, specularMap);
+  render::commandBufferEnd(commandBuffer);
+  render::commandBufferSubmit(context, commandBuffer);
+  vkWaitForFences(context.device_, 1u, &commandBuffer.fence_, VK_TRUE, UINT64_MAX);
 
   //Clean-up
   for (u32 i(0); i < mipLevels; ++i)
   {
-    render::textureDestroy(context, &renderTargets[i]);
-    render::frameBufferDestroy(context, &frameBuffers[i]);
+    render::descriptorSetDestroy(context, &descriptorSets[i]);
+    vkDestroyImageView(context.device_, levelViews[i], nullptr);
   }
 
   render::descriptorSetLayoutDestroy(context, &descriptorSetLayout);
   render::pipelineLayoutDestroy(context, &pipelineLayout);
-  render::renderPassDestroy(context, &renderPass);
-
-  render::shaderDestroy(context, &vertexShader);
-  render::shaderDestroy(context, &fragmentShader);
-  render::graphicsPipelineDestroy(context, &pipeline);
-  render::descriptorSetDestroy(context, &descriptorSet);
+  render::shaderDestroy(context, &computeShader);
+  render::computePipelineDestroy(context, &pipeline);
   render::commandBufferDestroy(context, &commandBuffer);
   render::descriptorPoolDestroy(context, &descriptorPool);
-  mesh::destroy(context, &cube);
 }
 
 void render::waitForCommandBufferToFinish(const context_t& context)
@@ -3307,7 +3700,7 @@ void render::waitForCommandBufferToFinish(const context_t& context)
 void render::brdfConvolution(const context_t& context, uint32_t size, texture_t* brdfConvolution)
 {
   mesh::mesh_t quad = mesh::fullScreenQuad(context);
-  render::texture2DCreate(context, size, size, 1u, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, render::texture_sampler_t(), brdfConvolution);
+  render::texture2DCreate(context, size, size, 1u, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, render::texture_sampler_t(), brdfConvolution);
   bkk::render::textureChangeLayoutNow(context, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, brdfConvolution);
 
   //Create pipeline    
@@ -3499,159 +3892,27 @@ void render::brdfConvolution(const context_t& context, uint32_t size, texture_t*
 
 void render::texture2DCreateAndGenerateMipmaps(const context_t& context, const image::image2D_t& image, texture_sampler_t sampler, texture_t* texture)
 {
-  mesh::mesh_t quad = mesh::fullScreenQuad(context);
-
-  u32 size = maths::minValue(image.width_, image.height_);
-  u32 mipLevels = (u32)(1 + floor(log2(size)));
-
-  VkFormat format = getImageFormat(image);
-  bkk::render::texture2DCreate(context, size, size, mipLevels, format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, bkk::render::texture_sampler_t(), texture);
-
-  VkImageSubresourceRange subresourceRange = {};
-  subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  subresourceRange.baseMipLevel = 0;
-  subresourceRange.levelCount = mipLevels;
-  subresourceRange.layerCount = 1;
-  render::textureChangeLayoutNow(context, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, subresourceRange, texture);
-
-  texture_t inputTexture;
-  bkk::render::texture2DCreate(context, &image, 1u, texture_sampler_t(), &inputTexture);
-
-
-  //Create descriptor pool
-  render::descriptor_pool_t descriptorPool;
-  render::descriptorPoolCreate(context, 1u,
-    render::combined_image_sampler_count(1u + mipLevels ),
-    render::uniform_buffer_count(0u),
-    render::storage_buffer_count(0u),
-    render::storage_image_count(0u),
-    &descriptorPool);
-
-  render::descriptor_set_layout_t descriptorSetLayout;
-  render::descriptor_binding_t bindings = { render::descriptor_t::type::COMBINED_IMAGE_SAMPLER, 0, VK_SHADER_STAGE_FRAGMENT_BIT };
-  render::descriptorSetLayoutCreate(context, &bindings, 1u, &descriptorSetLayout);
-
-  //Create descriptor set
-  render::descriptor_t inputTextureDesc = render::getDescriptor(inputTexture);
-  render::descriptor_set_t descriptorSet;
-  render::descriptorSetCreate(context, descriptorPool, descriptorSetLayout, &inputTextureDesc, &descriptorSet);
-
-
-  //Create pipeline    
-  render::pipeline_layout_t pipelineLayout;
-  render::pipelineLayoutCreate(context, &descriptorSetLayout, 1u, nullptr, 0u, &pipelineLayout);
-
-  render::render_pass_t::attachment_t attachments = { format, VK_SAMPLE_COUNT_1_BIT,
-    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
-    VK_ATTACHMENT_STORE_OP_STORE,VK_ATTACHMENT_LOAD_OP_CLEAR };
-  render::render_pass_t renderPass = {};
-  render::renderPassCreate(context, &attachments, 1u, nullptr, 0u, nullptr, 0u, &renderPass);
-
-  //Load shaders
-  render::shader_t vertexShader;
-  const char* vsSource = R"(  
-                                #version 440 core
-                                layout(location = 0) in vec3 aPosition;
-                                layout(location = 1) in vec2 aTexCoord;
-                                layout(location = 0) out vec2 uv;
-                                void main(void)
-                                {
-                                  gl_Position = vec4(aPosition,1.0);
-                                  uv = aTexCoord;
-                                })";
-  render::shaderCreateFromGLSLSource(context, render::shader_t::VERTEX_SHADER, vsSource, &vertexShader);
-
-  render::shader_t fragmentShader;
-  const char* fsSource = R"(  
-                                #version 440 core
-                                layout(location = 0) out vec4 color;
-                                layout(location = 0) in vec2 uv;
-                                layout (set = 0, binding = 0) uniform sampler2D uTexture;
-                                void main()
-                                {                                  
-                                  color = texture(uTexture,uv);
-                                }
-                          )";
-  render::shaderCreateFromGLSLSource(context, render::shader_t::FRAGMENT_SHADER, fsSource, &fragmentShader);
-
-  render::graphics_pipeline_t::description_t pipelineDesc = {};
-  pipelineDesc.viewPort_ = { 0.0f, 0.0f, (float)size, (float)size, 0.0f, 1.0f };
-  pipelineDesc.scissorRect_ = { { 0,0 },{ size, size } };
-  pipelineDesc.blendState_.resize(1);
-  pipelineDesc.blendState_[0].colorWriteMask = 0xF;
-  pipelineDesc.blendState_[0].blendEnable = VK_FALSE;
-  pipelineDesc.cullMode_ = VK_CULL_MODE_BACK_BIT;
-  pipelineDesc.depthTestEnabled_ = false;
-  pipelineDesc.depthWriteEnabled_ = false;
-  pipelineDesc.vertexShader_ = vertexShader;
-  pipelineDesc.fragmentShader_ = fragmentShader;
-  render::graphics_pipeline_t pipeline = {};
-  render::graphicsPipelineCreate(context, renderPass.handle_, 0u, quad.vertexFormat_, pipelineLayout, pipelineDesc, &pipeline);
-
-  VkClearValue clearValue;
-  clearValue.color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
-
-  render::command_buffer_t commandBuffer = {};
-  render::commandBufferCreate(context, VK_COMMAND_BUFFER_LEVEL_PRIMARY, nullptr, nullptr, 0u, nullptr, 0u, render::command_buffer_t::GRAPHICS, &commandBuffer);
-
+  texture2DCreateAndGenerateMipmaps(context, image, sampler, nullptr, texture);
+}
 
-  std::vector<render::frame_buffer_t> frameBuffers(mipLevels);
-  std::vector<render::texture_t> renderTargets(mipLevels);
-  u32 mipSize = size;
-  for (u32 mipLevel = 0; mipLevel < mipLevels; ++mipLevel)
+void render::texture2DCreateAndGenerateMipmaps(const context_t& context, const image::image2D_t& image, texture_sampler_t sampler, upload_batch_t* batch, texture_t* texture)
+{
+  if (batch == nullptr)
   {
-    //Create render target and framebuffer
-    frameBuffers[mipLevel] = {};
-    render::texture2DCreate(context, mipSize, mipSize, 1u, format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, render::texture_sampler_t(), &renderTargets[mipLevel]);
-    bkk::render::textureChangeLayoutNow(context, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, &renderTargets[mipLevel]);
-    render::frameBufferCreate(context, mipSize, mipSize, renderPass, &renderTargets[mipLevel].imageView_, &frameBuffers[mipLevel]);
-
-    if (mipLevel > 0)
-    {
-      render::descriptorSetDestroy(context, &descriptorSet);
-      descriptor_t descriptor = getDescriptor(renderTargets[mipLevel - 1]);
-      render::descriptorSetCreate(context, descriptorPool, descriptorSetLayout, &descriptor, &descriptorSet);
-    }
-
-    render::commandBufferBegin(context, commandBuffer);
-    render::commandBufferRenderPassBegin(context, &frameBuffers[mipLevel], &clearValue, 1u, commandBuffer);
-    render::graphicsPipelineBind(commandBuffer.handle_, pipeline);
-    bkk::render::descriptorSetBindForGraphics(commandBuffer.handle_, pipelineLayout, 0, &descriptorSet, 1u);
-    mesh::draw(commandBuffer.handle_, quad);
-    render::commandBufferRenderPassEnd(commandBuffer);
-
-    //Copy render target to mip level
-    renderTargets[mipLevel].layout_ = VK_IMAGE_LAYOUT_UNDEFINED;
-    render::textureChangeLayout(commandBuffer.handle_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, &renderTargets[mipLevel]);
-    render::textureCopy(commandBuffer, &renderTargets[mipLevel], texture, mipSize, mipSize, mipLevel);
-    render::textureChangeLayout(commandBuffer.handle_, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, &renderTargets[mipLevel]);
-
-    render::commandBufferEnd(commandBuffer);
-    render::commandBufferSubmit(context, commandBuffer);
-
-    mipSize /= 2;
+    UploadNow(context, [&](upload_batch_t* temporaryBatch) { texture2DCreateAndGenerateMipmaps(context, image, sampler, temporaryBatch, texture); return true; });
+    return;
   }
 
-  //Change cubemap layout for shader access
-  render::textureChangeLayoutNow(context, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, subresourceRange, texture);
-
-    
-  //Clean-up
-  for (u32 i(0); i < mipLevels; ++i)
-  {
-    render::textureDestroy(context, &renderTargets[i]);
-    render::frameBufferDestroy(context, &frameBuffers[i]);
-  }
+  Texture2DCreateStaged(context, image, 1u, true,
+    [&image](uint32_t level, uint8_t* mapping, size_t size)
+    {
+      memcpy(mapping, image.data_, maths::minValue((size_t)image.dataSize_, size));
+      return true;
+    },
+    sampler, batch, texture);
+}
 
-  render::textureDestroy(context, &inputTexture);
-  render::descriptorSetLayoutDestroy(context, &descriptorSetLayout);
-  render::descriptorSetDestroy(context, &descriptorSet);  
-  render::pipelineLayoutDestroy(context, &pipelineLayout);
-  render::renderPassDestroy(context, &renderPass);
-  render::shaderDestroy(context, &vertexShader);
-  render::shaderDestroy(context, &fragmentShader);
-  render::graphicsPipelineDestroy(context, &pipeline);
-  render::commandBufferDestroy(context, &commandBuffer);
-  render::descriptorPoolDestroy(context, &descriptorPool);
-  mesh::destroy(context, &quad);
+void render::textureGenerateMipmaps(VkCommandBuffer commandBuffer, texture_t* texture, VkFilter filter)
+{
+  GenerateMipmaps(commandBuffer, texture, 1u, filter);
 }
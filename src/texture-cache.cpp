@@ -0,0 +1,242 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "texture-cache.h"
+#include "render.h"
+#include "image.h"
+#include <cstdio>
+
+using namespace bkk;
+using namespace bkk::render;
+
+//FNV-1a hash of the size, format and data of an image
+static uint64_t HashImage(const image::image2D_t& image)
+{
+  uint64_t hash = 14695981039346656037ull;
+  uint32_t description[5] = { image.width_, image.height_, image.componentCount_, image.componentSize_, (uint32_t)image.compression_ };
+  const uint8_t* bytes[2] = { (const uint8_t*)description, image.data_ };
+  size_t size[2] = { sizeof(description), image.dataSize_ };
+  for (uint32_t i(0); i < 2; ++i)
+  {
+    for (size_t j(0); j < size[i]; ++j)
+    {
+      hash = (hash ^ bytes[i][j]) * 1099511628211ull;
+    }
+  }
+
+  return hash;
+}
+
+static void DestroyEntry(const context_t& context, handle_t handle, texture_cache_t* cache)
+{
+  texture_cache_t::entry_t* entry = cache->entry_.get(handle);
+  cache->stats_.residentBytes_ -= entry->texture_.memory_.size_;
+  cache->stats_.residentTextures_--;
+  cache->keyToEntry_.erase(entry->key_);
+  textureDestroy(context, &entry->texture_);
+  cache->entry_.remove(handle);
+}
+
+//Evicts unreferenced textures, least recently released first, until the cache fits in the budget
+static void Evict(const context_t& context, texture_cache_t* cache)
+{
+  while (cache->stats_.residentBytes_ > cache->budget_ && !cache->lru_.empty())
+  {
+    handle_t handle = cache->lru_.front();
+    cache->lru_.pop_front();
+    DestroyEntry(context, handle, cache);
+    cache->stats_.evictions_++;
+  }
+}
+
+static handle_t AddEntry(const context_t& context, const char* key, const texture_t& texture, texture_cache_t* cache)
+{
+  texture_cache_t::entry_t entry;
+  entry.key_ = key;
+  entry.texture_ = texture;
+  entry.refCount_ = 1u;
+  handle_t handle = cache->entry_.add(entry);
+  cache->keyToEntry_[entry.key_] = handle;
+  cache->stats_.residentBytes_ += texture.memory_.size_;
+  cache->stats_.residentTextures_++;
+
+  Evict(context, cache);
+  return handle;
+}
+
+//Returns false if the texture can't be created (e.g block compressed images on devices without BC support)
+static bool CreateTexture(const context_t& context, const image::image2D_t& image, bool generateMipmaps, texture_sampler_t sampler, upload_batch_t* batch, texture_t* texture)
+{
+  if (generateMipmaps)
+  {
+    texture2DCreateAndGenerateMipmaps(context, image, sampler, batch, texture);
+  }
+  else
+  {
+    texture2DCreate(context, &image, 1u, sampler, batch, texture);
+  }
+
+  return texture->image_ != VK_NULL_HANDLE;
+}
+
+void render::textureCacheCreate(uint64_t budget, texture_cache_t* cache)
+{
+  cache->budget_ = budget;
+  cache->stats_ = {};
+}
+
+void render::textureCacheDestroy(const context_t& context, texture_cache_t* cache)
+{
+  packed_freelist_iterator_t<texture_cache_t::entry_t> entryIter = cache->entry_.begin();
+  while (entryIter != cache->entry_.end())
+  {
+    textureDestroy(context, &entryIter.get().texture_);
+    ++entryIter;
+  }
+
+  cache->entry_ = packed_freelist_t<texture_cache_t::entry_t>();
+  cache->keyToEntry_.clear();
+  cache->lru_.clear();
+  cache->stats_.residentBytes_ = 0u;
+  cache->stats_.residentTextures_ = 0u;
+}
+
+handle_t render::textureCacheFind(const char* key, texture_cache_t* cache)
+{
+  auto it = cache->keyToEntry_.find(key);
+  if (it == cache->keyToEntry_.end())
+  {
+    cache->stats_.misses_++;
+    return INVALID_ID;
+  }
+
+  //Referenced entries can't be evicted
+  texture_cache_t::entry_t* entry = cache->entry_.get(it->second);
+  if (entry->refCount_ == 0u)
+  {
+    cache->lru_.erase(entry->lruPosition_);
+  }
+
+  entry->refCount_++;
+  cache->stats_.hits_++;
+  return it->second;
+}
+
+handle_t render::textureCacheAdd(const context_t& context, const char* key, const image::image2D_t& image, bool generateMipmaps, texture_sampler_t sampler, upload_batch_t* batch, texture_cache_t* cache)
+{
+  auto it = cache->keyToEntry_.find(key);
+  if (it != cache->keyToEntry_.end())
+  {
+    return textureCacheFind(key, cache);
+  }
+
+  texture_t texture = {};
+  if (!CreateTexture(context, image, generateMipmaps, sampler, batch, &texture))
+  {
+    return INVALID_ID;
+  }
+
+  return AddEntry(context, key, texture, cache);
+}
+
+handle_t render::textureCacheAcquire(const context_t& context, const char* path, bool flipVertical, bool generateMipmaps, texture_sampler_t sampler, upload_batch_t* batch, texture_cache_t* cache)
+{
+  handle_t handle = textureCacheFind(path, cache);
+  if (cache->entry_.get(handle) != nullptr)
+  {
+    return handle;
+  }
+
+  //Files with a mip chain are copied as they are. Other formats are decoded, and mipmaps generated if requested
+  texture_t texture = {};
+  image::mip_chain_t mipChain;
+  bool result = false;
+  if (image::loadMipChain(path, &mipChain))
+  {
+    result = texture2DCreate(context, mipChain, sampler, batch, &texture);
+    image::unloadMipChain(&mipChain);
+  }
+  else if (generateMipmaps)
+  {
+    image::image2D_t image = {};
+    result = image::load(path, flipVertical, &image);
+    if (result)
+    {
+      result = CreateTexture(context, image, true, sampler, batch, &texture);
+      image::unload(&image);
+    }
+  }
+  else
+  {
+    result = texture2DCreate(context, path, flipVertical, sampler, batch, &texture);
+  }
+
+  return result ? AddEntry(context, path, texture, cache) : INVALID_ID;
+}
+
+handle_t render::textureCacheAcquire(const context_t& context, const image::image2D_t& image, bool generateMipmaps, texture_sampler_t sampler, upload_batch_t* batch, texture_cache_t* cache)
+{
+  char key[32];
+  snprintf(key, sizeof(key), "#%016llx", (unsigned long long)HashImage(image));
+  handle_t handle = textureCacheFind(key, cache);
+  if (cache->entry_.get(handle) != nullptr)
+  {
+    return handle;
+  }
+
+  texture_t texture = {};
+  if (!CreateTexture(context, image, generateMipmaps, sampler, batch, &texture))
+  {
+    return INVALID_ID;
+  }
+
+  return AddEntry(context, key, texture, cache);
+}
+
+void render::textureCacheRelease(const context_t& context, handle_t texture, texture_cache_t* cache)
+{
+  texture_cache_t::entry_t* entry = cache->entry_.get(texture);
+  if (entry == nullptr || entry->refCount_ == 0u)
+  {
+    return;
+  }
+
+  if (--entry->refCount_ == 0u)
+  {
+    entry->lruPosition_ = cache->lru_.insert(cache->lru_.end(), texture);
+    Evict(context, cache);
+  }
+}
+
+texture_t* render::textureCacheGet(handle_t texture, texture_cache_t* cache)
+{
+  texture_cache_t::entry_t* entry = cache->entry_.get(texture);
+  return entry ? &entry->texture_ : nullptr;
+}
+
+void render::textureCacheSetBudget(const context_t& context, uint64_t budget, texture_cache_t* cache)
+{
+  cache->budget_ = budget;
+  Evict(context, cache);
+}
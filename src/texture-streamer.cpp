@@ -0,0 +1,369 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "texture-streamer.h"
+#include "render.h"
+#include "maths.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace bkk;
+using namespace bkk::render;
+
+static VkImageSubresourceRange LevelRange(uint32_t baseLevel, uint32_t levelCount)
+{
+  VkImageSubresourceRange range = {};
+  range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  range.baseMipLevel = baseLevel;
+  range.levelCount = levelCount;
+  range.layerCount = 1u;
+  return range;
+}
+
+//Staging offsets have to be multiples of the texel (or block) size and of 4 bytes
+static VkDeviceSize StagingAlignment(const image::image2D_t& image)
+{
+  return 4u * ((image.compression_ != image::COMPRESSION_NONE) ? 16u : image.componentCount_ * image.componentSize_);
+}
+
+//Least detailed level with enough detail to cover 'size' pixels
+static uint32_t LevelForSize(const image::image2D_t& image, uint32_t levelCount, float size)
+{
+  float maxDimension = (float)maths::maxValue(image.width_, image.height_);
+  if (size <= 0.0f)
+  {
+    return levelCount - 1;
+  }
+
+  int32_t level = (int32_t)floorf(log2f(maxDimension / size));
+  return (uint32_t)maths::maxValue(0, maths::minValue(level, (int32_t)levelCount - 1));
+}
+
+//Replaced textures and views are destroyed once the frames in flight can't be using them. Views replaced when levels are streamed in
+//are retired on their own, in a texture with no image
+static void RetireTexture(const texture_t& texture, texture_streamer_t* streamer)
+{
+  streamer->retired_.push_back({ texture, streamer->frame_ });
+}
+
+static void DestroyRetired(const context_t& context, texture_t* texture)
+{
+  if (texture->image_ == VK_NULL_HANDLE)
+  {
+    vkDestroyImageView(context.device_, texture->imageView_, nullptr);
+  }
+  else
+  {
+    textureDestroy(context, texture);
+  }
+}
+
+//Creates the view of the resident levels, so sampling is clamped to them
+static void CreateResidentView(const context_t& context, streamed_texture_t* streamed)
+{
+  texture_t* texture = &streamed->texture_;
+  VkImageViewCreateInfo imageViewCreateInfo = {};
+  imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  imageViewCreateInfo.format = texture->format_;
+  imageViewCreateInfo.image = texture->image_;
+  imageViewCreateInfo.subresourceRange = LevelRange(streamed->residentLevel_ - streamed->imageLevel_, streamed->source_.levelCount_ - streamed->residentLevel_);
+  imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  vkCreateImageView(context.device_, &imageViewCreateInfo, nullptr, &texture->imageView_);
+
+  texture->descriptor_.imageView = texture->imageView_;
+  texture->descriptor_.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  streamed->changed_ = true;
+}
+
+//Creates an image with memory for the levels from imageLevel to the last one. The view is created later, once some levels are resident
+static void CreateImage(const context_t& context, const streamed_texture_t& streamed, uint32_t imageLevel, texture_t* texture)
+{
+  const image::mip_chain_t& source = streamed.source_;
+  uint32_t levelCount = source.levelCount_ - imageLevel;
+  uint32_t width = maths::maxValue(source.image_.width_ >> imageLevel, 1u);
+  uint32_t height = maths::maxValue(source.image_.height_ >> imageLevel, 1u);
+  texture2DCreate(context, width, height, levelCount, getImageFormat(source.image_),
+    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, streamed.sampler_, texture);
+  texture->mipLevels_ = levelCount;
+  vkDestroyImageView(context.device_, texture->imageView_, nullptr);
+  texture->imageView_ = VK_NULL_HANDLE;
+}
+
+//Records the upload of the levels from firstLevel to the most detailed resident one into the image, through staging memory of the batch.
+//Levels that are not resident have undefined contents, and only the uploaded levels change layout, so frames in flight can keep
+//sampling the resident ones. The view is replaced to include the new levels
+static void StreamLevels(const context_t& context, uint32_t firstLevel, texture_streamer_t* streamer, streamed_texture_t* streamed)
+{
+  const image::mip_chain_t& source = streamed->source_;
+  texture_t* texture = &streamed->texture_;
+  VkDeviceSize alignment = StagingAlignment(source.image_);
+  for (uint32_t level(firstLevel); level < streamed->residentLevel_; ++level)
+  {
+    //Allocating may submit the batch if the staging ring is full, so the command buffer is queried afterwards
+    VkBuffer stagingBuffer;
+    VkDeviceSize stagingOffset;
+    uint8_t* mapping = uploadBatchAllocate(context, source.levelSize_[level], alignment, &streamer->batch_, &stagingBuffer, &stagingOffset);
+    memcpy(mapping, source.levelData_[level], source.levelSize_[level]);
+    VkCommandBuffer commandBuffer = uploadBatchGetCommandBuffer(context, &streamer->batch_);
+
+    VkBufferImageCopy copy = {};
+    copy.bufferOffset = stagingOffset;
+    copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - streamed->imageLevel_, 0u, 1u };
+    copy.imageExtent = { maths::maxValue(source.image_.width_ >> level, 1u), maths::maxValue(source.image_.height_ >> level, 1u), 1u };
+
+    VkImageSubresourceRange range = LevelRange(level - streamed->imageLevel_, 1u);
+    texture->layout_ = VK_IMAGE_LAYOUT_UNDEFINED;
+    textureChangeLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, range, texture);
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, texture->image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1u, &copy);
+    textureChangeLayout(commandBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, range, texture);
+  }
+
+  if (texture->imageView_ != VK_NULL_HANDLE)
+  {
+    texture_t retiredView = {};
+    retiredView.imageView_ = texture->imageView_;
+    RetireTexture(retiredView, streamer);
+  }
+
+  streamed->residentLevel_ = firstLevel;
+  CreateResidentView(context, streamed);
+}
+
+//Replaces the image of the texture with one that has memory for the levels from imageLevel to the last one, copying the resident levels
+//it can hold. Used to free the memory of dropped levels, and to get it back if they are needed again
+static void RecreateImage(const context_t& context, uint32_t imageLevel, texture_streamer_t* streamer, streamed_texture_t* streamed)
+{
+  const image::mip_chain_t& source = streamed->source_;
+  texture_t* oldTexture = &streamed->texture_;
+  texture_t texture;
+  CreateImage(context, *streamed, imageLevel, &texture);
+
+  uint32_t firstCopiedLevel = maths::maxValue(imageLevel, streamed->residentLevel_);
+  std::vector<VkImageCopy> regions;
+  for (uint32_t level(firstCopiedLevel); level < source.levelCount_; ++level)
+  {
+    VkImageCopy region = {};
+    region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - streamed->imageLevel_, 0u, 1u };
+    region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - imageLevel, 0u, 1u };
+    region.extent = { maths::maxValue(source.image_.width_ >> level, 1u), maths::maxValue(source.image_.height_ >> level, 1u), 1u };
+    regions.push_back(region);
+  }
+
+  //Frames in flight still sample the old texture, so it goes back to shader read-only layout after the copy
+  VkCommandBuffer commandBuffer = uploadBatchGetCommandBuffer(context, &streamer->batch_);
+  VkImageSubresourceRange oldRange = LevelRange(firstCopiedLevel - streamed->imageLevel_, source.levelCount_ - firstCopiedLevel);
+  VkImageSubresourceRange newRange = LevelRange(firstCopiedLevel - imageLevel, source.levelCount_ - firstCopiedLevel);
+  textureChangeLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, oldRange, oldTexture);
+  textureChangeLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, newRange, &texture);
+  vkCmdCopyImage(commandBuffer, oldTexture->image_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture.image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+  textureChangeLayout(commandBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, oldRange, oldTexture);
+  textureChangeLayout(commandBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, newRange, &texture);
+
+  RetireTexture(*oldTexture, streamer);
+  streamed->texture_ = texture;
+  streamed->imageLevel_ = imageLevel;
+  streamed->residentLevel_ = firstCopiedLevel;
+  CreateResidentView(context, streamed);
+}
+
+void render::textureStreamerCreate(const context_t& context, uint32_t initialSize, uint64_t uploadBudget, uint32_t retireDelay, texture_streamer_t* streamer)
+{
+  streamer->initialSize_ = initialSize;
+  streamer->uploadBudget_ = uploadBudget;
+  streamer->retireDelay_ = retireDelay;
+  streamer->frame_ = 0u;
+  uploadBatchCreate(context, uploadBudget, &streamer->batch_);
+}
+
+void render::textureStreamerDestroy(const context_t& context, texture_streamer_t* streamer)
+{
+  uploadBatchDestroy(context, &streamer->batch_);
+
+  packed_freelist_iterator_t<streamed_texture_t> textureIter = streamer->texture_.begin();
+  while (textureIter != streamer->texture_.end())
+  {
+    textureDestroy(context, &textureIter.get().texture_);
+    image::unloadMipChain(&textureIter.get().source_);
+    ++textureIter;
+  }
+
+  for (uint32_t i(0); i < streamer->retired_.size(); ++i)
+  {
+    DestroyRetired(context, &streamer->retired_[i].texture_);
+  }
+
+  streamer->texture_ = packed_freelist_t<streamed_texture_t>();
+  streamer->retired_.clear();
+}
+
+handle_t render::textureStreamerAdd(const context_t& context, const char* path, bool flipVertical, texture_sampler_t sampler, texture_streamer_t* streamer)
+{
+  streamed_texture_t streamed = {};
+  if (!image::loadMipChain(path, &streamed.source_))
+  {
+    image::image2D_t image = {};
+    bool result = image::load(path, flipVertical, &image) && image::buildMipChain(image, &streamed.source_);
+    image::unload(&image);
+    if (!result)
+    {
+      return INVALID_ID;
+    }
+  }
+
+  //Levels are copied as they are, so the format has to be sampleable without expanding it
+  VkFormatProperties properties = {};
+  vkGetPhysicalDeviceFormatProperties(context.physicalDevice_, getImageFormat(streamed.source_.image_), &properties);
+  if ((properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) == 0 ||
+      (streamed.source_.image_.compression_ != image::COMPRESSION_NONE && !context.enabledFeatures_.textureCompressionBC))
+  {
+    image::unloadMipChain(&streamed.source_);
+    return INVALID_ID;
+  }
+
+  streamed.sampler_ = sampler;
+  streamed.initialLevel_ = LevelForSize(streamed.source_.image_, streamed.source_.levelCount_, (float)streamer->initialSize_);
+  streamed.imageLevel_ = 0u;
+  streamed.residentLevel_ = streamed.source_.levelCount_;
+  streamed.targetLevel_ = streamed.initialLevel_;
+  CreateImage(context, streamed, 0u, &streamed.texture_);
+  handle_t handle = streamer->texture_.add(streamed);
+
+  //Upload the initial levels
+  StreamLevels(context, streamed.initialLevel_, streamer, streamer->texture_.get(handle));
+  return handle;
+}
+
+void render::textureStreamerRemove(handle_t texture, texture_streamer_t* streamer)
+{
+  streamed_texture_t* streamed = streamer->texture_.get(texture);
+  if (streamed)
+  {
+    RetireTexture(streamed->texture_, streamer);
+    image::unloadMipChain(&streamed->source_);
+    streamer->texture_.remove(texture);
+  }
+}
+
+void render::textureStreamerSetScreenSize(handle_t texture, float screenSize, texture_streamer_t* streamer)
+{
+  streamed_texture_t* streamed = streamer->texture_.get(texture);
+  if (streamed)
+  {
+    streamed->screenSize_ = screenSize;
+    streamed->targetLevel_ = maths::minValue(LevelForSize(streamed->source_.image_, streamed->source_.levelCount_, screenSize), streamed->initialLevel_);
+  }
+}
+
+uint32_t render::textureStreamerUpdate(const context_t& context, texture_streamer_t* streamer)
+{
+  ++streamer->frame_;
+
+  //Destroy the textures and views replaced long enough ago
+  for (uint32_t i(0); i < streamer->retired_.size();)
+  {
+    if (streamer->frame_ - streamer->retired_[i].frame_ > streamer->retireDelay_)
+    {
+      DestroyRetired(context, &streamer->retired_[i].texture_);
+      streamer->retired_[i] = streamer->retired_.back();
+      streamer->retired_.pop_back();
+    }
+    else
+    {
+      ++i;
+    }
+  }
+
+  std::vector<streamed_texture_t>& textures = streamer->texture_.getData();
+  for (uint32_t i(0); i < textures.size(); ++i)
+  {
+    textures[i].changed_ = false;
+  }
+
+  //Nothing new is recorded until the uploads of the previous update have finished, so the update never waits for them.
+  //Uploads recorded when adding textures are submitted here
+  if (uploadBatchFinished(context, streamer->batch_))
+  {
+    //Textures that need more levels, by decreasing screen size. Textures with levels they don't need anymore are recreated without them
+    std::vector<uint32_t> streamIn;
+    for (uint32_t i(0); i < textures.size(); ++i)
+    {
+      if (textures[i].targetLevel_ < textures[i].residentLevel_)
+      {
+        streamIn.push_back(i);
+      }
+      else if (textures[i].targetLevel_ > textures[i].residentLevel_)
+      {
+        RecreateImage(context, textures[i].targetLevel_, streamer, &textures[i]);
+      }
+    }
+
+    std::sort(streamIn.begin(), streamIn.end(), [&textures](uint32_t a, uint32_t b) { return textures[a].screenSize_ > textures[b].screenSize_; });
+
+    //Stream one level of each texture while there is budget, counting the uploads of textures added since the last update and the
+    //alignment of each level in the staging ring. At least one level is streamed in each update, even if it is over the budget
+    VkDeviceSize stagingSize = streamer->batch_.recording_ ? streamer->batch_.stagingHead_ : 0u;
+    for (uint32_t i(0); i < streamIn.size(); ++i)
+    {
+      streamed_texture_t* streamed = &textures[streamIn[i]];
+      uint32_t newLevel = streamed->residentLevel_ - 1;
+      VkDeviceSize alignment = StagingAlignment(streamed->source_.image_);
+      VkDeviceSize levelOffset = (stagingSize + alignment - 1) / alignment * alignment;
+      if (i > 0 && levelOffset + streamed->source_.levelSize_[newLevel] > streamer->uploadBudget_)
+      {
+        break;
+      }
+      stagingSize = levelOffset + streamed->source_.levelSize_[newLevel];
+
+      //The image was recreated without the level when it was dropped
+      if (newLevel < streamed->imageLevel_)
+      {
+        RecreateImage(context, 0u, streamer, streamed);
+      }
+
+      StreamLevels(context, newLevel, streamer, streamed);
+    }
+  }
+
+  uploadBatchSubmit(context, false, &streamer->batch_);
+
+  uint32_t changedCount = 0u;
+  for (uint32_t i(0); i < textures.size(); ++i)
+  {
+    changedCount += textures[i].changed_ ? 1u : 0u;
+  }
+
+  return changedCount;
+}
+
+texture_t* render::textureStreamerGet(handle_t texture, texture_streamer_t* streamer, bool* changed)
+{
+  streamed_texture_t* streamed = streamer->texture_.get(texture);
+  if (changed)
+  {
+    *changed = streamed && streamed->changed_;
+  }
+
+  return streamed ? &streamed->texture_ : nullptr;
+}
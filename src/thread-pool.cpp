@@ -0,0 +1,169 @@
+/*
+* Brokkr framework
+*
+* Copyright(c) 2017 by Ferran Sole
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files(the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "thread-pool.h"
+#include <atomic>
+#include <memory>
+
+using namespace bkk;
+using namespace bkk::thread;
+
+static void workerThread(thread_pool_t* pool)
+{
+  while (true)
+  {
+    job_t job;
+    {
+      std::unique_lock<std::mutex> lock(pool->mutex_);
+      pool->jobAdded_.wait(lock, [pool] { return pool->exit_ || !pool->jobs_.empty(); });
+      if (pool->exit_ && pool->jobs_.empty())
+      {
+        return;
+      }
+
+      job = std::move(pool->jobs_.front());
+      pool->jobs_.pop_front();
+    }
+
+    job();
+
+    {
+      std::lock_guard<std::mutex> lock(pool->mutex_);
+      --pool->pendingJobs_;
+    }
+    pool->jobFinished_.notify_all();
+  }
+}
+
+void thread::poolCreate(u32 threadCount, thread_pool_t* pool)
+{
+  if (threadCount == 0u)
+  {
+    u32 hardwareThreads = (u32)std::thread::hardware_concurrency();
+    threadCount = hardwareThreads > 1u ? hardwareThreads - 1u : 1u;
+  }
+
+  pool->exit_ = false;
+  pool->pendingJobs_ = 0u;
+  pool->threads_.reserve(threadCount);
+  for (u32 i(0); i<threadCount; ++i)
+  {
+    pool->threads_.push_back(std::thread(workerThread, pool));
+  }
+}
+
+void thread::poolDestroy(thread_pool_t* pool)
+{
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex_);
+    pool->exit_ = true;
+  }
+  pool->jobAdded_.notify_all();
+
+  for (u32 i(0); i<pool->threads_.size(); ++i)
+  {
+    pool->threads_[i].join();
+  }
+
+  pool->threads_.clear();
+}
+
+u32 thread::poolGetThreadCount(const thread_pool_t* pool)
+{
+  return pool ? (u32)pool->threads_.size() : 0u;
+}
+
+void thread::poolAddJob(thread_pool_t* pool, const job_t& job)
+{
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex_);
+    pool->jobs_.push_back(job);
+    ++pool->pendingJobs_;
+  }
+  pool->jobAdded_.notify_one();
+}
+
+void thread::poolWait(thread_pool_t* pool)
+{
+  std::unique_lock<std::mutex> lock(pool->mutex_);
+  pool->jobFinished_.wait(lock, [pool] { return pool->pendingJobs_ == 0u; });
+}
+
+void thread::parallelFor(thread_pool_t* pool, u32 count, u32 grainSize, const parallel_for_body_t& body)
+{
+  if (count == 0u)
+  {
+    return;
+  }
+
+  grainSize = maths::maxValue(grainSize, 1u);
+  u32 chunkCount = (count + grainSize - 1) / grainSize;
+  u32 helperCount = maths::minValue(poolGetThreadCount(pool), chunkCount - 1);
+  if (helperCount == 0u)
+  {
+    body(0u, count);
+    return;
+  }
+
+  //State is shared with the helper jobs, which may start running after this function has returned
+  //if all the workers were busy, in which case they won't find any chunk left to process
+  struct parallel_for_state_t
+  {
+    std::atomic<u32> nextChunk_;
+    std::atomic<u32> finishedChunks_;
+    std::mutex mutex_;
+    std::condition_variable done_;
+  };
+
+  std::shared_ptr<parallel_for_state_t> state = std::make_shared<parallel_for_state_t>();
+  state->nextChunk_ = 0u;
+  state->finishedChunks_ = 0u;
+
+  //Body is only referenced while there are chunks left, and those can't outlive this call
+  const parallel_for_body_t* bodyPtr = &body;
+  auto processChunks = [state, bodyPtr, count, grainSize, chunkCount]()
+  {
+    u32 chunk;
+    while ((chunk = state->nextChunk_.fetch_add(1u)) < chunkCount)
+    {
+      u32 begin = chunk * grainSize;
+      (*bodyPtr)(begin, maths::minValue(begin + grainSize, count));
+      if (state->finishedChunks_.fetch_add(1u) + 1u == chunkCount)
+      {
+        std::lock_guard<std::mutex> lock(state->mutex_);
+        state->done_.notify_all();
+      }
+    }
+  };
+
+  for (u32 i(0); i<helperCount; ++i)
+  {
+    poolAddJob(pool, processChunks);
+  }
+
+  processChunks();
+
+  std::unique_lock<std::mutex> lock(state->mutex_);
+  state->done_.wait(lock, [&state, chunkCount] { return state->finishedChunks_.load() == chunkCount; });
+}